@@ -21,17 +21,15 @@ device_pins =
 PC_EVENT = 0
 COUNTER = 0
 
-function device_init()   
-   for k, v in pairs(device_pins) do set_pin_state(_G[v.name], SLO) end     
-   set_callback(0, PC_EVENT)   
+function device_init()
+   BUS = pin_group(A0, A1, A2, A3, A4, A5, A6, A7, A8, A9, A10, A11, A12, A13, A14, A15)
+   write_pins(BUS, 0)
+   start_clock(100 * MSEC, 0, PC_EVENT)
 end
 
-function timer_callback(time, eventid)    
-    if eventid == PC_EVENT then        
-        for k, v in pairs(device_pins) do 
-            set_pin_bool(_G[v.name], get_bit(COUNTER, k) )           
-        end
+function timer_callback(time, eventid)
+    if eventid == PC_EVENT then
+        write_pins(BUS, COUNTER)
         COUNTER = COUNTER + 1
-        set_callback(time + 100 * MSEC, PC_EVENT)   
     end
 end
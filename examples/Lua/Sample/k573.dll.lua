@@ -1,59 +1,20 @@
 -- Device description
 device_pins =
 {
-    {is_digital=true, name = "A0", on_time=1000, off_time=1000},
-    {is_digital=true, name = "A1", on_time=1000, off_time=1000},
-    {is_digital=true, name = "A2", on_time=1000, off_time=1000},
-    {is_digital=true, name = "A3", on_time=1000, off_time=1000},
-    {is_digital=true, name = "A4", on_time=1000, off_time=1000},
-    {is_digital=true, name = "A5", on_time=1000, off_time=1000},
-    {is_digital=true, name = "A6", on_time=1000, off_time=1000},
-    {is_digital=true, name = "A7", on_time=1000, off_time=1000},
-    {is_digital=true, name = "A8", on_time=1000, off_time=1000},
-    {is_digital=true, name = "A9", on_time=1000, off_time=1000},
-    {is_digital=true, name = "A10", on_time=1000, off_time=1000},
-    {is_digital=true, name = "A11", on_time=1000, off_time=1000},
-    {is_digital=true, name = "A12", on_time=1000, off_time=1000},
-    {is_digital=true, name = "A13", on_time=1000, off_time=1000},
-    {is_digital=true, name = "A14", on_time=1000, off_time=1000},
-    {is_digital=true, name = "D0", on_time=1000, off_time=1000},
-    {is_digital=true, name = "D1", on_time=1000, off_time=1000},
-    {is_digital=true, name = "D2", on_time=1000, off_time=1000},
-    {is_digital=true, name = "D3", on_time=1000, off_time=1000},
-    {is_digital=true, name = "D4", on_time=1000, off_time=1000},
-    {is_digital=true, name = "D5", on_time=1000, off_time=1000},
-    {is_digital=true, name = "D6", on_time=1000, off_time=1000},
-    {is_digital=true, name = "D7", on_time=1000, off_time=1000},
+    {is_digital=true, port = "ADDR", stem = "A", from = 0, to = 14, on_time=1000, off_time=1000},
+    {is_digital=true, port = "DATA", stem = "D", from = 0, to = 7, on_time=1000, off_time=1000},
     {is_digital=true, name = "$CE$", on_time=1000, off_time=1000},
     {is_digital=true, name = "$OE$", on_time=1000, off_time=1000},
     {is_digital=true, name = "VPP", on_time=1000, off_time=1000},
 }
 
-ADDRESS = 0
-
-function read_file(file)
-    local file = io.open(file, "rb")
-    local content = file:read("*a")
-    file:close()
-    return content
-end
+-- The EPROM runs natively, Lua is not needed on pin changes
+device_sensitivity = {}
 
 function device_init()
-    local romfile = get_string_param("file")
-    rom = read_file(romfile)
-end
-
-function device_simulate()
-    for i = 0, 14 do
-        if 1 == get_pin_bool(_G["A"..i]) then
-            ADDRESS = set_bit(ADDRESS, i)
-        else
-            ADDRESS = clear_bit(ADDRESS, i)
-        end
-    end
-    for i = 0, 7 do
-        set_pin_bool(_G["D"..i], get_bit(string.byte(rom, ADDRESS), i))
-    end
+    rom = memory_chip{addr=ADDR, data=DATA, ce=_ENV["$CE$"], oe=_ENV["$OE$"],
+                      file=get_string_param("file"), fill=0xFF,
+                      access=250000, enable=100000, release=60000}
 end
 
 function timer_callback(time, eventid)
@@ -62,17 +23,17 @@ end
 function on_suspend()
     if nil == mempop then
         mempop, memid = create_memory_popup("My ROM dump")
-        set_memory_popup(mempop, rom, string.len(rom))
+        set_memory_popup(mempop, rom, #rom)
     elseif mempop then
         repaint_memory_popup(mempop)
     end
 
     if nil == debugpop then
         debugpop, debugid = create_debug_popup("My ROM vars")
-        print_to_debug_popup(debugpop, string.format("Address: %.4X\nData: %.4X\n", ADDRESS, string.byte(rom, ADDRESS)))
+        print_to_debug_popup(debugpop, string.format("Address: %.4X\nData: %.4X\n", read_pins(ADDR), read_pins(DATA)))
         dump_to_debug_popup(debugpop, rom, 32, 0x1000)
     elseif debugpop then
-        print_to_debug_popup(debugpop, string.format("Address: %.4X\nData: %.4X\n", ADDRESS, string.byte(rom, ADDRESS)))
+        print_to_debug_popup(debugpop, string.format("Address: %.4X\nData: %.4X\n", read_pins(ADDR), read_pins(DATA)))
         dump_to_debug_popup(debugpop, rom, 32, 0x1000)
     end
 end
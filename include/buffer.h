@@ -0,0 +1,56 @@
+/**
+ *
+ * @file   buffer.h
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Reference counted byte blocks and the buffers viewing them.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BUFFER_H
+#define BUFFER_H
+#include <vsm_api.h>
+
+#define BUFFER_META "openvsm.buffer" ///< Metatable of buffer objects
+
+typedef struct VSM_BLOCK VSM_BLOCK;
+typedef void ( *BLOCK_FREE ) ( VSM_BLOCK* block );
+
+struct VSM_BLOCK
+{
+	uint8_t* data; ///< Bytes
+	size_t size; ///< Number of bytes
+	int32_t refs; ///< Buffers and devices holding the block
+	bool readonly; ///< Writes are refused
+	BLOCK_FREE free; ///< Releases data once the last reference is gone, NULL for free()
+	void* owner; ///< Whatever free needs to find its way back
+}; ///< Reference counted memory, never moved while referenced
+
+typedef struct VSM_BUFFER
+{
+	VSM_BLOCK* block; ///< Block viewed, holds one reference
+	uint8_t* data; ///< First byte of the view
+	size_t size; ///< Bytes in the view
+} VSM_BUFFER; ///< Window into a block, the Lua buffer object
+
+VSM_BLOCK* block_new ( size_t size );
+VSM_BLOCK* block_retain ( VSM_BLOCK* block );
+void block_release ( VSM_BLOCK* block );
+uint64_t buffer_read ( const VSM_BUFFER* buf, size_t offset, uint8_t width );
+void buffer_write ( VSM_BUFFER* buf, size_t offset, uint64_t value, uint8_t width );
+
+#endif
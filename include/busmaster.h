@@ -0,0 +1,81 @@
+/**
+ *
+ * @file   busmaster.h
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Parallel bus transactors.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BUSMASTER_H
+#define BUSMASTER_H
+#include <vsm_api.h>
+
+#define BUS_MASTER_META "openvsm.bus_master" ///< Metatable of bus transactor objects
+
+typedef enum BUS_PHASE
+{
+	BUS_IDLE, ///< No cycle under way
+	BUS_SAMPLE, ///< Waiting for the read sample point
+	BUS_READY, ///< Waiting for the ready line at the end of the strobe
+	BUS_END, ///< Waiting for the end of the hold time
+} BUS_PHASE;
+
+typedef struct BUS_CYCLE
+{
+	uint64_t addr; ///< Address driven on the address group
+	uint64_t data; ///< Data written, or read once the cycle is over
+	bool write; ///< Write cycle
+	int32_t lua_ref; ///< Registry reference of the Lua completion function, LUA_NOREF if none
+	bool failed; ///< The host refused an event of the cycle, data is not valid
+} BUS_CYCLE; ///< One queued bus transaction
+
+typedef void ( *BUS_DONE ) ( VSM_BUS_MASTER* master, BUS_CYCLE* cycle );
+
+struct VSM_BUS_MASTER
+{
+	VSM_MODEL* model; ///< Model the transactor belongs to
+	int32_t slot; ///< Index in model->bus_masters, also the host event id
+	VSM_PIN_GROUP* addr; ///< Address group, owned by the transactor
+	VSM_PIN_GROUP* data; ///< Data group, owned by the transactor
+	VSM_PIN* rd; ///< Read strobe, NULL if the bus only writes
+	VSM_PIN* wr; ///< Write strobe, NULL if the bus only reads
+	VSM_PIN* cs; ///< Chip select held over the whole cycle, NULL if none
+	VSM_PIN* ready; ///< Ready line checked at the end of the strobe, NULL if none
+	bool active_high; ///< Strobe and select polarity
+	bool ready_level; ///< Level of ready that lets the cycle end
+	RELTIME setup; ///< Address and select to strobe
+	RELTIME strobe; ///< Strobe width
+	RELTIME sample; ///< Strobe start to the read sample point
+	RELTIME hold; ///< Strobe end to the end of the cycle
+	RELTIME wait; ///< Ready poll interval
+	BUS_CYCLE* queue; ///< Pending cycles, a ring
+	int32_t queue_head; ///< First pending cycle
+	int32_t queue_count; ///< Pending cycles
+	int32_t queue_size; ///< Allocated cycles
+	BUS_PHASE phase; ///< Progress of the cycle at queue_head
+	ABSTIME cycle_end; ///< Time the current cycle ends
+	BUS_DONE on_done; ///< Called after every cycle
+	int32_t lua_ref; ///< Registry reference of the transactor object handed to Lua
+}; ///< Parallel bus transactor
+
+VSM_BUS_MASTER* bus_master_new ( VSM_MODEL* model, VSM_PIN_GROUP* addr, VSM_PIN_GROUP* data );
+void bus_master_free ( VSM_BUS_MASTER* master );
+bool bus_cycle ( VSM_BUS_MASTER* master, uint64_t addr, uint64_t data, bool write, int32_t lua_ref );
+void bus_master_callback ( VSM_BUS_MASTER* master, ABSTIME atime );
+
+#endif
@@ -25,8 +25,6 @@
 #define C_BIND_H
 #include <vsm_api.h>
 
-extern int popup_id;
-
 bool is_pin_active ( IDSIMPIN* pin );
 bool is_pin_posedge ( IDSIMPIN* pin );
 bool is_pin_negedge ( IDSIMPIN* pin );
@@ -36,40 +34,61 @@ bool is_pin_high ( IDSIMPIN* pin );
 bool is_pin_low ( IDSIMPIN* pin );
 bool is_pin_steady ( IDSIMPIN* pin );
 bool vsm_register ( ILICENCESERVER* ils );
-char* get_string_param ( char* field_name );
-bool get_bool_param ( char* field_name );
-double get_num_param ( char* field_name );
-int32_t get_hex_param ( char* field_name );
-int64_t get_init_param ( char* field_name );
+char* get_string_param ( VSM_MODEL* model, char* field_name );
+bool get_bool_param ( VSM_MODEL* model, char* field_name );
+double get_num_param ( VSM_MODEL* model, char* field_name );
+int32_t get_hex_param ( VSM_MODEL* model, char* field_name );
+int64_t get_init_param ( VSM_MODEL* model, char* field_name );
 const char *state_to_string (STATE s);
 void console_alloc ( const char* title );
-void systime ( ABSTIME* at );
-bool set_vdm_handler ( void );
-void set_pin_bool ( VSM_PIN pin, bool level );
+void systime ( VSM_MODEL* model, ABSTIME* at );
+bool set_vdm_handler ( VSM_MODEL* model );
+void set_pin_bool ( VSM_MODEL* model, VSM_PIN pin, bool level );
 int32_t get_pin_bool ( VSM_PIN pin );
-IDSIMPIN* get_pin ( char* pin_name );
+IDSIMPIN* get_pin ( VSM_MODEL* model, char* pin_name );
 STATE get_pin_state ( IDSIMPIN* pin );
-void delete_popup ( POPUPID id );
-void load_image ( char* filename, uint8_t* buffer, size_t buffer_size );
-void out_error ( const char* format, ... );
-void out_log ( const char* format, ... );
-void out_message ( const char* format, ... );
-void out_warning ( const char* format, ... );
-void set_callback ( RELTIME picotime, EVENTID id );
-void set_pin_state ( VSM_PIN pin, STATE state );
+void delete_popup ( VSM_MODEL* model, POPUPID id );
+void load_image ( VSM_MODEL* model, char* filename, uint8_t* buffer, size_t buffer_size );
+void out_error ( VSM_MODEL* model, const char* format, ... );
+void out_log ( VSM_MODEL* model, const char* format, ... );
+void out_message ( VSM_MODEL* model, const char* format, ... );
+void out_warning ( VSM_MODEL* model, const char* format, ... );
+uint32_t set_callback ( VSM_MODEL* model, RELTIME picotime, EVENTID id );
+bool cancel_callback ( VSM_MODEL* model, uint32_t handle );
+int32_t take_due_timers ( VSM_MODEL* model, uint32_t serial, ABSTIME atime );
+bool cancel_event ( VSM_MODEL* model, EVENT* event );
+bool start_clock ( VSM_MODEL* model, RELTIME period, RELTIME phase, EVENTID id );
+bool start_pin_clock ( VSM_MODEL* model, RELTIME period, RELTIME phase, VSM_PIN* pin );
+bool stop_clock ( VSM_MODEL* model, EVENTID id );
+bool stop_pin_clock ( VSM_MODEL* model, VSM_PIN* pin );
+void set_pin_state ( VSM_MODEL* model, VSM_PIN pin, STATE state );
 bool add_source_file ( ISOURCEPOPUP* popup, char* filename, bool lowlevel );
 void set_pc_address ( ISOURCEPOPUP* popup, size_t address );
 void set_memory_popup ( IMEMORYPOPUP* popup, size_t offset, void* buffer, size_t size );
 void repaint_memory_popup ( IMEMORYPOPUP* popup );
 void print_to_debug_popup ( IDEBUGPOPUP* popup, const char* message );
 void dump_to_debug_popup ( IDEBUGPOPUP* popup, const uint8_t* buf, uint32_t offset, uint32_t size );
-void toggle_pin_state ( VSM_PIN pin );
-IDEBUGPOPUP* create_debug_popup ( const char* title, const int32_t id );
-IDEBUGPOPUP* create_source_popup ( const char* title, const int32_t id );
-IDEBUGPOPUP* create_status_popup ( const char* title, const int32_t id );
-IDEBUGPOPUP* create_var_popup ( const char* title, const int32_t id );
-IMEMORYPOPUP* create_memory_popup ( const char* title, const int32_t id );
-IPOPUP* create_popup ( CREATEPOPUPSTRUCT* cps );
+void toggle_pin_state ( VSM_MODEL* model, VSM_PIN pin );
+void set_pin_handler ( VSM_MODEL* model, VSM_PIN* pin, bool enable );
+void watch_pin ( VSM_MODEL* model, VSM_PIN* pin );
+uint64_t read_pins ( VSM_PIN_GROUP* group );
+void write_pins ( VSM_PIN_GROUP* group, uint64_t word );
+void drive_pins ( VSM_PIN_GROUP* group, ABSTIME atime, uint64_t word );
+void release_pins ( VSM_PIN_GROUP* group, ABSTIME atime );
+bool promote_pin_group ( VSM_PIN_GROUP* group );
+IBUSPIN* get_bus_pin ( VSM_MODEL* model, char* stem, uint32_t base, uint32_t width );
+void set_bus_timing ( IBUSPIN* bus, RELTIME tlh, RELTIME thl, RELTIME tz );
+void drive_bus_value ( VSM_MODEL* model, IBUSPIN* bus, uint32_t value );
+void drive_bus_bit ( VSM_MODEL* model, IBUSPIN* bus, uint32_t bit, STATE state );
+void drive_bus_tristate ( VSM_MODEL* model, IBUSPIN* bus );
+uint32_t get_bus_value ( IBUSPIN* bus );
+STATE get_bus_bit ( IBUSPIN* bus, uint32_t bit );
+IDEBUGPOPUP* create_debug_popup ( VSM_MODEL* model, const char* title, const int32_t id );
+IDEBUGPOPUP* create_source_popup ( VSM_MODEL* model, const char* title, const int32_t id );
+IDEBUGPOPUP* create_status_popup ( VSM_MODEL* model, const char* title, const int32_t id );
+IDEBUGPOPUP* create_var_popup ( VSM_MODEL* model, const char* title, const int32_t id );
+IMEMORYPOPUP* create_memory_popup ( VSM_MODEL* model, const char* title, const int32_t id );
+IPOPUP* create_popup ( VSM_MODEL* model, CREATEPOPUPSTRUCT* cps );
 
 inline bool iscontention ( STATE s );
 inline bool isdefined ( STATE s );
@@ -2,17 +2,125 @@
 #define DEVICE_H
 #include <vsm_api.h>
 
-typedef struct VSM_PIN 
+struct VSM_PIN
 {
 	BOOL is_digital; ///< Pin is a digital one
 	char* name;	///< The name of the pin in graphical model
 	ABSTIME on_time; ///< Pin switch on-time
 	ABSTIME off_time; ///< Pin switch off-time
 	IDSIMPIN* pin; ///< DSIM pin pointer itself
-} VSM_PIN; ///< OpenVSM pin structure
+	VSM_MODEL* model; ///< Model the pin belongs to
+	int32_t lua_ref; ///< Registry reference of the pin object handed to Lua
+	int32_t edge_handlers[EDGE_MAX]; ///< Registry references of the Lua edge handlers
+	bool edge_listed; ///< Pin is in the model edge_pins list
+	bool edge_hooked; ///< Pin events go to vsm_pin_handler
+	VSM_SERIAL* listener; ///< Native decoder fed with the pin edges, NULL if none
+	VSM_SEQUENCER* waiter; ///< Sequencer stalled on a wait_pin of this pin, NULL if none
+	ABSTIME edge_time; ///< Time of the last edge dispatched to the handlers
+}; ///< OpenVSM pin structure
 
-IINSTANCE* model_instance; ///< Global model instance object
-IDSIMCKT* model_dsim; ///< Global DSIM object
-extern VSM_PIN device_pins[32]; ///< Global array of device pins, index starts from 1 not from 0
+#define MAXGROUPBITS 64 ///< Widest pin group a single word can carry
+
+struct VSM_PIN_GROUP
+{
+	VSM_MODEL* model; ///< Model the pins belong to
+	uint32_t width; ///< Number of pins in the group
+	IBUSPIN* bus; ///< Host bus pin covering the group, NULL if it is driven pin by pin
+	VSM_PIN* pins[]; ///< Pins, bit 0 of the group word first
+}; ///< Pins read and driven as one word
+
+typedef struct VSM_BUS
+{
+	VSM_MODEL* model; ///< Model the bus belongs to
+	IBUSPIN* bus; ///< Host bus pin
+	uint32_t width; ///< Number of bits
+} VSM_BUS; ///< Bus pin object handed to Lua
+
+typedef struct VSM_CLOCK
+{
+	EVENT* event; ///< Host clock event, needed to stop it
+	EVENTID id; ///< Event id handed to timer_callback, unused by pin clocks
+	VSM_PIN* pin; ///< Pin toggled without Lua, NULL if the clock runs timer_callback
+	bool level; ///< Level the pin was last driven to
+} VSM_CLOCK; ///< Periodic host callback started by start_clock
+
+typedef struct VSM_TIMER
+{
+	uint32_t handle; ///< Handle returned by set_callback, 0 once cancelled while due
+	EVENTID id; ///< Event id handed to timer_callback
+	ABSTIME time; ///< Time the event fires at
+} VSM_TIMER; ///< One-shot callback scheduled with set_callback
+
+typedef struct VSM_EVENT_HANDLER
+{
+	EVENTID id; ///< Event id
+	int32_t lua_ref; ///< Registry reference of the handler, LUA_NOREF once removed
+} VSM_EVENT_HANDLER; ///< Slot of the on_event hash table
+
+#define FIRST_DYNAMIC_EVENT 0x40000000 ///< new_event_id starts here, clear of literal ids
+
+typedef struct VSM_SENSITIVITY
+{
+	bool enabled; ///< Script declared device_sensitivity
+	uint32_t modes; ///< DSIMMODES that always run device_simulate
+	int32_t edge_count; ///< Pins whose edges run device_simulate, first in pins
+	int32_t active_count; ///< Pins that run device_simulate while active, after the edge pins
+	VSM_PIN** pins; ///< Edge pins followed by active pins
+	int32_t size; ///< Allocated pin slots
+} VSM_SENSITIVITY; ///< Filter in front of device_simulate
+
+struct VSM_MODEL
+{
+	IDSIMMODEL dsim_model; ///< Object handed to the host, must be the first member
+	ICPU cpu; ///< VDM handler object handed to the host
+	IINSTANCE* instance; ///< Model instance object
+	IDSIMCKT* dsim; ///< DSIM object
+	lua_State* luactx; ///< Lua state of this instance
+	LUA_CHUNK* chunk; ///< Process-wide compiled script the state was loaded from
+	int32_t lua_hooks[HOOK_MAX]; ///< Registry references of the script entry points
+	VSM_PIN* pins; ///< Array of device pins, index starts from 1 not from 0
+	int32_t pin_count; ///< Number of declared pins
+	VSM_PIN** edge_pins; ///< Pins that ever had an edge handler, scanned by vsm_pin_handler
+	int32_t edge_pin_count; ///< Number of pins in edge_pins
+	VSM_SENSITIVITY sensitivity; ///< Pins and modes device_simulate reacts to
+	VSM_CLOCK* clocks; ///< Running clocks
+	int32_t clock_count; ///< Number of running clocks
+	VSM_TIMER* timers; ///< Pending set_callback events, a binary min-heap on time
+	int32_t timer_count; ///< Number of pending events
+	int32_t timer_size; ///< Allocated timer slots
+	uint32_t timer_handle; ///< Last handle given out
+	EVENT* timer_event; ///< The one host event armed for the timers, NULL if none
+	ABSTIME timer_armed; ///< Time timer_event fires at
+	uint32_t timer_serial; ///< Host event id of timer_event
+	VSM_TIMER* timer_due; ///< Events being dispatched by vsm_timer_callback
+	int32_t timer_due_count; ///< Number of events being dispatched
+	int32_t timer_due_size; ///< Allocated due slots
+	VSM_EVENT_HANDLER* event_handlers; ///< on_event handlers, open addressing by event id
+	int32_t event_handler_size; ///< Slots in event_handlers, a power of two
+	int32_t event_handler_count; ///< Used slots, removed handlers included
+	EVENTID next_event_id; ///< Next id new_event_id gives out
+	int32_t popup_id; ///< Last popup id given out, unique within the instance
+	VSM_SERIAL** serials; ///< Serial engines, indexed by their host event id
+	int32_t serial_count; ///< Number of serial engines
+	VSM_BUS_MASTER** bus_masters; ///< Bus transactors, indexed by their host event id
+	int32_t bus_master_count; ///< Number of bus transactors
+	VSM_SEQUENCER** sequencers; ///< Pin sequencers, indexed by their host event id
+	int32_t sequencer_count; ///< Number of pin sequencers
+	VSM_MEMCHIP** memchips; ///< Memory chips, evaluated on every simulate call
+	int32_t memchip_count; ///< Number of memory chips
+	VSM_SPARSE** sparses; ///< Sparse memories
+	int32_t sparse_count; ///< Number of sparse memories
+	VSM_NVMEM** nvmems; ///< Persistent memories, flushed on suspend and stop
+	int32_t nvmem_count; ///< Number of persistent memories
+	VSM_MEMMAP** memmaps; ///< Address space maps
+	int32_t memmap_count; ///< Number of address space maps
+}; ///< Per-instance model context
+
+/**
+ * The host only ever sees &model->dsim_model, so any IDSIMMODEL* it passes
+ * back is the context itself
+ */
+#define VSM_MODEL_OF(dsim_model) ( ( VSM_MODEL* ) ( dsim_model ) )
+#define VSM_MODEL_OF_CPU(icpu) ( ( VSM_MODEL* ) ( ( char* ) ( icpu ) - offsetof ( VSM_MODEL, cpu ) ) )
 
 #endif
@@ -0,0 +1,44 @@
+/**
+ *
+ * @file   image.h
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Shared read-only ROM images.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef IMAGE_H
+#define IMAGE_H
+#include <vsm_api.h>
+
+typedef struct VSM_IMAGE
+{
+	struct VSM_IMAGE* next;
+	char* path; ///< Full file path
+	uint64_t mtime; ///< File modification time the image was made from
+	uint64_t file_size; ///< File size the image was made from
+	size_t size; ///< Size asked for a host-parsed image, 0 for a mapped file
+	uint8_t fill; ///< Byte a host-parsed image started from
+	bool mapped; ///< Data is a view of the file, otherwise parsed by the host
+	VSM_BLOCK* block; ///< Image, not referenced by the cache itself
+} VSM_IMAGE; ///< Process-wide read-only image of a file
+
+VSM_BLOCK* image_open ( VSM_MODEL* model, const char* path, size_t size, uint8_t fill );
+bool image_host_format ( const char* path );
+
+#endif
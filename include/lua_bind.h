@@ -2,6 +2,17 @@
 #define LUA_BIND_H
 #include <vsm_api.h>
 
+typedef struct VSM_MODEL VSM_MODEL;
+typedef struct VSM_PIN VSM_PIN;
+typedef struct VSM_PIN_GROUP VSM_PIN_GROUP;
+typedef struct VSM_SERIAL VSM_SERIAL;
+typedef struct VSM_BUS_MASTER VSM_BUS_MASTER;
+typedef struct VSM_SEQUENCER VSM_SEQUENCER;
+typedef struct VSM_MEMCHIP VSM_MEMCHIP;
+typedef struct VSM_SPARSE VSM_SPARSE;
+typedef struct VSM_NVMEM VSM_NVMEM;
+typedef struct VSM_MEMMAP VSM_MEMMAP;
+
 typedef struct lua_bind_func
 {
 	int32_t ( *lua_c_api ) ( lua_State* );
@@ -18,10 +29,67 @@ typedef struct lua_bind_var
 #define PIN_NUM "number"
 #define PIN_OFF_TIME "off_time"
 #define PIN_ON_TIME "on_time"
+#define PORT_NAME "port"
+#define PORT_STEM "stem"
+#define PORT_FROM "from"
+#define PORT_TO "to"
+#define PORT_PINS "pins"
+#define SENSITIVITY_NAME "device_sensitivity"
+#define SENSITIVITY_ACTIVE "active"
+#define SENSITIVITY_MODES "modes"
+#define PIN_META "openvsm.pin" ///< Metatable of pin objects
+#define PIN_GROUP_META "openvsm.pin_group" ///< Metatable of pin group objects
+#define BUS_META "openvsm.bus" ///< Metatable of host bus pin objects
+#define POPUP_SOURCES "openvsm.popup_sources" ///< Registry table of the data each memory popup shows
+
+/**
+ * Script entry points resolved once at setup. The run mode hooks follow
+ * RUNMODES order, so HOOK_RUNMODE() maps a mode straight to its slot.
+ */
+typedef enum LUA_HOOK
+{
+	HOOK_DEVICE_INIT,
+	HOOK_DEVICE_SIMULATE,
+	HOOK_TIMER_CALLBACK,
+	HOOK_TIMER_BATCH,
+	HOOK_ON_BATCH,
+	HOOK_ON_START,
+	HOOK_ON_STOP,
+	HOOK_ON_SUSPEND,
+	HOOK_ON_ANIMATE,
+	HOOK_ON_STEPTIME,
+	HOOK_ON_STEPOVER,
+	HOOK_ON_STEPINTO,
+	HOOK_ON_STEPOUT,
+	HOOK_ON_STEPTO,
+	HOOK_ON_META,
+	HOOK_ON_DUMP,
+	HOOK_MAX
+} LUA_HOOK;
 
-void lua_load_script ( const char* function );
-void lua_run_function ( const char* func_name );
-void register_functions ( lua_State* L );
+#define HOOK_RUNMODE(mode) ( HOOK_ON_BATCH + ( mode ) - RM_BATCH )
+
+/**
+ * Per-pin handlers registered with on_posedge, on_negedge and on_change
+ */
+typedef enum PIN_EDGE
+{
+	EDGE_POS,
+	EDGE_NEG,
+	EDGE_ANY,
+	EDGE_MAX
+} PIN_EDGE;
 
-extern lua_State* luactx;
+void lua_load_script ( VSM_MODEL* model, const char* function );
+void lua_run_function ( VSM_MODEL* model, const char* func_name );
+void lua_resolve_hooks ( VSM_MODEL* model );
+void lua_release_hooks ( VSM_MODEL* model );
+bool lua_push_hook ( VSM_MODEL* model, LUA_HOOK hook );
+void lua_run_hook ( VSM_MODEL* model, LUA_HOOK hook, int32_t nargs );
+void register_functions ( VSM_MODEL* model );
+void lua_bind_pin ( VSM_MODEL* model, VSM_PIN* pin, bool global );
+void lua_push_pin ( lua_State* L, VSM_PIN* pin );
+VSM_PIN_GROUP* lua_new_pin_group ( lua_State* L, VSM_MODEL* model, uint32_t width );
+void lua_run_pin_handler ( VSM_PIN* pin, PIN_EDGE edge, ABSTIME atime );
+bool lua_run_event_handler ( VSM_MODEL* model, ABSTIME atime, EVENTID eventid );
 #endif
@@ -0,0 +1,73 @@
+/**
+ *
+ * @file   lua_cache.h
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Compiled model script cache.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LUA_CACHE_H
+#define LUA_CACHE_H
+#include <vsm_api.h>
+
+#define LUA_CACHE_MAGIC "OVSMLC1"
+#define LUA_CACHE_EXT "c" ///< model.dll.lua is cached as model.dll.luac
+#define LUA_CACHE_ENV "LUAVSM_CACHE" ///< Optional directory for cache files
+
+typedef struct LUA_CACHE_HEADER
+{
+	char magic[8]; ///< LUA_CACHE_MAGIC
+	uint32_t version; ///< LUA_VERSION_NUM of the dumping interpreter
+	uint32_t source_size; ///< Size of the script the chunk was built from
+	uint64_t source_mtime; ///< Modification time of that script
+	uint64_t source_hash; ///< FNV-1a hash of that script
+} LUA_CACHE_HEADER; ///< Header in front of the dumped bytecode
+
+typedef struct LUA_SHARED_TABLE
+{
+	struct LUA_SHARED_TABLE* next;
+	char* name; ///< Name the script registered the table under
+	bool integer; ///< All values are integers, otherwise all are numbers
+	size_t count; ///< Number of values, indexes are 1..count
+	union
+	{
+		lua_Integer* ivalues;
+		lua_Number* nvalues;
+	};
+} LUA_SHARED_TABLE; ///< Read-only array shared by every instance of a script
+
+typedef struct LUA_CHUNK
+{
+	struct LUA_CHUNK* next;
+	char* script; ///< Full script path
+	uint64_t source_mtime; ///< Script modification time the image was built from
+	uint32_t source_size; ///< Script size the image was built from
+	uint8_t* image; ///< Dumped bytecode
+	size_t image_size;
+	LUA_SHARED_TABLE* tables; ///< Constant tables published by the first instance
+	int32_t refcount; ///< Models using the chunk plus one while it is cached
+} LUA_CHUNK; ///< Process-wide compiled script image
+
+int32_t lua_cache_load ( VSM_MODEL* model, const char* script );
+uint64_t lua_cache_hash ( const uint8_t* data, size_t size );
+void lua_cache_release ( LUA_CHUNK* chunk );
+void lua_cache_flush ( void );
+LUA_SHARED_TABLE* lua_cache_find_table ( LUA_CHUNK* chunk, const char* name );
+LUA_SHARED_TABLE* lua_cache_add_table ( LUA_CHUNK* chunk, const char* name, size_t count, bool integer );
+
+#endif
@@ -0,0 +1,62 @@
+/**
+ *
+ * @file   memchip.h
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Native ROM and RAM chips.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MEMCHIP_H
+#define MEMCHIP_H
+#include <vsm_api.h>
+
+#define MEMCHIP_META "openvsm.memory_chip" ///< Metatable of memory chip objects
+
+struct VSM_MEMCHIP
+{
+	VSM_MODEL* model; ///< Model the chip belongs to
+	VSM_PIN_GROUP* addr; ///< Address group, owned by the chip
+	VSM_PIN_GROUP* data; ///< Data group, owned by the chip
+	VSM_PIN* ce; ///< Chip enable, NULL if always selected
+	VSM_PIN* oe; ///< Output enable, NULL if always enabled
+	VSM_PIN* we; ///< Write enable, NULL for a ROM
+	bool active_high; ///< Control pin polarity
+	VSM_BLOCK* block; ///< Block holding the contents, one reference
+	uint8_t* mem; ///< Contents, inside block
+	size_t size; ///< Bytes in mem
+	uint8_t word_bytes; ///< Bytes per data word, little endian in mem
+	uint64_t words; ///< Addressable words
+	RELTIME access; ///< Address or chip enable to valid data
+	RELTIME enable; ///< Output enable to valid data
+	RELTIME release; ///< Disable to high impedance
+	bool driving; ///< Data pins are driven
+	uint64_t out_value; ///< Word on the data pins while driving
+	uint64_t last_addr; ///< Address at the previous evaluation
+	bool last_ce; ///< Chip enable at the previous evaluation
+	bool writing; ///< A write strobe was open at the previous evaluation
+	int32_t lua_ref; ///< Registry reference of the chip object handed to Lua
+}; ///< Memory chip driven from the model simulate call
+
+VSM_MEMCHIP* memchip_new ( VSM_MODEL* model, VSM_PIN_GROUP* addr, VSM_PIN_GROUP* data, uint64_t words );
+void memchip_free ( VSM_MEMCHIP* chip );
+uint64_t memchip_peek ( VSM_MEMCHIP* chip, uint64_t addr );
+void memchip_poke ( VSM_MEMCHIP* chip, uint64_t addr, uint64_t value );
+void memchip_simulate ( VSM_MEMCHIP* chip, ABSTIME atime );
+bool memchip_attach ( VSM_MEMCHIP* chip, VSM_BLOCK* block, uint8_t* data, size_t size );
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ *
+ * @file   memmap.h
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Paged address space decoding.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef MEMMAP_H
+#define MEMMAP_H
+#include <vsm_api.h>
+
+#define MEMMAP_META "openvsm.memory_map" ///< Metatable of memory map objects
+#define MEMMAP_MAX_PAGES ( 1 << 24 ) ///< Page table entries a map may have
+
+typedef uint64_t ( *MEMMAP_READ ) ( VSM_MEMMAP* map, void* ctx, uint64_t addr, uint8_t width );
+typedef void ( *MEMMAP_WRITE ) ( VSM_MEMMAP* map, void* ctx, uint64_t addr, uint64_t value, uint8_t width );
+typedef struct MEMMAP_REGION MEMMAP_REGION;
+typedef void ( *MEMMAP_FREE ) ( VSM_MEMMAP* map, MEMMAP_REGION* region );
+
+struct MEMMAP_REGION
+{
+	uint64_t base; ///< First address
+	uint64_t size; ///< Bytes, whole pages
+	VSM_BLOCK* block; ///< Memory behind the region, holds one reference, NULL for I/O
+	MEMMAP_READ read; ///< I/O read handler, NULL reads the open bus
+	MEMMAP_WRITE write; ///< I/O write handler, NULL drops writes
+	void* ctx; ///< Handed to the handlers
+	int32_t read_ref; ///< Registry reference of the Lua read hook
+	int32_t write_ref; ///< Registry reference of the Lua write hook
+	uint64_t pages; ///< Page table entries pointing at the region, it is released at 0
+	MEMMAP_FREE free; ///< Called when the region is released while the model lives, NULL if nothing to do
+}; ///< Range registered with memmap_ram or memmap_io, lives while pages point at it
+
+typedef struct MEMMAP_PAGE
+{
+	uint8_t* read; ///< Memory read in place, NULL for I/O or unmapped pages
+	uint8_t* write; ///< Memory written in place, NULL for ROM, I/O or unmapped pages
+	MEMMAP_REGION* region; ///< Region the page belongs to, NULL if unmapped
+} MEMMAP_PAGE; ///< Page table entry
+
+struct VSM_MEMMAP
+{
+	VSM_MODEL* model; ///< Model the map belongs to
+	uint8_t page_bits; ///< log2 of the page size
+	uint64_t size; ///< Bytes in the address space, a power of two, addresses wrap
+	MEMMAP_PAGE* pages; ///< Page table
+	size_t page_count; ///< Entries in pages
+	MEMMAP_REGION** regions; ///< Live regions, and released ones waiting for dispatch to end
+	int32_t region_count; ///< Number of regions
+	int32_t dispatch; ///< I/O handlers under way, regions are only released at 0
+	uint8_t open_bus; ///< Byte read from unmapped pages
+	int32_t lua_ref; ///< Registry reference of the map object handed to Lua
+}; ///< Address space of a CPU or DMA master
+
+VSM_MEMMAP* memmap_new ( VSM_MODEL* model, uint8_t addr_bits, uint8_t page_bits );
+void memmap_free ( VSM_MEMMAP* map );
+MEMMAP_REGION* memmap_ram ( VSM_MEMMAP* map, uint64_t base, VSM_BLOCK* block, uint8_t* data, uint64_t size, bool readonly );
+MEMMAP_REGION* memmap_io ( VSM_MEMMAP* map, uint64_t base, uint64_t size, MEMMAP_READ read, MEMMAP_WRITE write, void* ctx );
+bool memmap_unmap ( VSM_MEMMAP* map, uint64_t base, uint64_t size );
+uint64_t memmap_read ( VSM_MEMMAP* map, uint64_t addr, uint8_t width );
+void memmap_write ( VSM_MEMMAP* map, uint64_t addr, uint64_t value, uint8_t width );
+
+#endif
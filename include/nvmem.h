@@ -0,0 +1,61 @@
+/**
+ *
+ * @file   nvmem.h
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Persistent file-backed memories.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef NVMEM_H
+#define NVMEM_H
+#include <vsm_api.h>
+
+#define NVMEM_META "openvsm.nv_memory" ///< Metatable of persistent memory objects
+#define NVMEM_PAGE_BITS 12
+#define NVMEM_PAGE ( 1 << NVMEM_PAGE_BITS ) ///< Dirty tracking granule
+
+struct VSM_NVMEM
+{
+	VSM_MODEL* model; ///< Model the memory belongs to
+	VSM_BLOCK* block; ///< Mapped file, read-only to buffers so every write is tracked
+	uint8_t* data; ///< Contents, block->data
+	size_t size; ///< Bytes
+	uint8_t* dirty; ///< Bit per page written since the last flush
+	size_t page_count; ///< Pages in the memory
+	size_t dirty_count; ///< Pages marked in dirty
+	bool flash; ///< Writes can only move bits away from erase_value, erase restores them
+	uint8_t erase_value; ///< Value of erased bytes, also of bytes added to a short file
+	size_t sector; ///< Erase granule in bytes, also the wear granule
+	RELTIME program_time; ///< Time a write keeps the part busy, 0 for none
+	RELTIME erase_time; ///< Time an erase keeps the part busy, 0 for none
+	ABSTIME busy_until; ///< End of the last program or erase
+	uint32_t* wear; ///< Erases of each sector, writes for EEPROMs, NULL if not counted
+	size_t sector_count; ///< Sectors in the memory
+	int32_t lua_ref; ///< Registry reference of the memory object handed to Lua
+}; ///< Non-volatile memory kept in a memory-mapped file
+
+VSM_NVMEM* nvmem_new ( VSM_MODEL* model, const char* path, size_t size, size_t sector, uint8_t erase_value );
+void nvmem_free ( VSM_NVMEM* nv );
+bool nvmem_track_wear ( VSM_NVMEM* nv );
+bool nvmem_busy ( VSM_NVMEM* nv, ABSTIME atime );
+bool nvmem_write ( VSM_NVMEM* nv, ABSTIME atime, size_t addr, const void* src, size_t len );
+bool nvmem_erase ( VSM_NVMEM* nv, ABSTIME atime, size_t addr, size_t len );
+size_t nvmem_flush ( VSM_NVMEM* nv );
+
+#endif
@@ -0,0 +1,127 @@
+/**
+ *
+ * @file   sequencer.h
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Programmable pin sequencers.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+#include <vsm_api.h>
+
+#define SEQUENCER_META "openvsm.sequencer" ///< Metatable of sequencer objects
+#define SEQ_MAX_PROGRAM 64 ///< Instructions a program may have
+#define SEQ_FIFO 256 ///< Words each FIFO holds
+#define SEQ_BUDGET 256 ///< Instructions run per host callback before yielding
+
+typedef enum SEQ_OPCODE
+{
+	SEQ_SET, ///< Drive the masked out pins to arg
+	SEQ_WAIT, ///< Idle for arg ticks
+	SEQ_WAIT_PIN, ///< Stall until in pin `pin` reads arg
+	SEQ_OUT, ///< Shift arg bits from the output shift register to the first out pins
+	SEQ_IN, ///< Shift arg bits from the first in pins into the input shift register
+	SEQ_PUSH, ///< Push the input shift register to the receive FIFO, even partly filled
+	SEQ_SETX, ///< Load the X counter with arg
+	SEQ_JMP, ///< Jump to arg if the condition holds
+	SEQ_IRQ, ///< Raise interrupt arg with the script
+} SEQ_OPCODE;
+
+typedef enum SEQ_COND
+{
+	COND_ALWAYS,
+	COND_X_DEC, ///< X is not zero, X is decremented either way
+	COND_PIN, ///< In pin `pin` is high
+	COND_NOT_PIN, ///< In pin `pin` is low
+	COND_NOT_OSRE, ///< Output bits or transmit words are left
+} SEQ_COND;
+
+typedef enum SEQ_STALL
+{
+	STALL_NONE,
+	STALL_TX, ///< out found no word to pull
+	STALL_RX, ///< Receive FIFO is full
+	STALL_PIN, ///< wait_pin is waiting for an edge
+} SEQ_STALL;
+
+typedef struct SEQ_INSN
+{
+	uint8_t op; ///< SEQ_OPCODE
+	uint8_t cond; ///< SEQ_COND of a jump
+	uint8_t pin; ///< In pin used by wait_pin and pin conditions
+	uint64_t arg; ///< Value, bit count, tick count, target or interrupt number
+	uint64_t mask; ///< Out pins touched by set
+	uint32_t delay; ///< Extra ticks after the instruction
+} SEQ_INSN; ///< Decoded sequencer instruction
+
+typedef struct SEQ_FIFO_RING
+{
+	uint32_t word[SEQ_FIFO]; ///< Words
+	int32_t head; ///< Oldest word
+	int32_t count; ///< Words held
+} SEQ_FIFO_RING; ///< Word FIFO between the script and the sequencer
+
+typedef void ( *SEQ_RX ) ( VSM_SEQUENCER* seq );
+typedef void ( *SEQ_IRQ_FN ) ( VSM_SEQUENCER* seq, uint32_t irq );
+
+struct VSM_SEQUENCER
+{
+	VSM_MODEL* model; ///< Model the sequencer belongs to
+	int32_t slot; ///< Index in model->sequencers, also the host event id
+	VSM_PIN_GROUP* out; ///< Pins driven by set and out, owned by the sequencer
+	VSM_PIN_GROUP* in; ///< Pins read by in, wait_pin and jumps, owned by the sequencer
+	RELTIME tick; ///< Duration of one instruction
+	SEQ_INSN program[SEQ_MAX_PROGRAM]; ///< Program
+	int32_t length; ///< Instructions in program
+	int32_t pc; ///< Next instruction
+	uint32_t x; ///< Loop counter
+	uint64_t out_word; ///< Last word driven on the out pins
+	uint32_t osr; ///< Output shift register
+	uint8_t osr_count; ///< Bits left in osr
+	uint32_t isr; ///< Input shift register
+	uint8_t isr_count; ///< Bits shifted into isr
+	uint8_t pull_bits; ///< Bits of a transmit word
+	uint8_t push_bits; ///< Bits that make a receive word
+	bool msb_first; ///< Shift direction of both shift registers
+	SEQ_FIFO_RING tx; ///< Words from the script
+	SEQ_FIFO_RING rx; ///< Words for the script
+	int32_t rx_batch; ///< Receive words that make on_rx run
+	bool running; ///< Started and not stopped
+	SEQ_STALL stall; ///< Why the program does not advance
+	ABSTIME time; ///< Time the instruction at pc runs at
+	EVENT* event; ///< Armed host callback, NULL if none
+	VSM_PIN* wait_pin; ///< Pin a stalled wait_pin listens to
+	SEQ_RX on_rx; ///< Called when rx_batch words are waiting
+	SEQ_IRQ_FN on_irq; ///< Called by irq
+	int32_t lua_ref; ///< Registry reference of the sequencer object handed to Lua
+	int32_t rx_ref; ///< Registry reference of the Lua receive function
+	int32_t irq_ref; ///< Registry reference of the Lua interrupt function
+	int32_t labels_ref; ///< Registry reference of the Lua table of program labels
+}; ///< Programmable pin sequencer
+
+VSM_SEQUENCER* sequencer_new ( VSM_MODEL* model, VSM_PIN_GROUP* out, VSM_PIN_GROUP* in );
+void sequencer_free ( VSM_SEQUENCER* seq );
+void sequencer_start ( VSM_SEQUENCER* seq, int32_t pc );
+void sequencer_stop ( VSM_SEQUENCER* seq );
+int32_t sequencer_put ( VSM_SEQUENCER* seq, const uint32_t* words, int32_t count );
+int32_t sequencer_get ( VSM_SEQUENCER* seq, uint32_t* words, int32_t count );
+void sequencer_callback ( VSM_SEQUENCER* seq, ABSTIME atime );
+void sequencer_edge ( VSM_SEQUENCER* seq, VSM_PIN* pin, ABSTIME atime );
+
+#endif
@@ -0,0 +1,198 @@
+/**
+ *
+ * @file   serial.h
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Native serial engines.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SERIAL_H
+#define SERIAL_H
+#include <vsm_api.h>
+
+#define SERIAL_META "openvsm.serial" ///< Metatable of serial engine objects
+#define SERIAL_MAX_OPS 64 ///< Line operations generated per byte, the longest is an I2C byte
+#define SERIAL_LINES 4 ///< Pins an engine may use
+#define SERIAL_RING 256 ///< Receive ring size, a full ring is delivered at once
+#define SERIAL_MAX_EDGES 16 ///< Line edges remembered inside one UART frame
+
+typedef enum SERIAL_KIND
+{
+	SERIAL_UART_TX,
+	SERIAL_SPI_MASTER,
+	SERIAL_I2C_MASTER,
+	SERIAL_UART_RX,
+	SERIAL_SPI_RX,
+	SERIAL_I2C_RX,
+	SERIAL_I2C_SLAVE,
+	SERIAL_SPI_SLAVE,
+} SERIAL_KIND;
+
+typedef enum SERIAL_PARITY
+{
+	PARITY_NONE,
+	PARITY_EVEN,
+	PARITY_ODD,
+} SERIAL_PARITY;
+
+/* Per byte receive flags */
+#define RX_FRAMING 0x01 ///< Bad start or stop bit, or SPI byte cut short by CS
+#define RX_PARITY 0x02 ///< UART parity mismatch
+#define RX_NACK 0x04 ///< I2C byte was not acknowledged
+#define RX_START 0x08 ///< First byte after an I2C start or SPI select
+
+/* Line numbers inside VSM_SERIAL.lines */
+#define UART_TX 0
+#define UART_RX 0
+#define SPI_SCK 0
+#define SPI_MOSI 1
+#define SPI_MISO 2
+#define SPI_CS 3
+#define I2C_SCL 0
+#define I2C_SDA 1
+
+typedef enum SERIAL_OP_KIND
+{
+	OP_NOP,	///< Only carries a delay
+	OP_DRIVE, ///< Drive the line to level
+	OP_RELEASE, ///< Let an open-drain line float
+	OP_SAMPLE, ///< Shift the line level into the receive register
+	OP_STORE, ///< Append the receive register to the receive buffer
+	OP_ACK, ///< Sample an I2C acknowledge
+} SERIAL_OP_KIND;
+
+typedef struct SERIAL_OP
+{
+	RELTIME delay; ///< Time from the previous operation
+	uint8_t kind; ///< SERIAL_OP_KIND
+	uint8_t line; ///< Line the operation acts on
+	uint8_t level; ///< Level for OP_DRIVE
+} SERIAL_OP; ///< One step on the lines, generated a byte at a time
+
+typedef enum I2C_PHASE
+{
+	I2C_IDLE,
+	I2C_BODY,
+	I2C_DONE,
+} I2C_PHASE;
+
+typedef enum SLAVE_STATE
+{
+	SLAVE_IDLE, ///< Not addressed, waiting for a start or select
+	SLAVE_ADDRESS, ///< Receiving the I2C address or the SPI command byte
+	SLAVE_POINTER, ///< Receiving further register address bytes
+	SLAVE_WRITE, ///< Master writes registers
+	SLAVE_READ, ///< Master reads registers
+} SLAVE_STATE;
+
+#define REG_HOOK_READ 0x01 ///< Register value is asked for before it is sent
+#define REG_HOOK_WRITE 0x02 ///< Register is reported after it was written
+
+typedef struct SERIAL_REGMAP
+{
+	uint8_t* value; ///< Register contents
+	uint8_t* reset; ///< Values restored by slave_reset
+	uint8_t* ro_mask; ///< Bits the master cannot write
+	uint8_t* hooks; ///< REG_HOOK_* of each register
+	uint32_t size; ///< Number of registers
+	uint32_t pointer; ///< Register the next byte goes to or comes from
+	uint8_t addr_bytes; ///< Register address bytes, for SPI the command byte counts as the first
+} SERIAL_REGMAP; ///< Register file of a slave engine
+
+typedef void ( *SERIAL_DONE ) ( VSM_SERIAL* serial );
+typedef uint8_t ( *SERIAL_REG_READ ) ( VSM_SERIAL* serial, uint32_t reg, uint8_t value );
+typedef void ( *SERIAL_REG_WRITE ) ( VSM_SERIAL* serial, uint32_t reg, uint8_t value );
+typedef void ( *SERIAL_RX ) ( VSM_SERIAL* serial, const uint8_t* bytes, const uint8_t* flags, const uint8_t* aux, size_t len );
+
+struct VSM_SERIAL
+{
+	VSM_MODEL* model; ///< Model the engine belongs to
+	SERIAL_KIND kind; ///< Protocol
+	int32_t slot; ///< Index in model->serials, also the host event id
+	VSM_PIN* lines[SERIAL_LINES]; ///< Pins, see the line numbers above
+	int8_t level[SERIAL_LINES]; ///< Last driven level, -1 if released or unknown
+	RELTIME bit_time; ///< UART bit time, SPI and I2C clock period
+	uint8_t bits; ///< UART data bits
+	uint8_t stop_bits; ///< UART stop bits
+	SERIAL_PARITY parity; ///< UART parity
+	uint8_t mode; ///< SPI mode, CPOL is bit 1, CPHA is bit 0
+	bool msb_first; ///< SPI bit order
+	uint8_t* tx; ///< Bytes to send
+	size_t tx_len; ///< Bytes queued
+	size_t tx_pos; ///< Bytes already turned into operations
+	size_t tx_size; ///< Allocated tx bytes
+	uint8_t* rx; ///< Bytes received during the transfer
+	size_t rx_len; ///< Bytes received
+	size_t rx_size; ///< Allocated rx bytes
+	size_t read_count; ///< I2C bytes to read, 0 for a write
+	I2C_PHASE phase; ///< I2C transaction progress
+	bool ack; ///< Last I2C acknowledge seen
+	uint32_t shift; ///< Receive shift register
+	SERIAL_OP ops[SERIAL_MAX_OPS]; ///< Operations of the byte in flight
+	int32_t op_count; ///< Operations generated
+	int32_t op_pos; ///< Next operation to run
+	RELTIME pending; ///< Delay not attached to an operation yet
+	bool busy; ///< A transfer is under way
+	SERIAL_DONE on_done; ///< Called when the queue drained or the I2C transaction ended
+	int32_t lua_ref; ///< Registry reference of the engine object handed to Lua
+	int32_t done_ref; ///< Registry reference of the Lua completion function
+	uint8_t ring[SERIAL_RING]; ///< Received bytes
+	uint8_t ring_flags[SERIAL_RING]; ///< RX_* flags of each received byte
+	uint8_t ring_aux[SERIAL_RING]; ///< MISO byte received along each SPI byte
+	int32_t ring_head; ///< Oldest buffered byte
+	int32_t ring_count; ///< Buffered bytes
+	int32_t rx_batch; ///< Bytes buffered before on_rx runs, frame ends deliver earlier
+	uint32_t shift_aux; ///< MISO shift register
+	int32_t bit_count; ///< Bits shifted into the byte being received
+	uint8_t next_flags; ///< Flags of the byte being received
+	bool in_frame; ///< UART frame or I2C transaction under way
+	ABSTIME frame_start; ///< Falling edge of the UART start bit
+	ABSTIME edges[SERIAL_MAX_EDGES]; ///< Line edges seen inside the UART frame
+	int32_t edge_count; ///< Edges in edges
+	SERIAL_RX on_rx; ///< Called with the buffered bytes
+	int32_t rx_ref; ///< Registry reference of the Lua receive function
+	SERIAL_REGMAP regs; ///< Slave register file
+	SLAVE_STATE state; ///< Slave transaction progress
+	bool slave_read; ///< The master reads in the current slave transaction
+	uint8_t address; ///< I2C slave address
+	uint8_t read_flag; ///< Bits of the SPI command byte that ask for a read
+	uint8_t pointer_bytes; ///< Register address bytes received so far
+	uint8_t out; ///< Byte the slave is shifting out
+	bool prefetched; ///< out was peeked ahead of the byte, its read hook and pointer advance are still due
+	RELTIME stretch; ///< Time the I2C slave holds SCL low after each byte, 0 for none
+	SERIAL_REG_READ on_read; ///< Called for registers with REG_HOOK_READ
+	SERIAL_REG_WRITE on_write; ///< Called for registers with REG_HOOK_WRITE
+	int32_t read_hooks_ref; ///< Registry reference of the Lua table of read hooks
+	int32_t write_hooks_ref; ///< Registry reference of the Lua table of write hooks
+}; ///< Native serial engine
+
+extern const char* const serial_parity_names[];
+
+VSM_SERIAL* serial_new ( VSM_MODEL* model, SERIAL_KIND kind );
+void serial_free ( VSM_SERIAL* serial );
+bool serial_send ( VSM_SERIAL* serial, const uint8_t* data, size_t len );
+bool i2c_write ( VSM_SERIAL* serial, uint8_t address, const uint8_t* data, size_t len );
+bool i2c_read ( VSM_SERIAL* serial, uint8_t address, size_t len );
+void serial_run ( VSM_SERIAL* serial, ABSTIME atime );
+void serial_callback ( VSM_SERIAL* serial, ABSTIME atime );
+void serial_edge ( VSM_SERIAL* serial, VSM_PIN* pin, ABSTIME atime );
+bool serial_listen ( VSM_SERIAL* serial );
+bool slave_regs ( VSM_SERIAL* serial, uint32_t size, uint8_t addr_bytes );
+void slave_reset ( VSM_SERIAL* serial );
+
+#endif
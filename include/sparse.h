@@ -0,0 +1,59 @@
+/**
+ *
+ * @file   sparse.h
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Sparse, lazily allocated memories.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef SPARSE_H
+#define SPARSE_H
+#include <vsm_api.h>
+
+#define SPARSE_META "openvsm.sparse_memory" ///< Metatable of sparse memory objects
+#define SPARSE_PAGE_BITS 12
+#define SPARSE_PAGE ( 1 << SPARSE_PAGE_BITS ) ///< Allocation granule
+
+struct VSM_SPARSE
+{
+	VSM_MODEL* model; ///< Model the memory belongs to
+	uint64_t size; ///< Bytes
+	uint8_t** pages; ///< Page table, a NULL page holds only fill bytes
+	size_t page_count; ///< Entries in pages
+	size_t resident; ///< Pages allocated
+	uint8_t fill; ///< Value of untouched bytes
+	uint8_t* zero; ///< One page of fill bytes read in place of every missing page
+	IMEMORYPOPUP* popup; ///< Popup showing a window of the memory, NULL if none
+	uint8_t* view; ///< Copy of the window the popup shows
+	uint64_t view_base; ///< First byte of the window
+	size_t view_size; ///< Bytes in the window
+	int32_t lua_ref; ///< Registry reference of the memory object handed to Lua
+}; ///< Large memory paying only for the pages written
+
+VSM_SPARSE* sparse_new ( VSM_MODEL* model, uint64_t size, uint8_t fill );
+void sparse_free ( VSM_SPARSE* sp );
+bool sparse_read ( VSM_SPARSE* sp, uint64_t addr, void* dst, size_t len );
+bool sparse_write ( VSM_SPARSE* sp, uint64_t addr, const void* src, size_t len );
+bool sparse_fill ( VSM_SPARSE* sp, uint64_t addr, uint8_t value, uint64_t len );
+bool sparse_copy ( VSM_SPARSE* dst, uint64_t dst_addr, VSM_SPARSE* src, uint64_t src_addr, uint64_t len );
+uint64_t sparse_peek ( VSM_SPARSE* sp, uint64_t addr, uint8_t width );
+void sparse_poke ( VSM_SPARSE* sp, uint64_t addr, uint64_t value, uint8_t width );
+bool sparse_show ( VSM_SPARSE* sp, IMEMORYPOPUP* popup, uint64_t base, size_t size );
+
+#endif
@@ -29,6 +29,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <assert.h>
 #include <time.h>
 
@@ -39,29 +40,17 @@
 #include <defines.h>
 #include <enums.h>
 #include <vsm_classes.h>
-#include <device.h>
-#include <c_bind.h>
 #include <lua_bind.h>
+#include <lua_cache.h>
 
 #undef _WIN32_WINNT
 #define _WIN32_WINNT 0x0500
 #define VSM_API_VERSION  110
 #define model_key 0x00000000
 
-extern bool global_device_init;
-extern bool global_device_simulate;
-extern bool global_timer_callback;
-extern bool global_on_stop;
-extern bool global_on_suspend;
-
 int32_t vasprintf ( char** sptr, char* fmt, va_list argv );
 int32_t asprintf ( char** sptr, char* fmt, ... );
 
-void
-register_functions ( lua_State* L );
-void
-lua_load_script ( const char* device_name );
-
 int32_t __attribute__ ( ( fastcall ) )
 vsm_isdigital ( IDSIMMODEL* this, uint32_t edx, char* pinname );
 void __attribute__ ( ( fastcall ) )
@@ -76,6 +65,18 @@ void __attribute__ ( ( fastcall ) )
 vsm_simulate (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, DSIMMODES mode );
 void __attribute__ ( ( fastcall ) )
 vsm_callback (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, EVENTID eventid );
+void __attribute__ ( ( fastcall ) )
+vsm_timer_callback (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, EVENTID eventid );
+void __attribute__ ( ( fastcall ) )
+vsm_serial_callback (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, EVENTID eventid );
+void __attribute__ ( ( fastcall ) )
+vsm_bus_callback (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, EVENTID eventid );
+void __attribute__ ( ( fastcall ) )
+vsm_sequencer_callback (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, EVENTID eventid );
+void __attribute__ ( ( fastcall ) )
+vsm_clock_callback (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, EVENTID eventid );
+void __attribute__ ( ( fastcall ) )
+vsm_pin_handler (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, DSIMMODES mode );
 
 LRESULT __attribute__ ( ( fastcall ) )
 icpu_vdmhlr (  ICPU* this, uint32_t edx, VDM_COMMAND* cmd, uint8_t* data );
@@ -185,7 +186,7 @@ struct IDSIMMODEL
 struct IBUSPIN
 {
 
-	ICPU_vtable* vtable;
+	IBUSPIN_vtable* vtable;
 	
 };
 
@@ -243,11 +244,21 @@ struct IMSGHLR
 	IMSGHLR_vtable* vtable;
 };
 
-IDSIMMODEL_vtable VSM_DEVICE_vtable;
-IDSIMMODEL VSM_DEVICE;
-
-ICPU_vtable ICPU_DEVICE_vtable;
-ICPU ICPU_DEVICE;
+/* Model context embeds the host interface objects above */
+#include <device.h>
+#include <c_bind.h>
+#include <buffer.h>
+#include <image.h>
+#include <serial.h>
+#include <busmaster.h>
+#include <sequencer.h>
+#include <memchip.h>
+#include <sparse.h>
+#include <nvmem.h>
+#include <memmap.h>
+
+extern IDSIMMODEL_vtable VSM_DEVICE_vtable;
+extern ICPU_vtable ICPU_DEVICE_vtable;
 
 #endif
 
@@ -0,0 +1,112 @@
+/**
+ *
+ * @file   buffer.c
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Reference counted byte blocks and the buffers viewing them.
+ *
+ * Blocks keep ROM images and other large data out of the Lua heap. Lua
+ * buffer objects, slices of them and native devices all point into the
+ * same block and share it by reference count, so nothing is copied when
+ * an image is handed from one to another or shown in a popup.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <vsm_api.h>
+
+/**
+ * [Allocate a zeroed block with one reference]
+ * @param  size [bytes]
+ * @return      [block or NULL if out of memory]
+ */
+VSM_BLOCK*
+block_new ( size_t size )
+{
+	VSM_BLOCK* block = calloc ( 1, sizeof *block );
+	if ( NULL == block )
+		return NULL;
+	/* Zero-sized blocks still get a pointer so views never see NULL */
+	block->data = calloc ( size ? size : 1, 1 );
+	if ( NULL == block->data )
+	{
+		free ( block );
+		return NULL;
+	}
+	block->size = size;
+	block->refs = 1;
+	return block;
+}
+
+/**
+ * [Take one more reference]
+ * @param  block [block]
+ * @return       [the block]
+ */
+VSM_BLOCK*
+block_retain ( VSM_BLOCK* block )
+{
+	block->refs++;
+	return block;
+}
+
+/**
+ * [Drop a reference, the last one frees the block]
+ * @param block [block, NULL is ignored]
+ */
+void
+block_release ( VSM_BLOCK* block )
+{
+	if ( NULL == block || --block->refs > 0 )
+		return;
+	if ( block->free )
+		block->free ( block );
+	else
+		free ( block->data );
+	free ( block );
+}
+
+/**
+ * [Read a little endian word]
+ * @param  buf    [buffer]
+ * @param  offset [byte offset, the word must fit]
+ * @param  width  [bytes, 1 to 8]
+ * @return        [word]
+ */
+uint64_t
+buffer_read ( const VSM_BUFFER* buf, size_t offset, uint8_t width )
+{
+	const uint8_t* p = buf->data + offset;
+	uint64_t value = 0;
+	for ( int32_t i=width - 1; i >= 0; i-- )
+		value = ( value << 8 ) | p[i];
+	return value;
+}
+
+/**
+ * [Write a little endian word]
+ * @param buf    [buffer over a writable block]
+ * @param offset [byte offset, the word must fit]
+ * @param value  [word]
+ * @param width  [bytes, 1 to 8]
+ */
+void
+buffer_write ( VSM_BUFFER* buf, size_t offset, uint64_t value, uint8_t width )
+{
+	uint8_t* p = buf->data + offset;
+	for ( int32_t i=0; i < width; i++, value >>= 8 )
+		p[i] = value;
+}
@@ -0,0 +1,298 @@
+/**
+ *
+ * @file   busmaster.c
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Parallel bus transactors.
+ *
+ * A transactor runs read and write cycles on an address group, a data
+ * group and a few strobes with timing declared once. All edges of a cycle
+ * are handed to the host with their timestamps when the cycle starts, the
+ * model is called back only to sample read data and at the end of the
+ * cycle, which is when the script hears about it.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <vsm_api.h>
+
+/**
+ * [Copy a pin group so the transactor does not depend on a Lua object]
+ * @param  group [pin group]
+ * @return       [copy or NULL if out of memory]
+ */
+static VSM_PIN_GROUP*
+bus_group_copy ( const VSM_PIN_GROUP* group )
+{
+	size_t size = sizeof *group + group->width * sizeof group->pins[0];
+	VSM_PIN_GROUP* copy = malloc ( size );
+	if ( NULL == copy )
+		return NULL;
+	memcpy ( copy, group, size );
+	return copy;
+}
+
+/**
+ * [Create a transactor and register it with the model]
+ * @param  model [model context]
+ * @param  addr  [address group, copied]
+ * @param  data  [data group, copied]
+ * @return       [transactor with no strobes and no timing, NULL if out of memory]
+ */
+VSM_BUS_MASTER*
+bus_master_new ( VSM_MODEL* model, VSM_PIN_GROUP* addr, VSM_PIN_GROUP* data )
+{
+	VSM_BUS_MASTER** masters = realloc ( model->bus_masters, ( model->bus_master_count + 1 ) * sizeof *masters );
+	if ( NULL == masters )
+		return NULL;
+	model->bus_masters = masters;
+
+	VSM_BUS_MASTER* master = calloc ( 1, sizeof *master );
+	if ( NULL == master )
+		return NULL;
+	master->addr = bus_group_copy ( addr );
+	master->data = bus_group_copy ( data );
+	if ( NULL == master->addr || NULL == master->data )
+	{
+		bus_master_free ( master );
+		return NULL;
+	}
+	promote_pin_group ( master->addr );
+	promote_pin_group ( master->data );
+	master->model = model;
+	master->slot = model->bus_master_count;
+	master->ready_level = true;
+	master->lua_ref = LUA_NOREF;
+	model->bus_masters[model->bus_master_count++] = master;
+	return master;
+}
+
+/**
+ * [Release a transactor, only done when the model goes away]
+ * @param master [transactor]
+ */
+void
+bus_master_free ( VSM_BUS_MASTER* master )
+{
+	free ( master->addr );
+	free ( master->data );
+	free ( master->queue );
+	free ( master );
+}
+
+/**
+ * [Drive a strobe or the select to its active or idle level]
+ * @param master [transactor]
+ * @param pin    [strobe, NULL is ignored]
+ * @param atime  [time of the edge]
+ * @param active [active level wanted]
+ */
+static void
+bus_strobe ( VSM_BUS_MASTER* master, VSM_PIN* pin, ABSTIME atime, bool active )
+{
+	if ( NULL == pin )
+		return;
+	bool level = active == master->active_high;
+	pin->pin->vtable->setstate2 ( pin->pin, 0, atime, pin->on_time, level ? SHI : SLO );
+}
+
+/**
+ * [Schedule the next callback of the transactor]
+ * @param  master [transactor]
+ * @param  atime  [callback time]
+ * @return        [false if the host refused the event]
+ */
+static bool
+bus_arm ( VSM_BUS_MASTER* master, ABSTIME atime )
+{
+	VSM_MODEL* model = master->model;
+	return NULL != model->dsim->vtable->setcallbackex ( model->dsim, 0, atime, &model->dsim_model, ( void* ) vsm_bus_callback, master->slot );
+}
+
+/**
+ * [Schedule the edges that close a cycle: select off, written data released]
+ * @param master [transactor]
+ * @param cycle  [cycle being run]
+ */
+static void
+bus_close ( VSM_BUS_MASTER* master, BUS_CYCLE* cycle )
+{
+	bus_strobe ( master, master->cs, master->cycle_end, false );
+	if ( cycle->write )
+		release_pins ( master->data, master->cycle_end );
+}
+
+/**
+ * [End the cycle at the head of the queue and the queued ones as failed,
+ * nothing would resume them]
+ *
+ * @param master [transactor]
+ * @param atime  [end of a strobe left active by a ready wait]
+ */
+static void
+bus_fail ( VSM_BUS_MASTER* master, ABSTIME atime )
+{
+	BUS_CYCLE* cycle = &master->queue[master->queue_head];
+	out_error ( master->model, "bus master: cannot schedule the cycle at address 0x%llx", ( unsigned long long ) cycle->addr );
+	if ( BUS_READY == master->phase )
+	{
+		bus_strobe ( master, cycle->write ? master->wr : master->rd, atime, false );
+		master->cycle_end = atime + master->hold;
+		bus_close ( master, cycle );
+	}
+	master->phase = BUS_IDLE;
+	/* Queued cycles would meet the same refusal, a completion may start a new one */
+	while ( BUS_IDLE == master->phase && master->queue_count )
+	{
+		BUS_CYCLE done = master->queue[master->queue_head];
+		done.failed = true;
+		master->queue_head = ( master->queue_head + 1 ) % master->queue_size;
+		master->queue_count--;
+		if ( master->on_done )
+			master->on_done ( master, &done );
+	}
+}
+
+/**
+ * [Start the cycle at the head of the queue]
+ *
+ * Without a ready line every edge of the cycle is known now and goes to
+ * the host at once.
+ *
+ * @param master [transactor]
+ * @param atime  [cycle start]
+ */
+static void
+bus_start ( VSM_BUS_MASTER* master, ABSTIME atime )
+{
+	BUS_CYCLE* cycle = &master->queue[master->queue_head];
+	VSM_PIN* strobe = cycle->write ? master->wr : master->rd;
+	ABSTIME strobe_at = atime + master->setup;
+	ABSTIME strobe_end = strobe_at + master->strobe;
+
+	drive_pins ( master->addr, atime, cycle->addr );
+	bus_strobe ( master, master->cs, atime, true );
+	if ( cycle->write )
+		drive_pins ( master->data, atime, cycle->data );
+	bus_strobe ( master, strobe, strobe_at, true );
+	if ( master->ready )
+	{
+		master->phase = BUS_READY;
+		if ( !bus_arm ( master, strobe_end ) )
+			bus_fail ( master, strobe_end );
+		return;
+	}
+	bus_strobe ( master, strobe, strobe_end, false );
+	master->cycle_end = strobe_end + master->hold;
+	bus_close ( master, cycle );
+	master->phase = cycle->write ? BUS_END : BUS_SAMPLE;
+	if ( !bus_arm ( master, cycle->write ? master->cycle_end : strobe_at + master->sample ) )
+		bus_fail ( master, strobe_end );
+}
+
+/**
+ * [Queue a cycle, it starts at once if the bus is idle]
+ * @param  master  [transactor]
+ * @param  addr    [address]
+ * @param  data    [data to write, ignored by reads]
+ * @param  write   [write cycle]
+ * @param  lua_ref [completion function reference handed back in the cycle, LUA_NOREF if none]
+ * @return         [false if out of memory or the bus has no strobe for it]
+ */
+bool
+bus_cycle ( VSM_BUS_MASTER* master, uint64_t addr, uint64_t data, bool write, int32_t lua_ref )
+{
+	if ( NULL == ( write ? master->wr : master->rd ) )
+		return false;
+	if ( master->queue_count == master->queue_size )
+	{
+		int32_t size = master->queue_size ? master->queue_size * 2 : 8;
+		BUS_CYCLE* queue = malloc ( size * sizeof *queue );
+		if ( NULL == queue )
+			return false;
+		/* Unwrap the ring while growing it */
+		for ( int32_t i=0; i < master->queue_count; i++ )
+			queue[i] = master->queue[( master->queue_head + i ) % master->queue_size];
+		free ( master->queue );
+		master->queue = queue;
+		master->queue_head = 0;
+		master->queue_size = size;
+	}
+	BUS_CYCLE* cycle = &master->queue[( master->queue_head + master->queue_count++ ) % master->queue_size];
+	cycle->addr = addr;
+	cycle->data = data;
+	cycle->write = write;
+	cycle->lua_ref = lua_ref;
+	cycle->failed = false;
+	if ( BUS_IDLE == master->phase )
+	{
+		ABSTIME curtime = 0;
+		systime ( master->model, &curtime );
+		bus_start ( master, curtime );
+	}
+	return true;
+}
+
+/**
+ * [Host callback of a transactor: read sample, ready poll or cycle end]
+ * @param master [transactor]
+ * @param atime  [event time]
+ */
+void
+bus_master_callback ( VSM_BUS_MASTER* master, ABSTIME atime )
+{
+	BUS_CYCLE* cycle = &master->queue[master->queue_head];
+	switch ( master->phase )
+	{
+		case BUS_SAMPLE:
+			cycle->data = read_pins ( master->data );
+			master->phase = BUS_END;
+			if ( !bus_arm ( master, master->cycle_end ) )
+				bus_fail ( master, atime );
+			break;
+		case BUS_READY:
+			if ( is_pin_high ( master->ready->pin ) != master->ready_level )
+			{
+				if ( !bus_arm ( master, atime + master->wait ) )
+					bus_fail ( master, atime );
+				break;
+			}
+			if ( !cycle->write )
+				cycle->data = read_pins ( master->data );
+			bus_strobe ( master, cycle->write ? master->wr : master->rd, atime, false );
+			master->cycle_end = atime + master->hold;
+			bus_close ( master, cycle );
+			master->phase = BUS_END;
+			if ( !bus_arm ( master, master->cycle_end ) )
+				bus_fail ( master, atime );
+			break;
+		case BUS_END:
+		{
+			BUS_CYCLE done = *cycle;
+			master->queue_head = ( master->queue_head + 1 ) % master->queue_size;
+			master->queue_count--;
+			master->phase = BUS_IDLE;
+			/* The completion may queue the next cycle, which then starts right away */
+			if ( master->on_done )
+				master->on_done ( master, &done );
+			if ( BUS_IDLE == master->phase && master->queue_count )
+				bus_start ( master, atime );
+			break;
+		}
+		default:
+			break;
+	}
+}
@@ -51,8 +51,6 @@ const char *state_to_string (STATE pinstate)
 	}
 }
 
-int popup_id = 0; //!< Global pop identificator. Should be unique
-
 /**
  * [Register model to Proteus license server]
  * @param  ils [description]
@@ -71,13 +69,14 @@ vsm_register ( ILICENCESERVER* ils )
 
 /**
  * [set_pin_state  description]
+ * @param model [model context]
  * @param pin   [description]
  * @param state [description]
  */
-void set_pin_state ( VSM_PIN pin, STATE state )
+void set_pin_state ( VSM_MODEL* model, VSM_PIN pin, STATE state )
 {
 	ABSTIME curtime = 0;
-	systime ( &curtime );
+	systime ( model, &curtime );
 	pin.pin->vtable->setstate2 ( pin.pin, 0, curtime, pin.on_time, state );
 }
 
@@ -86,10 +85,10 @@ void set_pin_state ( VSM_PIN pin, STATE state )
  * @param pin   [description]
  * @param level [description]
  */
-void set_pin_bool ( VSM_PIN pin, bool level )
+void set_pin_bool ( VSM_MODEL* model, VSM_PIN pin, bool level )
 {
 	ABSTIME curtime = 0;
-	systime ( &curtime );
+	systime ( model, &curtime );
 	pin.pin->vtable->setstate2 ( pin.pin, 0, curtime, pin.on_time, level ? SHI : SLO );
 }
 
@@ -97,9 +96,9 @@ void set_pin_bool ( VSM_PIN pin, bool level )
  * [systime  description]
  * @param at [description]
  */
-void systime ( ABSTIME* at )
+void systime ( VSM_MODEL* model, ABSTIME* at )
 {
-	model_dsim->vtable->sysvar ( model_dsim, 0, ( DOUBLE* ) at, DSIMTIMENOW );
+	model->dsim->vtable->sysvar ( model->dsim, 0, ( DOUBLE* ) at, DSIMTIMENOW );
 }
 
 /**
@@ -107,9 +106,9 @@ void systime ( ABSTIME* at )
  * @param  field_name [description]
  * @return            [description]
  */
-char* get_string_param ( char* field_name )
+char* get_string_param ( VSM_MODEL* model, char* field_name )
 {
-	return model_instance->vtable->getstrval ( model_instance, 0, field_name, "?" );
+	return model->instance->vtable->getstrval ( model->instance, 0, field_name, "?" );
 }
 
 /**
@@ -117,9 +116,9 @@ char* get_string_param ( char* field_name )
  * @param  field_name [description]
  * @return            [description]
  */
-bool get_bool_param ( char* field_name )
+bool get_bool_param ( VSM_MODEL* model, char* field_name )
 {
-	return model_instance->vtable->getboolval ( model_instance, 0, field_name, FALSE );
+	return model->instance->vtable->getboolval ( model->instance, 0, field_name, FALSE );
 }
 
 /**
@@ -127,10 +126,10 @@ bool get_bool_param ( char* field_name )
  * @param  field_name [description]
  * @return            [description]
  */
-double get_num_param ( char* field_name )
+double get_num_param ( VSM_MODEL* model, char* field_name )
 {
 	double result = 0;
-	model_instance->vtable->getnumval ( model_instance, 0, &result, field_name, 0.0 );
+	model->instance->vtable->getnumval ( model->instance, 0, &result, field_name, 0.0 );
 	return result;
 }
 
@@ -139,9 +138,9 @@ double get_num_param ( char* field_name )
  * @param  field_name [description]
  * @return            [description]
  */
-int32_t get_hex_param ( char* field_name )
+int32_t get_hex_param ( VSM_MODEL* model, char* field_name )
 {
-	return ( int32_t ) model_instance->vtable->gethexval ( model_instance, 0, field_name, 0 );
+	return ( int32_t ) model->instance->vtable->gethexval ( model->instance, 0, field_name, 0 );
 }
 
 /**
@@ -149,9 +148,9 @@ int32_t get_hex_param ( char* field_name )
  * @param  field_name [description]
  * @return            [description]
  */
-int64_t get_init_param ( char* field_name )
+int64_t get_init_param ( VSM_MODEL* model, char* field_name )
 {
-	return ( int64_t ) model_instance->vtable->getinitval ( model_instance, 0, field_name, 0 );
+	return ( int64_t ) model->instance->vtable->getinitval ( model->instance, 0, field_name, 0 );
 }
 
 /**
@@ -160,9 +159,9 @@ int64_t get_init_param ( char* field_name )
  * @param buffer      [description]
  * @param buffer_size [description]
  */
-void load_image ( char* filename, uint8_t* buffer, size_t buffer_size )
+void load_image ( VSM_MODEL* model, char* filename, uint8_t* buffer, size_t buffer_size )
 {
-	model_instance->vtable->loadmemory ( model_instance, 0, filename, buffer, buffer_size, 0, 0 );
+	model->instance->vtable->loadmemory ( model->instance, 0, filename, buffer, buffer_size, 0, 0 );
 }
 
 /**
@@ -170,9 +169,9 @@ void load_image ( char* filename, uint8_t* buffer, size_t buffer_size )
  * @param  cps [description]
  * @return     [description]
  */
-IPOPUP* create_popup ( CREATEPOPUPSTRUCT* cps )
+IPOPUP* create_popup ( VSM_MODEL* model, CREATEPOPUPSTRUCT* cps )
 {
-	return ( ( IPOPUP* ) model_instance->vtable->createpopup ( model_instance, 0, cps ) );
+	return ( ( IPOPUP* ) model->instance->vtable->createpopup ( model->instance, 0, cps ) );
 }
 
 /**
@@ -181,7 +180,7 @@ IPOPUP* create_popup ( CREATEPOPUPSTRUCT* cps )
  * @param  id    [description]
  * @return       [description]
  */
-IMEMORYPOPUP* create_memory_popup ( const char* title, const int32_t id )
+IMEMORYPOPUP* create_memory_popup ( VSM_MODEL* model, const char* title, const int32_t id )
 {
 	CREATEPOPUPSTRUCT* cps = malloc ( sizeof *cps );
 	cps->caption = ( char* ) title;
@@ -190,7 +189,7 @@ IMEMORYPOPUP* create_memory_popup ( const char* title, const int32_t id )
 	cps->height = 32;
 	cps->width = 16;
 	cps->id = id;
-	IMEMORYPOPUP* popup = ( IMEMORYPOPUP* ) create_popup ( cps );
+	IMEMORYPOPUP* popup = ( IMEMORYPOPUP* ) create_popup ( model, cps );
 	free ( cps );
 	return popup;
 }
@@ -201,7 +200,7 @@ IMEMORYPOPUP* create_memory_popup ( const char* title, const int32_t id )
  * @param  id    [description]
  * @return       [description]
  */
-IDEBUGPOPUP* create_debug_popup ( const char* title, const int32_t id )
+IDEBUGPOPUP* create_debug_popup ( VSM_MODEL* model, const char* title, const int32_t id )
 {
 	CREATEPOPUPSTRUCT* cps = malloc ( sizeof *cps );
 	cps->caption = ( char* ) title;
@@ -210,7 +209,7 @@ IDEBUGPOPUP* create_debug_popup ( const char* title, const int32_t id )
 	cps->height = 200;
 	cps->width = 640;
 	cps->id = id;
-	IDEBUGPOPUP* popup = create_popup ( cps );
+	IDEBUGPOPUP* popup = create_popup ( model, cps );
 	free ( cps );
 	return popup;
 }
@@ -221,7 +220,7 @@ IDEBUGPOPUP* create_debug_popup ( const char* title, const int32_t id )
  * @param  id    [description]
  * @return       [description]
  */
-IDEBUGPOPUP* create_source_popup ( const char* title, const int32_t id )
+IDEBUGPOPUP* create_source_popup ( VSM_MODEL* model, const char* title, const int32_t id )
 {
 	CREATEPOPUPSTRUCT* cps = malloc ( sizeof *cps );
 	cps->caption = ( char* ) title;
@@ -230,7 +229,7 @@ IDEBUGPOPUP* create_source_popup ( const char* title, const int32_t id )
 	cps->height = 200;
 	cps->width = 640;
 	cps->id = id;
-	IDEBUGPOPUP* popup = create_popup ( cps );
+	IDEBUGPOPUP* popup = create_popup ( model, cps );
 	free ( cps );
 	return popup;
 }
@@ -241,7 +240,7 @@ IDEBUGPOPUP* create_source_popup ( const char* title, const int32_t id )
  * @param  id    [description]
  * @return       [description]
  */
-IDEBUGPOPUP* create_status_popup ( const char* title, const int32_t id )
+IDEBUGPOPUP* create_status_popup ( VSM_MODEL* model, const char* title, const int32_t id )
 {
 	CREATEPOPUPSTRUCT* cps = malloc ( sizeof *cps );
 	cps->caption = ( char* ) title;
@@ -250,7 +249,7 @@ IDEBUGPOPUP* create_status_popup ( const char* title, const int32_t id )
 	cps->height = 200;
 	cps->width = 200;
 	cps->id = id;
-	IDEBUGPOPUP* popup = create_popup ( cps );
+	IDEBUGPOPUP* popup = create_popup ( model, cps );
 	free ( cps );
 	return popup;
 }
@@ -261,7 +260,7 @@ IDEBUGPOPUP* create_status_popup ( const char* title, const int32_t id )
  * @param  id    [description]
  * @return       [description]
  */
-IDEBUGPOPUP* create_var_popup ( const char* title, const int32_t id )
+IDEBUGPOPUP* create_var_popup ( VSM_MODEL* model, const char* title, const int32_t id )
 {
 	CREATEPOPUPSTRUCT* cps = malloc ( sizeof *cps );
 	cps->caption = ( char* ) title;
@@ -270,7 +269,7 @@ IDEBUGPOPUP* create_var_popup ( const char* title, const int32_t id )
 	cps->height = 200;
 	cps->width = 200;
 	cps->id = id;
-	IDEBUGPOPUP* popup = create_popup ( cps );
+	IDEBUGPOPUP* popup = create_popup ( model, cps );
 	free ( cps );
 	return popup;
 }
@@ -279,9 +278,9 @@ IDEBUGPOPUP* create_var_popup ( const char* title, const int32_t id )
  * [delete_popup  description]
  * @param id [description]
  */
-void delete_popup ( POPUPID id )
+void delete_popup ( VSM_MODEL* model, POPUPID id )
 {
-	model_instance->vtable->deletepopup ( model_instance, 0, id );
+	model->instance->vtable->deletepopup ( model->instance, 0, id );
 }
 
 /**
@@ -314,9 +313,9 @@ bool add_source_file ( ISOURCEPOPUP* popup, char* filename, bool lowlevel )
  * [set_vdm_handler  description]
  * @return  [description]
  */
-bool set_vdm_handler ( void )
+bool set_vdm_handler ( VSM_MODEL* model )
 {
-	return model_instance->vtable->setvdmhlr ( model_instance, 0, &ICPU_DEVICE );
+	return model->instance->vtable->setvdmhlr ( model->instance, 0, &model->cpu );
 }
 
 /**
@@ -364,17 +363,267 @@ void dump_to_debug_popup ( IDEBUGPOPUP* popup, const uint8_t* buf, uint32_t offs
  * [toggle_pin_state  description]
  * @param pin [description]
  */
-void toggle_pin_state ( VSM_PIN pin )
+void toggle_pin_state ( VSM_MODEL* model, VSM_PIN pin )
 {
 	STATE pinstate = get_pin_state ( pin.pin );
 	if ( SHI == pinstate )
 	{
-		set_pin_state ( pin, SLO );
+		set_pin_state ( model, pin, SLO );
 	}
 	else if ( SLO == pinstate )
 	{
-		set_pin_state ( pin, SHI );
+		set_pin_state ( model, pin, SHI );
+	}
+}
+
+/**
+ * [Route the pin events to vsm_pin_handler instead of the model simulate]
+ * @param model  [model context]
+ * @param pin    [pin]
+ * @param enable [false hands the pin back to simulate]
+ */
+void set_pin_handler ( VSM_MODEL* model, VSM_PIN* pin, bool enable )
+{
+	if ( enable )
+		pin->pin->vtable->sethandler ( pin->pin, 0, &model->dsim_model, ( void* ) vsm_pin_handler );
+	else
+		pin->pin->vtable->sethandler ( pin->pin, 0, &model->dsim_model, NULL );
+}
+
+/**
+ * [Route the pin to vsm_pin_handler while it has Lua edge handlers, a
+ * native listener or a waiting sequencer, and back to simulate once it has none]
+ * @param model [model context]
+ * @param pin   [pin whose handlers changed]
+ */
+void watch_pin ( VSM_MODEL* model, VSM_PIN* pin )
+{
+	bool wanted = NULL != pin->listener || NULL != pin->waiter;
+	for ( int32_t i=0; i < EDGE_MAX; i++ )
+		wanted |= LUA_NOREF != pin->edge_handlers[i];
+
+	/* Pins stay listed once added, the dispatcher skips those without handlers */
+	if ( wanted && !pin->edge_listed )
+	{
+		model->edge_pins[model->edge_pin_count++] = pin;
+		pin->edge_listed = true;
+	}
+	if ( wanted != pin->edge_hooked )
+	{
+		set_pin_handler ( model, pin, wanted );
+		pin->edge_hooked = wanted;
+	}
+}
+
+/**
+ * [Read a pin group as one word, floating and undefined pins read as 0]
+ * @param  group [pin group]
+ * @return       [group word, bit 0 is the first pin]
+ */
+uint64_t read_pins ( VSM_PIN_GROUP* group )
+{
+	if ( group->bus )
+		return group->bus->vtable->getbusvalue ( group->bus, 0 );
+
+	uint64_t word = 0;
+	for ( uint32_t i=0; i < group->width; i++ )
+	{
+		IDSIMPIN* pin = group->pins[i]->pin;
+		if ( ishigh ( pin->vtable->istate ( pin, 0 ) ) )
+			word |= 1ULL << i;
+	}
+	return word;
+}
+
+/**
+ * [Drive a whole pin group from one word at the current time]
+ * @param group [pin group]
+ * @param word  [group word, bit 0 is the first pin]
+ */
+void write_pins ( VSM_PIN_GROUP* group, uint64_t word )
+{
+	ABSTIME curtime = 0;
+	systime ( group->model, &curtime );
+	drive_pins ( group, curtime, word );
+}
+
+/**
+ * [Drive a whole pin group from one word at a given, possibly future, time]
+ * @param group [pin group]
+ * @param atime [time of the change]
+ * @param word  [group word, bit 0 is the first pin]
+ */
+void drive_pins ( VSM_PIN_GROUP* group, ABSTIME atime, uint64_t word )
+{
+	/* One bus event instead of one event per pin */
+	if ( group->bus )
+	{
+		group->bus->vtable->drivebusvalue ( group->bus, 0, atime, word );
+		return;
+	}
+	for ( uint32_t i=0; i < group->width; i++, word >>= 1 )
+	{
+		VSM_PIN* pin = group->pins[i];
+		pin->pin->vtable->setstate2 ( pin->pin, 0, atime, pin->on_time, word & 1 ? SHI : SLO );
+	}
+}
+
+/**
+ * [Let a whole pin group float at a given time]
+ * @param group [pin group]
+ * @param atime [time of the change]
+ */
+void release_pins ( VSM_PIN_GROUP* group, ABSTIME atime )
+{
+	if ( group->bus )
+	{
+		group->bus->vtable->drivetristate ( group->bus, 0, atime );
+		return;
+	}
+	for ( uint32_t i=0; i < group->width; i++ )
+	{
+		VSM_PIN* pin = group->pins[i];
+		pin->pin->vtable->setstate2 ( pin->pin, 0, atime, pin->off_time, FLT );
+	}
+}
+
+/**
+ * [Split a pin name like A12 into its stem and index]
+ * @param  name  [pin name]
+ * @param  index [index on return]
+ * @return       [stem length, 0 if the name has no trailing number or no stem]
+ */
+static size_t pin_name_stem ( const char* name, uint32_t* index )
+{
+	size_t len = strlen ( name );
+	size_t stem = len;
+	while ( stem > 0 && name[stem-1] >= '0' && name[stem-1] <= '9' )
+		stem--;
+	if ( 0 == stem || len == stem )
+		return 0;
+	*index = strtoul ( name + stem, NULL, 10 );
+	return stem;
+}
+
+/**
+ * [Back a pin group with one host bus pin when its pins form a contiguous stem]
+ *
+ * A group of A0, A1 ... A14 with identical timing is served by one IBUSPIN,
+ * anything else keeps being driven pin by pin.
+ *
+ * @param  group [pin group]
+ * @return       [true if the group got a bus pin]
+ */
+bool promote_pin_group ( VSM_PIN_GROUP* group )
+{
+	if ( group->bus || group->width < 2 || group->width > MAXBUSBITS )
+		return group->bus != NULL;
+
+	VSM_PIN* first = group->pins[0];
+	uint32_t base = 0;
+	size_t stem = pin_name_stem ( first->name, &base );
+	if ( 0 == stem )
+		return false;
+	for ( uint32_t i=1; i < group->width; i++ )
+	{
+		VSM_PIN* pin = group->pins[i];
+		uint32_t index = 0;
+		if ( stem != pin_name_stem ( pin->name, &index ) || 0 != strncmp ( first->name, pin->name, stem ) ||
+		     index != base + i || pin->on_time != first->on_time || pin->off_time != first->off_time )
+			return false;
 	}
+
+	char name[MAX_PATH] = {0};
+	snprintf ( name, sizeof name, "%.*s", ( int ) stem, first->name );
+	group->bus = get_bus_pin ( group->model, name, base, group->width );
+	if ( group->bus )
+		set_bus_timing ( group->bus, first->on_time, first->on_time, first->off_time );
+	return group->bus != NULL;
+}
+
+/**
+ * [Get a host bus pin made of pins stem+base ... stem+base+width-1]
+ * @param  model [model context]
+ * @param  stem  [common pin name part, "A" for A0..A14]
+ * @param  base  [index of the first pin]
+ * @param  width [number of pins, at most MAXBUSBITS]
+ * @return       [bus pin or NULL]
+ */
+IBUSPIN* get_bus_pin ( VSM_MODEL* model, char* stem, uint32_t base, uint32_t width )
+{
+	return model->instance->vtable->getbuspin1 ( model->instance, 0, stem, base, width, FALSE );
+}
+
+/**
+ * [set_bus_timing  description]
+ * @param bus [bus pin]
+ * @param tlh [low to high delay]
+ * @param thl [high to low delay]
+ * @param tz  [delay to tristate]
+ */
+void set_bus_timing ( IBUSPIN* bus, RELTIME tlh, RELTIME thl, RELTIME tz )
+{
+	bus->vtable->settiming ( bus, 0, tlh, thl, tz );
+}
+
+/**
+ * [Drive the whole bus at the current time]
+ * @param model [model context]
+ * @param bus   [bus pin]
+ * @param value [bus value, bit 0 is the first pin]
+ */
+void drive_bus_value ( VSM_MODEL* model, IBUSPIN* bus, uint32_t value )
+{
+	ABSTIME curtime = 0;
+	systime ( model, &curtime );
+	bus->vtable->drivebusvalue ( bus, 0, curtime, value );
+}
+
+/**
+ * [Drive a single bus bit at the current time]
+ * @param model [model context]
+ * @param bus   [bus pin]
+ * @param bit   [bit number]
+ * @param state [new state]
+ */
+void drive_bus_bit ( VSM_MODEL* model, IBUSPIN* bus, uint32_t bit, STATE state )
+{
+	ABSTIME curtime = 0;
+	systime ( model, &curtime );
+	bus->vtable->drivebitstate ( bus, 0, curtime, bit, state );
+}
+
+/**
+ * [Release the bus at the current time]
+ * @param model [model context]
+ * @param bus   [bus pin]
+ */
+void drive_bus_tristate ( VSM_MODEL* model, IBUSPIN* bus )
+{
+	ABSTIME curtime = 0;
+	systime ( model, &curtime );
+	bus->vtable->drivetristate ( bus, 0, curtime );
+}
+
+/**
+ * [get_bus_value  description]
+ * @param  bus [bus pin]
+ * @return     [bus value, bit 0 is the first pin]
+ */
+uint32_t get_bus_value ( IBUSPIN* bus )
+{
+	return bus->vtable->getbusvalue ( bus, 0 );
+}
+
+/**
+ * [get_bus_bit  description]
+ * @param  bus [bus pin]
+ * @param  bit [bit number]
+ * @return     [bit state]
+ */
+STATE get_bus_bit ( IBUSPIN* bus, uint32_t bit )
+{
+	return bus->vtable->getbitstate ( bus, 0, bit );
 }
 
 /**
@@ -447,27 +696,319 @@ bool is_pin_edge ( IDSIMPIN* pin )
 }
 
 /**
- * [set_callback  description]
- * @param picotime [description]
- * @param id       [description]
+ * [Order of two pending events, earlier first and FIFO within a time stamp]
+ * @param  a [event]
+ * @param  b [event]
+ * @return   [true if a fires before b]
+ */
+static inline bool timer_before ( const VSM_TIMER* a, const VSM_TIMER* b )
+{
+	if ( a->time != b->time )
+		return a->time < b->time;
+	return ( int32_t ) ( a->handle - b->handle ) < 0;
+}
+
+/**
+ * [Restore the heap order around one slot]
+ * @param model [model context]
+ * @param slot  [index in model->timers]
+ */
+static void timer_sift ( VSM_MODEL* model, int32_t slot )
+{
+	VSM_TIMER* heap = model->timers;
+	VSM_TIMER timer = heap[slot];
+	while ( slot > 0 && timer_before ( &timer, &heap[( slot - 1 ) / 2] ) )
+	{
+		heap[slot] = heap[( slot - 1 ) / 2];
+		slot = ( slot - 1 ) / 2;
+	}
+	for ( ;; )
+	{
+		int32_t child = 2 * slot + 1;
+		if ( child >= model->timer_count )
+			break;
+		if ( child + 1 < model->timer_count && timer_before ( &heap[child + 1], &heap[child] ) )
+			child++;
+		if ( !timer_before ( &heap[child], &timer ) )
+			break;
+		heap[slot] = heap[child];
+		slot = child;
+	}
+	heap[slot] = timer;
+}
+
+/**
+ * [Remove one slot from the timer heap]
+ * @param model [model context]
+ * @param slot  [index in model->timers]
+ */
+static void timer_remove ( VSM_MODEL* model, int32_t slot )
+{
+	model->timers[slot] = model->timers[--model->timer_count];
+	if ( slot < model->timer_count )
+		timer_sift ( model, slot );
+}
+
+/**
+ * [Keep exactly one host event armed, at the earliest pending deadline]
+ *
+ * A later deadline than the armed one is left alone: the armed event fires
+ * early, finds nothing due and arms the next one.
+ *
+ * @param  model [model context]
+ * @return       [false if the host refused the event, nothing is armed then]
+ */
+static bool timer_arm ( VSM_MODEL* model )
+{
+	if ( 0 == model->timer_count )
+		return true;
+	ABSTIME deadline = model->timers[0].time;
+	if ( model->timer_event && model->timer_armed <= deadline )
+		return true;
+	if ( model->timer_event )
+		cancel_event ( model, model->timer_event );
+	/* A stale host event that could not be cancelled carries an old serial */
+	model->timer_event = model->dsim->vtable->setcallbackex ( model->dsim, 0, deadline, &model->dsim_model, ( void* ) vsm_timer_callback, ++model->timer_serial );
+	if ( NULL == model->timer_event )
+	{
+		model->timer_armed = 0;
+		out_error ( model, "Cannot schedule a timer event at %lld ps", ( long long ) deadline );
+		return false;
+	}
+	model->timer_armed = deadline;
+	return true;
+}
+
+/**
+ * [Schedule timer_callback at an absolute time]
+ * @param  model    [model context]
+ * @param  picotime [event time]
+ * @param  id       [event id passed to timer_callback]
+ * @return          [handle for cancel_callback, 0 if the event could not be scheduled]
+ */
+uint32_t set_callback ( VSM_MODEL* model, RELTIME picotime, EVENTID id )
+{
+	if ( model->timer_count == model->timer_size )
+	{
+		int32_t size = model->timer_size ? 2 * model->timer_size : 8;
+		VSM_TIMER* timers = realloc ( model->timers, size * sizeof *timers );
+		if ( NULL == timers )
+			return 0;
+		model->timers = timers;
+		model->timer_size = size;
+	}
+	/* 0 is never a valid handle */
+	if ( 0 == ++model->timer_handle )
+		++model->timer_handle;
+
+	VSM_TIMER* timer = &model->timers[model->timer_count++];
+	timer->handle = model->timer_handle;
+	timer->id = id;
+	timer->time = picotime;
+	timer_sift ( model, model->timer_count - 1 );
+	if ( false == timer_arm ( model ) )
+	{
+		/* Drop the event nothing would fire and re-arm the earlier ones */
+		cancel_callback ( model, model->timer_handle );
+		timer_arm ( model );
+		return 0;
+	}
+	return model->timer_handle;
+}
+
+/**
+ * [Cancel an event scheduled with set_callback, it never reaches the script]
+ * @param  model  [model context]
+ * @param  handle [handle returned by set_callback]
+ * @return        [false if the event already fired or was cancelled]
+ */
+bool cancel_callback ( VSM_MODEL* model, uint32_t handle )
+{
+	/* Events due in the dispatch under way can still be cancelled */
+	for ( int32_t i=0; i < model->timer_due_count; i++ )
+	{
+		if ( handle == model->timer_due[i].handle )
+		{
+			model->timer_due[i].handle = 0;
+			return true;
+		}
+	}
+	for ( int32_t i=0; i < model->timer_count; i++ )
+	{
+		if ( handle == model->timers[i].handle )
+		{
+			timer_remove ( model, i );
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * [Move every event due by the host callback time to model->timer_due]
+ * @param  model  [model context]
+ * @param  serial [event id the host callback carried]
+ * @param  atime  [host callback time]
+ * @return        [number of due events, 0 for a stale host event]
  */
-void set_callback ( RELTIME picotime, EVENTID id )
+int32_t take_due_timers ( VSM_MODEL* model, uint32_t serial, ABSTIME atime )
 {
-	model_dsim->vtable->setcallback ( model_dsim, 0, picotime, &VSM_DEVICE, id );
+	if ( serial != model->timer_serial || NULL == model->timer_event )
+		return 0;
+	model->timer_event = NULL;
+	model->timer_due_count = 0;
+	while ( model->timer_count && model->timers[0].time <= atime )
+	{
+		if ( model->timer_due_count == model->timer_due_size )
+		{
+			int32_t size = model->timer_due_size ? 2 * model->timer_due_size : 8;
+			VSM_TIMER* due = realloc ( model->timer_due, size * sizeof *due );
+			if ( NULL == due )
+				break;
+			model->timer_due = due;
+			model->timer_due_size = size;
+		}
+		model->timer_due[model->timer_due_count++] = model->timers[0];
+		timer_remove ( model, 0 );
+	}
+	timer_arm ( model );
+	return model->timer_due_count;
+}
+
+/**
+ * [Cancel an event returned by the host]
+ * @param  model [model context]
+ * @param  event [host event]
+ * @return       [false if the event already fired or is unknown]
+ */
+bool cancel_event ( VSM_MODEL* model, EVENT* event )
+{
+	return model->dsim->vtable->cancelcallback ( model->dsim, 0, event, &model->dsim_model );
+}
+
+/**
+ * [Stop the clock in the given slot and drop it from the model]
+ * @param model [model context]
+ * @param slot  [index in model->clocks]
+ */
+static void remove_clock ( VSM_MODEL* model, int32_t slot )
+{
+	cancel_event ( model, model->clocks[slot].event );
+	model->clocks[slot] = model->clocks[--model->clock_count];
+}
+
+/**
+ * [Start a host clock, the first tick comes after phase]
+ * @param  model  [model context]
+ * @param  period [tick period]
+ * @param  phase  [delay of the first tick from now]
+ * @param  func   [model method the host calls on every tick]
+ * @param  id     [event id passed to func]
+ * @return        [clock slot, NULL if out of memory or refused by the host]
+ */
+static VSM_CLOCK* add_clock ( VSM_MODEL* model, RELTIME period, RELTIME phase, void* func, EVENTID id )
+{
+	ABSTIME curtime = 0;
+	systime ( model, &curtime );
+	VSM_CLOCK* clocks = realloc ( model->clocks, ( model->clock_count + 1 ) * sizeof *clocks );
+	if ( NULL == clocks )
+		return NULL;
+	model->clocks = clocks;
+	VSM_CLOCK* clock = &clocks[model->clock_count++];
+	memset ( clock, 0, sizeof *clock );
+	clock->id = id;
+	clock->event = model->dsim->vtable->setclockcallback ( model->dsim, 0, curtime + phase, period, &model->dsim_model, func, id );
+	if ( NULL == clock->event )
+	{
+		model->clock_count--;
+		return NULL;
+	}
+	return clock;
+}
+
+/**
+ * [Run timer_callback with the given id every period, restarts a clock with the same id]
+ * @param  model  [model context]
+ * @param  period [clock period]
+ * @param  phase  [delay of the first tick from now]
+ * @param  id     [event id passed to timer_callback]
+ * @return        [false if out of memory or refused by the host]
+ */
+bool start_clock ( VSM_MODEL* model, RELTIME period, RELTIME phase, EVENTID id )
+{
+	stop_clock ( model, id );
+	return NULL != add_clock ( model, period, phase, ( void* ) vsm_callback, id );
+}
+
+/**
+ * [Toggle a pin every half period without calling the script]
+ * @param  model  [model context]
+ * @param  period [clock period]
+ * @param  phase  [delay of the first edge from now]
+ * @param  pin    [pin to drive]
+ * @return        [false if out of memory or refused by the host]
+ */
+bool start_pin_clock ( VSM_MODEL* model, RELTIME period, RELTIME phase, VSM_PIN* pin )
+{
+	stop_pin_clock ( model, pin );
+	/* The pin number tells vsm_clock_callback which pin to toggle */
+	VSM_CLOCK* clock = add_clock ( model, period / 2, phase, ( void* ) vsm_clock_callback, pin - model->pins );
+	if ( NULL == clock )
+		return false;
+	clock->pin = pin;
+	return true;
+}
+
+/**
+ * [Stop the timer_callback clock started with the given id]
+ * @param  model [model context]
+ * @param  id    [event id]
+ * @return       [false if no such clock runs]
+ */
+bool stop_clock ( VSM_MODEL* model, EVENTID id )
+{
+	for ( int32_t i=0; i < model->clock_count; i++ )
+	{
+		if ( NULL == model->clocks[i].pin && id == model->clocks[i].id )
+		{
+			remove_clock ( model, i );
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * [Stop the clock driving a pin, the pin keeps its last level]
+ * @param  model [model context]
+ * @param  pin   [pin]
+ * @return       [false if no clock drives the pin]
+ */
+bool stop_pin_clock ( VSM_MODEL* model, VSM_PIN* pin )
+{
+	for ( int32_t i=0; i < model->clock_count; i++ )
+	{
+		if ( pin == model->clocks[i].pin )
+		{
+			remove_clock ( model, i );
+			return true;
+		}
+	}
+	return false;
 }
 
 /**
  * [out_log  description]
  * @param format [description]
  */
-void out_log ( const char* format, ... )
+void out_log ( VSM_MODEL* model, const char* format, ... )
 {
 	char* string;
 	va_list args;
 	va_start ( args, format );
 	if ( 0 > vasprintf ( &string, ( char* ) format, args ) ) string = NULL;
 	va_end ( args );
-	model_instance->vtable->log ( model_instance, string );
+	model->instance->vtable->log ( model->instance, string );
 	free ( string );
 }
 
@@ -475,14 +1016,14 @@ void out_log ( const char* format, ... )
  * [out_message  description]
  * @param format [description]
  */
-void out_message ( const char* format, ... )
+void out_message ( VSM_MODEL* model, const char* format, ... )
 {
 	char* string;
 	va_list args;
 	va_start ( args, format );
 	if ( 0 > vasprintf ( &string, ( char* ) format, args ) ) string = NULL;
 	va_end ( args );
-	model_instance->vtable->message ( model_instance, string );
+	model->instance->vtable->message ( model->instance, string );
 	free ( string );
 }
 
@@ -490,14 +1031,14 @@ void out_message ( const char* format, ... )
  * [out_warning  description]
  * @param format [description]
  */
-void out_warning ( const char* format, ... )
+void out_warning ( VSM_MODEL* model, const char* format, ... )
 {
 	char* string;
 	va_list args;
 	va_start ( args, format );
 	if ( 0 > vasprintf ( &string, ( char* ) format, args ) ) string = NULL;
 	va_end ( args );
-	model_instance->vtable->warning ( model_instance, string );
+	model->instance->vtable->warning ( model->instance, string );
 	free ( string );
 }
 
@@ -505,14 +1046,14 @@ void out_warning ( const char* format, ... )
  * [out_error  description]
  * @param format [description]
  */
-void out_error ( const char* format, ... )
+void out_error ( VSM_MODEL* model, const char* format, ... )
 {
 	char* string;
 	va_list args;
 	va_start ( args, format );
 	if ( 0 > vasprintf ( &string, ( char* ) format, args ) ) string = NULL;
 	va_end ( args );
-	model_instance->vtable->error ( model_instance, string );
+	model->instance->vtable->error ( model->instance, string );
 	free ( string );
 }
 
@@ -521,9 +1062,9 @@ void out_error ( const char* format, ... )
  * @param  pin_name [description]
  * @return          [description]
  */
-IDSIMPIN* get_pin ( char* pin_name )
+IDSIMPIN* get_pin ( VSM_MODEL* model, char* pin_name )
 {
-	return model_instance->vtable->getdsimpin ( model_instance, 0, pin_name, TRUE );
+	return model->instance->vtable->getdsimpin ( model->instance, 0, pin_name, TRUE );
 }
 
 /**
@@ -0,0 +1,211 @@
+/**
+ *
+ * @file   image.c
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Shared read-only ROM images.
+ *
+ * Every instance asking for the same file gets the same block. Raw binary
+ * files are mapped read-only straight from the disk, so identical ROM parts
+ * cost one page cache copy and no reads at startup. Formats only the host
+ * understands are loaded once through load_image and kept read-only.
+ *
+ * Images are keyed by full path and modification time, a rebuilt firmware
+ * is picked up by the next instance. The cache holds no reference, an image
+ * goes away with the last buffer or chip using it.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <vsm_api.h>
+#include <sys/stat.h>
+
+static VSM_IMAGE* image_list = NULL; ///< Images alive in the process
+
+/* Extensions the host parses rather than maps */
+static const char* host_formats[] =
+{
+	"hex", "ihx", "ihex", "s19", "s28", "s37", "srec", "mot", "obj", NULL,
+};
+
+/**
+ * [Tell if a file must be parsed by the host]
+ * @param  path [file name]
+ * @return      [true for HEX, S-record and similar formats]
+ */
+bool
+image_host_format ( const char* path )
+{
+	const char* ext = strrchr ( path, '.' );
+	if ( NULL == ext || strchr ( ext, '\\' ) || strchr ( ext, '/' ) )
+		return false;
+	for ( int32_t i=0; host_formats[i]; i++ )
+		if ( 0 == strcasecmp ( ext + 1, host_formats[i] ) )
+			return true;
+	return false;
+}
+
+/**
+ * [Map a whole file read-only]
+ * @param  path [file name]
+ * @return      [first byte of the view or NULL]
+ */
+static uint8_t*
+map_file ( const char* path )
+{
+	HANDLE file = CreateFile ( path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( INVALID_HANDLE_VALUE == file )
+		return NULL;
+	/* The view keeps the mapping and the file open by itself */
+	HANDLE mapping = CreateFileMapping ( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	CloseHandle ( file );
+	if ( NULL == mapping )
+		return NULL;
+	uint8_t* view = MapViewOfFile ( mapping, FILE_MAP_READ, 0, 0, 0 );
+	CloseHandle ( mapping );
+	return view;
+}
+
+/**
+ * [Block release hook, unlinks the image and drops its data]
+ * @param block [block of an image]
+ */
+static void
+image_free ( VSM_BLOCK* block )
+{
+	VSM_IMAGE* image = block->owner;
+	for ( VSM_IMAGE** link = &image_list; *link; link = &( *link )->next )
+	{
+		if ( *link == image )
+		{
+			*link = image->next;
+			break;
+		}
+	}
+	if ( image->mapped )
+		UnmapViewOfFile ( block->data );
+	else
+		free ( block->data );
+	free ( image->path );
+	free ( image );
+}
+
+/**
+ * [Find a live image]
+ * @param  path [full file path]
+ * @param  st   [current file status]
+ * @param  size [size of a host-parsed image, 0 for a mapped one]
+ * @param  fill [fill byte of a host-parsed image]
+ * @return      [image or NULL]
+ */
+static VSM_IMAGE*
+find_image ( const char* path, const struct stat* st, size_t size, uint8_t fill )
+{
+	for ( VSM_IMAGE* image = image_list; image; image = image->next )
+	{
+		if ( 0 != strcmp ( image->path, path ) || image->size != size )
+			continue;
+		if ( image->mtime != ( uint64_t ) st->st_mtime || image->file_size != ( uint64_t ) st->st_size )
+			continue;
+		if ( size && image->fill != fill )
+			continue;
+		return image;
+	}
+	return NULL;
+}
+
+/**
+ * [Get the shared read-only image of a file]
+ *
+ * Raw files are mapped whole and size is ignored, the block is as large as
+ * the file. Host formats are parsed into size bytes starting from fill, the
+ * file size is used when size is 0. A file the process cannot see by its
+ * name is still handed to the host, privately, when size is given.
+ *
+ * @param  model [model asking, used to reach the host loader]
+ * @param  path  [file name]
+ * @param  size  [bytes of a host-parsed image, 0 for the file size]
+ * @param  fill  [initial bytes of a host-parsed image]
+ * @return       [new reference to a read-only block or NULL]
+ */
+VSM_BLOCK*
+image_open ( VSM_MODEL* model, const char* path, size_t size, uint8_t fill )
+{
+	struct stat st;
+	char* full = _fullpath ( NULL, path, 0 );
+	if ( NULL == full || 0 != stat ( full, &st ) )
+	{
+		free ( full );
+		if ( 0 == size )
+			return NULL;
+		VSM_BLOCK* block = block_new ( size );
+		if ( NULL == block )
+			return NULL;
+		memset ( block->data, fill, size );
+		load_image ( model, ( char* ) path, block->data, size );
+		block->readonly = true;
+		return block;
+	}
+
+	/* Empty files cannot be mapped, they go through the host path */
+	bool host = image_host_format ( full ) || 0 == st.st_size;
+	if ( host && 0 == size )
+		size = st.st_size;
+	size_t key = host ? size : 0;
+
+	VSM_IMAGE* image = find_image ( full, &st, key, fill );
+	if ( image )
+	{
+		free ( full );
+		return block_retain ( image->block );
+	}
+
+	image = calloc ( 1, sizeof *image );
+	VSM_BLOCK* block = calloc ( 1, sizeof *block );
+	uint8_t* data = NULL;
+	if ( image && block )
+		data = host ? malloc ( size ? size : 1 ) : map_file ( full );
+	if ( NULL == data )
+	{
+		free ( block );
+		free ( image );
+		free ( full );
+		return NULL;
+	}
+	if ( host )
+	{
+		memset ( data, fill, size );
+		load_image ( model, full, data, size );
+	}
+
+	block->data = data;
+	block->size = host ? size : ( size_t ) st.st_size;
+	block->refs = 1;
+	block->readonly = true;
+	block->free = image_free;
+	block->owner = image;
+	image->path = full;
+	image->mtime = st.st_mtime;
+	image->file_size = st.st_size;
+	image->size = key;
+	image->fill = fill;
+	image->mapped = !host;
+	image->block = block;
+	image->next = image_list;
+	image_list = image;
+	return block;
+}
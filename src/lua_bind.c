@@ -22,6 +22,7 @@
  */
 
 #include <vsm_api.h>
+#include <sys/stat.h>
 
 static int lua_state_to_string ( lua_State* L );
 static int lua_set_pin_state ( lua_State* L );
@@ -64,6 +65,157 @@ static int lua_toggle_bit ( lua_State* L );
 static int lua_clear_bit ( lua_State* L );
 
 static int lua_get_systime ( lua_State* L );
+static int lua_cancel_callback ( lua_State* L );
+static int lua_on_event ( lua_State* L );
+static int lua_new_event_id ( lua_State* L );
+static int lua_start_clock ( lua_State* L );
+static int lua_stop_clock ( lua_State* L );
+
+static int lua_shared_table ( lua_State* L );
+static int lua_shared_table_index ( lua_State* L );
+static int lua_shared_table_len ( lua_State* L );
+static int lua_shared_table_newindex ( lua_State* L );
+
+#define SHARED_TABLE_META "openvsm.shared_table"
+
+static int lua_pin_set ( lua_State* L );
+static int lua_pin_set_bool ( lua_State* L );
+static int lua_pin_get ( lua_State* L );
+static int lua_pin_state ( lua_State* L );
+static int lua_pin_toggle ( lua_State* L );
+static int lua_pin_high ( lua_State* L );
+static int lua_pin_low ( lua_State* L );
+static int lua_pin_floating ( lua_State* L );
+static int lua_pin_edge ( lua_State* L );
+static int lua_pin_posedge ( lua_State* L );
+static int lua_pin_negedge ( lua_State* L );
+static int lua_pin_active ( lua_State* L );
+static int lua_pin_steady ( lua_State* L );
+static int lua_pin_name ( lua_State* L );
+
+static int lua_uart_tx ( lua_State* L );
+static int lua_spi_master ( lua_State* L );
+static int lua_i2c_master ( lua_State* L );
+static int lua_serial_send ( lua_State* L );
+static int lua_serial_i2c_write ( lua_State* L );
+static int lua_serial_i2c_read ( lua_State* L );
+static int lua_serial_busy ( lua_State* L );
+static int lua_uart_rx ( lua_State* L );
+static int lua_spi_rx ( lua_State* L );
+static int lua_i2c_rx ( lua_State* L );
+static int lua_serial_on_rx ( lua_State* L );
+static int lua_i2c_slave ( lua_State* L );
+static int lua_spi_slave ( lua_State* L );
+static int lua_serial_reg ( lua_State* L );
+static int lua_serial_set_reg ( lua_State* L );
+static int lua_serial_reset ( lua_State* L );
+
+static int lua_bus_master ( lua_State* L );
+static int lua_bus_master_write ( lua_State* L );
+static int lua_bus_master_read ( lua_State* L );
+static int lua_bus_master_busy ( lua_State* L );
+
+static int lua_sequencer ( lua_State* L );
+static int lua_sequencer_start ( lua_State* L );
+static int lua_sequencer_stop ( lua_State* L );
+static int lua_sequencer_put ( lua_State* L );
+static int lua_sequencer_get ( lua_State* L );
+static int lua_sequencer_running ( lua_State* L );
+
+static int lua_memory_chip ( lua_State* L );
+static int lua_memchip_peek ( lua_State* L );
+static int lua_memchip_poke ( lua_State* L );
+static int lua_memchip_load ( lua_State* L );
+static int lua_memchip_contents ( lua_State* L );
+static int lua_memchip_len ( lua_State* L );
+static int lua_memchip_buffer ( lua_State* L );
+
+static int lua_buffer ( lua_State* L );
+static int lua_load_image ( lua_State* L );
+static int lua_rom_image ( lua_State* L );
+
+static int lua_sparse_memory ( lua_State* L );
+static int lua_sparse_read ( lua_State* L );
+static int lua_sparse_write ( lua_State* L );
+static int lua_sparse_fill ( lua_State* L );
+static int lua_sparse_copy ( lua_State* L );
+static int lua_sparse_string ( lua_State* L );
+static int lua_sparse_load ( lua_State* L );
+static int lua_sparse_resident ( lua_State* L );
+static int lua_sparse_show ( lua_State* L );
+static int lua_sparse_len ( lua_State* L );
+
+static int lua_nv_memory ( lua_State* L );
+static int lua_nvmem_read ( lua_State* L );
+static int lua_nvmem_write ( lua_State* L );
+static int lua_nvmem_load ( lua_State* L );
+static int lua_nvmem_erase ( lua_State* L );
+static int lua_nvmem_busy ( lua_State* L );
+static int lua_nvmem_wear ( lua_State* L );
+static int lua_nvmem_flush ( lua_State* L );
+static int lua_nvmem_string ( lua_State* L );
+static int lua_nvmem_buffer ( lua_State* L );
+static int lua_nvmem_len ( lua_State* L );
+
+static int lua_memory_map ( lua_State* L );
+static int lua_memmap_map ( lua_State* L );
+static int lua_memmap_io ( lua_State* L );
+static int lua_memmap_unmap ( lua_State* L );
+static int lua_memmap_read ( lua_State* L );
+static int lua_memmap_write ( lua_State* L );
+static int lua_memmap_string ( lua_State* L );
+static int lua_memmap_load ( lua_State* L );
+static int lua_buffer_index ( lua_State* L );
+static int lua_buffer_newindex ( lua_State* L );
+static int lua_buffer_len ( lua_State* L );
+static int lua_buffer_gc ( lua_State* L );
+static int lua_buffer_read ( lua_State* L );
+static int lua_buffer_write ( lua_State* L );
+static int lua_buffer_slice ( lua_State* L );
+static int lua_buffer_string ( lua_State* L );
+static int lua_buffer_fill ( lua_State* L );
+static int lua_buffer_copy ( lua_State* L );
+static int lua_buffer_load ( lua_State* L );
+static int lua_buffer_readonly ( lua_State* L );
+static VSM_BUFFER* lua_push_buffer ( lua_State* L, VSM_BLOCK* block, uint8_t* data, size_t size );
+
+static int lua_on_posedge ( lua_State* L );
+static int lua_on_negedge ( lua_State* L );
+static int lua_on_change ( lua_State* L );
+
+static int lua_pin_group ( lua_State* L );
+static int lua_read_pins ( lua_State* L );
+static int lua_write_pins ( lua_State* L );
+static int lua_pin_group_len ( lua_State* L );
+static int lua_pin_group_pin ( lua_State* L );
+
+static int lua_get_bus ( lua_State* L );
+static int lua_bus_read ( lua_State* L );
+static int lua_bus_write ( lua_State* L );
+static int lua_bus_set_bit ( lua_State* L );
+static int lua_bus_get_bit ( lua_State* L );
+static int lua_bus_tristate ( lua_State* L );
+static int lua_bus_len ( lua_State* L );
+
+static const char* const lua_hook_names[HOOK_MAX] =
+{
+	[HOOK_DEVICE_INIT] = "device_init",
+	[HOOK_DEVICE_SIMULATE] = "device_simulate",
+	[HOOK_TIMER_CALLBACK] = "timer_callback",
+	[HOOK_TIMER_BATCH] = "timer_batch",
+	[HOOK_ON_BATCH] = "on_batch",
+	[HOOK_ON_START] = "on_start",
+	[HOOK_ON_STOP] = "on_stop",
+	[HOOK_ON_SUSPEND] = "on_suspend",
+	[HOOK_ON_ANIMATE] = "on_animate",
+	[HOOK_ON_STEPTIME] = "on_steptime",
+	[HOOK_ON_STEPOVER] = "on_stepover",
+	[HOOK_ON_STEPINTO] = "on_stepinto",
+	[HOOK_ON_STEPOUT] = "on_stepout",
+	[HOOK_ON_STEPTO] = "on_stepto",
+	[HOOK_ON_META] = "on_meta",
+	[HOOK_ON_DUMP] = "on_dump",
+};
 
 static const lua_bind_var lua_var_api_list[]=
 {
@@ -85,9 +237,147 @@ static const lua_bind_var lua_var_api_list[]=
 	{.var_name="NSEC", .var_value=100000000L},
 	{.var_name="SEC", .var_value=1000000000000L},
 	{.var_name="NOW", .var_value=0L},
+	{.var_name="DSIMBOOT", .var_value=DSIMBOOT},
+	{.var_name="DSIMSETTLE", .var_value=DSIMSETTLE},
+	{.var_name="DSIMNORMAL", .var_value=DSIMNORMAL},
+	{.var_name="DSIMEND", .var_value=DSIMEND},
+	{.var_name="RX_FRAMING", .var_value=RX_FRAMING},
+	{.var_name="RX_PARITY", .var_value=RX_PARITY},
+	{.var_name="RX_NACK", .var_value=RX_NACK},
+	{.var_name="RX_START", .var_value=RX_START},
 	{.var_name=0},
 };
 
+static const luaL_Reg lua_pin_methods[] =
+{
+	{"set", lua_pin_set},
+	{"set_bool", lua_pin_set_bool},
+	{"get", lua_pin_get},
+	{"state", lua_pin_state},
+	{"toggle", lua_pin_toggle},
+	{"high", lua_pin_high},
+	{"low", lua_pin_low},
+	{"floating", lua_pin_floating},
+	{"edge", lua_pin_edge},
+	{"posedge", lua_pin_posedge},
+	{"negedge", lua_pin_negedge},
+	{"active", lua_pin_active},
+	{"steady", lua_pin_steady},
+	{"name", lua_pin_name},
+	{NULL, NULL},
+};
+
+static const luaL_Reg lua_pin_group_methods[] =
+{
+	{"read", lua_read_pins},
+	{"write", lua_write_pins},
+	{"pin", lua_pin_group_pin},
+	{NULL, NULL},
+};
+
+static const luaL_Reg lua_serial_methods[] =
+{
+	{"send", lua_serial_send},
+	{"write", lua_serial_i2c_write},
+	{"read", lua_serial_i2c_read},
+	{"busy", lua_serial_busy},
+	{"on_rx", lua_serial_on_rx},
+	{"reg", lua_serial_reg},
+	{"set_reg", lua_serial_set_reg},
+	{"reset", lua_serial_reset},
+	{NULL, NULL},
+};
+
+static const luaL_Reg lua_bus_master_methods[] =
+{
+	{"write", lua_bus_master_write},
+	{"read", lua_bus_master_read},
+	{"busy", lua_bus_master_busy},
+	{NULL, NULL},
+};
+
+static const luaL_Reg lua_sequencer_methods[] =
+{
+	{"start", lua_sequencer_start},
+	{"stop", lua_sequencer_stop},
+	{"put", lua_sequencer_put},
+	{"get", lua_sequencer_get},
+	{"running", lua_sequencer_running},
+	{NULL, NULL},
+};
+
+static const luaL_Reg lua_memchip_methods[] =
+{
+	{"peek", lua_memchip_peek},
+	{"poke", lua_memchip_poke},
+	{"load", lua_memchip_load},
+	{"contents", lua_memchip_contents},
+	{"buffer", lua_memchip_buffer},
+	{NULL, NULL},
+};
+
+static const luaL_Reg lua_buffer_methods[] =
+{
+	{"read", lua_buffer_read},
+	{"write", lua_buffer_write},
+	{"slice", lua_buffer_slice},
+	{"string", lua_buffer_string},
+	{"fill", lua_buffer_fill},
+	{"copy", lua_buffer_copy},
+	{"load", lua_buffer_load},
+	{"readonly", lua_buffer_readonly},
+	{NULL, NULL},
+};
+
+static const luaL_Reg lua_sparse_methods[] =
+{
+	{"read", lua_sparse_read},
+	{"write", lua_sparse_write},
+	{"fill", lua_sparse_fill},
+	{"copy", lua_sparse_copy},
+	{"string", lua_sparse_string},
+	{"load", lua_sparse_load},
+	{"resident", lua_sparse_resident},
+	{"show", lua_sparse_show},
+	{NULL, NULL},
+};
+
+static const luaL_Reg lua_nvmem_methods[] =
+{
+	{"read", lua_nvmem_read},
+	{"write", lua_nvmem_write},
+	{"load", lua_nvmem_load},
+	{"erase", lua_nvmem_erase},
+	{"busy", lua_nvmem_busy},
+	{"wear", lua_nvmem_wear},
+	{"flush", lua_nvmem_flush},
+	{"string", lua_nvmem_string},
+	{"buffer", lua_nvmem_buffer},
+	{NULL, NULL},
+};
+
+static const luaL_Reg lua_memmap_methods[] =
+{
+	{"map", lua_memmap_map},
+	{"io", lua_memmap_io},
+	{"unmap", lua_memmap_unmap},
+	{"read", lua_memmap_read},
+	{"write", lua_memmap_write},
+	{"string", lua_memmap_string},
+	{"load", lua_memmap_load},
+	{NULL, NULL},
+};
+
+static const luaL_Reg lua_bus_methods[] =
+{
+	{"read", lua_bus_read},
+	{"write", lua_bus_write},
+	{"set_bit", lua_bus_set_bit},
+	{"get_bit", lua_bus_get_bit},
+	{"tristate", lua_bus_tristate},
+	{NULL, NULL},
+};
+
 static const lua_bind_func lua_c_api_list[] =
 {
 	{.lua_func_name="state_to_string", .lua_c_api=&lua_state_to_string},
@@ -108,6 +398,11 @@ static const lua_bind_func lua_c_api_list[] =
 	{.lua_func_name="out_warning", .lua_c_api=&lua_out_warning},
 	{.lua_func_name="out_error", .lua_c_api=&lua_out_error},
 	{.lua_func_name="set_callback", .lua_c_api=&lua_set_callback},
+	{.lua_func_name="cancel_callback", .lua_c_api=&lua_cancel_callback},
+	{.lua_func_name="on_event", .lua_c_api=&lua_on_event},
+	{.lua_func_name="new_event_id", .lua_c_api=&lua_new_event_id},
+	{.lua_func_name="start_clock", .lua_c_api=&lua_start_clock},
+	{.lua_func_name="stop_clock", .lua_c_api=&lua_stop_clock},
 	{.lua_func_name="create_debug_popup", .lua_c_api=&lua_create_debug_popup},
 	{.lua_func_name="create_memory_popup", .lua_c_api=&lua_create_memory_popup},
 	{.lua_func_name="create_source_popup", .lua_c_api=&lua_create_source_popup},
@@ -129,16 +424,56 @@ static const lua_bind_func lua_c_api_list[] =
 	{.lua_func_name="clear_bit", .lua_c_api=&lua_clear_bit},
 	{.lua_func_name="toggle_bit", .lua_c_api=&lua_toggle_bit},
 	{.lua_func_name="systime", .lua_c_api=&lua_get_systime},
+	{.lua_func_name="shared_table", .lua_c_api=&lua_shared_table},
+	{.lua_func_name="pin_group", .lua_c_api=&lua_pin_group},
+	{.lua_func_name="read_pins", .lua_c_api=&lua_read_pins},
+	{.lua_func_name="write_pins", .lua_c_api=&lua_write_pins},
+	{.lua_func_name="get_bus", .lua_c_api=&lua_get_bus},
+	{.lua_func_name="uart_tx", .lua_c_api=&lua_uart_tx},
+	{.lua_func_name="spi_master", .lua_c_api=&lua_spi_master},
+	{.lua_func_name="i2c_master", .lua_c_api=&lua_i2c_master},
+	{.lua_func_name="uart_rx", .lua_c_api=&lua_uart_rx},
+	{.lua_func_name="spi_rx", .lua_c_api=&lua_spi_rx},
+	{.lua_func_name="i2c_rx", .lua_c_api=&lua_i2c_rx},
+	{.lua_func_name="i2c_slave", .lua_c_api=&lua_i2c_slave},
+	{.lua_func_name="spi_slave", .lua_c_api=&lua_spi_slave},
+	{.lua_func_name="bus_master", .lua_c_api=&lua_bus_master},
+	{.lua_func_name="bus_write", .lua_c_api=&lua_bus_master_write},
+	{.lua_func_name="bus_read", .lua_c_api=&lua_bus_master_read},
+	{.lua_func_name="sequencer", .lua_c_api=&lua_sequencer},
+	{.lua_func_name="memory_chip", .lua_c_api=&lua_memory_chip},
+	{.lua_func_name="buffer", .lua_c_api=&lua_buffer},
+	{.lua_func_name="load_image", .lua_c_api=&lua_load_image},
+	{.lua_func_name="rom_image", .lua_c_api=&lua_rom_image},
+	{.lua_func_name="sparse_memory", .lua_c_api=&lua_sparse_memory},
+	{.lua_func_name="nv_memory", .lua_c_api=&lua_nv_memory},
+	{.lua_func_name="memory_map", .lua_c_api=&lua_memory_map},
+	{.lua_func_name="on_posedge", .lua_c_api=&lua_on_posedge},
+	{.lua_func_name="on_negedge", .lua_c_api=&lua_on_negedge},
+	{.lua_func_name="on_change", .lua_c_api=&lua_on_change},
 	{ NULL, NULL},
 };
 
+/**
+ * [Model context the API function was bound to by register_functions]
+ * @param  L [Lua state]
+ * @return   [model context]
+ */
+static inline VSM_MODEL*
+lua_get_model ( lua_State* L )
+{
+	return lua_touserdata ( L, lua_upvalueindex ( 1 ) );
+}
+
 void
-register_functions ( lua_State* L )
+register_functions ( VSM_MODEL* model )
 {
-	/*  Declare functions */
+	lua_State* L = model->luactx;
+	/*  Declare functions, each one carries its model context as upvalue */
 	for ( int32_t i=0; lua_c_api_list[i].lua_func_name; i++ )
 	{
-		lua_pushcfunction ( L, lua_c_api_list[i].lua_c_api );
+		lua_pushlightuserdata ( L, model );
+		lua_pushcclosure ( L, lua_c_api_list[i].lua_c_api, 1 );
 		lua_setglobal ( L, lua_c_api_list[i].lua_func_name );
 	}
 	/* Declare variables */
@@ -147,26 +482,168 @@ register_functions ( lua_State* L )
 		lua_pushinteger ( L, lua_var_api_list[i].var_value );
 		lua_setglobal ( L, lua_var_api_list[i].var_name );
 	}
-	/* Declare pins */
-	for ( int i=0; device_pins[i].name; i++ )
+	/* Read-only view of constant tables shared between instances */
+	luaL_newmetatable ( L, SHARED_TABLE_META );
+	lua_pushcfunction ( L, lua_shared_table_index );
+	lua_setfield ( L, -2, "__index" );
+	lua_pushcfunction ( L, lua_shared_table_len );
+	lua_setfield ( L, -2, "__len" );
+	lua_pushcfunction ( L, lua_shared_table_newindex );
+	lua_setfield ( L, -2, "__newindex" );
+	lua_pop ( L, 1 );
+	/* Pin objects */
+	luaL_newmetatable ( L, PIN_META );
+	luaL_newlib ( L, lua_pin_methods );
+	lua_setfield ( L, -2, "__index" );
+	lua_pushcfunction ( L, lua_pin_name );
+	lua_setfield ( L, -2, "__tostring" );
+	lua_pop ( L, 1 );
+	/* Pin groups */
+	luaL_newmetatable ( L, PIN_GROUP_META );
+	luaL_newlib ( L, lua_pin_group_methods );
+	lua_setfield ( L, -2, "__index" );
+	lua_pushcfunction ( L, lua_pin_group_len );
+	lua_setfield ( L, -2, "__len" );
+	lua_pop ( L, 1 );
+	/* Host bus pins */
+	luaL_newmetatable ( L, BUS_META );
+	luaL_newlib ( L, lua_bus_methods );
+	lua_setfield ( L, -2, "__index" );
+	lua_pushcfunction ( L, lua_bus_len );
+	lua_setfield ( L, -2, "__len" );
+	lua_pop ( L, 1 );
+	/* Serial engines */
+	luaL_newmetatable ( L, SERIAL_META );
+	luaL_newlib ( L, lua_serial_methods );
+	lua_setfield ( L, -2, "__index" );
+	lua_pop ( L, 1 );
+	/* Bus transactors */
+	luaL_newmetatable ( L, BUS_MASTER_META );
+	luaL_newlib ( L, lua_bus_master_methods );
+	lua_setfield ( L, -2, "__index" );
+	lua_pop ( L, 1 );
+	/* Pin sequencers */
+	luaL_newmetatable ( L, SEQUENCER_META );
+	luaL_newlib ( L, lua_sequencer_methods );
+	lua_setfield ( L, -2, "__index" );
+	lua_pop ( L, 1 );
+	/* Memory chips */
+	luaL_newmetatable ( L, MEMCHIP_META );
+	luaL_newlib ( L, lua_memchip_methods );
+	lua_setfield ( L, -2, "__index" );
+	lua_pushcfunction ( L, lua_memchip_len );
+	lua_setfield ( L, -2, "__len" );
+	lua_pop ( L, 1 );
+	/* Buffers, integer keys index bytes and other keys find the methods */
+	luaL_newmetatable ( L, BUFFER_META );
+	luaL_newlib ( L, lua_buffer_methods );
+	lua_pushcclosure ( L, lua_buffer_index, 1 );
+	lua_setfield ( L, -2, "__index" );
+	lua_pushcfunction ( L, lua_buffer_newindex );
+	lua_setfield ( L, -2, "__newindex" );
+	lua_pushcfunction ( L, lua_buffer_len );
+	lua_setfield ( L, -2, "__len" );
+	lua_pushcfunction ( L, lua_buffer_gc );
+	lua_setfield ( L, -2, "__gc" );
+	lua_pop ( L, 1 );
+	luaL_newmetatable ( L, SPARSE_META );
+	luaL_newlib ( L, lua_sparse_methods );
+	lua_setfield ( L, -2, "__index" );
+	lua_pushcfunction ( L, lua_sparse_len );
+	lua_setfield ( L, -2, "__len" );
+	lua_pop ( L, 1 );
+	luaL_newmetatable ( L, NVMEM_META );
+	luaL_newlib ( L, lua_nvmem_methods );
+	lua_setfield ( L, -2, "__index" );
+	lua_pushcfunction ( L, lua_nvmem_len );
+	lua_setfield ( L, -2, "__len" );
+	lua_pop ( L, 1 );
+	luaL_newmetatable ( L, MEMMAP_META );
+	luaL_newlib ( L, lua_memmap_methods );
+	lua_setfield ( L, -2, "__index" );
+	lua_pop ( L, 1 );
+}
+
+/**
+ * [Create the Lua object of a pin]
+ * @param model  [model context]
+ * @param pin    [pin from the model pin table]
+ * @param global [also publish it as a global named after the pin]
+ */
+void
+lua_bind_pin ( VSM_MODEL* model, VSM_PIN* pin, bool global )
+{
+	lua_State* L = model->luactx;
+	VSM_PIN** ud = lua_newuserdata ( L, sizeof *ud );
+	*ud = pin;
+	luaL_setmetatable ( L, PIN_META );
+	if ( global )
 	{
-		lua_pushinteger ( L, i );
-		lua_setglobal ( L, device_pins[i].name );
+		lua_pushvalue ( L, -1 );
+		lua_setglobal ( L, pin->name );
 	}
+	pin->lua_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+}
+
+/**
+ * [Push the Lua object of a pin]
+ * @param L   [Lua state]
+ * @param pin [pin bound with lua_bind_pin]
+ */
+void
+lua_push_pin ( lua_State* L, VSM_PIN* pin )
+{
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, pin->lua_ref );
+}
+
+/**
+ * [Fetch a pin argument, a pin object or a legacy pin number]
+ * @param  L   [Lua state]
+ * @param  idx [argument index]
+ * @return     [pin, raises a Lua error if the argument is not a pin]
+ */
+static VSM_PIN*
+lua_check_pin ( lua_State* L, int idx )
+{
+	idx = lua_absindex ( L, idx );
+	VSM_PIN** ud = luaL_testudata ( L, idx, PIN_META );
+	if ( ud )
+		return *ud;
+
+	VSM_MODEL* model = lua_get_model ( L );
+	int isnum = 0;
+	lua_Integer pin_num = lua_tointegerx ( L, idx, &isnum );
+	if ( 0 == isnum || pin_num < 1 || pin_num > model->pin_count )
+		luaL_argerror ( L, idx, "pin expected" );
+	return &model->pins[pin_num];
+}
+
+/**
+ * [Fetch the pin object methods are called on]
+ * @param  L [Lua state]
+ * @return   [pin]
+ */
+static inline VSM_PIN*
+lua_check_self ( lua_State* L )
+{
+	return *( VSM_PIN** ) luaL_checkudata ( L, 1, PIN_META );
 }
 
 void
-lua_load_script ( const char* device_name )
-{	 
+lua_load_script ( VSM_MODEL* model, const char* device_name )
+{
+	lua_State* luactx = model->luactx;
 	char spath[512] = {0};
 	if ( 0 == GetEnvironmentVariable ( "LUAVSM", spath, sizeof spath ) )
 	{
-		out_error ( "LUAVSM environment variable is not set" );
+		out_error ( model, "LUAVSM environment variable is not set" );
 	}
 	char *script=NULL;
-	asprintf ( &script, "%s%s%s", spath, '\\' == spath[strlen(spath)-1]? "":"\\", device_name );
+	size_t spath_len = strlen ( spath );
+	asprintf ( &script, "%s%s%s", spath, 0 == spath_len || '\\' == spath[spath_len-1]? "":"\\", device_name );
 	
-	int32_t lua_err = luaL_loadfile ( luactx, script );
+	/* Compiled chunk comes from the bytecode cache when it is up to date */
+	int32_t lua_err = lua_cache_load ( model, script );
 	free(script);
 	if ( 0 != lua_err )
 	{
@@ -175,87 +652,234 @@ lua_load_script ( const char* device_name )
 		{
 			case LUA_ERRSYNTAX:
 				mess = lua_tostring(luactx, -1);
-				out_error ( "Syntax error in Lua script\n%s", mess );
+				out_error ( model, "Syntax error in Lua script\n%s", mess );
+				lua_pop ( luactx, 1 );
 				return;
 			case LUA_ERRMEM:
-				out_error ( "Not enough memory to load script" );
+				out_error ( model, "Not enough memory to load script" );
+				lua_pop ( luactx, 1 );
 				return;
 			case LUA_ERRFILE:
-				out_error ( "Error loading script file" );
+				out_error ( model, "Error loading script file" );
+				lua_pop ( luactx, 1 );
 				return;
 			default:
-				out_error ( "Unknown error, shouldn't happen" );
+				out_error ( model, "Unknown error, shouldn't happen" );
 				assert ( 0 );
 		}
 	}
 	/* Primer run, if not run it - nothing works, need for parse */
 	if ( 0 != lua_pcall ( luactx, 0, 0, 0 ) )
 	{
-		out_error ( "Failed to load the script" );
+		out_error ( model, "Failed to load the script\n%s", lua_tostring ( luactx, -1 ) );
+		lua_pop ( luactx, 1 );
 		return;
 	}
 	
-	out_log ( "Successfully loaded Lua script" );
+	out_log ( model, "Successfully loaded Lua script" );
 }
 
 void
-lua_run_function ( const char* func_name )
+lua_run_function ( VSM_MODEL* model, const char* func_name )
 {
+	lua_State* luactx = model->luactx;
 	/* Declare function to run */
 	lua_getglobal ( luactx, func_name );
 	/* First argument */
 	lua_pcall ( luactx, 0, 0, 0 );
 }
 
+/**
+ * [Look up every script entry point once and pin it in the registry]
+ * @param model [model context with the script already loaded]
+ */
+void
+lua_resolve_hooks ( VSM_MODEL* model )
+{
+	lua_State* L = model->luactx;
+	for ( int32_t i=0; i < HOOK_MAX; i++ )
+	{
+		luaL_unref ( L, LUA_REGISTRYINDEX, model->lua_hooks[i] );
+		model->lua_hooks[i] = LUA_NOREF;
+		lua_getglobal ( L, lua_hook_names[i] );
+		if ( lua_isfunction ( L, -1 ) )
+		{
+			model->lua_hooks[i] = luaL_ref ( L, LUA_REGISTRYINDEX );
+			continue;
+		}
+		lua_pop ( L, 1 );
+	}
+}
+
+/**
+ * [Drop all registry references taken by lua_resolve_hooks]
+ * @param model [model context]
+ */
+void
+lua_release_hooks ( VSM_MODEL* model )
+{
+	lua_State* L = model->luactx;
+	for ( int32_t i=0; i < HOOK_MAX; i++ )
+	{
+		luaL_unref ( L, LUA_REGISTRYINDEX, model->lua_hooks[i] );
+		model->lua_hooks[i] = LUA_NOREF;
+	}
+}
+
+/**
+ * [Push a resolved hook onto the stack]
+ * @param  model [model context]
+ * @param  hook  [hook slot]
+ * @return       [false if the script does not define it, nothing is pushed then]
+ */
+bool
+lua_push_hook ( VSM_MODEL* model, LUA_HOOK hook )
+{
+	if ( LUA_NOREF == model->lua_hooks[hook] )
+		return false;
+	lua_rawgeti ( model->luactx, LUA_REGISTRYINDEX, model->lua_hooks[hook] );
+	return true;
+}
+
+/**
+ * [Call a hook previously pushed with lua_push_hook followed by its arguments]
+ * @param model [model context]
+ * @param hook  [hook slot, used for error reporting]
+ * @param nargs [number of arguments pushed after the function]
+ */
+void
+lua_run_hook ( VSM_MODEL* model, LUA_HOOK hook, int32_t nargs )
+{
+	lua_State* L = model->luactx;
+	if ( 0 != lua_pcall ( L, nargs, 0, 0 ) )
+	{
+		out_error ( model, "%s: %s", lua_hook_names[hook], lua_tostring ( L, -1 ) );
+		lua_pop ( L, 1 );
+	}
+}
+
+/**
+ * [Call a Lua edge handler of a pin as fn(pin, time)]
+ * @param pin   [pin that moved]
+ * @param edge  [handler slot]
+ * @param atime [event time]
+ */
+void
+lua_run_pin_handler ( VSM_PIN* pin, PIN_EDGE edge, ABSTIME atime )
+{
+	if ( LUA_NOREF == pin->edge_handlers[edge] )
+		return;
+	lua_State* L = pin->model->luactx;
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, pin->edge_handlers[edge] );
+	lua_push_pin ( L, pin );
+	lua_pushinteger ( L, atime );
+	if ( 0 != lua_pcall ( L, 2, 0, 0 ) )
+	{
+		out_error ( pin->model, "%s handler: %s", pin->name, lua_tostring ( L, -1 ) );
+		lua_pop ( L, 1 );
+	}
+}
+
+/**
+ * [Find the on_event slot of an event id]
+ * @param  model [model context]
+ * @param  id    [event id]
+ * @return       [slot holding the id, or the free slot it would go to, NULL if the table is empty]
+ */
+static VSM_EVENT_HANDLER*
+lua_event_slot ( VSM_MODEL* model, EVENTID id )
+{
+	if ( 0 == model->event_handler_size )
+		return NULL;
+	uint32_t mask = model->event_handler_size - 1;
+	/* Fibonacci hashing spreads both small literal ids and the dynamic range */
+	uint32_t i = ( ( uint32_t ) id * 2654435769u ) & mask;
+	while ( 0 != model->event_handlers[i].lua_ref && id != model->event_handlers[i].id )
+		i = ( i + 1 ) & mask;
+	return &model->event_handlers[i];
+}
+
+/**
+ * [Call the on_event handler of an event as fn(time, id)]
+ * @param  model   [model context]
+ * @param  atime   [event time]
+ * @param  eventid [event id]
+ * @return         [false if no handler is registered, timer_callback gets the event then]
+ */
+bool
+lua_run_event_handler ( VSM_MODEL* model, ABSTIME atime, EVENTID eventid )
+{
+	VSM_EVENT_HANDLER* slot = lua_event_slot ( model, eventid );
+	if ( NULL == slot || slot->lua_ref <= 0 )
+		return false;
+	lua_State* L = model->luactx;
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, slot->lua_ref );
+	lua_pushinteger ( L, atime );
+	lua_pushinteger ( L, eventid );
+	if ( 0 != lua_pcall ( L, 2, 0, 0 ) )
+	{
+		out_error ( model, "event %ld handler: %s", ( long ) eventid, lua_tostring ( L, -1 ) );
+		lua_pop ( L, 1 );
+	}
+	return true;
+}
+
 static int
 lua_get_string_param ( lua_State* L )
 {
-	lua_pushstring ( L, get_string_param ( ( char* ) lua_tostring ( L, -1 ) ) );
+	VSM_MODEL* model = lua_get_model ( L );
+	lua_pushstring ( L, get_string_param ( model, ( char* ) lua_tostring ( L, -1 ) ) );
 	return 1;
 }
 
 static int
 lua_get_bool_param ( lua_State* L )
 {
-	lua_pushboolean ( L, get_bool_param ( ( char* ) lua_tostring ( L, -1 ) ) );
+	VSM_MODEL* model = lua_get_model ( L );
+	lua_pushboolean ( L, get_bool_param ( model, ( char* ) lua_tostring ( L, -1 ) ) );
 	return 1;
 }
 
 static int
 lua_get_num_param ( lua_State* L )
 {
-	lua_pushnumber ( L, get_num_param ( ( char* ) lua_tostring ( L, -1 ) ) );
+	VSM_MODEL* model = lua_get_model ( L );
+	lua_pushnumber ( L, get_num_param ( model, ( char* ) lua_tostring ( L, -1 ) ) );
 	return 1;
 }
 
 static int
 lua_get_hex_param ( lua_State* L )
 {
-	lua_pushinteger ( L, get_hex_param ( ( char* ) lua_tostring ( L, -1 ) ) );
+	VSM_MODEL* model = lua_get_model ( L );
+	lua_pushinteger ( L, get_hex_param ( model, ( char* ) lua_tostring ( L, -1 ) ) );
 	return 1;
 }
 
 static int
 lua_get_init_param ( lua_State* L )
 {
-	lua_pushinteger ( L, get_init_param ( ( char* ) lua_tostring ( L, -1 ) ) );
+	VSM_MODEL* model = lua_get_model ( L );
+	lua_pushinteger ( L, get_init_param ( model, ( char* ) lua_tostring ( L, -1 ) ) );
 	return 1;
 }
 
 static int
 lua_delete_popup ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	int id = lua_tonumber ( L, -1 );
-	delete_popup ( id );
+	delete_popup ( model, id );
 	return 0;
 }
 
 static int
 lua_create_debug_popup ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	const char* text = lua_tostring ( L, -1 );
-	lua_pushlightuserdata ( L, create_debug_popup ( text, ++popup_id ) );
-	lua_pushinteger ( L, popup_id );
+	lua_pushlightuserdata ( L, create_debug_popup ( model, text, ++model->popup_id ) );
+	lua_pushinteger ( L, model->popup_id );
 	return 2;
 }
 
@@ -267,10 +891,11 @@ lua_create_debug_popup ( lua_State* L )
 static int
 lua_print_to_debug_popup ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 2 > argnum )
 	{
-		out_error ( "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
 	/**
@@ -280,6 +905,58 @@ lua_print_to_debug_popup ( lua_State* L )
 	return 0;
 }
 
+/**
+ * [Fetch a byte source argument: a string, a buffer or a memory chip,
+ * the last two are used in place]
+ * @param  L   [Lua state]
+ * @param  idx [argument index]
+ * @param  len [size in bytes on return]
+ * @return     [bytes]
+ */
+static const uint8_t*
+lua_check_bytes ( lua_State* L, int idx, size_t* len )
+{
+	VSM_BUFFER* buf = luaL_testudata ( L, idx, BUFFER_META );
+	if ( buf )
+	{
+		*len = buf->size;
+		return buf->data;
+	}
+	VSM_MEMCHIP** chip = luaL_testudata ( L, idx, MEMCHIP_META );
+	if ( chip )
+	{
+		*len = ( *chip )->size;
+		return ( *chip )->mem;
+	}
+	return ( const uint8_t* ) luaL_checklstring ( L, idx, len );
+}
+
+/**
+ * [Keep the data a memory popup shows alive while it shows it]
+ *
+ * The registry maps each popup to its source, a new source replaces the
+ * old one. A chip is anchored through a buffer over its current block.
+ *
+ * @param L     [Lua state]
+ * @param popup [index of the popup]
+ * @param src   [index of the string, buffer or chip shown]
+ */
+static void
+lua_anchor_popup_source ( lua_State* L, int popup, int src )
+{
+	popup = lua_absindex ( L, popup );
+	src = lua_absindex ( L, src );
+	luaL_getsubtable ( L, LUA_REGISTRYINDEX, POPUP_SOURCES );
+	lua_pushvalue ( L, popup );
+	VSM_MEMCHIP** chip = luaL_testudata ( L, src, MEMCHIP_META );
+	if ( chip )
+		lua_push_buffer ( L, ( *chip )->block, ( *chip )->mem, ( *chip )->size );
+	else
+		lua_pushvalue ( L, src );
+	lua_rawset ( L, -3 );
+	lua_pop ( L, 1 );
+}
+
 /**
 * Prints a text string to debug popup
 * @param L Lua state
@@ -288,67 +965,78 @@ lua_print_to_debug_popup ( lua_State* L )
 static int
 lua_dump_to_debug_popup ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 4 > argnum )
 	{
-		out_error ( "Function %s expects 4 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 4 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
 	
 	lua_Number offset = luaL_checknumber ( L,-1 );
 	lua_Number size = luaL_checknumber ( L,-2 );
-	const char* buf = luaL_checkstring ( L,-3 );
-	dump_to_debug_popup ( lua_touserdata ( L, -4 ), ( BYTE* ) buf, offset, size );
+	size_t len;
+	const uint8_t* buf = lua_check_bytes ( L, -3, &len );
+	luaL_argcheck ( L, offset >= 0 && size >= 0 && offset + size <= len, argnum - 1, "range outside the data" );
+	dump_to_debug_popup ( lua_touserdata ( L, -4 ), buf, offset, size );
 	return 0;
 }
 
 static int
 lua_create_source_popup ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	const char* text = lua_tostring ( L, -1 );
-	lua_pushlightuserdata ( L, create_source_popup ( text, ++popup_id ) );
-	lua_pushinteger ( L, popup_id );
+	lua_pushlightuserdata ( L, create_source_popup ( model, text, ++model->popup_id ) );
+	lua_pushinteger ( L, model->popup_id );
 	return 2;
 }
 static int
 lua_create_status_popup ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	const char* text = lua_tostring ( L, -1 );
-	lua_pushlightuserdata ( L, create_status_popup ( text, ++popup_id ) );
-	lua_pushinteger ( L, popup_id );
+	lua_pushlightuserdata ( L, create_status_popup ( model, text, ++model->popup_id ) );
+	lua_pushinteger ( L, model->popup_id );
 	return 2;
 }
 static int
 lua_create_var_popup ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	const char* text = lua_tostring ( L, -1 );
-	lua_pushlightuserdata ( L, create_var_popup ( text, ++popup_id ) );
-	lua_pushinteger ( L, popup_id );
+	lua_pushlightuserdata ( L, create_var_popup ( model, text, ++model->popup_id ) );
+	lua_pushinteger ( L, model->popup_id );
 	return 2;
 }
 
 static int
 lua_create_memory_popup ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	const char* text = lua_tostring ( L, -1 );
-	lua_pushlightuserdata ( L, create_memory_popup ( text, ++popup_id ) );
-	lua_pushinteger ( L, popup_id );
+	lua_pushlightuserdata ( L, create_memory_popup ( model, text, ++model->popup_id ) );
+	lua_pushinteger ( L, model->popup_id );
 	return 2;
 }
 
 static int
 lua_set_memory_popup ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 
 	lua_Number argnum = lua_gettop ( L );
 	if ( 3 > argnum )
 	{
-		out_error ( "Function %s expects 3 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 3 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
 	
 	lua_Number size = luaL_checknumber ( L,-1 );
-	const char* buf = luaL_checkstring ( L,-2 );
+	size_t len;
+	const uint8_t* buf = lua_check_bytes ( L, -2, &len );
+	luaL_argcheck ( L, size >= 0 && size <= len, argnum, "size larger than the data" );
+	lua_anchor_popup_source ( L, -3, -2 );
 	
 	set_memory_popup ( lua_touserdata ( L, -3 ), 0, ( void* ) buf, size );
 	
@@ -358,17 +1046,18 @@ lua_set_memory_popup ( lua_State* L )
 static int
 lua_add_source_file ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 
 	lua_Number argnum = lua_gettop ( L );
 	if ( 2 > argnum )
 	{
-		out_error ( "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
 	
 	if ( false == add_source_file ( lua_touserdata ( L, -3 ), ( char* ) lua_tostring ( L, -2 ), lua_toboolean ( L, -1 ) ) )
 	{
-		out_log ( "Fail" );
+		out_log ( model, "Fail" );
 	}
 	
 	return 0;
@@ -377,15 +1066,16 @@ lua_add_source_file ( lua_State* L )
 static int
 lua_repaint_memory_popup ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 1 > argnum )
 	{
-		out_error ( "Function %s expects 1 argument got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 1 argument got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
 	if ( 0 == lua_isuserdata ( L, -1 ) )
 	{
-		out_error ( "Bad argument" );
+		out_error ( model, "Bad argument" );
 		return 0;
 	}
 	
@@ -396,44 +1086,47 @@ lua_repaint_memory_popup ( lua_State* L )
 static int
 lua_set_pin_state ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 2 > argnum )
 	{
-		out_error ( "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
-	int32_t pin_num = lua_tonumber ( L, -2 );
+	VSM_PIN* pin = lua_check_pin ( L, -2 );
 	int32_t pin_state = lua_tonumber ( L, -1 );
-	set_pin_state ( device_pins[pin_num], pin_state );
+	set_pin_state ( model, *pin, pin_state );
 	return 0;
 }
 
 static int
 lua_set_pin_bool ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 2 > argnum )
 	{
-		out_error ( "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
-	int32_t pin_num = lua_tonumber ( L, -2 );
+	VSM_PIN* pin = lua_check_pin ( L, -2 );
 	bool pin_level = lua_toboolean ( L, -1 );
-	set_pin_bool ( device_pins[pin_num], pin_level );
+	set_pin_bool ( model, *pin, pin_level );
 	return 0;
 }
 
 static int
 lua_get_pin_bool ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 1 > argnum )
 	{
-		out_error ( "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
-	int32_t pin_num = lua_tonumber ( L, -1 );
-	int32_t state = get_pin_bool ( device_pins[pin_num]);
+	VSM_PIN* pin = lua_check_pin ( L, -1 );
+	int32_t state = get_pin_bool ( *pin );
 	if ( -1 == state )
 	{		
 		lua_pushnil(L);
@@ -446,10 +1139,11 @@ lua_get_pin_bool ( lua_State* L )
 static int
 lua_state_to_string ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 1 > argnum )
 	{
-		out_error ( "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
 	int32_t state = lua_tonumber ( L, -1 );
@@ -461,25 +1155,26 @@ lua_state_to_string ( lua_State* L )
 static int
 lua_get_pin_state ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 1 > argnum )
 	{
-		out_error ( "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
-	int32_t pin_num = lua_tonumber ( L, -1 );
+	VSM_PIN* pin = lua_check_pin ( L, -1 );
 	
-	if ( TRUE == is_pin_high ( device_pins[pin_num].pin ) )
+	if ( TRUE == is_pin_high ( pin->pin ) )
 	{
 		lua_pushnumber ( L, SHI );
 		return 1;
 	}
-	else if ( TRUE == is_pin_low ( device_pins[pin_num].pin ) )
+	else if ( TRUE == is_pin_low ( pin->pin ) )
 	{
 		lua_pushnumber ( L, SLO );
 		return 1;
 	}
-	else if ( TRUE == is_pin_floating ( device_pins[pin_num].pin ) )
+	else if ( TRUE == is_pin_floating ( pin->pin ) )
 	{
 		lua_pushnumber ( L, FLT );
 		return 1;
@@ -494,193 +1189,268 @@ lua_get_pin_state ( lua_State* L )
 static int
 lua_is_pin_low ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 1 > argnum )
 	{
-		out_error ( "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
-	int32_t pin_num = lua_tonumber ( L, -1 );
-	lua_pushboolean ( L, is_pin_low ( device_pins[pin_num].pin ) );
+	VSM_PIN* pin = lua_check_pin ( L, -1 );
+	lua_pushboolean ( L, is_pin_low ( pin->pin ) );
 	return 1;
 }
 
 static int
 lua_is_pin_high ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 1 > argnum )
 	{
-		out_error ( "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
-	int32_t pin_num = lua_tonumber ( L, -1 );
-	lua_pushboolean ( L, is_pin_high ( device_pins[pin_num].pin ) );
+	VSM_PIN* pin = lua_check_pin ( L, -1 );
+	lua_pushboolean ( L, is_pin_high ( pin->pin ) );
 	return 1;
 }
 
 static int
 lua_is_pin_edge ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 1 > argnum )
 	{
-		out_error ( "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
-	int32_t pin_num = lua_tonumber ( L, -1 );
-	lua_pushboolean ( L, is_pin_edge ( device_pins[pin_num].pin ) );
+	VSM_PIN* pin = lua_check_pin ( L, -1 );
+	lua_pushboolean ( L, is_pin_edge ( pin->pin ) );
 	return 1;
 }
 
 static int
 lua_is_pin_posedge ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 1 > argnum )
 	{
-		out_error ( "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
-	int32_t pin_num = lua_tonumber ( L, -1 );
-	lua_pushboolean ( L, is_pin_posedge ( device_pins[pin_num].pin ) );
+	VSM_PIN* pin = lua_check_pin ( L, -1 );
+	lua_pushboolean ( L, is_pin_posedge ( pin->pin ) );
 	return 1;
 }
 
 static int
 lua_is_pin_negedge ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 1 > argnum )
 	{
-		out_error ( "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
-	int32_t pin_num = lua_tonumber ( L, -1 );
-	lua_pushboolean ( L, is_pin_negedge ( device_pins[pin_num].pin ) );
+	VSM_PIN* pin = lua_check_pin ( L, -1 );
+	lua_pushboolean ( L, is_pin_negedge ( pin->pin ) );
 	return 1;
 }
 
 static int
 lua_is_pin_active ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 1 > argnum )
 	{
-		out_error ( "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
-	int32_t pin_num = lua_tonumber ( L, -1 );
-	lua_pushboolean ( L, is_pin_active ( device_pins[pin_num].pin ) );
+	VSM_PIN* pin = lua_check_pin ( L, -1 );
+	lua_pushboolean ( L, is_pin_active ( pin->pin ) );
 	return 1;
 }
 
 static int
 lua_toggle_pin_state ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 1 > argnum )
 	{
-		out_error ( "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
-	int32_t pin_num = lua_tonumber ( L, -1 );
-	toggle_pin_state ( device_pins[pin_num] );
+	VSM_PIN* pin = lua_check_pin ( L, -1 );
+	toggle_pin_state ( model, *pin );
 	return 0;
 }
 
 static int
 lua_is_pin_floating ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 1 > argnum )
 	{
-		out_error ( "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
-	int32_t pin_num = lua_tonumber ( L, -1 );
-	lua_pushboolean ( L, is_pin_floating ( device_pins[pin_num].pin ) );
+	VSM_PIN* pin = lua_check_pin ( L, -1 );
+	lua_pushboolean ( L, is_pin_floating ( pin->pin ) );
 	return 1;
 }
 
 static int
 lua_out_log ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 1 > argnum )
 	{
-		out_error ( "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
 	const char* text = lua_tostring ( L, -1 );
-	out_log ( text );
+	out_log ( model, text );
 	return 0;
 }
 
 static int
 lua_out_message ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 1 > argnum )
 	{
-		out_error ( "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
 	const char* text = lua_tostring ( L, -1 );
-	out_message ( text );
+	out_message ( model, text );
 	return 0;
 }
 
 static int
 lua_out_warning ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 1 > argnum )
 	{
-		out_error ( "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
 	const char* text = lua_tostring ( L, -1 );
-	out_warning ( text );
+	out_warning ( model, text );
 	return 0;
 }
 
 static int
 lua_out_error ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 1 > argnum )
 	{
-		out_error ( "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 1 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
 	const char* text = lua_tostring ( L, -1 );
-	out_error ( text );
+	out_error ( model, text );
 	return 0;
 }
 
 static int
 lua_set_callback ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 2 > argnum )
 	{
-		out_error ( "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
 	//TODO: Add check integer type
 	lua_Number picotime = lua_tonumber ( L, -2 );
 	lua_Number eventid = lua_tonumber ( L, -1 );
 	
-	set_callback ( picotime, eventid );
+	uint32_t handle = set_callback ( model, picotime, eventid );
+	if ( 0 == handle )
+		lua_pushnil ( L );
+	else
+		lua_pushinteger ( L, handle );
+	return 1;
+}
+
+/**
+ * Cancels an event scheduled by set_callback: cancel_callback(handle)
+ * @param L Lua state
+ * @return true if the event was still pending
+ */
+static int
+lua_cancel_callback ( lua_State* L )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	lua_Integer handle = luaL_checkinteger ( L, 1 );
+	lua_pushboolean ( L, handle > 0 && handle <= UINT32_MAX && cancel_callback ( model, handle ) );
+	return 1;
+}
+
+/**
+ * Starts a host clock: start_clock(period, phase, event_id) runs
+ * timer_callback(time, event_id) every period, start_clock(period, phase, pin)
+ * toggles the pin every half period without entering Lua, raises an error
+ * if the host refuses the clock
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_start_clock ( lua_State* L )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	lua_Integer period = luaL_checkinteger ( L, 1 );
+	lua_Integer phase = luaL_optinteger ( L, 2, 0 );
+	luaL_argcheck ( L, period > 1, 1, "period too short" );
+	luaL_argcheck ( L, phase >= 0, 2, "phase must not be negative" );
+
+	bool started;
+	if ( LUA_TNUMBER == lua_type ( L, 3 ) )
+		started = start_clock ( model, period, phase, lua_tointeger ( L, 3 ) );
+	else
+		started = start_pin_clock ( model, period, phase, lua_check_pin ( L, 3 ) );
+	if ( !started )
+		return luaL_error ( L, "cannot start the clock" );
 	return 0;
 }
 
+/**
+ * Stops a clock: stop_clock(event_id) or stop_clock(pin)
+ * @param L Lua state
+ * @return true if the clock was running
+ */
+static int
+lua_stop_clock ( lua_State* L )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	if ( LUA_TNUMBER == lua_type ( L, 1 ) )
+		lua_pushboolean ( L, stop_clock ( model, lua_tointeger ( L, 1 ) ) );
+	else
+		lua_pushboolean ( L, stop_pin_clock ( model, lua_check_pin ( L, 1 ) ) );
+	return 1;
+}
+
 static int
 lua_get_systime ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	ABSTIME curtime = 0;
-	systime ( &curtime );
+	systime ( model, &curtime );
 	lua_pushnumber ( L, curtime );
 	return 1;
 }
@@ -688,10 +1458,11 @@ lua_get_systime ( lua_State* L )
 static int
 lua_get_bit ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 2 > argnum )
 	{
-		out_error ( "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
 	//TODO: Add check integer type
@@ -704,10 +1475,11 @@ lua_get_bit ( lua_State* L )
 static int
 lua_clear_bit ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 2 > argnum )
 	{
-		out_error ( "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
 	//TODO: Add check integer type
@@ -721,10 +1493,11 @@ lua_clear_bit ( lua_State* L )
 static int
 lua_set_bit ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 2 > argnum )
 	{
-		out_error ( "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
 	//TODO: Add check integer type
@@ -738,10 +1511,11 @@ lua_set_bit ( lua_State* L )
 static int
 lua_toggle_bit ( lua_State* L )
 {
+	VSM_MODEL* model = lua_get_model ( L );
 	lua_Number argnum = lua_gettop ( L );
 	if ( 2 > argnum )
 	{
-		out_error ( "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
+		out_error ( model, "Function %s expects 2 arguments got %d\n", __PRETTY_FUNCTION__, argnum );
 		return 0;
 	}
 	//TODO: Add check integer type
@@ -751,3 +1525,3102 @@ lua_toggle_bit ( lua_State* L )
 	lua_pushnumber ( L, byte );
 	return 1;
 }
+
+/**
+ * Returns a constant array shared by every instance of the script.
+ * shared_table(name, builder) calls builder (or takes the table itself)
+ * only in the first instance, later ones get the same read-only data.
+ * @param L Lua state
+ * @return read-only table view
+ */
+static int
+lua_shared_table ( lua_State* L )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	const char* name = luaL_checkstring ( L, 1 );
+	luaL_checkany ( L, 2 );
+	LUA_SHARED_TABLE* table = model->chunk ? lua_cache_find_table ( model->chunk, name ) : NULL;
+	if ( NULL == table )
+	{
+		if ( lua_isfunction ( L, 2 ) )
+		{
+			lua_pushvalue ( L, 2 );
+			lua_call ( L, 0, 1 );
+			lua_replace ( L, 2 );
+		}
+		luaL_checktype ( L, 2, LUA_TTABLE );
+		/* Without a process image there is nothing to share with */
+		if ( NULL == model->chunk )
+		{
+			lua_settop ( L, 2 );
+			return 1;
+		}
+		size_t count = luaL_len ( L, 2 );
+		bool integer = true;
+		/* Every entry is checked before the table is published, nothing below may raise */
+		for ( size_t i=1; i <= count; i++ )
+		{
+			if ( LUA_TNUMBER != lua_rawgeti ( L, 2, i ) )
+				return luaL_error ( L, "shared table '%s' holds a non-number at %d", name, ( int ) i );
+			integer = integer && lua_isinteger ( L, -1 );
+			lua_pop ( L, 1 );
+		}
+		table = lua_cache_add_table ( model->chunk, name, count, integer );
+		if ( NULL == table )
+			return luaL_error ( L, "not enough memory for shared table '%s'", name );
+		for ( size_t i=1; i <= count; i++ )
+		{
+			lua_rawgeti ( L, 2, i );
+			if ( integer )
+				table->ivalues[i-1] = lua_tointeger ( L, -1 );
+			else
+				table->nvalues[i-1] = lua_tonumber ( L, -1 );
+			lua_pop ( L, 1 );
+		}
+	}
+	LUA_SHARED_TABLE** ud = lua_newuserdata ( L, sizeof *ud );
+	*ud = table;
+	luaL_setmetatable ( L, SHARED_TABLE_META );
+	return 1;
+}
+
+static int
+lua_shared_table_index ( lua_State* L )
+{
+	LUA_SHARED_TABLE* table = *( LUA_SHARED_TABLE** ) luaL_checkudata ( L, 1, SHARED_TABLE_META );
+	lua_Integer i = lua_tointeger ( L, 2 );
+	if ( i < 1 || ( size_t ) i > table->count )
+	{
+		lua_pushnil ( L );
+		return 1;
+	}
+	if ( table->integer )
+		lua_pushinteger ( L, table->ivalues[i-1] );
+	else
+		lua_pushnumber ( L, table->nvalues[i-1] );
+	return 1;
+}
+
+static int
+lua_shared_table_len ( lua_State* L )
+{
+	LUA_SHARED_TABLE* table = *( LUA_SHARED_TABLE** ) luaL_checkudata ( L, 1, SHARED_TABLE_META );
+	lua_pushinteger ( L, table->count );
+	return 1;
+}
+
+static int
+lua_shared_table_newindex ( lua_State* L )
+{
+	LUA_SHARED_TABLE* table = *( LUA_SHARED_TABLE** ) luaL_checkudata ( L, 1, SHARED_TABLE_META );
+	return luaL_error ( L, "shared table '%s' is read-only", table->name );
+}
+
+static int
+lua_pin_set ( lua_State* L )
+{
+	VSM_PIN* pin = lua_check_self ( L );
+	set_pin_state ( pin->model, *pin, luaL_checkinteger ( L, 2 ) );
+	return 0;
+}
+
+static int
+lua_pin_set_bool ( lua_State* L )
+{
+	VSM_PIN* pin = lua_check_self ( L );
+	set_pin_bool ( pin->model, *pin, lua_toboolean ( L, 2 ) );
+	return 0;
+}
+
+static int
+lua_pin_get ( lua_State* L )
+{
+	VSM_PIN* pin = lua_check_self ( L );
+	int32_t state = get_pin_bool ( *pin );
+	if ( -1 == state )
+		lua_pushnil ( L );
+	else
+		lua_pushboolean ( L, state );
+	return 1;
+}
+
+static int
+lua_pin_state ( lua_State* L )
+{
+	VSM_PIN* pin = lua_check_self ( L );
+	lua_pushinteger ( L, get_pin_state ( pin->pin ) );
+	return 1;
+}
+
+static int
+lua_pin_toggle ( lua_State* L )
+{
+	VSM_PIN* pin = lua_check_self ( L );
+	toggle_pin_state ( pin->model, *pin );
+	return 0;
+}
+
+static int
+lua_pin_high ( lua_State* L )
+{
+	lua_pushboolean ( L, is_pin_high ( lua_check_self ( L )->pin ) );
+	return 1;
+}
+
+static int
+lua_pin_low ( lua_State* L )
+{
+	lua_pushboolean ( L, is_pin_low ( lua_check_self ( L )->pin ) );
+	return 1;
+}
+
+static int
+lua_pin_floating ( lua_State* L )
+{
+	lua_pushboolean ( L, is_pin_floating ( lua_check_self ( L )->pin ) );
+	return 1;
+}
+
+static int
+lua_pin_edge ( lua_State* L )
+{
+	lua_pushboolean ( L, is_pin_edge ( lua_check_self ( L )->pin ) );
+	return 1;
+}
+
+static int
+lua_pin_posedge ( lua_State* L )
+{
+	lua_pushboolean ( L, is_pin_posedge ( lua_check_self ( L )->pin ) );
+	return 1;
+}
+
+static int
+lua_pin_negedge ( lua_State* L )
+{
+	lua_pushboolean ( L, is_pin_negedge ( lua_check_self ( L )->pin ) );
+	return 1;
+}
+
+static int
+lua_pin_active ( lua_State* L )
+{
+	lua_pushboolean ( L, is_pin_active ( lua_check_self ( L )->pin ) );
+	return 1;
+}
+
+static int
+lua_pin_steady ( lua_State* L )
+{
+	lua_pushboolean ( L, is_pin_steady ( lua_check_self ( L )->pin ) );
+	return 1;
+}
+
+static int
+lua_pin_name ( lua_State* L )
+{
+	lua_pushstring ( L, lua_check_self ( L )->name );
+	return 1;
+}
+
+/**
+ * [Push a new pin group object]
+ * @param  L     [Lua state]
+ * @param  model [model the pins belong to]
+ * @param  width [number of pins]
+ * @return       [group living in the Lua heap, pins are to be filled in]
+ */
+VSM_PIN_GROUP*
+lua_new_pin_group ( lua_State* L, VSM_MODEL* model, uint32_t width )
+{
+	if ( width > MAXGROUPBITS )
+		luaL_error ( L, "pin group is %d pins wide, at most %d allowed", ( int ) width, MAXGROUPBITS );
+	VSM_PIN_GROUP* group = lua_newuserdata ( L, sizeof *group + width * sizeof group->pins[0] );
+	group->model = model;
+	group->width = width;
+	group->bus = NULL;
+	luaL_setmetatable ( L, PIN_GROUP_META );
+	return group;
+}
+
+/**
+ * [Fetch a pin group argument, a plain table of pins is converted in place]
+ * @param  L   [Lua state]
+ * @param  idx [argument index]
+ * @return     [group, raises a Lua error if the argument is not a group]
+ */
+static VSM_PIN_GROUP*
+lua_check_pin_group ( lua_State* L, int idx )
+{
+	idx = lua_absindex ( L, idx );
+	VSM_PIN_GROUP* group = luaL_testudata ( L, idx, PIN_GROUP_META );
+	if ( group )
+		return group;
+
+	luaL_checktype ( L, idx, LUA_TTABLE );
+	uint32_t width = luaL_len ( L, idx );
+	group = lua_new_pin_group ( L, lua_get_model ( L ), width );
+	for ( uint32_t i=0; i < width; i++ )
+	{
+		lua_rawgeti ( L, idx, i + 1 );
+		group->pins[i] = lua_check_pin ( L, -1 );
+		lua_pop ( L, 1 );
+	}
+	lua_replace ( L, idx );
+	return group;
+}
+
+/**
+ * Builds a pin group, bit 0 first: pin_group(A0, A1, ...) or pin_group({A0, A1, ...})
+ * @param L Lua state
+ * @return pin group object
+ */
+static int
+lua_pin_group ( lua_State* L )
+{
+	if ( lua_istable ( L, 1 ) )
+	{
+		promote_pin_group ( lua_check_pin_group ( L, 1 ) );
+		lua_settop ( L, 1 );
+		return 1;
+	}
+	uint32_t width = lua_gettop ( L );
+	VSM_PIN_GROUP* group = lua_new_pin_group ( L, lua_get_model ( L ), width );
+	for ( uint32_t i=0; i < width; i++ )
+		group->pins[i] = lua_check_pin ( L, i + 1 );
+	promote_pin_group ( group );
+	return 1;
+}
+
+static int
+lua_read_pins ( lua_State* L )
+{
+	VSM_BUS* bus = luaL_testudata ( L, 1, BUS_META );
+	if ( bus )
+		return lua_bus_read ( L );
+	lua_pushinteger ( L, read_pins ( lua_check_pin_group ( L, 1 ) ) );
+	return 1;
+}
+
+static int
+lua_write_pins ( lua_State* L )
+{
+	VSM_BUS* bus = luaL_testudata ( L, 1, BUS_META );
+	if ( bus )
+		return lua_bus_write ( L );
+	VSM_PIN_GROUP* group = lua_check_pin_group ( L, 1 );
+	write_pins ( group, luaL_checkinteger ( L, 2 ) );
+	return 0;
+}
+
+static int
+lua_pin_group_len ( lua_State* L )
+{
+	VSM_PIN_GROUP* group = luaL_checkudata ( L, 1, PIN_GROUP_META );
+	lua_pushinteger ( L, group->width );
+	return 1;
+}
+
+/**
+ * Returns the pin object of a group bit: group:pin(bit)
+ * @param L Lua state
+ * @return pin object
+ */
+static int
+lua_pin_group_pin ( lua_State* L )
+{
+	VSM_PIN_GROUP* group = luaL_checkudata ( L, 1, PIN_GROUP_META );
+	lua_Integer bit = luaL_checkinteger ( L, 2 );
+	luaL_argcheck ( L, bit >= 0 && ( uint32_t ) bit < group->width, 2, "bit out of range" );
+	lua_push_pin ( L, group->pins[bit] );
+	return 1;
+}
+
+/**
+ * Gets a host bus pin: get_bus(stem, base, width [, on_time, off_time])
+ * Both levels are driven after on_time, like single pins, and the bus
+ * floats after off_time.
+ * @param L Lua state
+ * @return bus object or nil if the host has no such pins
+ */
+static int
+lua_get_bus ( lua_State* L )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	const char* stem = luaL_checkstring ( L, 1 );
+	uint32_t base = luaL_checkinteger ( L, 2 );
+	uint32_t width = luaL_checkinteger ( L, 3 );
+	if ( 0 == width || width > MAXBUSBITS )
+		return luaL_argerror ( L, 3, "bad bus width" );
+
+	IBUSPIN* pin = get_bus_pin ( model, ( char* ) stem, base, width );
+	if ( NULL == pin )
+	{
+		lua_pushnil ( L );
+		return 1;
+	}
+	if ( false == lua_isnoneornil ( L, 4 ) )
+	{
+		RELTIME on_time = luaL_checkinteger ( L, 4 );
+		RELTIME off_time = luaL_optinteger ( L, 5, on_time );
+		set_bus_timing ( pin, on_time, on_time, off_time );
+	}
+	VSM_BUS* bus = lua_newuserdata ( L, sizeof *bus );
+	bus->model = model;
+	bus->bus = pin;
+	bus->width = width;
+	luaL_setmetatable ( L, BUS_META );
+	return 1;
+}
+
+static int
+lua_bus_read ( lua_State* L )
+{
+	VSM_BUS* bus = luaL_checkudata ( L, 1, BUS_META );
+	lua_pushinteger ( L, get_bus_value ( bus->bus ) );
+	return 1;
+}
+
+static int
+lua_bus_write ( lua_State* L )
+{
+	VSM_BUS* bus = luaL_checkudata ( L, 1, BUS_META );
+	drive_bus_value ( bus->model, bus->bus, luaL_checkinteger ( L, 2 ) );
+	return 0;
+}
+
+static int
+lua_bus_set_bit ( lua_State* L )
+{
+	VSM_BUS* bus = luaL_checkudata ( L, 1, BUS_META );
+	lua_Integer bit = luaL_checkinteger ( L, 2 );
+	luaL_argcheck ( L, bit >= 0 && ( uint32_t ) bit < bus->width, 2, "bit out of range" );
+	drive_bus_bit ( bus->model, bus->bus, bit, luaL_checkinteger ( L, 3 ) );
+	return 0;
+}
+
+static int
+lua_bus_get_bit ( lua_State* L )
+{
+	VSM_BUS* bus = luaL_checkudata ( L, 1, BUS_META );
+	lua_Integer bit = luaL_checkinteger ( L, 2 );
+	luaL_argcheck ( L, bit >= 0 && ( uint32_t ) bit < bus->width, 2, "bit out of range" );
+	lua_pushinteger ( L, get_bus_bit ( bus->bus, bit ) );
+	return 1;
+}
+
+static int
+lua_bus_tristate ( lua_State* L )
+{
+	VSM_BUS* bus = luaL_checkudata ( L, 1, BUS_META );
+	drive_bus_tristate ( bus->model, bus->bus );
+	return 0;
+}
+
+static int
+lua_bus_len ( lua_State* L )
+{
+	VSM_BUS* bus = luaL_checkudata ( L, 1, BUS_META );
+	lua_pushinteger ( L, bus->width );
+	return 1;
+}
+
+/**
+ * [Set or clear (fn is nil) one edge handler of a pin: on_xxx(pin, fn)]
+ * @param  L    [Lua state]
+ * @param  edge [handler slot]
+ * @return      [nothing]
+ */
+static int
+lua_set_edge_handler ( lua_State* L, PIN_EDGE edge )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	VSM_PIN* pin = lua_check_pin ( L, 1 );
+	if ( !lua_isnoneornil ( L, 2 ) )
+		luaL_checktype ( L, 2, LUA_TFUNCTION );
+	if ( NULL == pin->pin )
+		return luaL_argerror ( L, 1, "pin is not connected" );
+
+	luaL_unref ( L, LUA_REGISTRYINDEX, pin->edge_handlers[edge] );
+	pin->edge_handlers[edge] = LUA_NOREF;
+	if ( !lua_isnoneornil ( L, 2 ) )
+	{
+		lua_pushvalue ( L, 2 );
+		pin->edge_handlers[edge] = luaL_ref ( L, LUA_REGISTRYINDEX );
+	}
+
+	watch_pin ( model, pin );
+	return 0;
+}
+
+/**
+ * Runs fn(pin, time) on rising edges of the pin instead of device_simulate
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_on_posedge ( lua_State* L )
+{
+	return lua_set_edge_handler ( L, EDGE_POS );
+}
+
+/**
+ * Runs fn(pin, time) on falling edges of the pin instead of device_simulate
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_on_negedge ( lua_State* L )
+{
+	return lua_set_edge_handler ( L, EDGE_NEG );
+}
+
+/**
+ * Runs fn(pin, time) on every change of the pin instead of device_simulate
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_on_change ( lua_State* L )
+{
+	return lua_set_edge_handler ( L, EDGE_ANY );
+}
+
+/**
+ * Routes an event id to its own function: on_event(id, fn), fn is called as
+ * fn(time, id) instead of timer_callback, nil removes the handler
+ * @param L Lua state
+ * @return the event id
+ */
+static int
+lua_on_event ( lua_State* L )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	lua_Integer id = luaL_checkinteger ( L, 1 );
+	if ( !lua_isnoneornil ( L, 2 ) )
+		luaL_checktype ( L, 2, LUA_TFUNCTION );
+
+	VSM_EVENT_HANDLER* slot = lua_event_slot ( model, id );
+	if ( lua_isnoneornil ( L, 2 ) )
+	{
+		/* Removed handlers keep their slot until the next rebuild */
+		if ( slot && 0 != slot->lua_ref )
+		{
+			luaL_unref ( L, LUA_REGISTRYINDEX, slot->lua_ref );
+			slot->lua_ref = LUA_NOREF;
+		}
+		lua_pushinteger ( L, id );
+		return 1;
+	}
+
+	if ( ( NULL == slot || 0 == slot->lua_ref ) && 2 * ( model->event_handler_count + 1 ) > model->event_handler_size )
+	{
+		/* Rebuild without the removed handlers, growing only for the live ones */
+		VSM_EVENT_HANDLER* old = model->event_handlers;
+		int32_t old_size = model->event_handler_size;
+		int32_t live = 0;
+		for ( int32_t i=0; i < old_size; i++ )
+			live += old[i].lua_ref > 0;
+		int32_t size = 16;
+		while ( 4 * ( live + 1 ) > size )
+			size *= 2;
+		VSM_EVENT_HANDLER* handlers = calloc ( size, sizeof *handlers );
+		if ( NULL == handlers )
+			return luaL_error ( L, "not enough memory" );
+		model->event_handlers = handlers;
+		model->event_handler_size = size;
+		model->event_handler_count = live;
+		for ( int32_t i=0; i < old_size; i++ )
+			if ( old[i].lua_ref > 0 )
+				*lua_event_slot ( model, old[i].id ) = old[i];
+		free ( old );
+		slot = lua_event_slot ( model, id );
+	}
+
+	if ( 0 == slot->lua_ref )
+	{
+		slot->id = id;
+		model->event_handler_count++;
+	}
+	luaL_unref ( L, LUA_REGISTRYINDEX, slot->lua_ref );
+	lua_pushvalue ( L, 2 );
+	slot->lua_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	lua_pushinteger ( L, id );
+	return 1;
+}
+
+/**
+ * Gives out an event id no other part of the script uses: new_event_id()
+ * @param L Lua state
+ * @return event id
+ */
+static int
+lua_new_event_id ( lua_State* L )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	lua_pushinteger ( L, model->next_event_id++ );
+	return 1;
+}
+
+/**
+ * [Completion of a serial transfer, runs the function given with it as
+ * fn(engine, received, ack)]
+ * @param serial [engine]
+ */
+static void
+lua_serial_done ( VSM_SERIAL* serial )
+{
+	if ( LUA_NOREF == serial->done_ref )
+		return;
+	lua_State* L = serial->model->luactx;
+	int32_t ref = serial->done_ref;
+	/* The function may start the next transfer with a new one */
+	serial->done_ref = LUA_NOREF;
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, ref );
+	luaL_unref ( L, LUA_REGISTRYINDEX, ref );
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, serial->lua_ref );
+	lua_pushlstring ( L, ( const char* ) serial->rx, serial->rx_len );
+	lua_pushboolean ( L, serial->ack );
+	if ( 0 != lua_pcall ( L, 3, 0, 0 ) )
+	{
+		out_error ( serial->model, "serial completion: %s", lua_tostring ( L, -1 ) );
+		lua_pop ( L, 1 );
+	}
+}
+
+/**
+ * [Fetch an optional pin from a configuration table]
+ * @param  L     [Lua state]
+ * @param  idx   [configuration table index]
+ * @param  field [field name]
+ * @param  need  [raise an error if it is missing]
+ * @return       [pin or NULL]
+ */
+static VSM_PIN*
+lua_config_pin ( lua_State* L, int idx, const char* field, bool need )
+{
+	VSM_PIN* pin = NULL;
+	if ( LUA_TNIL != lua_getfield ( L, idx, field ) )
+		pin = lua_check_pin ( L, -1 );
+	else if ( need )
+		luaL_error ( L, "serial configuration needs %s", field );
+	lua_pop ( L, 1 );
+	return pin;
+}
+
+/**
+ * [Fetch a number from a configuration table]
+ * @param  L     [Lua state]
+ * @param  idx   [configuration table index]
+ * @param  field [field name]
+ * @param  def   [value if the field is missing]
+ * @return       [value]
+ */
+static lua_Number
+lua_config_number ( lua_State* L, int idx, const char* field, lua_Number def )
+{
+	lua_getfield ( L, idx, field );
+	lua_Number value = luaL_optnumber ( L, -1, def );
+	lua_pop ( L, 1 );
+	return value;
+}
+
+/**
+ * [Fetch an integer from a configuration table, raising an error for
+ * numbers with a fractional part]
+ * @param  L     [Lua state]
+ * @param  idx   [configuration table index]
+ * @param  field [field name]
+ * @param  def   [value if the field is missing]
+ * @return       [value]
+ */
+static lua_Integer
+lua_config_integer ( lua_State* L, int idx, const char* field, lua_Integer def )
+{
+	lua_Integer value = def;
+	if ( LUA_TNIL != lua_getfield ( L, idx, field ) )
+	{
+		int isnum = 0;
+		value = lua_tointegerx ( L, -1, &isnum );
+		if ( !isnum )
+			luaL_error ( L, "%s must be an integer", field );
+	}
+	lua_pop ( L, 1 );
+	return value;
+}
+
+/**
+ * [Fetch the parity of a UART configuration table, raising an error for an
+ * unknown name]
+ * @param  L   [Lua state]
+ * @param  idx [configuration table index]
+ * @return     [parity, none if the field is missing]
+ */
+static SERIAL_PARITY
+lua_config_parity ( lua_State* L, int idx )
+{
+	lua_getfield ( L, idx, "parity" );
+	SERIAL_PARITY parity = luaL_checkoption ( L, lua_gettop ( L ), "none", serial_parity_names );
+	lua_pop ( L, 1 );
+	return parity;
+}
+
+/**
+ * [Create a serial engine and its Lua object]
+ * @param  L    [Lua state]
+ * @param  kind [protocol]
+ * @param  rate [bit rate or clock frequency in Hz]
+ * @return      [engine, the object is left on the stack]
+ */
+static VSM_SERIAL*
+lua_new_serial ( lua_State* L, SERIAL_KIND kind, lua_Number rate )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	luaL_argcheck ( L, rate > 0, 1, "rate must be positive" );
+	VSM_SERIAL* serial = serial_new ( model, kind );
+	if ( NULL == serial )
+		luaL_error ( L, "not enough memory" );
+	serial->bit_time = 1000000000000.0 / rate;
+	serial->on_done = lua_serial_done;
+	VSM_SERIAL** ud = lua_newuserdata ( L, sizeof *ud );
+	*ud = serial;
+	luaL_setmetatable ( L, SERIAL_META );
+	/* The model owns the engine, the object lives as long as the model */
+	lua_pushvalue ( L, -1 );
+	serial->lua_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	return serial;
+}
+
+/**
+ * Creates a UART transmitter:
+ * uart_tx{tx=TX, baud=9600, bits=8, parity="none", stop=1}
+ * @param L Lua state
+ * @return engine object
+ */
+static int
+lua_uart_tx ( lua_State* L )
+{
+	luaL_checktype ( L, 1, LUA_TTABLE );
+	VSM_PIN* tx = lua_config_pin ( L, 1, "tx", true );
+	lua_Integer bits = lua_config_integer ( L, 1, "bits", 8 );
+	lua_Integer stop = lua_config_integer ( L, 1, "stop", 1 );
+	luaL_argcheck ( L, bits >= 5 && bits <= 8, 1, "bits must be 5 to 8" );
+	luaL_argcheck ( L, stop >= 1 && stop <= 2, 1, "stop must be 1 or 2" );
+	SERIAL_PARITY parity = lua_config_parity ( L, 1 );
+
+	VSM_SERIAL* serial = lua_new_serial ( L, SERIAL_UART_TX, lua_config_number ( L, 1, "baud", 9600 ) );
+	serial->lines[UART_TX] = tx;
+	serial->bits = bits;
+	serial->stop_bits = stop;
+	serial->parity = parity;
+	return 1;
+}
+
+/**
+ * Creates an SPI master:
+ * spi_master{sck=SCK, mosi=MOSI, miso=MISO, cs=CS, freq=1000000, mode=0, msb_first=true}
+ * miso and cs are optional
+ * @param L Lua state
+ * @return engine object
+ */
+static int
+lua_spi_master ( lua_State* L )
+{
+	luaL_checktype ( L, 1, LUA_TTABLE );
+	VSM_PIN* sck = lua_config_pin ( L, 1, "sck", true );
+	VSM_PIN* mosi = lua_config_pin ( L, 1, "mosi", true );
+	VSM_PIN* miso = lua_config_pin ( L, 1, "miso", false );
+	VSM_PIN* cs = lua_config_pin ( L, 1, "cs", false );
+	lua_Integer mode = lua_config_integer ( L, 1, "mode", 0 );
+	luaL_argcheck ( L, mode >= 0 && mode <= 3, 1, "mode must be 0 to 3" );
+	lua_getfield ( L, 1, "msb_first" );
+	bool msb_first = lua_isnil ( L, -1 ) || lua_toboolean ( L, -1 );
+	lua_pop ( L, 1 );
+
+	VSM_SERIAL* serial = lua_new_serial ( L, SERIAL_SPI_MASTER, lua_config_number ( L, 1, "freq", 1000000 ) );
+	serial->lines[SPI_SCK] = sck;
+	serial->lines[SPI_MOSI] = mosi;
+	serial->lines[SPI_MISO] = miso;
+	serial->lines[SPI_CS] = cs;
+	serial->mode = mode;
+	serial->msb_first = msb_first;
+	return 1;
+}
+
+/**
+ * Creates an I2C master: i2c_master{scl=SCL, sda=SDA, freq=100000}
+ * Both lines are open-drain, the circuit needs pull-ups
+ * @param L Lua state
+ * @return engine object
+ */
+static int
+lua_i2c_master ( lua_State* L )
+{
+	luaL_checktype ( L, 1, LUA_TTABLE );
+	VSM_PIN* scl = lua_config_pin ( L, 1, "scl", true );
+	VSM_PIN* sda = lua_config_pin ( L, 1, "sda", true );
+
+	VSM_SERIAL* serial = lua_new_serial ( L, SERIAL_I2C_MASTER, lua_config_number ( L, 1, "freq", 100000 ) );
+	serial->lines[I2C_SCL] = scl;
+	serial->lines[I2C_SDA] = sda;
+	return 1;
+}
+
+/**
+ * [Remember the completion function passed at idx]
+ *
+ * Only one completion may be pending, a second one would silently replace
+ * the first.
+ *
+ * @param L      [Lua state]
+ * @param serial [engine]
+ * @param idx    [argument index, none or nil for no function]
+ */
+static void
+lua_serial_set_done ( lua_State* L, VSM_SERIAL* serial, int idx )
+{
+	if ( lua_isnoneornil ( L, idx ) )
+		return;
+	luaL_checktype ( L, idx, LUA_TFUNCTION );
+	if ( LUA_NOREF != serial->done_ref )
+		luaL_error ( L, "a completion function is already pending" );
+	lua_pushvalue ( L, idx );
+	serial->done_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+}
+
+/**
+ * Queues bytes on a UART or SPI engine: engine:send(data [, fn]),
+ * fn(engine, received, ack) runs once the queue is sent
+ * @param L Lua state
+ * @return true if queued
+ */
+static int
+lua_serial_send ( lua_State* L )
+{
+	VSM_SERIAL* serial = *( VSM_SERIAL** ) luaL_checkudata ( L, 1, SERIAL_META );
+	size_t len = 0;
+	const char* data = luaL_checklstring ( L, 2, &len );
+	luaL_argcheck ( L, SERIAL_I2C_MASTER != serial->kind, 1, "use write or read on I2C" );
+	lua_serial_set_done ( L, serial, 3 );
+	lua_pushboolean ( L, serial_send ( serial, ( const uint8_t* ) data, len ) );
+	return 1;
+}
+
+/**
+ * Runs an I2C write: engine:write(address, data [, fn]),
+ * fn(engine, "", ack) runs after the stop condition
+ * @param L Lua state
+ * @return false if a transaction is under way
+ */
+static int
+lua_serial_i2c_write ( lua_State* L )
+{
+	VSM_SERIAL* serial = *( VSM_SERIAL** ) luaL_checkudata ( L, 1, SERIAL_META );
+	lua_Integer address = luaL_checkinteger ( L, 2 );
+	size_t len = 0;
+	const char* data = luaL_optlstring ( L, 3, "", &len );
+	luaL_argcheck ( L, address >= 0 && address < 128, 2, "7-bit address expected" );
+	if ( serial->busy )
+	{
+		lua_pushboolean ( L, false );
+		return 1;
+	}
+	lua_serial_set_done ( L, serial, 4 );
+	lua_pushboolean ( L, i2c_write ( serial, address, ( const uint8_t* ) data, len ) );
+	return 1;
+}
+
+/**
+ * Runs an I2C read: engine:read(address, count [, fn]),
+ * fn(engine, received, ack) runs after the stop condition
+ * @param L Lua state
+ * @return false if a transaction is under way
+ */
+static int
+lua_serial_i2c_read ( lua_State* L )
+{
+	VSM_SERIAL* serial = *( VSM_SERIAL** ) luaL_checkudata ( L, 1, SERIAL_META );
+	lua_Integer address = luaL_checkinteger ( L, 2 );
+	lua_Integer count = luaL_checkinteger ( L, 3 );
+	luaL_argcheck ( L, address >= 0 && address < 128, 2, "7-bit address expected" );
+	luaL_argcheck ( L, count > 0, 3, "count must be positive" );
+	if ( serial->busy )
+	{
+		lua_pushboolean ( L, false );
+		return 1;
+	}
+	lua_serial_set_done ( L, serial, 4 );
+	lua_pushboolean ( L, i2c_read ( serial, address, count ) );
+	return 1;
+}
+
+/**
+ * Tells whether a transfer is under way: engine:busy()
+ * @param L Lua state
+ * @return boolean
+ */
+static int
+lua_serial_busy ( lua_State* L )
+{
+	VSM_SERIAL* serial = *( VSM_SERIAL** ) luaL_checkudata ( L, 1, SERIAL_META );
+	lua_pushboolean ( L, serial->busy );
+	return 1;
+}
+
+/**
+ * [Received bytes of a decoder, runs the on_rx function as
+ * fn(engine, bytes, flags [, miso]), flags holding the RX_* bits of each byte]
+ * @param serial [decoder]
+ * @param bytes  [data]
+ * @param flags  [RX_* flags of each byte]
+ * @param aux    [MISO data of an SPI decoder]
+ * @param len    [number of bytes]
+ */
+static void
+lua_serial_rx ( VSM_SERIAL* serial, const uint8_t* bytes, const uint8_t* flags, const uint8_t* aux, size_t len )
+{
+	if ( LUA_NOREF == serial->rx_ref )
+		return;
+	lua_State* L = serial->model->luactx;
+	int32_t nargs = 3;
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, serial->rx_ref );
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, serial->lua_ref );
+	lua_pushlstring ( L, ( const char* ) bytes, len );
+	lua_pushlstring ( L, ( const char* ) flags, len );
+	if ( SERIAL_SPI_RX == serial->kind && serial->lines[SPI_MISO] )
+	{
+		lua_pushlstring ( L, ( const char* ) aux, len );
+		nargs++;
+	}
+	if ( 0 != lua_pcall ( L, nargs, 0, 0 ) )
+	{
+		out_error ( serial->model, "on_rx: %s", lua_tostring ( L, -1 ) );
+		lua_pop ( L, 1 );
+	}
+}
+
+/**
+ * [Raise an error if a decoder pin already feeds another decoder]
+ *
+ * Checked before the engine is created, the model would keep a failed one.
+ *
+ * @param L [Lua state]
+ * @param a [clock or data-in pin]
+ * @param b [second watched pin or NULL]
+ */
+static void
+lua_check_unheard ( lua_State* L, const VSM_PIN* a, const VSM_PIN* b )
+{
+	if ( ( a && a->listener ) || ( b && b->listener ) )
+		luaL_error ( L, "pin already feeds another decoder" );
+}
+
+/**
+ * [Finish a decoder built from the configuration table at index 1: batch
+ * size, receive function and pin listeners]
+ * @param  L      [Lua state]
+ * @param  serial [decoder with its lines set, its object on top of the stack]
+ * @return        [1, the object]
+ */
+static int
+lua_serial_listen ( lua_State* L, VSM_SERIAL* serial )
+{
+	lua_Integer batch = lua_config_integer ( L, 1, "count", serial->rx_batch );
+	luaL_argcheck ( L, batch >= 1 && batch <= SERIAL_RING, 1, "count out of range" );
+	serial->rx_batch = batch;
+	serial->on_rx = lua_serial_rx;
+	if ( LUA_TFUNCTION == lua_getfield ( L, 1, "on_rx" ) )
+		serial->rx_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	else
+		lua_pop ( L, 1 );
+	if ( false == serial_listen ( serial ) )
+		return luaL_error ( L, "pin already feeds another decoder" );
+	return 1;
+}
+
+/**
+ * Creates a UART receiver:
+ * uart_rx{rx=RX, baud=9600, bits=8, parity="none", count=1, on_rx=fn}
+ * fn(engine, bytes, flags) runs once count bytes arrived
+ * @param L Lua state
+ * @return engine object
+ */
+static int
+lua_uart_rx ( lua_State* L )
+{
+	luaL_checktype ( L, 1, LUA_TTABLE );
+	VSM_PIN* rx = lua_config_pin ( L, 1, "rx", true );
+	lua_Integer bits = lua_config_integer ( L, 1, "bits", 8 );
+	luaL_argcheck ( L, bits >= 5 && bits <= 8, 1, "bits must be 5 to 8" );
+	SERIAL_PARITY parity = lua_config_parity ( L, 1 );
+	lua_check_unheard ( L, rx, NULL );
+
+	VSM_SERIAL* serial = lua_new_serial ( L, SERIAL_UART_RX, lua_config_number ( L, 1, "baud", 9600 ) );
+	serial->lines[UART_RX] = rx;
+	serial->bits = bits;
+	serial->parity = parity;
+	return lua_serial_listen ( L, serial );
+}
+
+/**
+ * Creates an SPI receiver:
+ * spi_rx{sck=SCK, mosi=MOSI, miso=MISO, cs=CS, mode=0, msb_first=true, count=N, on_rx=fn}
+ * fn(engine, mosi_bytes, flags [, miso_bytes]) runs when CS goes high or
+ * count bytes arrived, miso and cs are optional
+ * @param L Lua state
+ * @return engine object
+ */
+static int
+lua_spi_rx ( lua_State* L )
+{
+	luaL_checktype ( L, 1, LUA_TTABLE );
+	VSM_PIN* sck = lua_config_pin ( L, 1, "sck", true );
+	VSM_PIN* mosi = lua_config_pin ( L, 1, "mosi", true );
+	VSM_PIN* miso = lua_config_pin ( L, 1, "miso", false );
+	VSM_PIN* cs = lua_config_pin ( L, 1, "cs", false );
+	lua_Integer mode = lua_config_integer ( L, 1, "mode", 0 );
+	luaL_argcheck ( L, mode >= 0 && mode <= 3, 1, "mode must be 0 to 3" );
+	lua_getfield ( L, 1, "msb_first" );
+	bool msb_first = lua_isnil ( L, -1 ) || lua_toboolean ( L, -1 );
+	lua_pop ( L, 1 );
+	lua_check_unheard ( L, sck, cs );
+
+	/* The clock rate is whatever the master drives */
+	VSM_SERIAL* serial = lua_new_serial ( L, SERIAL_SPI_RX, 1 );
+	serial->lines[SPI_SCK] = sck;
+	serial->lines[SPI_MOSI] = mosi;
+	serial->lines[SPI_MISO] = miso;
+	serial->lines[SPI_CS] = cs;
+	serial->mode = mode;
+	serial->msb_first = msb_first;
+	return lua_serial_listen ( L, serial );
+}
+
+/**
+ * Creates an I2C bus receiver: i2c_rx{scl=SCL, sda=SDA, count=N, on_rx=fn}
+ * fn(engine, bytes, flags) runs at every stop condition or once count
+ * bytes arrived, the address byte of a transaction is flagged RX_START
+ * @param L Lua state
+ * @return engine object
+ */
+static int
+lua_i2c_rx ( lua_State* L )
+{
+	luaL_checktype ( L, 1, LUA_TTABLE );
+	VSM_PIN* scl = lua_config_pin ( L, 1, "scl", true );
+	VSM_PIN* sda = lua_config_pin ( L, 1, "sda", true );
+	lua_check_unheard ( L, scl, sda );
+
+	VSM_SERIAL* serial = lua_new_serial ( L, SERIAL_I2C_RX, 1 );
+	serial->lines[I2C_SCL] = scl;
+	serial->lines[I2C_SDA] = sda;
+	return lua_serial_listen ( L, serial );
+}
+
+/**
+ * Replaces the receive function of a decoder: engine:on_rx(fn), nil stops delivery
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_serial_on_rx ( lua_State* L )
+{
+	VSM_SERIAL* serial = *( VSM_SERIAL** ) luaL_checkudata ( L, 1, SERIAL_META );
+	if ( !lua_isnoneornil ( L, 2 ) )
+		luaL_checktype ( L, 2, LUA_TFUNCTION );
+	luaL_unref ( L, LUA_REGISTRYINDEX, serial->rx_ref );
+	serial->rx_ref = LUA_NOREF;
+	if ( !lua_isnoneornil ( L, 2 ) )
+	{
+		lua_pushvalue ( L, 2 );
+		serial->rx_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	}
+	return 0;
+}
+
+/**
+ * [Read hook of a slave register, runs fn(engine, reg, value)]
+ * @param  serial [slave engine]
+ * @param  reg    [register]
+ * @param  value  [current value]
+ * @return        [number returned by the hook, value if it returned none]
+ */
+static uint8_t
+lua_slave_read ( VSM_SERIAL* serial, uint32_t reg, uint8_t value )
+{
+	lua_State* L = serial->model->luactx;
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, serial->read_hooks_ref );
+	lua_rawgeti ( L, -1, reg );
+	lua_remove ( L, -2 );
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, serial->lua_ref );
+	lua_pushinteger ( L, reg );
+	lua_pushinteger ( L, value );
+	if ( 0 != lua_pcall ( L, 3, 1, 0 ) )
+	{
+		out_error ( serial->model, "register %u read: %s", reg, lua_tostring ( L, -1 ) );
+		lua_pop ( L, 1 );
+		return value;
+	}
+	if ( lua_isinteger ( L, -1 ) )
+		value = lua_tointeger ( L, -1 );
+	lua_pop ( L, 1 );
+	return value;
+}
+
+/**
+ * [Write hook of a slave register, runs fn(engine, reg, value)]
+ * @param serial [slave engine]
+ * @param reg    [register]
+ * @param value  [value after the write]
+ */
+static void
+lua_slave_write ( VSM_SERIAL* serial, uint32_t reg, uint8_t value )
+{
+	lua_State* L = serial->model->luactx;
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, serial->write_hooks_ref );
+	lua_rawgeti ( L, -1, reg );
+	lua_remove ( L, -2 );
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, serial->lua_ref );
+	lua_pushinteger ( L, reg );
+	lua_pushinteger ( L, value );
+	if ( 0 != lua_pcall ( L, 3, 0, 0 ) )
+	{
+		out_error ( serial->model, "register %u write: %s", reg, lua_tostring ( L, -1 ) );
+		lua_pop ( L, 1 );
+	}
+}
+
+/**
+ * [Copy a hook table of the configuration, flagging its registers]
+ * @param  L      [Lua state]
+ * @param  serial [slave engine]
+ * @param  field  ["on_read" or "on_write"]
+ * @param  flag   [REG_HOOK_READ or REG_HOOK_WRITE]
+ * @return        [registry reference of the copy, LUA_NOREF if there is none]
+ */
+static int32_t
+lua_slave_hooks ( lua_State* L, VSM_SERIAL* serial, const char* field, uint8_t flag )
+{
+	if ( LUA_TNIL == lua_getfield ( L, 1, field ) )
+	{
+		lua_pop ( L, 1 );
+		return LUA_NOREF;
+	}
+	luaL_argcheck ( L, lua_istable ( L, -1 ), 1, field );
+	lua_newtable ( L );
+	lua_pushnil ( L );
+	while ( lua_next ( L, -3 ) )
+	{
+		lua_Integer reg = luaL_checkinteger ( L, -2 );
+		luaL_argcheck ( L, reg >= 0 && reg < serial->regs.size, 1, "hooked register out of range" );
+		luaL_checktype ( L, -1, LUA_TFUNCTION );
+		serial->regs.hooks[reg] |= flag;
+		lua_rawseti ( L, -3, reg );
+	}
+	int32_t ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	lua_pop ( L, 1 );
+	return ref;
+}
+
+/**
+ * [Build the register file of a slave from the configuration table at
+ * index 1: size, addr_bytes, reset (string or table), readonly masks and
+ * on_read/on_write hooks keyed by register]
+ * @param  L          [Lua state]
+ * @param  serial     [slave engine, its object on top of the stack]
+ * @param  addr_bytes [register address bytes if the table has none]
+ * @return            [1, the object]
+ */
+static int
+lua_slave_config ( lua_State* L, VSM_SERIAL* serial, lua_Integer addr_bytes )
+{
+	lua_Integer size = lua_config_integer ( L, 1, "size", 256 );
+	luaL_argcheck ( L, size >= 1 && size <= 0x10000, 1, "size must be 1 to 65536" );
+	addr_bytes = lua_config_integer ( L, 1, "addr_bytes", addr_bytes );
+	luaL_argcheck ( L, addr_bytes >= 0 && addr_bytes <= 2, 1, "addr_bytes must be 0 to 2" );
+	if ( false == slave_regs ( serial, size, addr_bytes ) )
+		return luaL_error ( L, "not enough memory" );
+
+	SERIAL_REGMAP* regs = &serial->regs;
+	switch ( lua_getfield ( L, 1, "reset" ) )
+	{
+		case LUA_TSTRING:
+		{
+			size_t len;
+			const char* data = lua_tolstring ( L, -1, &len );
+			memcpy ( regs->reset, data, len < regs->size ? len : regs->size );
+			break;
+		}
+		case LUA_TTABLE:
+			for ( lua_pushnil ( L ); lua_next ( L, -2 ); lua_pop ( L, 1 ) )
+			{
+				lua_Integer reg = luaL_checkinteger ( L, -2 );
+				luaL_argcheck ( L, reg >= 0 && reg < size, 1, "reset register out of range" );
+				regs->reset[reg] = luaL_checkinteger ( L, -1 );
+			}
+			break;
+		default:
+			break;
+	}
+	lua_pop ( L, 1 );
+	if ( LUA_TTABLE == lua_getfield ( L, 1, "readonly" ) )
+		for ( lua_pushnil ( L ); lua_next ( L, -2 ); lua_pop ( L, 1 ) )
+		{
+			lua_Integer reg = luaL_checkinteger ( L, -2 );
+			luaL_argcheck ( L, reg >= 0 && reg < size, 1, "readonly register out of range" );
+			regs->ro_mask[reg] = luaL_checkinteger ( L, -1 );
+		}
+	lua_pop ( L, 1 );
+
+	serial->read_hooks_ref = lua_slave_hooks ( L, serial, "on_read", REG_HOOK_READ );
+	serial->write_hooks_ref = lua_slave_hooks ( L, serial, "on_write", REG_HOOK_WRITE );
+	serial->on_read = lua_slave_read;
+	serial->on_write = lua_slave_write;
+	slave_reset ( serial );
+	if ( false == serial_listen ( serial ) )
+		return luaL_error ( L, "pin already feeds another decoder" );
+	return 1;
+}
+
+/**
+ * Creates an I2C slave answering from a register file:
+ * i2c_slave{scl=SCL, sda=SDA, address=0x50, size=256, addr_bytes=1,
+ * stretch=0, reset=..., readonly={[reg]=mask}, on_read={[reg]=fn},
+ * on_write={[reg]=fn}}
+ * The master writes the register address first, then data bytes which
+ * go to consecutive registers, reads continue from the last address.
+ * on_read hooks return the value to send, stretch holds SCL low after
+ * every byte.
+ * @param L Lua state
+ * @return engine object
+ */
+static int
+lua_i2c_slave ( lua_State* L )
+{
+	luaL_checktype ( L, 1, LUA_TTABLE );
+	VSM_PIN* scl = lua_config_pin ( L, 1, "scl", true );
+	VSM_PIN* sda = lua_config_pin ( L, 1, "sda", true );
+	lua_Integer address = lua_config_integer ( L, 1, "address", -1 );
+	luaL_argcheck ( L, address >= 0 && address <= 0x7F, 1, "address must be 0 to 0x7F" );
+	lua_Number stretch = lua_config_number ( L, 1, "stretch", 0 );
+	luaL_argcheck ( L, stretch >= 0, 1, "stretch must not be negative" );
+	lua_check_unheard ( L, scl, sda );
+
+	VSM_SERIAL* serial = lua_new_serial ( L, SERIAL_I2C_SLAVE, 1 );
+	serial->lines[I2C_SCL] = scl;
+	serial->lines[I2C_SDA] = sda;
+	serial->address = address;
+	serial->stretch = stretch;
+	return lua_slave_config ( L, serial, 1 );
+}
+
+/**
+ * Creates an SPI slave answering from a register file:
+ * spi_slave{sck=SCK, mosi=MOSI, miso=MISO, cs=CS, mode=0, msb_first=true,
+ * read_flag=0x80, size=128, addr_bytes=1, reset=..., readonly=..., on_read=...,
+ * on_write=...}
+ * The first byte after CS falls is the command: read_flag bits select a
+ * read and the other bits start the register address, addr_bytes counts
+ * it. Data bytes go to or come from consecutive registers.
+ * @param L Lua state
+ * @return engine object
+ */
+static int
+lua_spi_slave ( lua_State* L )
+{
+	luaL_checktype ( L, 1, LUA_TTABLE );
+	VSM_PIN* sck = lua_config_pin ( L, 1, "sck", true );
+	VSM_PIN* mosi = lua_config_pin ( L, 1, "mosi", true );
+	VSM_PIN* miso = lua_config_pin ( L, 1, "miso", true );
+	VSM_PIN* cs = lua_config_pin ( L, 1, "cs", true );
+	lua_Integer mode = lua_config_integer ( L, 1, "mode", 0 );
+	luaL_argcheck ( L, mode >= 0 && mode <= 3, 1, "mode must be 0 to 3" );
+	lua_Integer read_flag = lua_config_integer ( L, 1, "read_flag", 0x80 );
+	luaL_argcheck ( L, read_flag >= 0 && read_flag <= 0xFF, 1, "read_flag must be a byte mask" );
+	lua_Integer addr_bytes = lua_config_integer ( L, 1, "addr_bytes", 1 );
+	luaL_argcheck ( L, addr_bytes >= 1, 1, "the command byte carries the address" );
+	lua_getfield ( L, 1, "msb_first" );
+	bool msb_first = lua_isnil ( L, -1 ) || lua_toboolean ( L, -1 );
+	lua_pop ( L, 1 );
+	lua_check_unheard ( L, sck, cs );
+
+	VSM_SERIAL* serial = lua_new_serial ( L, SERIAL_SPI_SLAVE, 1 );
+	serial->lines[SPI_SCK] = sck;
+	serial->lines[SPI_MOSI] = mosi;
+	serial->lines[SPI_MISO] = miso;
+	serial->lines[SPI_CS] = cs;
+	serial->mode = mode;
+	serial->msb_first = msb_first;
+	serial->read_flag = read_flag;
+	return lua_slave_config ( L, serial, addr_bytes );
+}
+
+/**
+ * [Check that argument 1 is a slave and argument 2 one of its registers]
+ * @param  L   [Lua state]
+ * @param  reg [register number out]
+ * @return     [slave engine]
+ */
+static VSM_SERIAL*
+lua_check_slave_reg ( lua_State* L, uint32_t* reg )
+{
+	VSM_SERIAL* serial = *( VSM_SERIAL** ) luaL_checkudata ( L, 1, SERIAL_META );
+	luaL_argcheck ( L, NULL != serial->regs.value, 1, "not a slave" );
+	lua_Integer i = luaL_checkinteger ( L, 2 );
+	luaL_argcheck ( L, i >= 0 && i < serial->regs.size, 2, "register out of range" );
+	*reg = i;
+	return serial;
+}
+
+/**
+ * Reads a slave register without running its hooks: engine:reg(reg)
+ * @param L Lua state
+ * @return value
+ */
+static int
+lua_serial_reg ( lua_State* L )
+{
+	uint32_t reg;
+	VSM_SERIAL* serial = lua_check_slave_reg ( L, &reg );
+	lua_pushinteger ( L, serial->regs.value[reg] );
+	return 1;
+}
+
+/**
+ * Sets a slave register from the device side, read-only bits included:
+ * engine:set_reg(reg, value)
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_serial_set_reg ( lua_State* L )
+{
+	uint32_t reg;
+	VSM_SERIAL* serial = lua_check_slave_reg ( L, &reg );
+	serial->regs.value[reg] = luaL_checkinteger ( L, 3 );
+	return 0;
+}
+
+/**
+ * Restores the reset values of a slave: engine:reset()
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_serial_reset ( lua_State* L )
+{
+	VSM_SERIAL* serial = *( VSM_SERIAL** ) luaL_checkudata ( L, 1, SERIAL_META );
+	luaL_argcheck ( L, NULL != serial->regs.value, 1, "not a slave" );
+	slave_reset ( serial );
+	return 0;
+}
+
+/**
+ * [End of a bus cycle, runs the function given with it as
+ * fn(bus, addr, data, ok), ok false for a cycle that could not be run]
+ * @param master [transactor]
+ * @param cycle  [finished cycle, data holds what was read]
+ */
+static void
+lua_bus_master_done ( VSM_BUS_MASTER* master, BUS_CYCLE* cycle )
+{
+	if ( LUA_NOREF == cycle->lua_ref )
+		return;
+	lua_State* L = master->model->luactx;
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, cycle->lua_ref );
+	luaL_unref ( L, LUA_REGISTRYINDEX, cycle->lua_ref );
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, master->lua_ref );
+	lua_pushinteger ( L, cycle->addr );
+	lua_pushinteger ( L, cycle->data );
+	lua_pushboolean ( L, !cycle->failed );
+	if ( 0 != lua_pcall ( L, 4, 0, 0 ) )
+	{
+		out_error ( master->model, "bus cycle completion: %s", lua_tostring ( L, -1 ) );
+		lua_pop ( L, 1 );
+	}
+}
+
+/**
+ * Creates a parallel bus transactor:
+ * bus_master{addr=ADDR, data=DATA, rd=RD, wr=WR, cs=CS, active_high=false,
+ * setup=t, strobe=t, sample=t, hold=t, ready=READY, ready_level=1, wait=t}
+ * addr and data are pin groups or tables of pins. A cycle drives the
+ * address and select, after setup asserts the strobe for strobe, reads
+ * sample after the strobe starts and ends hold after the strobe. With a
+ * ready pin the strobe is stretched in steps of wait until ready reaches
+ * ready_level, reads then sample at the strobe end.
+ * @param L Lua state
+ * @return transactor object
+ */
+static int
+lua_bus_master ( lua_State* L )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	luaL_checktype ( L, 1, LUA_TTABLE );
+	lua_getfield ( L, 1, "addr" );
+	VSM_PIN_GROUP* addr = lua_check_pin_group ( L, -1 );
+	lua_getfield ( L, 1, "data" );
+	VSM_PIN_GROUP* data = lua_check_pin_group ( L, -1 );
+	VSM_PIN* rd = lua_config_pin ( L, 1, "rd", false );
+	VSM_PIN* wr = lua_config_pin ( L, 1, "wr", false );
+	luaL_argcheck ( L, rd || wr, 1, "bus needs rd or wr" );
+	lua_Number strobe = lua_config_number ( L, 1, "strobe", 0 );
+	luaL_argcheck ( L, strobe > 0, 1, "strobe must be positive" );
+	lua_Number setup = lua_config_number ( L, 1, "setup", 0 );
+	lua_Number hold = lua_config_number ( L, 1, "hold", 0 );
+	lua_Number sample = lua_config_number ( L, 1, "sample", strobe );
+	lua_Number wait = lua_config_number ( L, 1, "wait", strobe );
+	luaL_argcheck ( L, setup >= 0 && hold >= 0, 1, "setup and hold must not be negative" );
+	luaL_argcheck ( L, sample >= 0 && sample <= strobe, 1, "sample must fall inside the strobe" );
+	luaL_argcheck ( L, wait > 0, 1, "wait must be positive" );
+	lua_getfield ( L, 1, "active_high" );
+	bool active_high = lua_toboolean ( L, -1 );
+	lua_pop ( L, 1 );
+
+	VSM_BUS_MASTER* master = bus_master_new ( model, addr, data );
+	if ( NULL == master )
+		return luaL_error ( L, "not enough memory" );
+	lua_pop ( L, 2 );
+	master->rd = rd;
+	master->wr = wr;
+	master->cs = lua_config_pin ( L, 1, "cs", false );
+	master->ready = lua_config_pin ( L, 1, "ready", false );
+	master->ready_level = 0 != lua_config_number ( L, 1, "ready_level", 1 );
+	master->active_high = active_high;
+	master->setup = setup;
+	master->strobe = strobe;
+	master->sample = sample;
+	master->hold = hold;
+	master->wait = wait;
+	master->on_done = lua_bus_master_done;
+
+	/* Strobes rest at their idle level until the first cycle */
+	ABSTIME curtime = 0;
+	systime ( model, &curtime );
+	VSM_PIN* strobes[] = {rd, wr, master->cs};
+	for ( size_t i=0; i < sizeof strobes / sizeof strobes[0]; i++ )
+		if ( strobes[i] )
+			strobes[i]->pin->vtable->setstate2 ( strobes[i]->pin, 0, curtime, strobes[i]->on_time, active_high ? SLO : SHI );
+
+	VSM_BUS_MASTER** ud = lua_newuserdata ( L, sizeof *ud );
+	*ud = master;
+	luaL_setmetatable ( L, BUS_MASTER_META );
+	/* The model owns the transactor, the object lives as long as the model */
+	lua_pushvalue ( L, -1 );
+	master->lua_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	return 1;
+}
+
+/**
+ * [Queue a cycle from Lua arguments bus, addr[, data], fn]
+ * @param  L     [Lua state]
+ * @param  write [write cycle]
+ * @return       [1, true if the cycle was queued]
+ */
+static int
+lua_bus_master_cycle ( lua_State* L, bool write )
+{
+	VSM_BUS_MASTER* master = *( VSM_BUS_MASTER** ) luaL_checkudata ( L, 1, BUS_MASTER_META );
+	lua_Integer addr = luaL_checkinteger ( L, 2 );
+	lua_Integer data = write ? luaL_checkinteger ( L, 3 ) : 0;
+	int fn = write ? 4 : 3;
+	int32_t ref = LUA_NOREF;
+	if ( !lua_isnoneornil ( L, fn ) )
+	{
+		luaL_checktype ( L, fn, LUA_TFUNCTION );
+		lua_pushvalue ( L, fn );
+		ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	}
+	bool queued = bus_cycle ( master, addr, data, write, ref );
+	if ( !queued )
+		luaL_unref ( L, LUA_REGISTRYINDEX, ref );
+	lua_pushboolean ( L, queued );
+	return 1;
+}
+
+/**
+ * Queues a write cycle: bus:write(addr, data[, fn]) or bus_write(bus, addr, data[, fn])
+ * fn(bus, addr, data, ok) runs when the cycle is over, ok is false if the
+ * host refused to schedule it
+ * @param L Lua state
+ * @return true if the cycle was queued
+ */
+static int
+lua_bus_master_write ( lua_State* L )
+{
+	return lua_bus_master_cycle ( L, true );
+}
+
+/**
+ * Queues a read cycle: bus:read(addr[, fn]) or bus_read(bus, addr[, fn])
+ * fn(bus, addr, data, ok) runs with the sampled data when the cycle is over,
+ * ok is false if the host refused to schedule it
+ * @param L Lua state
+ * @return true if the cycle was queued
+ */
+static int
+lua_bus_master_read ( lua_State* L )
+{
+	return lua_bus_master_cycle ( L, false );
+}
+
+/**
+ * Tells if cycles are still queued or running: bus:busy()
+ * @param L Lua state
+ * @return true while busy
+ */
+static int
+lua_bus_master_busy ( lua_State* L )
+{
+	VSM_BUS_MASTER* master = *( VSM_BUS_MASTER** ) luaL_checkudata ( L, 1, BUS_MASTER_META );
+	lua_pushboolean ( L, 0 != master->queue_count );
+	return 1;
+}
+
+/**
+ * [Hand the receive FIFO to the script as fn(seq, words)]
+ * @param seq [sequencer]
+ */
+static void
+lua_sequencer_rx ( VSM_SEQUENCER* seq )
+{
+	if ( LUA_NOREF == seq->rx_ref )
+		return;
+	lua_State* L = seq->model->luactx;
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, seq->rx_ref );
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, seq->lua_ref );
+	lua_createtable ( L, seq->rx.count, 0 );
+	uint32_t word;
+	for ( int32_t i=1; sequencer_get ( seq, &word, 1 ); i++ )
+	{
+		lua_pushinteger ( L, word );
+		lua_rawseti ( L, -2, i );
+	}
+	if ( 0 != lua_pcall ( L, 2, 0, 0 ) )
+	{
+		out_error ( seq->model, "sequencer on_rx: %s", lua_tostring ( L, -1 ) );
+		lua_pop ( L, 1 );
+	}
+}
+
+/**
+ * [Run the interrupt function of a sequencer as fn(seq, irq)]
+ * @param seq [sequencer]
+ * @param irq [interrupt number of the irq instruction]
+ */
+static void
+lua_sequencer_irq ( VSM_SEQUENCER* seq, uint32_t irq )
+{
+	if ( LUA_NOREF == seq->irq_ref )
+		return;
+	lua_State* L = seq->model->luactx;
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, seq->irq_ref );
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, seq->lua_ref );
+	lua_pushinteger ( L, irq );
+	if ( 0 != lua_pcall ( L, 2, 0, 0 ) )
+	{
+		out_error ( seq->model, "sequencer on_irq: %s", lua_tostring ( L, -1 ) );
+		lua_pop ( L, 1 );
+	}
+}
+
+/**
+ * [Fetch numeric operand n of an instruction table]
+ * @param  L   [Lua state]
+ * @param  idx [instruction table index]
+ * @param  n   [operand position, the opcode is 1]
+ * @param  def [value if the operand is missing]
+ * @return     [operand]
+ */
+static lua_Integer
+lua_seq_operand ( lua_State* L, int idx, int n, lua_Integer def )
+{
+	lua_rawgeti ( L, idx, n );
+	lua_Integer value = luaL_optinteger ( L, -1, def );
+	lua_pop ( L, 1 );
+	return value;
+}
+
+/**
+ * [Turn the program table at idx into instructions]
+ *
+ * Strings in the program are labels naming the next instruction, jump
+ * targets are labels or instruction numbers counted from 0. The labels
+ * are kept for seq:start(label), their table is left on the stack. Errors
+ * are raised before any sequencer exists, so nothing is left registered.
+ *
+ * @param  L         [Lua state]
+ * @param  program   [instructions out, SEQ_MAX_PROGRAM of them]
+ * @param  out_width [out pins]
+ * @param  in_width  [in pins]
+ * @param  pull_bits [bits of a transmit word]
+ * @param  push_bits [bits of a receive word]
+ * @param  idx       [program table index]
+ * @return           [number of instructions]
+ */
+static int32_t
+lua_seq_assemble ( lua_State* L, SEQ_INSN* program, uint32_t out_width, uint32_t in_width,
+                   lua_Integer pull_bits, lua_Integer push_bits, int idx )
+{
+	static const char* const ops[] = {"set", "wait", "wait_pin", "out", "in", "push", "setx", "jmp", "irq", NULL};
+	static const char* const conds[] = {"always", "x--", "pin", "!pin", "!osre", NULL};
+	idx = lua_absindex ( L, idx );
+
+	/* Labels first, jumps may go forward */
+	lua_newtable ( L );
+	int labels = lua_gettop ( L );
+	int32_t length = 0;
+	lua_Integer items = luaL_len ( L, idx );
+	for ( lua_Integer i=1; i <= items; i++ )
+	{
+		if ( LUA_TSTRING == lua_rawgeti ( L, idx, i ) )
+		{
+			lua_pushinteger ( L, length );
+			lua_setfield ( L, labels, lua_tostring ( L, -2 ) );
+		}
+		else
+		{
+			luaL_checktype ( L, -1, LUA_TTABLE );
+			length++;
+		}
+		lua_pop ( L, 1 );
+	}
+	if ( 0 == length || length > SEQ_MAX_PROGRAM )
+		luaL_error ( L, "program must have 1 to %d instructions", SEQ_MAX_PROGRAM );
+
+	int32_t pc = 0;
+	for ( lua_Integer i=1; i <= items; i++ )
+	{
+		if ( LUA_TTABLE != lua_rawgeti ( L, idx, i ) )
+		{
+			lua_pop ( L, 1 );
+			continue;
+		}
+		int insn_idx = lua_gettop ( L );
+		SEQ_INSN* insn = &program[pc];
+		memset ( insn, 0, sizeof *insn );
+		lua_rawgeti ( L, insn_idx, 1 );
+		insn->op = luaL_checkoption ( L, -1, NULL, ops );
+		lua_pop ( L, 1 );
+		lua_Integer delay = lua_config_integer ( L, insn_idx, "delay", 0 );
+		lua_Integer arg = lua_seq_operand ( L, insn_idx, 2, 0 );
+		if ( delay < 0 )
+			luaL_error ( L, "instruction %d: delay must not be negative", pc );
+		insn->delay = delay;
+		insn->mask = ~0ULL;
+		switch ( insn->op )
+		{
+			case SEQ_SET:
+				if ( 0 == out_width )
+					luaL_error ( L, "instruction %d: set needs out pins", pc );
+				/* Masks go up to 64 pins, a double would round them */
+				lua_getfield ( L, insn_idx, "mask" );
+				insn->mask = luaL_optinteger ( L, -1, -1 );
+				lua_pop ( L, 1 );
+				break;
+			case SEQ_WAIT:
+				if ( arg < 1 )
+					luaL_error ( L, "instruction %d: wait needs at least one tick", pc );
+				break;
+			case SEQ_WAIT_PIN:
+				if ( arg < 0 || arg >= in_width )
+					luaL_error ( L, "instruction %d: no such in pin", pc );
+				insn->pin = arg;
+				arg = lua_seq_operand ( L, insn_idx, 3, 1 );
+				break;
+			case SEQ_OUT:
+				if ( arg < 1 || arg > pull_bits || arg > out_width )
+					luaL_error ( L, "instruction %d: bad out bit count", pc );
+				break;
+			case SEQ_IN:
+				if ( arg < 1 || arg > push_bits || arg > in_width )
+					luaL_error ( L, "instruction %d: bad in bit count", pc );
+				break;
+			case SEQ_JMP:
+				lua_rawgeti ( L, insn_idx, 2 );
+				if ( lua_type ( L, -1 ) == LUA_TSTRING )
+				{
+					if ( LUA_TNUMBER != lua_getfield ( L, labels, lua_tostring ( L, -1 ) ) )
+						luaL_error ( L, "instruction %d: no label %s", pc, lua_tostring ( L, -2 ) );
+					arg = lua_tointeger ( L, -1 );
+					lua_pop ( L, 1 );
+				}
+				lua_pop ( L, 1 );
+				if ( arg < 0 || arg >= length )
+					luaL_error ( L, "instruction %d: jump out of the program", pc );
+				lua_rawgeti ( L, insn_idx, 3 );
+				insn->cond = luaL_checkoption ( L, -1, "always", conds );
+				lua_pop ( L, 1 );
+				{
+					lua_Integer pin = lua_config_integer ( L, insn_idx, "pin", 0 );
+					if ( ( COND_PIN == insn->cond || COND_NOT_PIN == insn->cond ) && ( pin < 0 || pin >= in_width ) )
+						luaL_error ( L, "instruction %d: no such in pin", pc );
+					insn->pin = pin;
+				}
+				break;
+			default:
+				break;
+		}
+		insn->arg = arg;
+		lua_pop ( L, 1 );
+		pc++;
+	}
+	return length;
+}
+
+/**
+ * Creates a pin sequencer:
+ * sequencer{out=PINS, ["in"]=PINS, tick=t, pull_bits=8, push_bits=8,
+ * msb_first=true, count=1, on_rx=fn, on_irq=fn, program={...}}
+ * The program is a list of instructions and labels, each instruction
+ * takes one tick plus its delay=n ticks:
+ * {"set", value, mask=m}, {"wait", ticks}, {"wait_pin", in_pin, level},
+ * {"out", bits}, {"in", bits}, {"push"}, {"setx", n},
+ * {"jmp", target, "x--"|"pin"|"!pin"|"!osre", pin=in_pin}, {"irq", n}
+ * out pulls pull_bits words put by seq:put, in pushes push_bits words to
+ * fn(seq, words) once count of them are waiting, irq runs fn(seq, n).
+ * @param L Lua state
+ * @return sequencer object, stopped
+ */
+static int
+lua_sequencer ( lua_State* L )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	luaL_checktype ( L, 1, LUA_TTABLE );
+	VSM_PIN_GROUP* out = NULL;
+	VSM_PIN_GROUP* in = NULL;
+	if ( LUA_TNIL != lua_getfield ( L, 1, "out" ) )
+		out = lua_check_pin_group ( L, -1 );
+	if ( LUA_TNIL != lua_getfield ( L, 1, "in" ) )
+		in = lua_check_pin_group ( L, -1 );
+	luaL_argcheck ( L, out || in, 1, "sequencer needs out or in pins" );
+	lua_Number tick = lua_config_number ( L, 1, "tick", 0 );
+	luaL_argcheck ( L, tick >= 1, 1, "tick must be positive" );
+	lua_Integer pull_bits = lua_config_integer ( L, 1, "pull_bits", 8 );
+	lua_Integer push_bits = lua_config_integer ( L, 1, "push_bits", 8 );
+	luaL_argcheck ( L, pull_bits >= 1 && pull_bits <= 32 && push_bits >= 1 && push_bits <= 32, 1, "word size must be 1 to 32 bits" );
+	lua_Integer batch = lua_config_integer ( L, 1, "count", 1 );
+	luaL_argcheck ( L, batch >= 1 && batch <= SEQ_FIFO, 1, "count out of range" );
+	luaL_argcheck ( L, LUA_TTABLE == lua_getfield ( L, 1, "program" ), 1, "sequencer needs a program" );
+	SEQ_INSN program[SEQ_MAX_PROGRAM];
+	int32_t length = lua_seq_assemble ( L, program, out ? out->width : 0, in ? in->width : 0, pull_bits, push_bits, -1 );
+
+	VSM_SEQUENCER* seq = sequencer_new ( model, out, in );
+	if ( NULL == seq )
+		return luaL_error ( L, "not enough memory" );
+	memcpy ( seq->program, program, length * sizeof program[0] );
+	seq->length = length;
+	seq->labels_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	seq->tick = tick;
+	seq->pull_bits = pull_bits;
+	seq->push_bits = push_bits;
+	seq->rx_batch = batch;
+	lua_getfield ( L, 1, "msb_first" );
+	seq->msb_first = lua_isnil ( L, -1 ) || lua_toboolean ( L, -1 );
+	/* msb_first, program, in and out */
+	lua_pop ( L, 4 );
+
+	seq->on_rx = lua_sequencer_rx;
+	seq->on_irq = lua_sequencer_irq;
+	if ( LUA_TFUNCTION == lua_getfield ( L, 1, "on_rx" ) )
+		seq->rx_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	else
+		lua_pop ( L, 1 );
+	if ( LUA_TFUNCTION == lua_getfield ( L, 1, "on_irq" ) )
+		seq->irq_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	else
+		lua_pop ( L, 1 );
+
+	VSM_SEQUENCER** ud = lua_newuserdata ( L, sizeof *ud );
+	*ud = seq;
+	luaL_setmetatable ( L, SEQUENCER_META );
+	/* The model owns the sequencer, the object lives as long as the model */
+	lua_pushvalue ( L, -1 );
+	seq->lua_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	return 1;
+}
+
+/**
+ * Starts or restarts the program: seq:start([label or instruction number])
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_sequencer_start ( lua_State* L )
+{
+	VSM_SEQUENCER* seq = *( VSM_SEQUENCER** ) luaL_checkudata ( L, 1, SEQUENCER_META );
+	lua_Integer pc = 0;
+	if ( LUA_TSTRING == lua_type ( L, 2 ) )
+	{
+		lua_rawgeti ( L, LUA_REGISTRYINDEX, seq->labels_ref );
+		luaL_argcheck ( L, LUA_TNUMBER == lua_getfield ( L, -1, lua_tostring ( L, 2 ) ), 2, "no such label" );
+		pc = lua_tointeger ( L, -1 );
+	}
+	else
+	{
+		pc = luaL_optinteger ( L, 2, 0 );
+		luaL_argcheck ( L, pc >= 0 && pc < seq->length, 2, "instruction out of range" );
+	}
+	sequencer_start ( seq, pc );
+	return 0;
+}
+
+/**
+ * Stops the program: seq:stop()
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_sequencer_stop ( lua_State* L )
+{
+	sequencer_stop ( *( VSM_SEQUENCER** ) luaL_checkudata ( L, 1, SEQUENCER_META ) );
+	return 0;
+}
+
+/**
+ * Feeds the transmit FIFO: seq:put(string) with one word per byte, or
+ * seq:put({word, ...})
+ * @param L Lua state
+ * @return number of words taken, less if the FIFO filled up
+ */
+static int
+lua_sequencer_put ( lua_State* L )
+{
+	VSM_SEQUENCER* seq = *( VSM_SEQUENCER** ) luaL_checkudata ( L, 1, SEQUENCER_META );
+	uint32_t words[SEQ_FIFO];
+	int32_t count = 0;
+	if ( LUA_TSTRING == lua_type ( L, 2 ) )
+	{
+		size_t len;
+		const uint8_t* data = ( const uint8_t* ) lua_tolstring ( L, 2, &len );
+		for ( ; count < SEQ_FIFO && ( size_t ) count < len; count++ )
+			words[count] = data[count];
+	}
+	else
+	{
+		luaL_checktype ( L, 2, LUA_TTABLE );
+		lua_Integer len = luaL_len ( L, 2 );
+		for ( ; count < SEQ_FIFO && count < len; count++ )
+		{
+			lua_rawgeti ( L, 2, count + 1 );
+			words[count] = luaL_checkinteger ( L, -1 );
+			lua_pop ( L, 1 );
+		}
+	}
+	lua_pushinteger ( L, sequencer_put ( seq, words, count ) );
+	return 1;
+}
+
+/**
+ * Drains the receive FIFO: seq:get()
+ * @param L Lua state
+ * @return table of words, empty if none arrived
+ */
+static int
+lua_sequencer_get ( lua_State* L )
+{
+	VSM_SEQUENCER* seq = *( VSM_SEQUENCER** ) luaL_checkudata ( L, 1, SEQUENCER_META );
+	uint32_t words[SEQ_FIFO];
+	int32_t count = sequencer_get ( seq, words, SEQ_FIFO );
+	lua_createtable ( L, count, 0 );
+	for ( int32_t i=0; i < count; i++ )
+	{
+		lua_pushinteger ( L, words[i] );
+		lua_rawseti ( L, -2, i + 1 );
+	}
+	return 1;
+}
+
+/**
+ * Tells if the program runs, stalled on a FIFO or a pin included: seq:running()
+ * @param L Lua state
+ * @return true while started
+ */
+static int
+lua_sequencer_running ( lua_State* L )
+{
+	VSM_SEQUENCER* seq = *( VSM_SEQUENCER** ) luaL_checkudata ( L, 1, SEQUENCER_META );
+	lua_pushboolean ( L, seq->running );
+	return 1;
+}
+
+/**
+ * Creates a ROM or RAM chip:
+ * memory_chip{addr=ADDR, data=DATA, ce=CE, oe=OE, we=WE, active_high=false,
+ * size=words, image=string, file=name, fill=0, access=t, enable=t, release=t}
+ * addr and data are pin groups or tables of pins, ce, oe and we are
+ * optional and we makes it a RAM. size defaults to the address range.
+ * The contents start as fill, then image bytes or the file loaded by the
+ * host in any format it knows, not both. An image buffer covering the chip is used
+ * in place, unless it is read-only and the chip a RAM. A ROM file is
+ * shared with every other chip loading it. access is the delay from an
+ * address or chip enable change to data, enable the delay from output
+ * enable alone, release the delay to high impedance.
+ * @param L Lua state
+ * @return chip object
+ */
+static int
+lua_memory_chip ( lua_State* L )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	luaL_checktype ( L, 1, LUA_TTABLE );
+	lua_getfield ( L, 1, "addr" );
+	VSM_PIN_GROUP* addr = lua_check_pin_group ( L, -1 );
+	lua_getfield ( L, 1, "data" );
+	VSM_PIN_GROUP* data = lua_check_pin_group ( L, -1 );
+	luaL_argcheck ( L, addr->width >= 1 && addr->width < 32, 1, "address group must be 1 to 31 pins" );
+	luaL_argcheck ( L, data->width >= 1, 1, "data group is empty" );
+	lua_Integer words = lua_config_integer ( L, 1, "size", ( lua_Integer ) 1 << addr->width );
+	luaL_argcheck ( L, words >= 1, 1, "size must be positive" );
+	luaL_argcheck ( L, ( uint64_t ) words <= SIZE_MAX / ( ( data->width + 7 ) / 8 ), 1, "chip too large for the address space" );
+	lua_Number access = lua_config_number ( L, 1, "access", 0 );
+	lua_Number enable = lua_config_number ( L, 1, "enable", access );
+	lua_Number release = lua_config_number ( L, 1, "release", 0 );
+	luaL_argcheck ( L, access >= 0 && enable >= 0 && release >= 0, 1, "times must not be negative" );
+	lua_Integer fill = lua_config_integer ( L, 1, "fill", 0 );
+	lua_getfield ( L, 1, "active_high" );
+	bool active_high = lua_toboolean ( L, -1 );
+	lua_pop ( L, 1 );
+	/* A file would be loaded over a read-only image buffer */
+	bool image = LUA_TNIL != lua_getfield ( L, 1, "image" );
+	bool file = LUA_TNIL != lua_getfield ( L, 1, "file" );
+	lua_pop ( L, 2 );
+	luaL_argcheck ( L, !( image && file ), 1, "image and file are exclusive" );
+
+	VSM_MEMCHIP* chip = memchip_new ( model, addr, data, words );
+	if ( NULL == chip )
+		return luaL_error ( L, "not enough memory" );
+	lua_pop ( L, 2 );
+	chip->ce = lua_config_pin ( L, 1, "ce", false );
+	chip->oe = lua_config_pin ( L, 1, "oe", false );
+	chip->we = lua_config_pin ( L, 1, "we", false );
+	chip->active_high = active_high;
+	chip->access = access;
+	chip->enable = enable;
+	chip->release = release;
+
+	memset ( chip->mem, fill, chip->size );
+	lua_getfield ( L, 1, "image" );
+	VSM_BUFFER* buf = luaL_testudata ( L, -1, BUFFER_META );
+	if ( buf )
+	{
+		memchip_attach ( chip, buf->block, buf->data, buf->size );
+	}
+	else if ( LUA_TSTRING == lua_type ( L, -1 ) )
+	{
+		size_t len;
+		const char* image = lua_tolstring ( L, -1, &len );
+		memcpy ( chip->mem, image, len < chip->size ? len : chip->size );
+	}
+	if ( LUA_TSTRING == lua_getfield ( L, 1, "file" ) )
+	{
+		const char* file = lua_tostring ( L, -1 );
+		VSM_BLOCK* block = chip->we ? NULL : image_open ( model, file, chip->size, fill );
+		if ( block )
+		{
+			memchip_attach ( chip, block, block->data, block->size );
+			block_release ( block );
+		}
+		else
+		{
+			load_image ( model, ( char* ) file, chip->mem, chip->size );
+		}
+	}
+	lua_pop ( L, 2 );
+
+	VSM_MEMCHIP** ud = lua_newuserdata ( L, sizeof *ud );
+	*ud = chip;
+	luaL_setmetatable ( L, MEMCHIP_META );
+	/* The model owns the chip, the object lives as long as the model */
+	lua_pushvalue ( L, -1 );
+	chip->lua_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	return 1;
+}
+
+/**
+ * Reads a word without touching the pins: chip:peek(addr)
+ * @param L Lua state
+ * @return word
+ */
+static int
+lua_memchip_peek ( lua_State* L )
+{
+	VSM_MEMCHIP* chip = *( VSM_MEMCHIP** ) luaL_checkudata ( L, 1, MEMCHIP_META );
+	lua_pushinteger ( L, memchip_peek ( chip, luaL_checkinteger ( L, 2 ) ) );
+	return 1;
+}
+
+/**
+ * Writes a word, ROMs included: chip:poke(addr, value)
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_memchip_poke ( lua_State* L )
+{
+	VSM_MEMCHIP* chip = *( VSM_MEMCHIP** ) luaL_checkudata ( L, 1, MEMCHIP_META );
+	luaL_argcheck ( L, !chip->block->readonly, 1, "contents are read-only" );
+	memchip_poke ( chip, luaL_checkinteger ( L, 2 ), luaL_checkinteger ( L, 3 ) );
+	return 0;
+}
+
+/**
+ * Copies bytes into the chip: chip:load(string[, byte_offset])
+ * @param L Lua state
+ * @return number of bytes copied
+ */
+static int
+lua_memchip_load ( lua_State* L )
+{
+	VSM_MEMCHIP* chip = *( VSM_MEMCHIP** ) luaL_checkudata ( L, 1, MEMCHIP_META );
+	size_t len;
+	const char* data = luaL_checklstring ( L, 2, &len );
+	lua_Integer offset = luaL_optinteger ( L, 3, 0 );
+	luaL_argcheck ( L, !chip->block->readonly, 1, "contents are read-only" );
+	luaL_argcheck ( L, offset >= 0 && ( size_t ) offset <= chip->size, 3, "offset out of range" );
+	if ( len > chip->size - offset )
+		len = chip->size - offset;
+	memcpy ( chip->mem + offset, data, len );
+	lua_pushinteger ( L, len );
+	return 1;
+}
+
+/**
+ * Copies the contents out: chip:contents()
+ * @param L Lua state
+ * @return string of all bytes
+ */
+static int
+lua_memchip_contents ( lua_State* L )
+{
+	VSM_MEMCHIP* chip = *( VSM_MEMCHIP** ) luaL_checkudata ( L, 1, MEMCHIP_META );
+	lua_pushlstring ( L, ( const char* ) chip->mem, chip->size );
+	return 1;
+}
+
+/**
+ * Size in bytes: #chip
+ * @param L Lua state
+ * @return size
+ */
+static int
+lua_memchip_len ( lua_State* L )
+{
+	VSM_MEMCHIP* chip = *( VSM_MEMCHIP** ) luaL_checkudata ( L, 1, MEMCHIP_META );
+	lua_pushinteger ( L, chip->size );
+	return 1;
+}
+
+/**
+ * [Push a buffer object viewing part of a block]
+ * @param  L     [Lua state]
+ * @param  block [block, the object takes its own reference]
+ * @param  data  [first byte of the view, inside block]
+ * @param  size  [bytes in the view]
+ * @return       [the buffer]
+ */
+static VSM_BUFFER*
+lua_push_buffer ( lua_State* L, VSM_BLOCK* block, uint8_t* data, size_t size )
+{
+	VSM_BUFFER* buf = lua_newuserdata ( L, sizeof *buf );
+	buf->block = block_retain ( block );
+	buf->data = data;
+	buf->size = size;
+	luaL_setmetatable ( L, BUFFER_META );
+	return buf;
+}
+
+/**
+ * [Push a buffer over a fresh block]
+ * @param  L    [Lua state]
+ * @param  size [bytes]
+ * @return      [the buffer, zeroed]
+ */
+static VSM_BUFFER*
+lua_new_buffer ( lua_State* L, size_t size )
+{
+	VSM_BLOCK* block = block_new ( size );
+	if ( NULL == block )
+		luaL_error ( L, "not enough memory for %zu bytes", size );
+	VSM_BUFFER* buf = lua_push_buffer ( L, block, block->data, size );
+	block_release ( block );
+	return buf;
+}
+
+/**
+ * [Check a byte range of a buffer]
+ * @param  L      [Lua state]
+ * @param  buf    [buffer]
+ * @param  arg    [argument index of the offset, used in the error]
+ * @param  offset [first byte]
+ * @param  length [bytes]
+ * @return        [offset as size_t]
+ */
+static size_t
+lua_buffer_range ( lua_State* L, const VSM_BUFFER* buf, int arg, lua_Integer offset, lua_Integer length )
+{
+	luaL_argcheck ( L, offset >= 0 && length >= 0 && ( size_t ) offset <= buf->size &&
+	                ( size_t ) length <= buf->size - offset, arg, "range outside the buffer" );
+	return offset;
+}
+
+/**
+ * [Fetch a buffer that may be written]
+ * @param  L   [Lua state]
+ * @param  idx [argument index]
+ * @return     [buffer]
+ */
+static VSM_BUFFER*
+lua_check_writable_buffer ( lua_State* L, int idx )
+{
+	VSM_BUFFER* buf = luaL_checkudata ( L, idx, BUFFER_META );
+	luaL_argcheck ( L, !buf->block->readonly, idx, "buffer is read-only" );
+	return buf;
+}
+
+/**
+ * [Size of a file for load_image without an explicit size]
+ * @param  L    [Lua state]
+ * @param  file [file name]
+ * @return      [bytes]
+ */
+static size_t
+lua_file_size ( lua_State* L, const char* file )
+{
+	struct stat st;
+	if ( 0 != stat ( file, &st ) )
+		luaL_error ( L, "cannot size %s, give the image size", file );
+	return st.st_size;
+}
+
+/**
+ * Creates a buffer outside the Lua heap: buffer(size[, fill]) or buffer(string)
+ * Bytes are indexed from 0: buf[i], buf[i] = v
+ * @param L Lua state
+ * @return buffer
+ */
+static int
+lua_buffer ( lua_State* L )
+{
+	if ( LUA_TSTRING == lua_type ( L, 1 ) )
+	{
+		size_t len;
+		const char* data = lua_tolstring ( L, 1, &len );
+		VSM_BUFFER* buf = lua_new_buffer ( L, len );
+		memcpy ( buf->data, data, len );
+		return 1;
+	}
+	lua_Integer size = luaL_checkinteger ( L, 1 );
+	luaL_argcheck ( L, size >= 0, 1, "size must not be negative" );
+	VSM_BUFFER* buf = lua_new_buffer ( L, size );
+	if ( !lua_isnoneornil ( L, 2 ) )
+		memset ( buf->data, luaL_checkinteger ( L, 2 ), size );
+	return 1;
+}
+
+/**
+ * Loads an image file the way the host does, any format it knows:
+ * load_image(file[, size]), the file size is used without size
+ * @param L Lua state
+ * @return buffer
+ */
+static int
+lua_load_image ( lua_State* L )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	const char* file = luaL_checkstring ( L, 1 );
+	lua_Integer size = lua_isnoneornil ( L, 2 ) ? ( lua_Integer ) lua_file_size ( L, file ) : luaL_checkinteger ( L, 2 );
+	luaL_argcheck ( L, size >= 0, 2, "size must not be negative" );
+	VSM_BUFFER* buf = lua_new_buffer ( L, size );
+	load_image ( model, ( char* ) file, buf->data, buf->size );
+	return 1;
+}
+
+/**
+ * Opens the read-only image of a file shared by the whole process:
+ * rom_image(file[, size[, fill=0]]). Raw files are mapped, HEX and
+ * S-record files are parsed by the host into size bytes of fill.
+ * @param L Lua state
+ * @return buffer
+ */
+static int
+lua_rom_image ( lua_State* L )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	const char* file = luaL_checkstring ( L, 1 );
+	lua_Integer size = luaL_optinteger ( L, 2, 0 );
+	luaL_argcheck ( L, size >= 0, 2, "size must not be negative" );
+	VSM_BLOCK* block = image_open ( model, file, size, luaL_optinteger ( L, 3, 0 ) );
+	if ( NULL == block )
+		return luaL_error ( L, "cannot open image %s", file );
+	size_t len = size && ( size_t ) size < block->size ? ( size_t ) size : block->size;
+	lua_push_buffer ( L, block, block->data, len );
+	block_release ( block );
+	return 1;
+}
+
+static int
+lua_buffer_index ( lua_State* L )
+{
+	VSM_BUFFER* buf = luaL_checkudata ( L, 1, BUFFER_META );
+	int isnum = 0;
+	lua_Integer i = lua_tointegerx ( L, 2, &isnum );
+	if ( isnum )
+	{
+		if ( i >= 0 && ( size_t ) i < buf->size )
+			lua_pushinteger ( L, buf->data[i] );
+		else
+			lua_pushnil ( L );
+		return 1;
+	}
+	lua_pushvalue ( L, 2 );
+	lua_rawget ( L, lua_upvalueindex ( 1 ) );
+	return 1;
+}
+
+static int
+lua_buffer_newindex ( lua_State* L )
+{
+	VSM_BUFFER* buf = lua_check_writable_buffer ( L, 1 );
+	lua_Integer i = luaL_checkinteger ( L, 2 );
+	luaL_argcheck ( L, i >= 0 && ( size_t ) i < buf->size, 2, "index outside the buffer" );
+	buf->data[i] = luaL_checkinteger ( L, 3 );
+	return 0;
+}
+
+static int
+lua_buffer_len ( lua_State* L )
+{
+	VSM_BUFFER* buf = luaL_checkudata ( L, 1, BUFFER_META );
+	lua_pushinteger ( L, buf->size );
+	return 1;
+}
+
+static int
+lua_buffer_gc ( lua_State* L )
+{
+	VSM_BUFFER* buf = luaL_checkudata ( L, 1, BUFFER_META );
+	block_release ( buf->block );
+	buf->block = NULL;
+	return 0;
+}
+
+/**
+ * Reads a little endian word: buf:read(offset[, width=1]), width 1 to 8 bytes
+ * @param L Lua state
+ * @return word
+ */
+static int
+lua_buffer_read ( lua_State* L )
+{
+	VSM_BUFFER* buf = luaL_checkudata ( L, 1, BUFFER_META );
+	lua_Integer width = luaL_optinteger ( L, 3, 1 );
+	luaL_argcheck ( L, width >= 1 && width <= 8, 3, "width must be 1 to 8" );
+	size_t offset = lua_buffer_range ( L, buf, 2, luaL_checkinteger ( L, 2 ), width );
+	lua_pushinteger ( L, buffer_read ( buf, offset, width ) );
+	return 1;
+}
+
+/**
+ * Writes a little endian word: buf:write(offset, value[, width=1])
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_buffer_write ( lua_State* L )
+{
+	VSM_BUFFER* buf = lua_check_writable_buffer ( L, 1 );
+	lua_Integer value = luaL_checkinteger ( L, 3 );
+	lua_Integer width = luaL_optinteger ( L, 4, 1 );
+	luaL_argcheck ( L, width >= 1 && width <= 8, 4, "width must be 1 to 8" );
+	size_t offset = lua_buffer_range ( L, buf, 2, luaL_checkinteger ( L, 2 ), width );
+	buffer_write ( buf, offset, value, width );
+	return 0;
+}
+
+/**
+ * Views part of a buffer without copying: buf:slice(offset[, length])
+ * @param L Lua state
+ * @return buffer sharing the bytes
+ */
+static int
+lua_buffer_slice ( lua_State* L )
+{
+	VSM_BUFFER* buf = luaL_checkudata ( L, 1, BUFFER_META );
+	lua_Integer offset = luaL_checkinteger ( L, 2 );
+	lua_Integer length = luaL_optinteger ( L, 3, ( lua_Integer ) buf->size - offset );
+	lua_buffer_range ( L, buf, 2, offset, length );
+	lua_push_buffer ( L, buf->block, buf->data + offset, length );
+	return 1;
+}
+
+/**
+ * Copies bytes out to a Lua string: buf:string([offset[, length]])
+ * @param L Lua state
+ * @return string
+ */
+static int
+lua_buffer_string ( lua_State* L )
+{
+	VSM_BUFFER* buf = luaL_checkudata ( L, 1, BUFFER_META );
+	lua_Integer offset = luaL_optinteger ( L, 2, 0 );
+	lua_Integer length = luaL_optinteger ( L, 3, ( lua_Integer ) buf->size - offset );
+	lua_buffer_range ( L, buf, 2, offset, length );
+	lua_pushlstring ( L, ( const char* ) buf->data + offset, length );
+	return 1;
+}
+
+/**
+ * Sets a range to one byte value: buf:fill(value[, offset[, length]])
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_buffer_fill ( lua_State* L )
+{
+	VSM_BUFFER* buf = lua_check_writable_buffer ( L, 1 );
+	lua_Integer value = luaL_checkinteger ( L, 2 );
+	lua_Integer offset = luaL_optinteger ( L, 3, 0 );
+	lua_Integer length = luaL_optinteger ( L, 4, ( lua_Integer ) buf->size - offset );
+	lua_buffer_range ( L, buf, 3, offset, length );
+	memset ( buf->data + offset, value, length );
+	return 0;
+}
+
+/**
+ * Copies bytes in from a string, a buffer or a memory chip, overlapping
+ * ranges included: buf:copy(offset, source[, source_offset[, length]])
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_buffer_copy ( lua_State* L )
+{
+	VSM_BUFFER* buf = lua_check_writable_buffer ( L, 1 );
+	lua_Integer offset = luaL_checkinteger ( L, 2 );
+	size_t len;
+	const uint8_t* src = lua_check_bytes ( L, 3, &len );
+	lua_Integer src_offset = luaL_optinteger ( L, 4, 0 );
+	luaL_argcheck ( L, src_offset >= 0 && ( size_t ) src_offset <= len, 4, "offset outside the source" );
+	lua_Integer length = luaL_optinteger ( L, 5, ( lua_Integer ) ( len - src_offset ) );
+	luaL_argcheck ( L, length >= 0 && ( size_t ) length <= len - src_offset, 5, "length outside the source" );
+	lua_buffer_range ( L, buf, 2, offset, length );
+	memmove ( buf->data + offset, src + src_offset, length );
+	return 0;
+}
+
+/**
+ * Loads an image file into the buffer the way the host does:
+ * buf:load(file[, offset])
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_buffer_load ( lua_State* L )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	VSM_BUFFER* buf = lua_check_writable_buffer ( L, 1 );
+	const char* file = luaL_checkstring ( L, 2 );
+	lua_Integer offset = luaL_optinteger ( L, 3, 0 );
+	lua_buffer_range ( L, buf, 3, offset, 0 );
+	load_image ( model, ( char* ) file, buf->data + offset, buf->size - offset );
+	return 0;
+}
+
+/**
+ * Tells if the bytes can be written: buf:readonly()
+ * @param L Lua state
+ * @return true for read-only buffers
+ */
+static int
+lua_buffer_readonly ( lua_State* L )
+{
+	VSM_BUFFER* buf = luaL_checkudata ( L, 1, BUFFER_META );
+	lua_pushboolean ( L, buf->block->readonly );
+	return 1;
+}
+
+/**
+ * Views the contents of a chip as a buffer, no copy: chip:buffer()
+ * @param L Lua state
+ * @return buffer
+ */
+static int
+lua_memchip_buffer ( lua_State* L )
+{
+	VSM_MEMCHIP* chip = *( VSM_MEMCHIP** ) luaL_checkudata ( L, 1, MEMCHIP_META );
+	lua_push_buffer ( L, chip->block, chip->mem, chip->size );
+	return 1;
+}
+
+/**
+ * [Fetch a sparse memory argument]
+ * @param  L   [Lua state]
+ * @param  idx [argument index]
+ * @return     [memory]
+ */
+static VSM_SPARSE*
+lua_check_sparse ( lua_State* L, int idx )
+{
+	return *( VSM_SPARSE** ) luaL_checkudata ( L, idx, SPARSE_META );
+}
+
+/**
+ * [Check a byte range of a sparse memory]
+ * @param  L      [Lua state]
+ * @param  sp     [memory]
+ * @param  arg    [argument index of the address, used in the error]
+ * @param  addr   [first byte]
+ * @param  length [bytes]
+ */
+static void
+lua_sparse_range ( lua_State* L, const VSM_SPARSE* sp, int arg, lua_Integer addr, lua_Integer length )
+{
+	luaL_argcheck ( L, addr >= 0 && length >= 0 && ( uint64_t ) addr <= sp->size &&
+	                ( uint64_t ) length <= sp->size - addr, arg, "range outside the memory" );
+}
+
+/**
+ * Creates a large memory that allocates pages only when they are written:
+ * sparse_memory(size[, fill=0])
+ * @param L Lua state
+ * @return memory
+ */
+static int
+lua_sparse_memory ( lua_State* L )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	lua_Integer size = luaL_checkinteger ( L, 1 );
+	luaL_argcheck ( L, size >= 0, 1, "size must not be negative" );
+	VSM_SPARSE* sp = sparse_new ( model, size, luaL_optinteger ( L, 2, 0 ) );
+	if ( NULL == sp )
+		return luaL_error ( L, "not enough memory" );
+
+	VSM_SPARSE** ud = lua_newuserdata ( L, sizeof *ud );
+	*ud = sp;
+	luaL_setmetatable ( L, SPARSE_META );
+	/* The model owns the memory, the object lives as long as the model */
+	lua_pushvalue ( L, -1 );
+	sp->lua_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	return 1;
+}
+
+/**
+ * Reads a little endian word: mem:read(addr[, width=1]), width 1 to 8 bytes
+ * @param L Lua state
+ * @return word
+ */
+static int
+lua_sparse_read ( lua_State* L )
+{
+	VSM_SPARSE* sp = lua_check_sparse ( L, 1 );
+	lua_Integer width = luaL_optinteger ( L, 3, 1 );
+	luaL_argcheck ( L, width >= 1 && width <= 8, 3, "width must be 1 to 8" );
+	lua_Integer addr = luaL_checkinteger ( L, 2 );
+	lua_sparse_range ( L, sp, 2, addr, width );
+	lua_pushinteger ( L, sparse_peek ( sp, addr, width ) );
+	return 1;
+}
+
+/**
+ * Writes a little endian word: mem:write(addr, value[, width=1])
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_sparse_write ( lua_State* L )
+{
+	VSM_SPARSE* sp = lua_check_sparse ( L, 1 );
+	lua_Integer value = luaL_checkinteger ( L, 3 );
+	lua_Integer width = luaL_optinteger ( L, 4, 1 );
+	luaL_argcheck ( L, width >= 1 && width <= 8, 4, "width must be 1 to 8" );
+	lua_Integer addr = luaL_checkinteger ( L, 2 );
+	lua_sparse_range ( L, sp, 2, addr, width );
+	sparse_poke ( sp, addr, value, width );
+	return 0;
+}
+
+/**
+ * Sets a range to one byte value: mem:fill(value[, addr[, length]])
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_sparse_fill ( lua_State* L )
+{
+	VSM_SPARSE* sp = lua_check_sparse ( L, 1 );
+	lua_Integer value = luaL_checkinteger ( L, 2 );
+	lua_Integer addr = luaL_optinteger ( L, 3, 0 );
+	lua_Integer length = luaL_optinteger ( L, 4, ( lua_Integer ) sp->size - addr );
+	lua_sparse_range ( L, sp, 3, addr, length );
+	if ( !sparse_fill ( sp, addr, value, length ) )
+		return luaL_error ( L, "not enough memory" );
+	return 0;
+}
+
+/**
+ * Copies a range from a sparse memory, this one included:
+ * mem:copy(addr, source[, source_addr=0[, length]])
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_sparse_copy ( lua_State* L )
+{
+	VSM_SPARSE* sp = lua_check_sparse ( L, 1 );
+	lua_Integer addr = luaL_checkinteger ( L, 2 );
+	VSM_SPARSE* src = lua_check_sparse ( L, 3 );
+	lua_Integer src_addr = luaL_optinteger ( L, 4, 0 );
+	lua_sparse_range ( L, src, 4, src_addr, 0 );
+	lua_Integer length = luaL_optinteger ( L, 5, ( lua_Integer ) src->size - src_addr );
+	lua_sparse_range ( L, src, 4, src_addr, length );
+	lua_sparse_range ( L, sp, 2, addr, length );
+	if ( !sparse_copy ( sp, addr, src, src_addr, length ) )
+		return luaL_error ( L, "not enough memory" );
+	return 0;
+}
+
+/**
+ * Copies bytes out to a Lua string: mem:string(addr, length)
+ * @param L Lua state
+ * @return string
+ */
+static int
+lua_sparse_string ( lua_State* L )
+{
+	VSM_SPARSE* sp = lua_check_sparse ( L, 1 );
+	lua_Integer addr = luaL_checkinteger ( L, 2 );
+	lua_Integer length = luaL_checkinteger ( L, 3 );
+	lua_sparse_range ( L, sp, 2, addr, length );
+	luaL_Buffer b;
+	sparse_read ( sp, addr, luaL_buffinitsize ( L, &b, length ), length );
+	luaL_pushresultsize ( &b, length );
+	return 1;
+}
+
+/**
+ * Copies bytes in from a string, a buffer or a memory chip:
+ * mem:load(source[, addr=0]), rom_image() loads files this way
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_sparse_load ( lua_State* L )
+{
+	VSM_SPARSE* sp = lua_check_sparse ( L, 1 );
+	size_t len;
+	const uint8_t* data = lua_check_bytes ( L, 2, &len );
+	lua_Integer addr = luaL_optinteger ( L, 3, 0 );
+	lua_sparse_range ( L, sp, 3, addr, len );
+	if ( !sparse_write ( sp, addr, data, len ) )
+		return luaL_error ( L, "not enough memory" );
+	return 0;
+}
+
+/**
+ * Bytes actually allocated: mem:resident()
+ * @param L Lua state
+ * @return bytes
+ */
+static int
+lua_sparse_resident ( lua_State* L )
+{
+	VSM_SPARSE* sp = lua_check_sparse ( L, 1 );
+	lua_pushinteger ( L, ( lua_Integer ) sp->resident * SPARSE_PAGE );
+	return 1;
+}
+
+/**
+ * Shows a window of the memory in a memory popup, kept up to date by
+ * every change: mem:show(popup[, base=0[, size=65536]])
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_sparse_show ( lua_State* L )
+{
+	VSM_SPARSE* sp = lua_check_sparse ( L, 1 );
+	luaL_checktype ( L, 2, LUA_TLIGHTUSERDATA );
+	lua_Integer base = luaL_optinteger ( L, 3, 0 );
+	lua_sparse_range ( L, sp, 3, base, 0 );
+	lua_Integer left = ( lua_Integer ) sp->size - base;
+	lua_Integer size = luaL_optinteger ( L, 4, left < 0x10000 ? left : 0x10000 );
+	lua_sparse_range ( L, sp, 3, base, size );
+	if ( !sparse_show ( sp, lua_touserdata ( L, 2 ), base, size ) )
+		return luaL_error ( L, "memory already shown in another popup" );
+	return 0;
+}
+
+/**
+ * Size in bytes: #mem
+ * @param L Lua state
+ * @return size
+ */
+static int
+lua_sparse_len ( lua_State* L )
+{
+	VSM_SPARSE* sp = lua_check_sparse ( L, 1 );
+	lua_pushinteger ( L, sp->size );
+	return 1;
+}
+
+/**
+ * [Fetch a persistent memory argument]
+ * @param  L   [Lua state]
+ * @param  idx [argument index]
+ * @return     [memory]
+ */
+static VSM_NVMEM*
+lua_check_nvmem ( lua_State* L, int idx )
+{
+	return *( VSM_NVMEM** ) luaL_checkudata ( L, idx, NVMEM_META );
+}
+
+/**
+ * [Check a byte range of a persistent memory]
+ * @param  L      [Lua state]
+ * @param  nv     [memory]
+ * @param  arg    [argument index of the address, used in the error]
+ * @param  addr   [first byte]
+ * @param  length [bytes]
+ */
+static void
+lua_nvmem_range ( lua_State* L, const VSM_NVMEM* nv, int arg, lua_Integer addr, lua_Integer length )
+{
+	luaL_argcheck ( L, addr >= 0 && length >= 0 && ( size_t ) addr <= nv->size &&
+	                ( size_t ) length <= nv->size - addr, arg, "range outside the memory" );
+}
+
+/**
+ * [Current simulation time]
+ * @param  L [Lua state]
+ * @return   [time]
+ */
+static ABSTIME
+lua_nvmem_now ( lua_State* L )
+{
+	ABSTIME now;
+	systime ( lua_get_model ( L ), &now );
+	return now;
+}
+
+/**
+ * Opens an EEPROM or flash kept in a file between runs:
+ * nv_memory{file=name, size=bytes, sector=4096, flash=false,
+ * erase_value=0xFF, program_time=t, erase_time=t, wear=false}
+ * The file is created and grown as needed, size defaults to its size.
+ * A flash write only clears bits, erase sets them again. While a program
+ * or erase time runs further writes are refused. wear counts erases per
+ * sector, or writes for an EEPROM. Changes reach the file on suspend and
+ * stop, page by page.
+ * @param L Lua state
+ * @return memory object
+ */
+static int
+lua_nv_memory ( lua_State* L )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	luaL_checktype ( L, 1, LUA_TTABLE );
+	lua_getfield ( L, 1, "file" );
+	const char* file = luaL_checkstring ( L, -1 );
+	lua_Integer size = lua_config_integer ( L, 1, "size", 0 );
+	lua_Integer sector = lua_config_integer ( L, 1, "sector", NVMEM_PAGE );
+	lua_Integer erase_value = lua_config_integer ( L, 1, "erase_value", 0xFF );
+	lua_Number program_time = lua_config_number ( L, 1, "program_time", 0 );
+	lua_Number erase_time = lua_config_number ( L, 1, "erase_time", 0 );
+	luaL_argcheck ( L, size >= 0 && sector >= 1, 1, "size and sector must be positive" );
+	luaL_argcheck ( L, ( uint64_t ) size <= SIZE_MAX && ( uint64_t ) sector <= SIZE_MAX, 1, "size too large for the address space" );
+	luaL_argcheck ( L, erase_value >= 0 && erase_value <= 0xFF, 1, "erase_value must be a byte" );
+	luaL_argcheck ( L, program_time >= 0 && erase_time >= 0, 1, "times must not be negative" );
+	lua_getfield ( L, 1, "flash" );
+	bool flash = lua_toboolean ( L, -1 );
+	lua_getfield ( L, 1, "wear" );
+	bool wear = lua_toboolean ( L, -1 );
+	lua_pop ( L, 2 );
+
+	VSM_NVMEM* nv = nvmem_new ( model, file, size, sector, erase_value );
+	if ( NULL == nv )
+		return luaL_error ( L, "cannot map %s", file );
+	lua_pop ( L, 1 );
+	nv->flash = flash;
+	nv->program_time = program_time;
+	nv->erase_time = erase_time;
+	if ( wear && !nvmem_track_wear ( nv ) )
+		return luaL_error ( L, "not enough memory" );
+
+	VSM_NVMEM** ud = lua_newuserdata ( L, sizeof *ud );
+	*ud = nv;
+	luaL_setmetatable ( L, NVMEM_META );
+	/* The model owns the memory, the object lives as long as the model */
+	lua_pushvalue ( L, -1 );
+	nv->lua_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	return 1;
+}
+
+/**
+ * Reads a little endian word: mem:read(addr[, width=1]), width 1 to 8 bytes
+ * @param L Lua state
+ * @return word
+ */
+static int
+lua_nvmem_read ( lua_State* L )
+{
+	VSM_NVMEM* nv = lua_check_nvmem ( L, 1 );
+	lua_Integer addr = luaL_checkinteger ( L, 2 );
+	lua_Integer width = luaL_optinteger ( L, 3, 1 );
+	luaL_argcheck ( L, width >= 1 && width <= 8, 3, "width must be 1 to 8" );
+	lua_nvmem_range ( L, nv, 2, addr, width );
+	VSM_BUFFER view = { .block = nv->block, .data = nv->data, .size = nv->size };
+	lua_pushinteger ( L, buffer_read ( &view, addr, width ) );
+	return 1;
+}
+
+/**
+ * Writes or programs a little endian word: mem:write(addr, value[, width=1])
+ * @param L Lua state
+ * @return false if the part is busy
+ */
+static int
+lua_nvmem_write ( lua_State* L )
+{
+	VSM_NVMEM* nv = lua_check_nvmem ( L, 1 );
+	lua_Integer addr = luaL_checkinteger ( L, 2 );
+	uint64_t value = luaL_checkinteger ( L, 3 );
+	lua_Integer width = luaL_optinteger ( L, 4, 1 );
+	luaL_argcheck ( L, width >= 1 && width <= 8, 4, "width must be 1 to 8" );
+	lua_nvmem_range ( L, nv, 2, addr, width );
+	uint8_t bytes[8];
+	for ( int32_t i=0; i < width; i++, value >>= 8 )
+		bytes[i] = value;
+	lua_pushboolean ( L, nvmem_write ( nv, lua_nvmem_now ( L ), addr, bytes, width ) );
+	return 1;
+}
+
+/**
+ * Writes or programs bytes from a string, a buffer or a memory chip:
+ * mem:load(source[, addr=0])
+ * @param L Lua state
+ * @return false if the part is busy
+ */
+static int
+lua_nvmem_load ( lua_State* L )
+{
+	VSM_NVMEM* nv = lua_check_nvmem ( L, 1 );
+	size_t len;
+	const uint8_t* data = lua_check_bytes ( L, 2, &len );
+	lua_Integer addr = luaL_optinteger ( L, 3, 0 );
+	lua_nvmem_range ( L, nv, 3, addr, len );
+	lua_pushboolean ( L, nvmem_write ( nv, lua_nvmem_now ( L ), addr, data, len ) );
+	return 1;
+}
+
+/**
+ * Erases the sectors of a range, the whole part by default:
+ * mem:erase([addr=0[, length]])
+ * @param L Lua state
+ * @return false if the part is busy
+ */
+static int
+lua_nvmem_erase ( lua_State* L )
+{
+	VSM_NVMEM* nv = lua_check_nvmem ( L, 1 );
+	lua_Integer addr = luaL_optinteger ( L, 2, 0 );
+	lua_Integer length = luaL_optinteger ( L, 3, ( lua_Integer ) nv->size - addr );
+	lua_nvmem_range ( L, nv, 2, addr, length );
+	lua_pushboolean ( L, nvmem_erase ( nv, lua_nvmem_now ( L ), addr, length ) );
+	return 1;
+}
+
+/**
+ * Tells if a program or erase is under way: mem:busy()
+ * @param L Lua state
+ * @return true while busy
+ */
+static int
+lua_nvmem_busy ( lua_State* L )
+{
+	VSM_NVMEM* nv = lua_check_nvmem ( L, 1 );
+	lua_pushboolean ( L, nvmem_busy ( nv, lua_nvmem_now ( L ) ) );
+	return 1;
+}
+
+/**
+ * Wear cycles of the sector holding a byte: mem:wear(addr)
+ * @param L Lua state
+ * @return count, nil if wear is not counted
+ */
+static int
+lua_nvmem_wear ( lua_State* L )
+{
+	VSM_NVMEM* nv = lua_check_nvmem ( L, 1 );
+	lua_Integer addr = luaL_checkinteger ( L, 2 );
+	luaL_argcheck ( L, addr >= 0 && ( size_t ) addr < nv->size, 2, "address outside the memory" );
+	if ( NULL == nv->wear )
+		lua_pushnil ( L );
+	else
+		lua_pushinteger ( L, nv->wear[addr / nv->sector] );
+	return 1;
+}
+
+/**
+ * Writes the changed pages to the file now: mem:flush()
+ * @param L Lua state
+ * @return number of pages flushed
+ */
+static int
+lua_nvmem_flush ( lua_State* L )
+{
+	VSM_NVMEM* nv = lua_check_nvmem ( L, 1 );
+	lua_pushinteger ( L, nvmem_flush ( nv ) );
+	return 1;
+}
+
+/**
+ * Copies bytes out to a Lua string: mem:string([addr=0[, length]])
+ * @param L Lua state
+ * @return string
+ */
+static int
+lua_nvmem_string ( lua_State* L )
+{
+	VSM_NVMEM* nv = lua_check_nvmem ( L, 1 );
+	lua_Integer addr = luaL_optinteger ( L, 2, 0 );
+	lua_Integer length = luaL_optinteger ( L, 3, ( lua_Integer ) nv->size - addr );
+	lua_nvmem_range ( L, nv, 2, addr, length );
+	lua_pushlstring ( L, ( const char* ) nv->data + addr, length );
+	return 1;
+}
+
+/**
+ * Views the contents as a read-only buffer, no copy: mem:buffer()
+ * @param L Lua state
+ * @return buffer
+ */
+static int
+lua_nvmem_buffer ( lua_State* L )
+{
+	VSM_NVMEM* nv = lua_check_nvmem ( L, 1 );
+	lua_push_buffer ( L, nv->block, nv->data, nv->size );
+	return 1;
+}
+
+/**
+ * Size in bytes: #mem
+ * @param L Lua state
+ * @return size
+ */
+static int
+lua_nvmem_len ( lua_State* L )
+{
+	VSM_NVMEM* nv = lua_check_nvmem ( L, 1 );
+	lua_pushinteger ( L, nv->size );
+	return 1;
+}
+
+/**
+ * [Fetch a memory map argument]
+ * @param  L   [Lua state]
+ * @param  idx [argument index]
+ * @return     [map]
+ */
+static VSM_MEMMAP*
+lua_check_memmap ( lua_State* L, int idx )
+{
+	return *( VSM_MEMMAP** ) luaL_checkudata ( L, idx, MEMMAP_META );
+}
+
+/**
+ * [Read hook of an I/O region, runs fn(map, addr, width)]
+ * @param  map   [map]
+ * @param  ctx   [region]
+ * @param  addr  [address]
+ * @param  width [bytes]
+ * @return       [number returned by the hook, the open bus if it returned none]
+ */
+static uint64_t
+lua_memmap_io_read ( VSM_MEMMAP* map, void* ctx, uint64_t addr, uint8_t width )
+{
+	MEMMAP_REGION* region = ctx;
+	lua_State* L = map->model->luactx;
+	uint64_t value = 0;
+	for ( int32_t i=0; i < width; i++ )
+		value = ( value << 8 ) | map->open_bus;
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, region->read_ref );
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, map->lua_ref );
+	lua_pushinteger ( L, addr );
+	lua_pushinteger ( L, width );
+	if ( 0 != lua_pcall ( L, 3, 1, 0 ) )
+	{
+		out_error ( map->model, "I/O read at %llx: %s", ( unsigned long long ) addr, lua_tostring ( L, -1 ) );
+		lua_pop ( L, 1 );
+		return value;
+	}
+	if ( lua_isinteger ( L, -1 ) )
+		value = lua_tointeger ( L, -1 );
+	lua_pop ( L, 1 );
+	return value;
+}
+
+/**
+ * [Write hook of an I/O region, runs fn(map, addr, value, width)]
+ * @param map   [map]
+ * @param ctx   [region]
+ * @param addr  [address]
+ * @param value [word written]
+ * @param width [bytes]
+ */
+static void
+lua_memmap_io_write ( VSM_MEMMAP* map, void* ctx, uint64_t addr, uint64_t value, uint8_t width )
+{
+	MEMMAP_REGION* region = ctx;
+	lua_State* L = map->model->luactx;
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, region->write_ref );
+	lua_rawgeti ( L, LUA_REGISTRYINDEX, map->lua_ref );
+	lua_pushinteger ( L, addr );
+	lua_pushinteger ( L, value );
+	lua_pushinteger ( L, width );
+	if ( 0 != lua_pcall ( L, 4, 0, 0 ) )
+	{
+		out_error ( map->model, "I/O write at %llx: %s", ( unsigned long long ) addr, lua_tostring ( L, -1 ) );
+		lua_pop ( L, 1 );
+	}
+}
+
+/**
+ * [Release hook of a script I/O region, drops its hook references]
+ * @param map    [map]
+ * @param region [region no page points at any more]
+ */
+static void
+lua_memmap_io_free ( VSM_MEMMAP* map, MEMMAP_REGION* region )
+{
+	luaL_unref ( map->model->luactx, LUA_REGISTRYINDEX, region->read_ref );
+	luaL_unref ( map->model->luactx, LUA_REGISTRYINDEX, region->write_ref );
+}
+
+/**
+ * Creates an address space for a CPU or DMA master:
+ * memory_map{addr_bits=16, page_bits=8, open_bus=0xFF}
+ * Regions are registered once with map, io and unmap, then reads and
+ * writes of memory pages never enter the script.
+ * @param L Lua state
+ * @return map object
+ */
+static int
+lua_memory_map ( lua_State* L )
+{
+	VSM_MODEL* model = lua_get_model ( L );
+	if ( lua_isnoneornil ( L, 1 ) )
+	{
+		lua_settop ( L, 0 );
+		lua_newtable ( L );
+	}
+	luaL_checktype ( L, 1, LUA_TTABLE );
+	lua_Integer addr_bits = lua_config_integer ( L, 1, "addr_bits", 16 );
+	lua_Integer page_bits = lua_config_integer ( L, 1, "page_bits", 8 );
+	lua_Integer open_bus = lua_config_integer ( L, 1, "open_bus", 0xFF );
+	luaL_argcheck ( L, addr_bits >= 1 && addr_bits <= 48, 1, "addr_bits must be 1 to 48" );
+	luaL_argcheck ( L, page_bits >= 0 && page_bits <= addr_bits, 1, "page_bits must be 0 to addr_bits" );
+	luaL_argcheck ( L, addr_bits - page_bits <= 24, 1, "page table too large, use bigger pages" );
+	VSM_MEMMAP* map = memmap_new ( model, addr_bits, page_bits );
+	if ( NULL == map )
+		return luaL_error ( L, "not enough memory" );
+	map->open_bus = open_bus;
+
+	VSM_MEMMAP** ud = lua_newuserdata ( L, sizeof *ud );
+	*ud = map;
+	luaL_setmetatable ( L, MEMMAP_META );
+	/* The model owns the map, the object lives as long as the model */
+	lua_pushvalue ( L, -1 );
+	map->lua_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	return 1;
+}
+
+/**
+ * [Check a page aligned range of a map]
+ * @param  L    [Lua state]
+ * @param  map  [map]
+ * @param  arg  [argument index of the base, used in the error]
+ * @param  base [first address]
+ * @param  size [bytes]
+ */
+static void
+lua_memmap_range ( lua_State* L, const VSM_MEMMAP* map, int arg, lua_Integer base, lua_Integer size )
+{
+	lua_Integer mask = ( 1LL << map->page_bits ) - 1;
+	luaL_argcheck ( L, 0 == ( base & mask ) && 0 == ( size & mask ) && size > 0, arg, "range must be whole pages" );
+	luaL_argcheck ( L, base >= 0 && ( uint64_t ) base < map->size && ( uint64_t ) size <= map->size - base, arg, "range outside the address space" );
+}
+
+/**
+ * Maps memory read and written in place:
+ * map:map(base, source[, readonly=false]), source is a buffer, a memory
+ * chip or a persistent memory, its size must be whole pages. Read-only
+ * buffers and persistent memories map as ROM.
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_memmap_map ( lua_State* L )
+{
+	VSM_MEMMAP* map = lua_check_memmap ( L, 1 );
+	lua_Integer base = luaL_checkinteger ( L, 2 );
+	VSM_BLOCK* block;
+	uint8_t* data;
+	size_t size;
+	VSM_BUFFER* buf = luaL_testudata ( L, 3, BUFFER_META );
+	VSM_MEMCHIP** chip = luaL_testudata ( L, 3, MEMCHIP_META );
+	VSM_NVMEM** nv = luaL_testudata ( L, 3, NVMEM_META );
+	if ( buf )
+	{
+		block = buf->block;
+		data = buf->data;
+		size = buf->size;
+	}
+	else if ( chip )
+	{
+		block = ( *chip )->block;
+		data = ( *chip )->mem;
+		size = ( *chip )->size;
+	}
+	else if ( nv )
+	{
+		block = ( *nv )->block;
+		data = ( *nv )->data;
+		size = ( *nv )->size;
+	}
+	else
+	{
+		return luaL_argerror ( L, 3, "buffer, memory chip or persistent memory expected" );
+	}
+	lua_memmap_range ( L, map, 2, base, size );
+	if ( NULL == memmap_ram ( map, base, block, data, size, lua_toboolean ( L, 4 ) ) )
+		return luaL_error ( L, "not enough memory" );
+	return 0;
+}
+
+/**
+ * Maps I/O served by the script: map:io(base, size, read, write)
+ * read(map, addr, width) returns the word, write(map, addr, value, width)
+ * stores it, either may be nil.
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_memmap_io ( lua_State* L )
+{
+	VSM_MEMMAP* map = lua_check_memmap ( L, 1 );
+	lua_Integer base = luaL_checkinteger ( L, 2 );
+	lua_Integer size = luaL_checkinteger ( L, 3 );
+	lua_memmap_range ( L, map, 2, base, size );
+	if ( !lua_isnoneornil ( L, 4 ) )
+		luaL_checktype ( L, 4, LUA_TFUNCTION );
+	if ( !lua_isnoneornil ( L, 5 ) )
+		luaL_checktype ( L, 5, LUA_TFUNCTION );
+	bool read = !lua_isnoneornil ( L, 4 );
+	bool write = !lua_isnoneornil ( L, 5 );
+	MEMMAP_REGION* region = memmap_io ( map, base, size, read ? lua_memmap_io_read : NULL,
+	                                    write ? lua_memmap_io_write : NULL, NULL );
+	if ( NULL == region )
+		return luaL_error ( L, "not enough memory" );
+	region->ctx = region;
+	region->free = lua_memmap_io_free;
+	if ( read )
+	{
+		lua_pushvalue ( L, 4 );
+		region->read_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	}
+	if ( write )
+	{
+		lua_pushvalue ( L, 5 );
+		region->write_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+	}
+	return 0;
+}
+
+/**
+ * Returns pages to the open bus: map:unmap(base, size)
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_memmap_unmap ( lua_State* L )
+{
+	VSM_MEMMAP* map = lua_check_memmap ( L, 1 );
+	lua_Integer base = luaL_checkinteger ( L, 2 );
+	lua_Integer size = luaL_checkinteger ( L, 3 );
+	lua_memmap_range ( L, map, 2, base, size );
+	memmap_unmap ( map, base, size );
+	return 0;
+}
+
+/**
+ * Reads a little endian word: map:read(addr[, width=1]), width 1 to 8 bytes
+ * @param L Lua state
+ * @return word
+ */
+static int
+lua_memmap_read ( lua_State* L )
+{
+	VSM_MEMMAP* map = lua_check_memmap ( L, 1 );
+	lua_Integer addr = luaL_checkinteger ( L, 2 );
+	lua_Integer width = luaL_optinteger ( L, 3, 1 );
+	luaL_argcheck ( L, width >= 1 && width <= 8, 3, "width must be 1 to 8" );
+	lua_pushinteger ( L, memmap_read ( map, addr, width ) );
+	return 1;
+}
+
+/**
+ * Writes a little endian word: map:write(addr, value[, width=1])
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_memmap_write ( lua_State* L )
+{
+	VSM_MEMMAP* map = lua_check_memmap ( L, 1 );
+	lua_Integer addr = luaL_checkinteger ( L, 2 );
+	lua_Integer value = luaL_checkinteger ( L, 3 );
+	lua_Integer width = luaL_optinteger ( L, 4, 1 );
+	luaL_argcheck ( L, width >= 1 && width <= 8, 4, "width must be 1 to 8" );
+	memmap_write ( map, addr, value, width );
+	return 0;
+}
+
+/**
+ * Reads bytes through the map, I/O included: map:string(addr, length)
+ * @param L Lua state
+ * @return string
+ */
+static int
+lua_memmap_string ( lua_State* L )
+{
+	VSM_MEMMAP* map = lua_check_memmap ( L, 1 );
+	lua_Integer addr = luaL_checkinteger ( L, 2 );
+	lua_Integer length = luaL_checkinteger ( L, 3 );
+	luaL_argcheck ( L, length >= 0, 3, "length must not be negative" );
+	luaL_Buffer b;
+	char* out = luaL_buffinitsize ( L, &b, length );
+	for ( lua_Integer i=0; i < length; i++ )
+		out[i] = memmap_read ( map, addr + i, 1 );
+	luaL_pushresultsize ( &b, length );
+	return 1;
+}
+
+/**
+ * Writes bytes from a string, a buffer or a memory chip through the map:
+ * map:load(source[, addr=0])
+ * @param L Lua state
+ * @return nothing
+ */
+static int
+lua_memmap_load ( lua_State* L )
+{
+	VSM_MEMMAP* map = lua_check_memmap ( L, 1 );
+	size_t len;
+	const uint8_t* data = lua_check_bytes ( L, 2, &len );
+	lua_Integer addr = luaL_optinteger ( L, 3, 0 );
+	for ( size_t i=0; i < len; i++ )
+		memmap_write ( map, addr + i, data[i], 1 );
+	return 0;
+}
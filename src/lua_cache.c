@@ -0,0 +1,454 @@
+/**
+ *
+ * @file   lua_cache.c
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Compiled model script cache.
+ *
+ * Scripts are compiled once and their bytecode is stored next to the
+ * script (or in LUAVSM_CACHE directory), keyed by the script modification
+ * time, size and content hash. A stale or unreadable cache silently falls
+ * back to compiling the source.
+ *
+ * On top of that the bytecode image is kept in memory for the lifetime of
+ * the process, so further instances of the same model neither touch the
+ * disk cache nor compile, they just load the image into their own state.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <vsm_api.h>
+#include <sys/stat.h>
+
+typedef struct lua_dump_buffer
+{
+	uint8_t* data;
+	size_t size;
+	size_t capacity;
+} lua_dump_buffer;
+
+static LUA_CHUNK* chunk_list = NULL; ///< Compiled images of every script loaded so far
+
+/**
+ * [FNV-1a hash of a memory block]
+ * @param  data [data to hash]
+ * @param  size [data size]
+ * @return      [64-bit hash]
+ */
+uint64_t
+lua_cache_hash ( const uint8_t* data, size_t size )
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for ( size_t i=0; i < size; i++ )
+	{
+		hash ^= data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/**
+ * [Read a whole file into memory]
+ * @param  path [file name]
+ * @param  size [file size on return]
+ * @return      [malloc'ed file content or NULL]
+ */
+static uint8_t*
+read_file ( const char* path, size_t* size )
+{
+	FILE* file = fopen ( path, "rb" );
+	if ( NULL == file )
+		return NULL;
+
+	fseek ( file, 0, SEEK_END );
+	long length = ftell ( file );
+	fseek ( file, 0, SEEK_SET );
+	uint8_t* data = length < 0 ? NULL : malloc ( length + 1 );
+	if ( NULL == data || ( size_t ) length != fread ( data, 1, length, file ) )
+	{
+		free ( data );
+		fclose ( file );
+		return NULL;
+	}
+	fclose ( file );
+	*size = length;
+	return data;
+}
+
+/**
+ * [Build the cache file name for a script]
+ * @param  script [full script path]
+ * @return        [malloc'ed cache path, NULL if out of memory]
+ */
+static char*
+cache_path ( const char* script )
+{
+	char* path = NULL;
+	char cache_dir[MAX_PATH] = {0};
+	if ( 0 == GetEnvironmentVariable ( LUA_CACHE_ENV, cache_dir, sizeof cache_dir ) )
+	{
+		if ( asprintf ( &path, "%s%s", script, LUA_CACHE_EXT ) < 0 )
+			return NULL;
+		return path;
+	}
+	/* Only the script name goes into the shared cache directory */
+	const char* name = strrchr ( script, '\\' );
+	const char* name_unix = strrchr ( script, '/' );
+	if ( name_unix > name )
+		name = name_unix;
+	name = name ? name + 1 : script;
+	size_t len = strlen ( cache_dir );
+	if ( asprintf ( &path, "%s%s%s%s", cache_dir, '\\' == cache_dir[len-1] ? "" : "\\", name, LUA_CACHE_EXT ) < 0 )
+		return NULL;
+	return path;
+}
+
+static int
+dump_writer ( lua_State* L, const void* p, size_t sz, void* ud )
+{
+	( void ) L;
+	lua_dump_buffer* buf = ud;
+	if ( buf->size + sz > buf->capacity )
+	{
+		size_t capacity = buf->capacity ? buf->capacity * 2 : 4096;
+		while ( capacity < buf->size + sz )
+			capacity *= 2;
+		uint8_t* data = realloc ( buf->data, capacity );
+		if ( NULL == data )
+			return 1;
+		buf->data = data;
+		buf->capacity = capacity;
+	}
+	memcpy ( buf->data + buf->size, p, sz );
+	buf->size += sz;
+	return 0;
+}
+
+/**
+ * [Dump the compiled chunk on top of the stack into memory]
+ * @param  L   [Lua state, chunk on top of the stack]
+ * @param  buf [dump buffer, caller frees buf->data]
+ * @return     [true on success]
+ */
+static bool
+dump_chunk ( lua_State* L, lua_dump_buffer* buf )
+{
+	memset ( buf, 0, sizeof *buf );
+	if ( 0 != lua_dump ( L, dump_writer, buf, 0 ) )
+	{
+		free ( buf->data );
+		buf->data = NULL;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * [Write a dumped chunk into the cache file]
+ * @param path   [cache file name]
+ * @param header [filled cache header]
+ * @param buf    [dumped chunk]
+ */
+static void
+store_chunk ( const char* path, const LUA_CACHE_HEADER* header, const lua_dump_buffer* buf )
+{
+	/* Write aside and swap, so a concurrent reader never sees a torn file */
+	char* tmp = NULL;
+	if ( asprintf ( &tmp, "%s.tmp", path ) < 0 )
+		return;
+	FILE* file = fopen ( tmp, "wb" );
+	if ( file )
+	{
+		bool ok = 1 == fwrite ( header, sizeof *header, 1, file ) &&
+		          buf->size == fwrite ( buf->data, 1, buf->size, file );
+		ok = 0 == fclose ( file ) && ok;
+		remove ( path );
+		if ( false == ok || 0 != rename ( tmp, path ) )
+			remove ( tmp );
+	}
+	free ( tmp );
+}
+
+/**
+ * [Drop a reference to a chunk, freeing it with its tables on the last one]
+ * @param chunk [chunk, NULL is ignored]
+ */
+void
+lua_cache_release ( LUA_CHUNK* chunk )
+{
+	if ( NULL == chunk || 0 != --chunk->refcount )
+		return;
+
+	while ( chunk->tables )
+	{
+		LUA_SHARED_TABLE* table = chunk->tables;
+		chunk->tables = table->next;
+		free ( table->name );
+		free ( table->ivalues );
+		free ( table );
+	}
+	free ( chunk->script );
+	free ( chunk->image );
+	free ( chunk );
+}
+
+/**
+ * [Forget every cached image, models still using one keep it alive]
+ */
+void
+lua_cache_flush ( void )
+{
+	while ( chunk_list )
+	{
+		LUA_CHUNK* chunk = chunk_list;
+		chunk_list = chunk->next;
+		lua_cache_release ( chunk );
+	}
+}
+
+/**
+ * [Find the cached image of a script and unlink it if the script changed]
+ * @param  script [full script path]
+ * @param  st     [current script status]
+ * @return        [up to date chunk or NULL]
+ */
+static LUA_CHUNK*
+find_chunk ( const char* script, const struct stat* st )
+{
+	for ( LUA_CHUNK** link = &chunk_list; *link; link = &( *link )->next )
+	{
+		LUA_CHUNK* chunk = *link;
+		if ( 0 != strcmp ( chunk->script, script ) )
+			continue;
+		if ( chunk->source_mtime == ( uint64_t ) st->st_mtime && chunk->source_size == ( uint32_t ) st->st_size )
+			return chunk;
+		*link = chunk->next;
+		lua_cache_release ( chunk );
+		return NULL;
+	}
+	return NULL;
+}
+
+/**
+ * [Publish a bytecode image to the process cache]
+ * @param  script [full script path]
+ * @param  header [header describing the script the image was built from]
+ * @param  image  [malloc'ed image, owned by the chunk afterwards]
+ * @param  size   [image size]
+ * @return        [new chunk or NULL]
+ */
+static LUA_CHUNK*
+add_chunk ( const char* script, const LUA_CACHE_HEADER* header, uint8_t* image, size_t size )
+{
+	LUA_CHUNK* chunk = calloc ( 1, sizeof *chunk );
+	if ( NULL == chunk )
+	{
+		free ( image );
+		return NULL;
+	}
+	chunk->script = strdup ( script );
+	if ( NULL == chunk->script )
+	{
+		free ( chunk );
+		free ( image );
+		return NULL;
+	}
+	chunk->source_mtime = header->source_mtime;
+	chunk->source_size = header->source_size;
+	chunk->image = image;
+	chunk->image_size = size;
+	chunk->refcount = 1;
+	chunk->next = chunk_list;
+	chunk_list = chunk;
+	return chunk;
+}
+
+/**
+ * [Length of the prefix luaL_loadfile skips in a script]
+ *
+ * A UTF-8 byte order mark and a first line starting with '#'. The newline
+ * ending that line is kept so line numbers stay right.
+ *
+ * @param  source [script text]
+ * @param  size   [script size]
+ * @return        [bytes to skip]
+ */
+static size_t
+source_prefix ( const uint8_t* source, size_t size )
+{
+	size_t skip = 0;
+	if ( size >= 3 && 0 == memcmp ( source, "\xEF\xBB\xBF", 3 ) )
+		skip = 3;
+	if ( skip < size && '#' == source[skip] )
+		while ( skip < size && '\n' != source[skip] )
+			skip++;
+	return skip;
+}
+
+/**
+ * [Load a model script, preferring its cached bytecode]
+ *
+ * On success model->chunk holds a reference to the process-wide image.
+ *
+ * @param  model  [model context]
+ * @param  script [full script path]
+ * @return        [luaL_loadfile compatible status, the chunk or error message is on the stack]
+ */
+int32_t
+lua_cache_load ( VSM_MODEL* model, const char* script )
+{
+	lua_State* L = model->luactx;
+	struct stat st;
+	if ( 0 != stat ( script, &st ) )
+	{
+		lua_pushfstring ( L, "cannot open %s", script );
+		return LUA_ERRFILE;
+	}
+
+	/* Lua names a chunk without a name "?" */
+	char* chunkname = NULL;
+	if ( asprintf ( &chunkname, "@%s", script ) < 0 )
+		chunkname = NULL;
+
+	/* Another instance already compiled it */
+	LUA_CHUNK* chunk = find_chunk ( script, &st );
+	if ( chunk )
+	{
+		int32_t err = luaL_loadbufferx ( L, ( const char* ) chunk->image, chunk->image_size, chunkname, "b" );
+		free ( chunkname );
+		if ( LUA_OK == err )
+		{
+			chunk->refcount++;
+			model->chunk = chunk;
+		}
+		return err;
+	}
+
+	size_t source_size = 0;
+	uint8_t* source = read_file ( script, &source_size );
+	if ( NULL == source )
+	{
+		free ( chunkname );
+		lua_pushfstring ( L, "cannot open %s", script );
+		return LUA_ERRFILE;
+	}
+
+	LUA_CACHE_HEADER header;
+	memset ( &header, 0, sizeof header );
+	memcpy ( header.magic, LUA_CACHE_MAGIC, sizeof header.magic );
+	header.version = LUA_VERSION_NUM;
+	header.source_size = source_size;
+	header.source_mtime = st.st_mtime;
+	header.source_hash = lua_cache_hash ( source, source_size );
+
+	/* Without a cache path the script is only compiled */
+	char* path = cache_path ( script );
+	size_t cache_size = 0;
+	uint8_t* cache = path ? read_file ( path, &cache_size ) : NULL;
+	lua_dump_buffer buf = {0};
+	int32_t err = LUA_ERRERR;
+	if ( cache && cache_size > sizeof header && 0 == memcmp ( cache, &header, sizeof header ) )
+	{
+		err = luaL_loadbufferx ( L, ( const char* ) cache + sizeof header, cache_size - sizeof header, chunkname, "b" );
+		if ( LUA_OK == err )
+		{
+			buf.size = cache_size - sizeof header;
+			memmove ( cache, cache + sizeof header, buf.size );
+			buf.data = cache;
+			cache = NULL;
+		}
+		else
+		{
+			/* Corrupted or foreign bytecode, rebuild from source */
+			lua_pop ( L, 1 );
+		}
+	}
+	free ( cache );
+
+	if ( LUA_OK != err )
+	{
+		size_t skip = source_prefix ( source, source_size );
+		err = luaL_loadbufferx ( L, ( const char* ) source + skip, source_size - skip, chunkname, "t" );
+		if ( LUA_OK == err && dump_chunk ( L, &buf ) && path )
+			store_chunk ( path, &header, &buf );
+	}
+
+	if ( LUA_OK == err && buf.data )
+	{
+		chunk = add_chunk ( script, &header, buf.data, buf.size );
+		if ( chunk )
+		{
+			chunk->refcount++;
+			model->chunk = chunk;
+		}
+	}
+
+	free ( path );
+	free ( chunkname );
+	free ( source );
+	return err;
+}
+
+/**
+ * [Find a constant table published by an earlier instance of the script]
+ * @param  chunk [script image]
+ * @param  name  [table name]
+ * @return       [table or NULL]
+ */
+LUA_SHARED_TABLE*
+lua_cache_find_table ( LUA_CHUNK* chunk, const char* name )
+{
+	for ( LUA_SHARED_TABLE* table = chunk->tables; table; table = table->next )
+	{
+		if ( 0 == strcmp ( table->name, name ) )
+			return table;
+	}
+	return NULL;
+}
+
+/**
+ * [Allocate a constant table shared by every instance of the script]
+ * @param  chunk   [script image]
+ * @param  name    [table name]
+ * @param  count   [number of values]
+ * @param  integer [values are integers rather than numbers]
+ * @return         [table with uninitialized values or NULL]
+ */
+LUA_SHARED_TABLE*
+lua_cache_add_table ( LUA_CHUNK* chunk, const char* name, size_t count, bool integer )
+{
+	LUA_SHARED_TABLE* table = calloc ( 1, sizeof *table );
+	if ( NULL == table )
+		return NULL;
+	table->ivalues = malloc ( ( count ? count : 1 ) * ( integer ? sizeof ( lua_Integer ) : sizeof ( lua_Number ) ) );
+	if ( NULL == table->ivalues )
+	{
+		free ( table );
+		return NULL;
+	}
+	table->name = strdup ( name );
+	if ( NULL == table->name )
+	{
+		free ( table->ivalues );
+		free ( table );
+		return NULL;
+	}
+	table->integer = integer;
+	table->count = count;
+	table->next = chunk->tables;
+	chunk->tables = table;
+	return table;
+}
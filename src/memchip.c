@@ -0,0 +1,210 @@
+/**
+ *
+ * @file   memchip.c
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Native ROM and RAM chips.
+ *
+ * A chip watches its address group and control pins on every simulate
+ * call of the model and does the decode, the data drive with its access
+ * times, the release to high impedance and, for RAMs, the write at the
+ * end of the write strobe. Scripts only describe the chip once.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <vsm_api.h>
+
+/**
+ * [Copy a pin group so the chip does not depend on a Lua object]
+ * @param  group [pin group]
+ * @return       [copy or NULL if out of memory]
+ */
+static VSM_PIN_GROUP*
+memchip_group_copy ( const VSM_PIN_GROUP* group )
+{
+	size_t size = sizeof *group + group->width * sizeof group->pins[0];
+	VSM_PIN_GROUP* copy = malloc ( size );
+	if ( copy )
+		memcpy ( copy, group, size );
+	return copy;
+}
+
+/**
+ * [Create a chip and register it with the model]
+ * @param  model [model context]
+ * @param  addr  [address group, copied]
+ * @param  data  [data group, copied, up to 64 pins]
+ * @param  words [addressable words, higher addresses wrap]
+ * @return       [chip with zeroed contents and no control pins, NULL if the
+ *                 contents do not fit the address space or out of memory]
+ */
+VSM_MEMCHIP*
+memchip_new ( VSM_MODEL* model, VSM_PIN_GROUP* addr, VSM_PIN_GROUP* data, uint64_t words )
+{
+	uint8_t word_bytes = ( data->width + 7 ) / 8;
+	if ( 0 == words || words > SIZE_MAX / word_bytes )
+		return NULL;
+	VSM_MEMCHIP** chips = realloc ( model->memchips, ( model->memchip_count + 1 ) * sizeof *chips );
+	if ( NULL == chips )
+		return NULL;
+	model->memchips = chips;
+
+	VSM_MEMCHIP* chip = calloc ( 1, sizeof *chip );
+	if ( NULL == chip )
+		return NULL;
+	chip->word_bytes = word_bytes;
+	chip->words = words;
+	chip->size = words * chip->word_bytes;
+	chip->addr = memchip_group_copy ( addr );
+	chip->data = memchip_group_copy ( data );
+	chip->block = block_new ( chip->size );
+	if ( NULL == chip->addr || NULL == chip->data || NULL == chip->block )
+	{
+		memchip_free ( chip );
+		return NULL;
+	}
+	chip->mem = chip->block->data;
+	promote_pin_group ( chip->addr );
+	promote_pin_group ( chip->data );
+	chip->model = model;
+	chip->last_addr = ~0ULL;
+	chip->lua_ref = LUA_NOREF;
+	model->memchips[model->memchip_count++] = chip;
+	return chip;
+}
+
+/**
+ * [Release a chip, only done when the model goes away]
+ * @param chip [chip]
+ */
+void
+memchip_free ( VSM_MEMCHIP* chip )
+{
+	free ( chip->addr );
+	free ( chip->data );
+	block_release ( chip->block );
+	free ( chip );
+}
+
+/**
+ * [Read a word]
+ * @param  chip [chip]
+ * @param  addr [word address, wraps]
+ * @return      [word]
+ */
+uint64_t
+memchip_peek ( VSM_MEMCHIP* chip, uint64_t addr )
+{
+	const uint8_t* p = chip->mem + ( addr % chip->words ) * chip->word_bytes;
+	uint64_t value = 0;
+	for ( int32_t i=chip->word_bytes - 1; i >= 0; i-- )
+		value = ( value << 8 ) | p[i];
+	return value;
+}
+
+/**
+ * [Write a word, the data pins follow on the next evaluation]
+ * @param chip  [chip]
+ * @param addr  [word address, wraps]
+ * @param value [word]
+ */
+void
+memchip_poke ( VSM_MEMCHIP* chip, uint64_t addr, uint64_t value )
+{
+	uint8_t* p = chip->mem + ( addr % chip->words ) * chip->word_bytes;
+	for ( int32_t i=0; i < chip->word_bytes; i++, value >>= 8 )
+		p[i] = value;
+}
+
+/**
+ * [Level of a control pin]
+ * @param  chip [chip]
+ * @param  pin  [control pin, NULL counts as asserted]
+ * @return      [true if asserted]
+ */
+static inline bool
+memchip_active ( VSM_MEMCHIP* chip, VSM_PIN* pin )
+{
+	if ( NULL == pin )
+		return true;
+	return chip->active_high ? is_pin_high ( pin->pin ) : is_pin_low ( pin->pin );
+}
+
+/**
+ * [Follow the pins after a simulate call]
+ * @param chip  [chip]
+ * @param atime [current time]
+ */
+void
+memchip_simulate ( VSM_MEMCHIP* chip, ABSTIME atime )
+{
+	uint64_t addr = read_pins ( chip->addr ) % chip->words;
+	bool ce = memchip_active ( chip, chip->ce );
+	bool we = chip->we && memchip_active ( chip, chip->we );
+
+	/* A write lands when the strobe closes, by WE or by CE */
+	if ( chip->writing && !( ce && we ) )
+		memchip_poke ( chip, chip->last_addr, read_pins ( chip->data ) );
+	chip->writing = ce && we;
+
+	if ( ce && !we && memchip_active ( chip, chip->oe ) )
+	{
+		uint64_t value = memchip_peek ( chip, addr );
+		if ( !chip->driving || value != chip->out_value || addr != chip->last_addr )
+		{
+			/* Output enable alone is faster than a new address or select */
+			bool fresh = chip->driving || addr != chip->last_addr || ce != chip->last_ce;
+			drive_pins ( chip->data, atime + ( fresh ? chip->access : chip->enable ), value );
+			chip->driving = true;
+			chip->out_value = value;
+		}
+	}
+	else if ( chip->driving )
+	{
+		release_pins ( chip->data, atime + chip->release );
+		chip->driving = false;
+	}
+	chip->last_addr = addr;
+	chip->last_ce = ce;
+}
+
+/**
+ * [Use an image in place instead of the chip own contents]
+ *
+ * The image is shared when it covers the whole chip and, for a RAM, can
+ * be written. Otherwise it is copied in and the chip keeps its own block.
+ *
+ * @param  chip  [chip]
+ * @param  block [block holding the image]
+ * @param  data  [first image byte, inside block]
+ * @param  size  [image bytes]
+ * @return       [true if shared, false if copied]
+ */
+bool
+memchip_attach ( VSM_MEMCHIP* chip, VSM_BLOCK* block, uint8_t* data, size_t size )
+{
+	if ( size < chip->size || ( chip->we && block->readonly ) )
+	{
+		memcpy ( chip->mem, data, size < chip->size ? size : chip->size );
+		return false;
+	}
+	block_retain ( block );
+	block_release ( chip->block );
+	chip->block = block;
+	chip->mem = data;
+	return true;
+}
@@ -0,0 +1,332 @@
+/**
+ *
+ * @file   memmap.c
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Paged address space decoding.
+ *
+ * The address space is cut into pages, each pointing straight at the
+ * memory behind it or at the region whose handlers serve it. Regions are
+ * registered once; after that a RAM or ROM access is a table lookup and a
+ * copy, only I/O pages call out, to C or to the script.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <vsm_api.h>
+
+/**
+ * [Check that a range covers whole pages inside the address space]
+ * @param  map  [map]
+ * @param  base [first address]
+ * @param  size [bytes]
+ * @return      [true if usable]
+ */
+static bool
+memmap_aligned ( const VSM_MEMMAP* map, uint64_t base, uint64_t size )
+{
+	uint64_t mask = ( 1ULL << map->page_bits ) - 1;
+	return 0 == ( base & mask ) && 0 == ( size & mask ) && size && base < map->size && size <= map->size - base;
+}
+
+/**
+ * [Release the regions no page points at any more]
+ *
+ * A handler may remap its own pages, so nothing is released while one is
+ * running; the last handler to return sweeps instead.
+ *
+ * @param map [map]
+ */
+static void
+memmap_sweep ( VSM_MEMMAP* map )
+{
+	if ( map->dispatch )
+		return;
+	for ( int32_t i=map->region_count - 1; i >= 0; i-- )
+	{
+		MEMMAP_REGION* region = map->regions[i];
+		if ( region->pages )
+			continue;
+		if ( region->free )
+			region->free ( map, region );
+		block_release ( region->block );
+		free ( region );
+		map->regions[i] = map->regions[--map->region_count];
+	}
+}
+
+/**
+ * [Point pages at a region, or at nothing]
+ * @param map    [map]
+ * @param base   [first address, page aligned]
+ * @param size   [bytes, whole pages]
+ * @param data   [memory of the first page, NULL for I/O or unmapped pages]
+ * @param write  [pages are written in place]
+ * @param region [region or NULL to unmap]
+ */
+static void
+memmap_set_pages ( VSM_MEMMAP* map, uint64_t base, uint64_t size, uint8_t* data, bool write, MEMMAP_REGION* region )
+{
+	uint64_t page_size = 1ULL << map->page_bits;
+	for ( uint64_t off=0; off < size; off += page_size )
+	{
+		MEMMAP_PAGE* page = &map->pages[( base + off ) >> map->page_bits];
+		if ( page->region )
+			page->region->pages--;
+		page->read = data ? data + off : NULL;
+		page->write = data && write ? data + off : NULL;
+		page->region = region;
+		if ( region )
+			region->pages++;
+	}
+	memmap_sweep ( map );
+}
+
+/**
+ * [Add a region, it lives while pages point at it]
+ * @param  map  [map]
+ * @param  base [first address]
+ * @param  size [bytes]
+ * @return      [zeroed region or NULL if out of memory]
+ */
+static MEMMAP_REGION*
+memmap_region ( VSM_MEMMAP* map, uint64_t base, uint64_t size )
+{
+	MEMMAP_REGION** regions = realloc ( map->regions, ( map->region_count + 1 ) * sizeof *regions );
+	if ( NULL == regions )
+		return NULL;
+	map->regions = regions;
+	MEMMAP_REGION* region = calloc ( 1, sizeof *region );
+	if ( NULL == region )
+		return NULL;
+	region->base = base;
+	region->size = size;
+	region->read_ref = LUA_NOREF;
+	region->write_ref = LUA_NOREF;
+	map->regions[map->region_count++] = region;
+	return region;
+}
+
+/**
+ * [Create a map with every page unmapped and register it with the model]
+ * @param  model     [model context]
+ * @param  addr_bits [address bits, up to 48]
+ * @param  page_bits [log2 of the page size, at most addr_bits]
+ * @return           [map or NULL if the page table is too large or out of memory]
+ */
+VSM_MEMMAP*
+memmap_new ( VSM_MODEL* model, uint8_t addr_bits, uint8_t page_bits )
+{
+	if ( addr_bits > 48 || page_bits > addr_bits || ( 1ULL << ( addr_bits - page_bits ) ) > MEMMAP_MAX_PAGES )
+		return NULL;
+	VSM_MEMMAP** memmaps = realloc ( model->memmaps, ( model->memmap_count + 1 ) * sizeof *memmaps );
+	if ( NULL == memmaps )
+		return NULL;
+	model->memmaps = memmaps;
+
+	VSM_MEMMAP* map = calloc ( 1, sizeof *map );
+	if ( NULL == map )
+		return NULL;
+	map->page_count = 1ULL << ( addr_bits - page_bits );
+	map->pages = calloc ( map->page_count, sizeof *map->pages );
+	if ( NULL == map->pages )
+	{
+		free ( map );
+		return NULL;
+	}
+	map->model = model;
+	map->page_bits = page_bits;
+	map->size = 1ULL << addr_bits;
+	map->open_bus = 0xFF;
+	map->lua_ref = LUA_NOREF;
+	model->memmaps[model->memmap_count++] = map;
+	return map;
+}
+
+/**
+ * [Release a map and its references to memory, only done when the model goes away]
+ * @param map [map]
+ */
+void
+memmap_free ( VSM_MEMMAP* map )
+{
+	/* The script is already closed, region free hooks are not run */
+	for ( int32_t i=0; i < map->region_count; i++ )
+	{
+		block_release ( map->regions[i]->block );
+		free ( map->regions[i] );
+	}
+	free ( map->regions );
+	free ( map->pages );
+	free ( map );
+}
+
+/**
+ * [Run an I/O handler, regions it unmaps are released once it returns]
+ * @param  map   [map]
+ * @param  page  [I/O page]
+ * @param  addr  [address]
+ * @param  width [bytes]
+ * @return       [word read]
+ */
+static uint64_t
+memmap_io_read ( VSM_MEMMAP* map, MEMMAP_PAGE* page, uint64_t addr, uint8_t width )
+{
+	MEMMAP_REGION* region = page->region;
+	map->dispatch++;
+	uint64_t value = region->read ( map, region->ctx, addr, width );
+	map->dispatch--;
+	memmap_sweep ( map );
+	return value;
+}
+
+/**
+ * [Map memory, later regions cover earlier ones page by page]
+ * @param  map      [map]
+ * @param  base     [first address, page aligned]
+ * @param  block    [block holding the memory, the map takes a reference]
+ * @param  data     [first byte, inside block]
+ * @param  size     [bytes, whole pages]
+ * @param  readonly [writes are dropped, forced for read-only blocks]
+ * @return          [region or NULL if misaligned, outside the space or out of memory]
+ */
+MEMMAP_REGION*
+memmap_ram ( VSM_MEMMAP* map, uint64_t base, VSM_BLOCK* block, uint8_t* data, uint64_t size, bool readonly )
+{
+	if ( !memmap_aligned ( map, base, size ) )
+		return NULL;
+	MEMMAP_REGION* region = memmap_region ( map, base, size );
+	if ( NULL == region )
+		return NULL;
+	region->block = block_retain ( block );
+	memmap_set_pages ( map, base, size, data, !readonly && !block->readonly, region );
+	return region;
+}
+
+/**
+ * [Map I/O handlers, later regions cover earlier ones page by page]
+ * @param  map   [map]
+ * @param  base  [first address, page aligned]
+ * @param  size  [bytes, whole pages]
+ * @param  read  [read handler, NULL reads the open bus]
+ * @param  write [write handler, NULL drops writes]
+ * @param  ctx   [handed to the handlers]
+ * @return       [region or NULL if misaligned, outside the space or out of memory]
+ */
+MEMMAP_REGION*
+memmap_io ( VSM_MEMMAP* map, uint64_t base, uint64_t size, MEMMAP_READ read, MEMMAP_WRITE write, void* ctx )
+{
+	if ( !memmap_aligned ( map, base, size ) )
+		return NULL;
+	MEMMAP_REGION* region = memmap_region ( map, base, size );
+	if ( NULL == region )
+		return NULL;
+	region->read = read;
+	region->write = write;
+	region->ctx = ctx;
+	memmap_set_pages ( map, base, size, NULL, false, region );
+	return region;
+}
+
+/**
+ * [Return pages to the open bus]
+ * @param  map  [map]
+ * @param  base [first address, page aligned]
+ * @param  size [bytes, whole pages]
+ * @return      [false if misaligned or outside the space]
+ */
+bool
+memmap_unmap ( VSM_MEMMAP* map, uint64_t base, uint64_t size )
+{
+	if ( !memmap_aligned ( map, base, size ) )
+		return false;
+	memmap_set_pages ( map, base, size, NULL, false, NULL );
+	return true;
+}
+
+/**
+ * [Read a little endian word]
+ *
+ * A word inside one memory page is read in place. I/O pages get the whole
+ * word, a word across pages is read a byte at a time.
+ *
+ * @param  map   [map]
+ * @param  addr  [address, wraps]
+ * @param  width [bytes, 1 to 8]
+ * @return       [word]
+ */
+uint64_t
+memmap_read ( VSM_MEMMAP* map, uint64_t addr, uint8_t width )
+{
+	addr &= map->size - 1;
+	uint64_t off = addr & ( ( 1ULL << map->page_bits ) - 1 );
+	MEMMAP_PAGE* page = &map->pages[addr >> map->page_bits];
+	uint64_t value = 0;
+	if ( off + width > 1ULL << map->page_bits )
+	{
+		for ( int32_t i=width - 1; i >= 0; i-- )
+			value = ( value << 8 ) | memmap_read ( map, addr + i, 1 );
+		return value;
+	}
+	if ( page->read )
+	{
+		const uint8_t* p = page->read + off;
+		for ( int32_t i=width - 1; i >= 0; i-- )
+			value = ( value << 8 ) | p[i];
+		return value;
+	}
+	if ( page->region && page->region->read )
+		return memmap_io_read ( map, page, addr, width );
+	for ( int32_t i=0; i < width; i++ )
+		value = ( value << 8 ) | map->open_bus;
+	return value;
+}
+
+/**
+ * [Write a little endian word, writes to ROM and unmapped pages are dropped]
+ * @param map   [map]
+ * @param addr  [address, wraps]
+ * @param value [word]
+ * @param width [bytes, 1 to 8]
+ */
+void
+memmap_write ( VSM_MEMMAP* map, uint64_t addr, uint64_t value, uint8_t width )
+{
+	addr &= map->size - 1;
+	uint64_t off = addr & ( ( 1ULL << map->page_bits ) - 1 );
+	MEMMAP_PAGE* page = &map->pages[addr >> map->page_bits];
+	if ( off + width > 1ULL << map->page_bits )
+	{
+		for ( int32_t i=0; i < width; i++, value >>= 8 )
+			memmap_write ( map, addr + i, value & 0xFF, 1 );
+		return;
+	}
+	if ( page->write )
+	{
+		uint8_t* p = page->write + off;
+		for ( int32_t i=0; i < width; i++, value >>= 8 )
+			p[i] = value;
+		return;
+	}
+	if ( NULL == page->read && page->region && page->region->write )
+	{
+		MEMMAP_REGION* region = page->region;
+		map->dispatch++;
+		region->write ( map, region->ctx, addr, value, width );
+		map->dispatch--;
+		memmap_sweep ( map );
+	}
+}
@@ -0,0 +1,308 @@
+/**
+ *
+ * @file   nvmem.c
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Persistent file-backed memories.
+ *
+ * EEPROM and flash contents live in a file mapped into memory, so a run
+ * starts from whatever the previous one left. Writes only touch memory and
+ * mark their pages dirty; the dirty pages are handed to the system on
+ * suspend and stop, never the whole image, so parts written all the time
+ * do not stall the simulation on file I/O.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <vsm_api.h>
+#include <sys/stat.h>
+
+/**
+ * [Block release hook, unmaps the file]
+ * @param block [block of a persistent memory]
+ */
+static void
+nvmem_unmap ( VSM_BLOCK* block )
+{
+	UnmapViewOfFile ( block->data );
+}
+
+/**
+ * [Map a file for writing, growing it to size]
+ * @param  path [file name]
+ * @param  size [bytes mapped]
+ * @param  old  [file size before growing on return]
+ * @return      [first byte of the view or NULL]
+ */
+static uint8_t*
+nvmem_map ( const char* path, size_t size, uint64_t* old )
+{
+	HANDLE file = CreateFile ( path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( INVALID_HANDLE_VALUE == file )
+		return NULL;
+	DWORD high = 0;
+	DWORD low = GetFileSize ( file, &high );
+	*old = ( ( uint64_t ) high << 32 ) | low;
+	/* A mapping larger than the file extends it */
+	HANDLE mapping = CreateFileMapping ( file, NULL, PAGE_READWRITE, ( DWORD ) ( ( uint64_t ) size >> 32 ), ( DWORD ) size, NULL );
+	CloseHandle ( file );
+	if ( NULL == mapping )
+		return NULL;
+	uint8_t* view = MapViewOfFile ( mapping, FILE_MAP_WRITE, 0, 0, size );
+	CloseHandle ( mapping );
+	return view;
+}
+
+/**
+ * [Mark the pages of a range dirty]
+ * @param nv   [memory]
+ * @param addr [first byte]
+ * @param len  [bytes, not 0]
+ */
+static void
+nvmem_touch ( VSM_NVMEM* nv, size_t addr, size_t len )
+{
+	for ( size_t page = addr >> NVMEM_PAGE_BITS; page <= ( addr + len - 1 ) >> NVMEM_PAGE_BITS; page++ )
+	{
+		uint8_t bit = 1 << ( page & 7 );
+		if ( nv->dirty[page >> 3] & bit )
+			continue;
+		nv->dirty[page >> 3] |= bit;
+		nv->dirty_count++;
+	}
+}
+
+/**
+ * [Count one wear cycle on the sectors of a range]
+ * @param nv   [memory]
+ * @param addr [first byte]
+ * @param len  [bytes, not 0]
+ */
+static void
+nvmem_wear ( VSM_NVMEM* nv, size_t addr, size_t len )
+{
+	if ( NULL == nv->wear )
+		return;
+	for ( size_t s = addr / nv->sector; s <= ( addr + len - 1 ) / nv->sector; s++ )
+		nv->wear[s]++;
+}
+
+/**
+ * [Open a persistent memory and register it with the model]
+ *
+ * The file is created if missing and grown to size, the bytes added read
+ * as erase_value. size 0 takes the size of an existing file.
+ *
+ * @param  model       [model context]
+ * @param  path        [file name]
+ * @param  size        [bytes, 0 for the file size]
+ * @param  sector      [erase and wear granule in bytes]
+ * @param  erase_value [value of erased bytes]
+ * @return             [EEPROM-like memory with no timing, NULL on failure]
+ */
+VSM_NVMEM*
+nvmem_new ( VSM_MODEL* model, const char* path, size_t size, size_t sector, uint8_t erase_value )
+{
+	if ( 0 == size )
+	{
+		struct stat st;
+		if ( 0 != stat ( path, &st ) || 0 == st.st_size )
+			return NULL;
+		size = st.st_size;
+	}
+	VSM_NVMEM** nvmems = realloc ( model->nvmems, ( model->nvmem_count + 1 ) * sizeof *nvmems );
+	if ( NULL == nvmems )
+		return NULL;
+	model->nvmems = nvmems;
+
+	VSM_NVMEM* nv = calloc ( 1, sizeof *nv );
+	if ( NULL == nv )
+		return NULL;
+	nv->page_count = ( size + NVMEM_PAGE - 1 ) >> NVMEM_PAGE_BITS;
+	nv->dirty = calloc ( ( nv->page_count + 7 ) / 8, 1 );
+	nv->block = calloc ( 1, sizeof *nv->block );
+	uint64_t old = 0;
+	uint8_t* view = nv->dirty && nv->block ? nvmem_map ( path, size, &old ) : NULL;
+	if ( NULL == view )
+	{
+		free ( nv->block );
+		nv->block = NULL;
+		nvmem_free ( nv );
+		return NULL;
+	}
+	nv->block->data = view;
+	nv->block->size = size;
+	nv->block->refs = 1;
+	nv->block->readonly = true;
+	nv->block->free = nvmem_unmap;
+	nv->block->owner = nv;
+	nv->data = view;
+	nv->size = size;
+	nv->sector = sector ? sector : 1;
+	nv->sector_count = ( size + nv->sector - 1 ) / nv->sector;
+	nv->erase_value = erase_value;
+	nv->model = model;
+	nv->lua_ref = LUA_NOREF;
+	if ( old < size )
+	{
+		memset ( view + old, erase_value, size - old );
+		nvmem_touch ( nv, old, size - old );
+	}
+	model->nvmems[model->nvmem_count++] = nv;
+	return nv;
+}
+
+/**
+ * [Flush and release a memory, only done when the model goes away]
+ * @param nv [memory]
+ */
+void
+nvmem_free ( VSM_NVMEM* nv )
+{
+	if ( nv->block )
+		nvmem_flush ( nv );
+	/* Buffers or chips may still use the mapping, the last one unmaps it */
+	block_release ( nv->block );
+	free ( nv->dirty );
+	free ( nv->wear );
+	free ( nv );
+}
+
+/**
+ * [Start counting wear cycles per sector]
+ * @param  nv [memory]
+ * @return    [false if out of memory]
+ */
+bool
+nvmem_track_wear ( VSM_NVMEM* nv )
+{
+	if ( NULL == nv->wear )
+		nv->wear = calloc ( nv->sector_count, sizeof *nv->wear );
+	return NULL != nv->wear;
+}
+
+/**
+ * [Tell if a program or erase is still under way]
+ * @param  nv    [memory]
+ * @param  atime [current time]
+ * @return       [true if busy]
+ */
+bool
+nvmem_busy ( VSM_NVMEM* nv, ABSTIME atime )
+{
+	return atime < nv->busy_until;
+}
+
+/**
+ * [Write or program bytes]
+ *
+ * An EEPROM replaces the bytes and counts a wear cycle on every sector it
+ * writes. A flash can only move bits away from the erase value, the
+ * sectors wear when they are erased.
+ *
+ * @param  nv    [memory]
+ * @param  atime [current time]
+ * @param  addr  [first byte]
+ * @param  src   [bytes]
+ * @param  len   [bytes]
+ * @return       [false if busy or outside the memory]
+ */
+bool
+nvmem_write ( VSM_NVMEM* nv, ABSTIME atime, size_t addr, const void* src, size_t len )
+{
+	if ( nvmem_busy ( nv, atime ) || addr > nv->size || len > nv->size - addr )
+		return false;
+	if ( 0 == len )
+		return true;
+	const uint8_t* in = src;
+	uint8_t* out = nv->data + addr;
+	if ( !nv->flash )
+	{
+		memmove ( out, in, len );
+		nvmem_wear ( nv, addr, len );
+	}
+	else
+	{
+		/* A bit already away from the erase value stays away */
+		const uint8_t e = nv->erase_value;
+		for ( size_t i=0; i < len; i++ )
+			out[i] = e ^ ( ( out[i] ^ e ) | ( in[i] ^ e ) );
+	}
+	nvmem_touch ( nv, addr, len );
+	nv->busy_until = atime + nv->program_time;
+	return true;
+}
+
+/**
+ * [Erase the sectors holding a range]
+ * @param  nv    [memory]
+ * @param  atime [current time]
+ * @param  addr  [first byte, rounded down to its sector]
+ * @param  len   [bytes, rounded up to whole sectors]
+ * @return       [false if busy or outside the memory]
+ */
+bool
+nvmem_erase ( VSM_NVMEM* nv, ABSTIME atime, size_t addr, size_t len )
+{
+	if ( nvmem_busy ( nv, atime ) || addr > nv->size || len > nv->size - addr )
+		return false;
+	if ( 0 == len )
+		return true;
+	size_t start = addr - addr % nv->sector;
+	size_t end = ( addr + len + nv->sector - 1 ) / nv->sector * nv->sector;
+	if ( end > nv->size )
+		end = nv->size;
+	memset ( nv->data + start, nv->erase_value, end - start );
+	nvmem_touch ( nv, start, end - start );
+	nvmem_wear ( nv, start, end - start );
+	nv->busy_until = atime + nv->erase_time;
+	return true;
+}
+
+/**
+ * [Hand the dirty pages to the system, runs of pages go in one call]
+ * @param  nv [memory]
+ * @return    [pages flushed]
+ */
+size_t
+nvmem_flush ( VSM_NVMEM* nv )
+{
+	size_t flushed = nv->dirty_count;
+	for ( size_t page=0; nv->dirty_count && page < nv->page_count; )
+	{
+		if ( 0 == nv->dirty[page >> 3] )
+		{
+			page = ( page | 7 ) + 1;
+			continue;
+		}
+		if ( !( nv->dirty[page >> 3] & ( 1 << ( page & 7 ) ) ) )
+		{
+			page++;
+			continue;
+		}
+		size_t first = page;
+		while ( page < nv->page_count && ( nv->dirty[page >> 3] & ( 1 << ( page & 7 ) ) ) )
+		{
+			nv->dirty[page >> 3] &= ~( 1 << ( page & 7 ) );
+			nv->dirty_count--;
+			page++;
+		}
+		size_t offset = first << NVMEM_PAGE_BITS;
+		size_t end = page << NVMEM_PAGE_BITS;
+		FlushViewOfFile ( nv->data + offset, ( end < nv->size ? end : nv->size ) - offset );
+	}
+	return flushed;
+}
@@ -0,0 +1,517 @@
+/**
+ *
+ * @file   sequencer.c
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Programmable pin sequencers.
+ *
+ * A sequencer runs a short program of pin instructions (set, wait, shift
+ * out and in through FIFOs, jumps, interrupts), one tick per instruction
+ * plus its delay. Instructions that only drive pins are run ahead of
+ * simulation time and hand their edges to the host with timestamps, the
+ * model is called back only when an instruction has to look at the pins
+ * or talk to the script, when a FIFO stalls, or every SEQ_BUDGET
+ * instructions.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <vsm_api.h>
+
+/**
+ * [Copy a pin group so the sequencer does not depend on a Lua object]
+ * @param  group [pin group, NULL is allowed]
+ * @param  ok    [cleared if out of memory]
+ * @return       [copy or NULL]
+ */
+static VSM_PIN_GROUP*
+seq_group_copy ( const VSM_PIN_GROUP* group, bool* ok )
+{
+	if ( NULL == group )
+		return NULL;
+	size_t size = sizeof *group + group->width * sizeof group->pins[0];
+	VSM_PIN_GROUP* copy = malloc ( size );
+	if ( NULL == copy )
+		*ok = false;
+	else
+		memcpy ( copy, group, size );
+	return copy;
+}
+
+/**
+ * [Create a sequencer and register it with the model]
+ * @param  model [model context]
+ * @param  out   [pins set and out drive, copied, NULL if none]
+ * @param  in    [pins in and wait_pin read, copied, NULL if none]
+ * @return       [stopped sequencer with an empty program, NULL if out of memory]
+ */
+VSM_SEQUENCER*
+sequencer_new ( VSM_MODEL* model, VSM_PIN_GROUP* out, VSM_PIN_GROUP* in )
+{
+	VSM_SEQUENCER** seqs = realloc ( model->sequencers, ( model->sequencer_count + 1 ) * sizeof *seqs );
+	if ( NULL == seqs )
+		return NULL;
+	model->sequencers = seqs;
+
+	VSM_SEQUENCER* seq = calloc ( 1, sizeof *seq );
+	if ( NULL == seq )
+		return NULL;
+	bool ok = true;
+	seq->out = seq_group_copy ( out, &ok );
+	seq->in = seq_group_copy ( in, &ok );
+	if ( !ok )
+	{
+		sequencer_free ( seq );
+		return NULL;
+	}
+	if ( seq->out )
+		promote_pin_group ( seq->out );
+	if ( seq->in )
+		promote_pin_group ( seq->in );
+	seq->model = model;
+	seq->slot = model->sequencer_count;
+	seq->pull_bits = 8;
+	seq->push_bits = 8;
+	seq->msb_first = true;
+	seq->rx_batch = 1;
+	seq->lua_ref = LUA_NOREF;
+	seq->rx_ref = LUA_NOREF;
+	seq->irq_ref = LUA_NOREF;
+	seq->labels_ref = LUA_NOREF;
+	model->sequencers[model->sequencer_count++] = seq;
+	return seq;
+}
+
+/**
+ * [Release a sequencer, only done when the model goes away]
+ * @param seq [sequencer]
+ */
+void
+sequencer_free ( VSM_SEQUENCER* seq )
+{
+	free ( seq->out );
+	free ( seq->in );
+	free ( seq );
+}
+
+static inline bool
+fifo_push ( SEQ_FIFO_RING* fifo, uint32_t word )
+{
+	if ( SEQ_FIFO == fifo->count )
+		return false;
+	fifo->word[( fifo->head + fifo->count++ ) % SEQ_FIFO] = word;
+	return true;
+}
+
+static inline uint32_t
+fifo_pop ( SEQ_FIFO_RING* fifo )
+{
+	uint32_t word = fifo->word[fifo->head];
+	fifo->head = ( fifo->head + 1 ) % SEQ_FIFO;
+	fifo->count--;
+	return word;
+}
+
+/**
+ * [Level of an in pin]
+ * @param  seq   [sequencer]
+ * @param  index [pin number in the in group]
+ * @return       [true if high]
+ */
+static inline bool
+seq_pin ( VSM_SEQUENCER* seq, uint8_t index )
+{
+	return is_pin_high ( seq->in->pins[index]->pin );
+}
+
+/**
+ * [Instructions that must run at their own time rather than ahead of it:
+ * they look at the pins or may call the script]
+ * @param  insn [instruction]
+ * @return      [true if the instruction waits for simulation time]
+ */
+static bool
+seq_observes ( const SEQ_INSN* insn )
+{
+	switch ( insn->op )
+	{
+		case SEQ_WAIT_PIN:
+		case SEQ_IN:
+		case SEQ_PUSH:
+		case SEQ_IRQ:
+			return true;
+		case SEQ_JMP:
+			return COND_PIN == insn->cond || COND_NOT_PIN == insn->cond;
+		default:
+			return false;
+	}
+}
+
+/**
+ * [Schedule the next host callback of the sequencer]
+ *
+ * Nothing would advance the program once the host refuses the event, the
+ * sequencer is stopped then.
+ *
+ * @param  seq   [sequencer]
+ * @param  atime [callback time]
+ * @return       [false if the host refused the event]
+ */
+static bool
+seq_arm ( VSM_SEQUENCER* seq, ABSTIME atime )
+{
+	VSM_MODEL* model = seq->model;
+	seq->event = model->dsim->vtable->setcallbackex ( model->dsim, 0, atime, &model->dsim_model, ( void* ) vsm_sequencer_callback, seq->slot );
+	if ( NULL == seq->event )
+	{
+		out_error ( model, "sequencer: cannot schedule the next instruction, stopped" );
+		sequencer_stop ( seq );
+		return false;
+	}
+	return true;
+}
+
+/**
+ * [Stop listening to the pin of a stalled wait_pin]
+ * @param seq [sequencer]
+ */
+static void
+seq_unwait ( VSM_SEQUENCER* seq )
+{
+	VSM_PIN* pin = seq->wait_pin;
+	if ( NULL == pin )
+		return;
+	seq->wait_pin = NULL;
+	if ( seq == pin->waiter )
+	{
+		pin->waiter = NULL;
+		watch_pin ( seq->model, pin );
+	}
+}
+
+/**
+ * [Stall a wait_pin until its pin moves]
+ *
+ * The pin edge wakes the sequencer. A pin another sequencer already
+ * waits on is polled every tick instead.
+ *
+ * @param seq  [sequencer]
+ * @param insn [wait_pin instruction]
+ */
+static void
+seq_wait_pin ( VSM_SEQUENCER* seq, const SEQ_INSN* insn )
+{
+	VSM_PIN* pin = seq->in->pins[insn->pin];
+	if ( pin->waiter && seq != pin->waiter )
+	{
+		seq_arm ( seq, seq->time + seq->tick );
+		return;
+	}
+	seq->stall = STALL_PIN;
+	seq->wait_pin = pin;
+	pin->waiter = seq;
+	watch_pin ( seq->model, pin );
+}
+
+/**
+ * [Load the output shift register from the transmit FIFO]
+ * @param  seq [sequencer]
+ * @return     [false if the FIFO is empty]
+ */
+static bool
+seq_pull ( VSM_SEQUENCER* seq )
+{
+	if ( 0 == seq->tx.count )
+		return false;
+	uint32_t word = fifo_pop ( &seq->tx );
+	seq->osr = seq->msb_first ? word << ( 32 - seq->pull_bits ) : word;
+	seq->osr_count = seq->pull_bits;
+	return true;
+}
+
+/**
+ * [Move the input shift register to the receive FIFO]
+ * @param seq [sequencer, the FIFO has room]
+ */
+static void
+seq_push ( VSM_SEQUENCER* seq )
+{
+	uint32_t word = seq->isr;
+	if ( !seq->msb_first )
+		word = seq->isr_count ? seq->isr >> ( 32 - seq->isr_count ) : 0;
+	fifo_push ( &seq->rx, word );
+	seq->isr = 0;
+	seq->isr_count = 0;
+}
+
+/**
+ * [Run instructions from seq->time on]
+ * @param seq [running sequencer]
+ * @param now [current simulation time]
+ */
+static void
+seq_run ( VSM_SEQUENCER* seq, ABSTIME now )
+{
+	if ( seq->time < now )
+		seq->time = now;
+	for ( int32_t budget=SEQ_BUDGET; seq->running && STALL_NONE == seq->stall && NULL == seq->event; budget-- )
+	{
+		const SEQ_INSN* insn = &seq->program[seq->pc];
+		if ( 0 == budget || ( seq->time > now && seq_observes ( insn ) ) )
+		{
+			seq_arm ( seq, seq->time );
+			return;
+		}
+
+		int32_t next = ( seq->pc + 1 ) % seq->length;
+		uint32_t ticks = 1 + insn->delay;
+		bool irq = false;
+		bool rx = false;
+		switch ( insn->op )
+		{
+			case SEQ_SET:
+				seq->out_word = ( seq->out_word & ~insn->mask ) | ( insn->arg & insn->mask );
+				drive_pins ( seq->out, seq->time, seq->out_word );
+				break;
+			case SEQ_WAIT:
+				ticks = insn->arg + insn->delay;
+				break;
+			case SEQ_WAIT_PIN:
+				if ( seq_pin ( seq, insn->pin ) != ( 0 != insn->arg ) )
+				{
+					seq_wait_pin ( seq, insn );
+					return;
+				}
+				break;
+			case SEQ_OUT:
+			{
+				if ( seq->osr_count < insn->arg && !seq_pull ( seq ) )
+				{
+					seq->stall = STALL_TX;
+					return;
+				}
+				uint32_t value;
+				if ( seq->msb_first )
+				{
+					value = seq->osr >> ( 32 - insn->arg );
+					seq->osr = insn->arg < 32 ? seq->osr << insn->arg : 0;
+				}
+				else
+				{
+					value = insn->arg < 32 ? seq->osr & ( ( 1U << insn->arg ) - 1 ) : seq->osr;
+					seq->osr = insn->arg < 32 ? seq->osr >> insn->arg : 0;
+				}
+				seq->osr_count -= insn->arg;
+				uint64_t mask = ( 1ULL << insn->arg ) - 1;
+				seq->out_word = ( seq->out_word & ~mask ) | value;
+				drive_pins ( seq->out, seq->time, seq->out_word );
+				break;
+			}
+			case SEQ_IN:
+			{
+				bool full = seq->isr_count + insn->arg >= seq->push_bits;
+				if ( full && SEQ_FIFO == seq->rx.count )
+				{
+					seq->stall = STALL_RX;
+					return;
+				}
+				uint32_t value = read_pins ( seq->in ) & ( ( 1ULL << insn->arg ) - 1 );
+				if ( seq->msb_first )
+					seq->isr = insn->arg < 32 ? ( seq->isr << insn->arg ) | value : value;
+				else
+					seq->isr = insn->arg < 32 ? ( seq->isr >> insn->arg ) | ( value << ( 32 - insn->arg ) ) : value;
+				seq->isr_count += insn->arg;
+				if ( full )
+				{
+					seq->isr_count = seq->push_bits;
+					seq_push ( seq );
+					rx = true;
+				}
+				break;
+			}
+			case SEQ_PUSH:
+				if ( SEQ_FIFO == seq->rx.count )
+				{
+					seq->stall = STALL_RX;
+					return;
+				}
+				seq_push ( seq );
+				rx = true;
+				break;
+			case SEQ_SETX:
+				seq->x = insn->arg;
+				break;
+			case SEQ_JMP:
+			{
+				bool taken = true;
+				switch ( insn->cond )
+				{
+					case COND_X_DEC:
+						taken = 0 != seq->x--;
+						break;
+					case COND_PIN:
+						taken = seq_pin ( seq, insn->pin );
+						break;
+					case COND_NOT_PIN:
+						taken = !seq_pin ( seq, insn->pin );
+						break;
+					case COND_NOT_OSRE:
+						taken = seq->osr_count || seq->tx.count;
+						break;
+					default:
+						break;
+				}
+				if ( taken )
+					next = insn->arg;
+				break;
+			}
+			case SEQ_IRQ:
+				irq = true;
+				break;
+			default:
+				break;
+		}
+		/* Advance before the script runs, it may restart or stop the program */
+		seq->pc = next;
+		seq->time += ( ABSTIME ) ticks * seq->tick;
+		if ( rx && seq->on_rx && seq->rx.count >= seq->rx_batch )
+			seq->on_rx ( seq );
+		if ( irq && seq->on_irq )
+			seq->on_irq ( seq, insn->arg );
+	}
+}
+
+/**
+ * [Start the program]
+ * @param seq [sequencer with a program]
+ * @param pc  [first instruction]
+ */
+void
+sequencer_start ( VSM_SEQUENCER* seq, int32_t pc )
+{
+	sequencer_stop ( seq );
+	if ( 0 == seq->length )
+		return;
+	ABSTIME curtime = 0;
+	systime ( seq->model, &curtime );
+	seq->running = true;
+	seq->pc = pc % seq->length;
+	seq->time = curtime;
+	seq_run ( seq, curtime );
+}
+
+/**
+ * [Stop the program, edges already handed to the host still happen]
+ * @param seq [sequencer]
+ */
+void
+sequencer_stop ( VSM_SEQUENCER* seq )
+{
+	seq->running = false;
+	seq->stall = STALL_NONE;
+	seq_unwait ( seq );
+	if ( seq->event )
+		cancel_event ( seq->model, seq->event );
+	seq->event = NULL;
+}
+
+/**
+ * [Carry on after a stall was cleared]
+ * @param seq [sequencer]
+ * @param now [current time]
+ */
+static void
+seq_resume ( VSM_SEQUENCER* seq, ABSTIME now )
+{
+	seq->stall = STALL_NONE;
+	if ( seq->running )
+		seq_run ( seq, now );
+}
+
+/**
+ * [Append words to the transmit FIFO]
+ * @param  seq   [sequencer]
+ * @param  words [words]
+ * @param  count [number of words]
+ * @return       [words taken, the FIFO may fill up]
+ */
+int32_t
+sequencer_put ( VSM_SEQUENCER* seq, const uint32_t* words, int32_t count )
+{
+	int32_t taken = 0;
+	while ( taken < count && fifo_push ( &seq->tx, words[taken] ) )
+		taken++;
+	if ( taken && STALL_TX == seq->stall )
+	{
+		ABSTIME curtime = 0;
+		systime ( seq->model, &curtime );
+		seq_resume ( seq, curtime );
+	}
+	return taken;
+}
+
+/**
+ * [Take words from the receive FIFO]
+ * @param  seq   [sequencer]
+ * @param  words [buffer]
+ * @param  count [buffer size in words]
+ * @return       [words taken]
+ */
+int32_t
+sequencer_get ( VSM_SEQUENCER* seq, uint32_t* words, int32_t count )
+{
+	int32_t taken = 0;
+	while ( taken < count && seq->rx.count )
+		words[taken++] = fifo_pop ( &seq->rx );
+	if ( taken && STALL_RX == seq->stall )
+	{
+		ABSTIME curtime = 0;
+		systime ( seq->model, &curtime );
+		seq_resume ( seq, curtime );
+	}
+	return taken;
+}
+
+/**
+ * [Host callback of a sequencer]
+ * @param seq   [sequencer]
+ * @param atime [event time]
+ */
+void
+sequencer_callback ( VSM_SEQUENCER* seq, ABSTIME atime )
+{
+	seq->event = NULL;
+	if ( seq->running && STALL_NONE == seq->stall )
+		seq_run ( seq, atime );
+}
+
+/**
+ * [Edge of the pin a stalled wait_pin listens to, called from vsm_pin_handler]
+ * @param seq   [sequencer]
+ * @param pin   [pin that moved]
+ * @param atime [edge time]
+ */
+void
+sequencer_edge ( VSM_SEQUENCER* seq, VSM_PIN* pin, ABSTIME atime )
+{
+	if ( STALL_PIN != seq->stall || pin != seq->wait_pin )
+		return;
+	const SEQ_INSN* insn = &seq->program[seq->pc];
+	if ( is_pin_high ( pin->pin ) != ( 0 != insn->arg ) )
+		return;
+	seq_unwait ( seq );
+	seq_resume ( seq, atime );
+}
@@ -0,0 +1,1229 @@
+/**
+ *
+ * @file   serial.c
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Native serial engines.
+ *
+ * UART transmitters, SPI masters and I2C masters take a byte buffer and
+ * work the lines themselves. Every byte is turned into a short list of
+ * line operations (drive, release, sample) separated by delays, and the
+ * list is walked from host callbacks scheduled at the next change only,
+ * so a run of equal UART bits costs a single event. The script hears
+ * about the transfer once, when it is over.
+ *
+ * Receive decoders work the other way round: they are fed with the edges
+ * of their input pins, rebuild bytes with error flags, keep them in a ring
+ * and hand them to the script per frame or per batch of bytes.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <vsm_api.h>
+
+/**
+ * [Create an engine and register it with the model]
+ * @param  model [model context]
+ * @param  kind  [protocol]
+ * @return       [engine with no pins and no timing, NULL if out of memory]
+ */
+VSM_SERIAL*
+serial_new ( VSM_MODEL* model, SERIAL_KIND kind )
+{
+	VSM_SERIAL** serials = realloc ( model->serials, ( model->serial_count + 1 ) * sizeof *serials );
+	if ( NULL == serials )
+		return NULL;
+	model->serials = serials;
+
+	VSM_SERIAL* serial = calloc ( 1, sizeof *serial );
+	if ( NULL == serial )
+		return NULL;
+	serial->model = model;
+	serial->kind = kind;
+	serial->slot = model->serial_count;
+	serial->bits = 8;
+	serial->stop_bits = 1;
+	serial->msb_first = true;
+	serial->ack = true;
+	serial->lua_ref = LUA_NOREF;
+	serial->done_ref = LUA_NOREF;
+	serial->rx_ref = LUA_NOREF;
+	serial->read_hooks_ref = LUA_NOREF;
+	serial->write_hooks_ref = LUA_NOREF;
+	serial->rx_batch = SERIAL_UART_RX == kind ? 1 : SERIAL_RING;
+	for ( int32_t i=0; i < SERIAL_LINES; i++ )
+		serial->level[i] = -1;
+	model->serials[model->serial_count++] = serial;
+	return serial;
+}
+
+/**
+ * [Release an engine, only done when the model goes away]
+ * @param serial [engine]
+ */
+void
+serial_free ( VSM_SERIAL* serial )
+{
+	free ( serial->tx );
+	free ( serial->rx );
+	free ( serial->regs.value );
+	free ( serial->regs.reset );
+	free ( serial->regs.ro_mask );
+	free ( serial->regs.hooks );
+	free ( serial );
+}
+
+/**
+ * Parity names of a script configuration, in SERIAL_PARITY order
+ */
+const char* const serial_parity_names[] = { "none", "even", "odd", NULL };
+
+/**
+ * [Append bytes to a growing buffer]
+ * @param  buf  [buffer]
+ * @param  len  [bytes used]
+ * @param  size [bytes allocated]
+ * @param  data [bytes to append]
+ * @param  n    [number of bytes]
+ * @return      [false if out of memory]
+ */
+static bool
+serial_append ( uint8_t** buf, size_t* len, size_t* size, const uint8_t* data, size_t n )
+{
+	if ( *len + n > *size )
+	{
+		size_t new_size = *size ? *size : 16;
+		while ( new_size < *len + n )
+			new_size *= 2;
+		uint8_t* grown = realloc ( *buf, new_size );
+		if ( NULL == grown )
+			return false;
+		*buf = grown;
+		*size = new_size;
+	}
+	memcpy ( *buf + *len, data, n );
+	*len += n;
+	return true;
+}
+
+/**
+ * [Let time pass before the next operation]
+ * @param serial [engine]
+ * @param delay  [time]
+ */
+static inline void
+op_wait ( VSM_SERIAL* serial, RELTIME delay )
+{
+	serial->pending += delay;
+}
+
+/**
+ * [Add an operation after the pending delay]
+ * @param serial [engine]
+ * @param kind   [operation]
+ * @param line   [line number]
+ * @param level  [level for OP_DRIVE]
+ */
+static void
+op_add ( VSM_SERIAL* serial, SERIAL_OP_KIND kind, uint8_t line, uint8_t level )
+{
+	if ( serial->op_count == SERIAL_MAX_OPS )
+		return;
+	SERIAL_OP* op = &serial->ops[serial->op_count++];
+	op->delay = serial->pending;
+	op->kind = kind;
+	op->line = line;
+	op->level = level;
+	serial->pending = 0;
+}
+
+/**
+ * [Drive a line, nothing is generated if it already is at that level]
+ * @param serial [engine]
+ * @param line   [line number]
+ * @param level  [0 or 1]
+ */
+static void
+op_drive ( VSM_SERIAL* serial, uint8_t line, uint8_t level )
+{
+	if ( NULL == serial->lines[line] || level == serial->level[line] )
+		return;
+	serial->level[line] = level;
+	op_add ( serial, OP_DRIVE, line, level );
+}
+
+/**
+ * [Release an open-drain line, it reads high through the pull-up]
+ * @param serial [engine]
+ * @param line   [line number]
+ */
+static void
+op_release ( VSM_SERIAL* serial, uint8_t line )
+{
+	if ( -1 == serial->level[line] )
+		return;
+	serial->level[line] = -1;
+	op_add ( serial, OP_RELEASE, line, 1 );
+}
+
+/**
+ * [Operations of one UART frame: start bit, data LSB first, parity, stop bits]
+ * @param serial [engine]
+ * @param byte   [data]
+ */
+static void
+uart_frame ( VSM_SERIAL* serial, uint32_t byte )
+{
+	uint32_t ones = 0;
+	/* An undriven line idles high for a bit first, so the start bit is an edge */
+	if ( -1 == serial->level[UART_TX] )
+	{
+		op_drive ( serial, UART_TX, 1 );
+		op_wait ( serial, serial->bit_time );
+	}
+	op_drive ( serial, UART_TX, 0 );
+	op_wait ( serial, serial->bit_time );
+	for ( uint32_t i=0; i < serial->bits; i++, byte >>= 1 )
+	{
+		ones += byte & 1;
+		op_drive ( serial, UART_TX, byte & 1 );
+		op_wait ( serial, serial->bit_time );
+	}
+	if ( PARITY_NONE != serial->parity )
+	{
+		op_drive ( serial, UART_TX, ( ones & 1 ) ^ ( PARITY_ODD == serial->parity ) );
+		op_wait ( serial, serial->bit_time );
+	}
+	op_drive ( serial, UART_TX, 1 );
+	op_wait ( serial, serial->stop_bits * serial->bit_time );
+	/* Keeps the frame end, the next byte or the completion waits for it */
+	op_add ( serial, OP_NOP, 0, 0 );
+}
+
+/**
+ * [Operations of one SPI byte, both directions at once]
+ * @param serial [engine]
+ * @param byte   [data to shift out]
+ * @param first  [first byte of the transfer, selects the slave]
+ */
+static void
+spi_byte ( VSM_SERIAL* serial, uint32_t byte, bool first )
+{
+	const RELTIME half = serial->bit_time / 2;
+	const uint8_t cpol = ( serial->mode >> 1 ) & 1;
+	const bool cpha = serial->mode & 1;
+
+	if ( first )
+	{
+		op_drive ( serial, SPI_SCK, cpol );
+		op_drive ( serial, SPI_CS, 0 );
+		op_wait ( serial, half );
+	}
+	for ( int32_t i=0; i < 8; i++ )
+	{
+		uint8_t bit = serial->msb_first ? ( byte >> ( 7 - i ) ) & 1 : ( byte >> i ) & 1;
+		if ( cpha )
+		{
+			op_drive ( serial, SPI_SCK, !cpol );
+			op_drive ( serial, SPI_MOSI, bit );
+			op_wait ( serial, half );
+			op_drive ( serial, SPI_SCK, cpol );
+			op_add ( serial, OP_SAMPLE, SPI_MISO, 0 );
+			op_wait ( serial, half );
+		}
+		else
+		{
+			op_drive ( serial, SPI_MOSI, bit );
+			op_wait ( serial, half );
+			op_drive ( serial, SPI_SCK, !cpol );
+			op_add ( serial, OP_SAMPLE, SPI_MISO, 0 );
+			op_wait ( serial, half );
+			op_drive ( serial, SPI_SCK, cpol );
+		}
+	}
+	op_add ( serial, OP_STORE, 0, 0 );
+}
+
+/**
+ * [Operations of the I2C start condition]
+ * @param serial [engine]
+ */
+static void
+i2c_start ( VSM_SERIAL* serial )
+{
+	const RELTIME quarter = serial->bit_time / 4;
+	op_release ( serial, I2C_SDA );
+	op_release ( serial, I2C_SCL );
+	op_wait ( serial, quarter );
+	op_drive ( serial, I2C_SDA, 0 );
+	op_wait ( serial, quarter );
+	op_drive ( serial, I2C_SCL, 0 );
+	op_wait ( serial, quarter );
+}
+
+/**
+ * [Operations of the I2C stop condition]
+ * @param serial [engine]
+ */
+static void
+i2c_stop ( VSM_SERIAL* serial )
+{
+	const RELTIME quarter = serial->bit_time / 4;
+	op_drive ( serial, I2C_SDA, 0 );
+	op_wait ( serial, quarter );
+	op_release ( serial, I2C_SCL );
+	op_wait ( serial, quarter );
+	op_release ( serial, I2C_SDA );
+	op_wait ( serial, quarter );
+	op_add ( serial, OP_NOP, 0, 0 );
+}
+
+/**
+ * [Operations of one I2C clock pulse, SCL is low on entry and exit]
+ * @param serial [engine]
+ * @param sample [operation run while SCL is high, OP_NOP for none]
+ */
+static void
+i2c_clock ( VSM_SERIAL* serial, SERIAL_OP_KIND sample )
+{
+	const RELTIME quarter = serial->bit_time / 4;
+	op_wait ( serial, quarter );
+	op_release ( serial, I2C_SCL );
+	op_wait ( serial, quarter );
+	if ( OP_NOP != sample )
+		op_add ( serial, sample, I2C_SDA, 0 );
+	op_wait ( serial, quarter );
+	op_drive ( serial, I2C_SCL, 0 );
+	op_wait ( serial, quarter );
+}
+
+/**
+ * [Operations of one I2C byte written by the master, acknowledge included]
+ * @param serial [engine]
+ * @param byte   [data, MSB first]
+ */
+static void
+i2c_write_byte ( VSM_SERIAL* serial, uint32_t byte )
+{
+	for ( int32_t i=7; i >= 0; i-- )
+	{
+		if ( ( byte >> i ) & 1 )
+			op_release ( serial, I2C_SDA );
+		else
+			op_drive ( serial, I2C_SDA, 0 );
+		i2c_clock ( serial, OP_NOP );
+	}
+	op_release ( serial, I2C_SDA );
+	i2c_clock ( serial, OP_ACK );
+}
+
+/**
+ * [Operations of one I2C byte read by the master]
+ * @param serial [engine]
+ * @param last   [last byte, the master does not acknowledge it]
+ */
+static void
+i2c_read_byte ( VSM_SERIAL* serial, bool last )
+{
+	op_release ( serial, I2C_SDA );
+	for ( int32_t i=0; i < 8; i++ )
+		i2c_clock ( serial, OP_SAMPLE );
+	op_add ( serial, OP_STORE, 0, 0 );
+	if ( last )
+		op_release ( serial, I2C_SDA );
+	else
+		op_drive ( serial, I2C_SDA, 0 );
+	i2c_clock ( serial, OP_NOP );
+}
+
+/**
+ * [Generate the operations of the next byte]
+ * @param  serial [engine]
+ * @return        [false once the transfer is complete]
+ */
+static bool
+serial_fill ( VSM_SERIAL* serial )
+{
+	serial->op_count = 0;
+	serial->op_pos = 0;
+
+	switch ( serial->kind )
+	{
+		case SERIAL_UART_TX:
+			if ( serial->tx_pos == serial->tx_len )
+				return false;
+			uart_frame ( serial, serial->tx[serial->tx_pos++] );
+			return true;
+
+		case SERIAL_SPI_MASTER:
+			if ( serial->tx_pos == serial->tx_len )
+			{
+				if ( -1 == serial->level[SPI_CS] || 1 == serial->level[SPI_CS] )
+					return false;
+				op_wait ( serial, serial->bit_time / 2 );
+				op_drive ( serial, SPI_CS, 1 );
+				return true;
+			}
+			spi_byte ( serial, serial->tx[serial->tx_pos], 0 == serial->tx_pos || 1 == serial->level[SPI_CS] );
+			serial->tx_pos++;
+			return true;
+
+		case SERIAL_I2C_MASTER:
+			if ( I2C_DONE == serial->phase )
+				return false;
+			if ( I2C_IDLE == serial->phase )
+			{
+				i2c_start ( serial );
+				i2c_write_byte ( serial, serial->tx[serial->tx_pos++] );
+				serial->phase = I2C_BODY;
+				return true;
+			}
+			if ( !serial->ack
+			        || ( serial->read_count && serial->rx_len == serial->read_count )
+			        || ( !serial->read_count && serial->tx_pos == serial->tx_len ) )
+			{
+				i2c_stop ( serial );
+				serial->phase = I2C_DONE;
+				return true;
+			}
+			if ( serial->read_count )
+				i2c_read_byte ( serial, serial->rx_len + 1 == serial->read_count );
+			else
+				i2c_write_byte ( serial, serial->tx[serial->tx_pos++] );
+			return true;
+
+		default:
+			break;
+	}
+	return false;
+}
+
+/**
+ * [Carry out one operation on the lines]
+ * @param serial [engine]
+ * @param op     [operation]
+ * @param atime  [current time]
+ */
+static void
+serial_exec ( VSM_SERIAL* serial, SERIAL_OP* op, ABSTIME atime )
+{
+	VSM_PIN* pin = serial->lines[op->line];
+	switch ( op->kind )
+	{
+		case OP_DRIVE:
+			pin->pin->vtable->setstate2 ( pin->pin, 0, atime, pin->on_time, op->level ? SHI : SLO );
+			break;
+		case OP_RELEASE:
+			pin->pin->vtable->setstate2 ( pin->pin, 0, atime, pin->off_time, FLT );
+			break;
+		case OP_SAMPLE:
+			/* Without a MISO line zeros are shifted in */
+			if ( serial->msb_first || SERIAL_I2C_MASTER == serial->kind )
+				serial->shift = ( serial->shift << 1 ) | ( pin && is_pin_high ( pin->pin ) );
+			else
+				serial->shift = ( serial->shift >> 1 ) | ( ( pin && is_pin_high ( pin->pin ) ) << 7 );
+			break;
+		case OP_STORE:
+		{
+			uint8_t byte = serial->shift;
+			serial_append ( &serial->rx, &serial->rx_len, &serial->rx_size, &byte, 1 );
+			serial->shift = 0;
+			break;
+		}
+		case OP_ACK:
+			serial->ack = is_pin_low ( pin->pin );
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * [Run the operations due now and schedule a host callback for the next one]
+ * @param serial [engine]
+ * @param atime  [current time]
+ */
+void
+serial_run ( VSM_SERIAL* serial, ABSTIME atime )
+{
+	VSM_MODEL* model = serial->model;
+	for ( ;; )
+	{
+		if ( serial->op_pos == serial->op_count && false == serial_fill ( serial ) )
+			break;
+		if ( serial->op_pos == serial->op_count )
+			continue;
+		SERIAL_OP* op = &serial->ops[serial->op_pos];
+		if ( op->delay > 0 )
+		{
+			ABSTIME at = atime + op->delay;
+			op->delay = 0;
+			if ( model->dsim->vtable->setcallbackex ( model->dsim, 0, at, &model->dsim_model, ( void* ) vsm_serial_callback, serial->slot ) )
+				return;
+			/* Nothing would ever resume the transfer, end it unacknowledged */
+			out_error ( model, "serial: cannot schedule the next bit" );
+			serial->ack = false;
+			break;
+		}
+		serial_exec ( serial, op, atime );
+		serial->op_pos++;
+	}
+
+	serial->busy = false;
+	serial->tx_len = 0;
+	serial->tx_pos = 0;
+	serial->pending = 0;
+	if ( serial->on_done )
+		serial->on_done ( serial );
+}
+
+/**
+ * [Start the engine if it is idle]
+ * @param serial [engine]
+ */
+static void
+serial_kick ( VSM_SERIAL* serial )
+{
+	if ( serial->busy )
+		return;
+	ABSTIME curtime = 0;
+	systime ( serial->model, &curtime );
+	serial->busy = true;
+	serial->rx_len = 0;
+	serial->shift = 0;
+	serial->ack = true;
+	serial->phase = I2C_IDLE;
+	serial->op_count = 0;
+	serial->op_pos = 0;
+	serial_run ( serial, curtime );
+}
+
+/**
+ * [Queue bytes on a UART transmitter or an SPI master]
+ *
+ * Bytes queued while a transfer is under way extend it, the completion
+ * comes once for the whole run.
+ *
+ * @param  serial [engine]
+ * @param  data   [bytes]
+ * @param  len    [number of bytes]
+ * @return        [false if out of memory or the engine is an I2C master]
+ */
+bool
+serial_send ( VSM_SERIAL* serial, const uint8_t* data, size_t len )
+{
+	if ( SERIAL_I2C_MASTER == serial->kind )
+		return false;
+	if ( false == serial_append ( &serial->tx, &serial->tx_len, &serial->tx_size, data, len ) )
+		return false;
+	serial_kick ( serial );
+	return true;
+}
+
+/**
+ * [Run an I2C write transaction: start, address, data, stop]
+ * @param  serial  [I2C master]
+ * @param  address [7-bit slave address]
+ * @param  data    [bytes to write]
+ * @param  len     [number of bytes]
+ * @return         [false if a transaction is under way or out of memory]
+ */
+bool
+i2c_write ( VSM_SERIAL* serial, uint8_t address, const uint8_t* data, size_t len )
+{
+	if ( SERIAL_I2C_MASTER != serial->kind || serial->busy )
+		return false;
+	uint8_t header = address << 1;
+	serial->tx_len = 0;
+	serial->read_count = 0;
+	if ( false == serial_append ( &serial->tx, &serial->tx_len, &serial->tx_size, &header, 1 )
+	        || false == serial_append ( &serial->tx, &serial->tx_len, &serial->tx_size, data, len ) )
+		return false;
+	serial_kick ( serial );
+	return true;
+}
+
+/**
+ * [Run an I2C read transaction: start, address, len bytes, stop]
+ * @param  serial  [I2C master]
+ * @param  address [7-bit slave address]
+ * @param  len     [number of bytes to read, at least 1]
+ * @return         [false if a transaction is under way or out of memory]
+ */
+bool
+i2c_read ( VSM_SERIAL* serial, uint8_t address, size_t len )
+{
+	if ( SERIAL_I2C_MASTER != serial->kind || serial->busy || 0 == len )
+		return false;
+	uint8_t header = ( address << 1 ) | 1;
+	serial->tx_len = 0;
+	serial->read_count = len;
+	if ( false == serial_append ( &serial->tx, &serial->tx_len, &serial->tx_size, &header, 1 ) )
+		return false;
+	serial_kick ( serial );
+	return true;
+}
+
+/**
+ * [Hand every buffered byte to on_rx]
+ * @param serial [decoder]
+ */
+static void
+rx_deliver ( VSM_SERIAL* serial )
+{
+	uint8_t bytes[SERIAL_RING], flags[SERIAL_RING], aux[SERIAL_RING];
+	size_t len = serial->ring_count;
+	if ( 0 == len )
+		return;
+	for ( size_t i=0; i < len; i++ )
+	{
+		int32_t slot = ( serial->ring_head + i ) % SERIAL_RING;
+		bytes[i] = serial->ring[slot];
+		flags[i] = serial->ring_flags[slot];
+		aux[i] = serial->ring_aux[slot];
+	}
+	/* Emptied first, on_rx may already be fed again */
+	serial->ring_head = ( serial->ring_head + len ) % SERIAL_RING;
+	serial->ring_count = 0;
+	if ( serial->on_rx )
+		serial->on_rx ( serial, bytes, flags, aux, len );
+}
+
+/**
+ * [Buffer a received byte, delivering once the batch is complete]
+ * @param serial [decoder]
+ * @param byte   [data]
+ * @param aux    [MISO data of an SPI byte]
+ * @param flags  [RX_* flags]
+ */
+static void
+rx_push ( VSM_SERIAL* serial, uint8_t byte, uint8_t aux, uint8_t flags )
+{
+	if ( SERIAL_RING == serial->ring_count )
+		rx_deliver ( serial );
+	int32_t slot = ( serial->ring_head + serial->ring_count++ ) % SERIAL_RING;
+	serial->ring[slot] = byte;
+	serial->ring_flags[slot] = flags;
+	serial->ring_aux[slot] = aux;
+	if ( serial->ring_count >= serial->rx_batch )
+		rx_deliver ( serial );
+}
+
+/**
+ * [Bits in a UART frame up to the first stop bit]
+ * @param  serial [decoder]
+ * @return        [bit count]
+ */
+static inline int32_t
+uart_frame_bits ( VSM_SERIAL* serial )
+{
+	return 2 + serial->bits + ( PARITY_NONE != serial->parity );
+}
+
+/**
+ * [UART line edge: a falling edge while idle starts a frame, later edges
+ * are only timestamped]
+ * @param serial [decoder]
+ * @param pin    [RX pin]
+ * @param atime  [edge time]
+ */
+static void
+uart_rx_edge ( VSM_SERIAL* serial, VSM_PIN* pin, ABSTIME atime )
+{
+	VSM_MODEL* model = serial->model;
+	if ( serial->in_frame )
+	{
+		if ( serial->edge_count < SERIAL_MAX_EDGES )
+			serial->edges[serial->edge_count++] = atime;
+		return;
+	}
+	if ( !is_pin_negedge ( pin->pin ) )
+		return;
+	serial->in_frame = true;
+	serial->frame_start = atime;
+	serial->edge_count = 0;
+	/* One callback per frame, in the middle of the first stop bit */
+	ABSTIME at = atime + uart_frame_bits ( serial ) * serial->bit_time - serial->bit_time / 2;
+	if ( NULL == model->dsim->vtable->setcallbackex ( model->dsim, 0, at, &model->dsim_model, ( void* ) vsm_serial_callback, serial->slot ) )
+	{
+		/* No callback would ever close the frame, wait for the next start bit */
+		serial->in_frame = false;
+		out_error ( model, "uart_rx: cannot schedule the frame end" );
+	}
+}
+
+/**
+ * [Rebuild a UART frame from the edge timestamps, sampling mid-bit]
+ * @param serial [decoder]
+ */
+static void
+uart_rx_finish ( VSM_SERIAL* serial )
+{
+	const int32_t frame_bits = uart_frame_bits ( serial );
+	uint32_t frame = 0;
+	uint32_t level = 0;
+	int32_t edge = 0;
+	for ( int32_t i=0; i < frame_bits; i++ )
+	{
+		ABSTIME at = serial->frame_start + i * serial->bit_time + serial->bit_time / 2;
+		while ( edge < serial->edge_count && serial->edges[edge] <= at )
+		{
+			level ^= 1;
+			edge++;
+		}
+		frame |= level << i;
+	}
+	serial->in_frame = false;
+
+	uint8_t flags = 0;
+	uint32_t data = ( frame >> 1 ) & ( ( 1u << serial->bits ) - 1 );
+	if ( ( frame & 1 ) || !( ( frame >> ( frame_bits - 1 ) ) & 1 ) )
+		flags |= RX_FRAMING;
+	if ( PARITY_NONE != serial->parity )
+	{
+		uint32_t ones = __builtin_popcount ( data );
+		uint32_t parity = ( frame >> ( 1 + serial->bits ) ) & 1;
+		if ( parity != ( ( ones & 1 ) ^ ( PARITY_ODD == serial->parity ) ) )
+			flags |= RX_PARITY;
+	}
+	rx_push ( serial, data, 0, flags );
+}
+
+/**
+ * [SPI edge: CS frames the transfer, SCK shifts MOSI and MISO in]
+ * @param serial [decoder]
+ * @param pin    [SCK or CS]
+ */
+static void
+spi_rx_edge ( VSM_SERIAL* serial, VSM_PIN* pin )
+{
+	VSM_PIN* cs = serial->lines[SPI_CS];
+	if ( pin == cs )
+	{
+		if ( is_pin_negedge ( pin->pin ) )
+		{
+			serial->bit_count = 0;
+			serial->next_flags = RX_START;
+		}
+		else if ( is_pin_posedge ( pin->pin ) )
+		{
+			if ( serial->bit_count )
+				rx_push ( serial, serial->shift, serial->shift_aux, serial->next_flags | RX_FRAMING );
+			serial->bit_count = 0;
+			rx_deliver ( serial );
+		}
+		return;
+	}
+	if ( cs && !is_pin_low ( cs->pin ) )
+		return;
+
+	const bool cpol = ( serial->mode >> 1 ) & 1;
+	const bool cpha = serial->mode & 1;
+	const bool leading = cpol ? is_pin_negedge ( pin->pin ) : is_pin_posedge ( pin->pin );
+	/* Mode 0 and 2 sample on the leading edge, 1 and 3 on the trailing one */
+	if ( leading == cpha )
+		return;
+
+	VSM_PIN* mosi = serial->lines[SPI_MOSI];
+	VSM_PIN* miso = serial->lines[SPI_MISO];
+	uint32_t bit = mosi && is_pin_high ( mosi->pin );
+	uint32_t aux = miso && is_pin_high ( miso->pin );
+	if ( 0 == serial->bit_count )
+		serial->shift = serial->shift_aux = 0;
+	if ( serial->msb_first )
+	{
+		serial->shift = ( serial->shift << 1 ) | bit;
+		serial->shift_aux = ( serial->shift_aux << 1 ) | aux;
+	}
+	else
+	{
+		serial->shift |= bit << serial->bit_count;
+		serial->shift_aux |= aux << serial->bit_count;
+	}
+	if ( 8 == ++serial->bit_count )
+	{
+		rx_push ( serial, serial->shift, serial->shift_aux, serial->next_flags );
+		serial->next_flags = 0;
+		serial->bit_count = 0;
+	}
+}
+
+/**
+ * [I2C edge: SDA moving while SCL is high is a start or stop, SCL rising
+ * samples data and acknowledge bits]
+ * @param serial [decoder]
+ * @param pin    [SCL or SDA]
+ */
+static void
+i2c_rx_edge ( VSM_SERIAL* serial, VSM_PIN* pin )
+{
+	VSM_PIN* scl = serial->lines[I2C_SCL];
+	VSM_PIN* sda = serial->lines[I2C_SDA];
+	if ( pin == sda )
+	{
+		if ( !is_pin_high ( scl->pin ) )
+			return;
+		if ( is_pin_negedge ( pin->pin ) )
+		{
+			/* Repeated starts keep the transaction open */
+			serial->in_frame = true;
+			serial->bit_count = 0;
+			serial->shift = 0;
+			serial->next_flags = RX_START;
+		}
+		else if ( is_pin_posedge ( pin->pin ) )
+		{
+			serial->in_frame = false;
+			serial->bit_count = 0;
+			rx_deliver ( serial );
+		}
+		return;
+	}
+	if ( !serial->in_frame || !is_pin_posedge ( pin->pin ) )
+		return;
+	if ( serial->bit_count < 8 )
+	{
+		serial->shift = ( serial->shift << 1 ) | is_pin_high ( sda->pin );
+		serial->bit_count++;
+		return;
+	}
+	rx_push ( serial, serial->shift, 0, serial->next_flags | ( is_pin_high ( sda->pin ) ? RX_NACK : 0 ) );
+	serial->next_flags = 0;
+	serial->bit_count = 0;
+	serial->shift = 0;
+}
+
+/**
+ * [Allocate the register file of a slave engine, all registers read 0]
+ * @param  serial     [slave engine]
+ * @param  size       [number of registers, 1 to 65536]
+ * @param  addr_bytes [register address bytes, 0 to 2]
+ * @return            [false if out of memory]
+ */
+bool
+slave_regs ( VSM_SERIAL* serial, uint32_t size, uint8_t addr_bytes )
+{
+	SERIAL_REGMAP* regs = &serial->regs;
+	regs->value = calloc ( size, 1 );
+	regs->reset = calloc ( size, 1 );
+	regs->ro_mask = calloc ( size, 1 );
+	regs->hooks = calloc ( size, 1 );
+	regs->size = size;
+	regs->addr_bytes = addr_bytes;
+	return regs->value && regs->reset && regs->ro_mask && regs->hooks;
+}
+
+/**
+ * [Restore the reset values of a slave and drop any transaction]
+ * @param serial [slave engine]
+ */
+void
+slave_reset ( VSM_SERIAL* serial )
+{
+	memcpy ( serial->regs.value, serial->regs.reset, serial->regs.size );
+	serial->regs.pointer = 0;
+	serial->state = SLAVE_IDLE;
+}
+
+/**
+ * [Fetch the register at the pointer for the master, then advance]
+ * @param  serial [slave engine]
+ * @return        [register value, possibly refreshed by the read hook]
+ */
+static uint8_t
+slave_load ( VSM_SERIAL* serial )
+{
+	SERIAL_REGMAP* regs = &serial->regs;
+	uint32_t reg = regs->pointer;
+	if ( ( regs->hooks[reg] & REG_HOOK_READ ) && serial->on_read )
+		regs->value[reg] = serial->on_read ( serial, reg, regs->value[reg] );
+	regs->pointer = ( reg + 1 ) % regs->size;
+	return regs->value[reg];
+}
+
+/**
+ * [Store a byte from the master at the pointer, then advance]
+ * @param serial [slave engine]
+ * @param byte   [data, read-only bits are kept]
+ */
+static void
+slave_store ( VSM_SERIAL* serial, uint8_t byte )
+{
+	SERIAL_REGMAP* regs = &serial->regs;
+	uint32_t reg = regs->pointer;
+	uint8_t ro = regs->ro_mask[reg];
+	regs->value[reg] = ( regs->value[reg] & ro ) | ( byte & ~ro );
+	regs->pointer = ( reg + 1 ) % regs->size;
+	if ( ( regs->hooks[reg] & REG_HOOK_WRITE ) && serial->on_write )
+		serial->on_write ( serial, reg, regs->value[reg] );
+}
+
+/**
+ * [Take a register address byte, most significant first]
+ * @param  serial [slave engine]
+ * @param  byte   [address byte]
+ * @return        [true once the address is complete]
+ */
+static bool
+slave_pointer ( VSM_SERIAL* serial, uint8_t byte )
+{
+	SERIAL_REGMAP* regs = &serial->regs;
+	if ( 0 == serial->pointer_bytes )
+		regs->pointer = 0;
+	regs->pointer = ( ( regs->pointer << 8 ) | byte ) % regs->size;
+	return ++serial->pointer_bytes >= regs->addr_bytes;
+}
+
+/**
+ * [Drive or release a slave line, unchanged levels are not driven again]
+ * @param serial [slave engine]
+ * @param line   [line number]
+ * @param level  [0, 1 or -1 to let it float]
+ * @param atime  [current time]
+ */
+static void
+slave_line ( VSM_SERIAL* serial, uint8_t line, int8_t level, ABSTIME atime )
+{
+	VSM_PIN* pin = serial->lines[line];
+	if ( NULL == pin || level == serial->level[line] )
+		return;
+	serial->level[line] = level;
+	STATE state = level < 0 ? FLT : level ? SHI : SLO;
+	pin->pin->vtable->setstate2 ( pin->pin, 0, atime, level < 0 ? pin->off_time : pin->on_time, state );
+}
+
+/**
+ * [I2C slave edge]
+ *
+ * Bits are sampled on SCL rising and SDA only changes with SCL low, so
+ * the slave never fakes a start or stop. bit_count counts the clocks of
+ * the current byte, the 9th being the acknowledge.
+ *
+ * @param serial [slave engine]
+ * @param pin    [SCL or SDA]
+ * @param atime  [edge time]
+ */
+static void
+i2c_slave_edge ( VSM_SERIAL* serial, VSM_PIN* pin, ABSTIME atime )
+{
+	VSM_PIN* scl = serial->lines[I2C_SCL];
+	VSM_PIN* sda = serial->lines[I2C_SDA];
+	VSM_MODEL* model = serial->model;
+
+	if ( pin == sda )
+	{
+		if ( !is_pin_high ( scl->pin ) )
+			return;
+		if ( is_pin_negedge ( pin->pin ) )
+		{
+			serial->state = SLAVE_ADDRESS;
+			serial->slave_read = false;
+			serial->bit_count = 0;
+			serial->shift = 0;
+		}
+		else if ( is_pin_posedge ( pin->pin ) )
+		{
+			serial->state = SLAVE_IDLE;
+		}
+		return;
+	}
+	if ( SLAVE_IDLE == serial->state )
+		return;
+
+	if ( is_pin_posedge ( pin->pin ) )
+	{
+		if ( ++serial->bit_count > 8 )
+		{
+			/* Acknowledge clock, a NACK from the master ends the read */
+			if ( SLAVE_READ == serial->state && is_pin_high ( sda->pin ) )
+				serial->state = SLAVE_IDLE;
+			return;
+		}
+		if ( SLAVE_READ == serial->state )
+			return;
+		serial->shift = ( serial->shift << 1 ) | is_pin_high ( sda->pin );
+		if ( 8 != serial->bit_count )
+			return;
+		uint8_t byte = serial->shift;
+		switch ( serial->state )
+		{
+			case SLAVE_ADDRESS:
+				serial->pointer_bytes = 0;
+				serial->slave_read = byte & 1;
+				if ( ( byte >> 1 ) != serial->address )
+					serial->state = SLAVE_IDLE;
+				else if ( !serial->slave_read )
+					serial->state = serial->regs.addr_bytes ? SLAVE_POINTER : SLAVE_WRITE;
+				break;
+			case SLAVE_POINTER:
+				if ( slave_pointer ( serial, byte ) )
+					serial->state = SLAVE_WRITE;
+				break;
+			default:
+				slave_store ( serial, byte );
+				break;
+		}
+		return;
+	}
+
+	if ( !is_pin_negedge ( pin->pin ) )
+		return;
+	switch ( serial->bit_count )
+	{
+		case 8:
+			/* Acknowledge a byte from the master, or leave SDA to the master's acknowledge */
+			slave_line ( serial, I2C_SDA, SLAVE_READ == serial->state ? -1 : 0, atime );
+			break;
+		case 9:
+			serial->bit_count = 0;
+			serial->shift = 0;
+			if ( serial->slave_read )
+			{
+				serial->state = SLAVE_READ;
+				serial->out = slave_load ( serial );
+				slave_line ( serial, I2C_SDA, ( serial->out & 0x80 ) ? -1 : 0, atime );
+			}
+			else
+			{
+				slave_line ( serial, I2C_SDA, -1, atime );
+			}
+			/* SCL is only held once the event releasing it is scheduled */
+			if ( serial->stretch )
+			{
+				if ( model->dsim->vtable->setcallbackex ( model->dsim, 0, atime + serial->stretch, &model->dsim_model, ( void* ) vsm_serial_callback, serial->slot ) )
+					slave_line ( serial, I2C_SCL, 0, atime );
+				else
+					out_error ( model, "i2c_slave: cannot schedule the end of clock stretching" );
+			}
+			break;
+		default:
+			if ( SLAVE_READ == serial->state )
+				slave_line ( serial, I2C_SDA, ( ( serial->out << serial->bit_count ) & 0x80 ) ? -1 : 0, atime );
+			break;
+	}
+}
+
+/**
+ * [Level of the SPI slave output bit due next]
+ * @param  serial [slave engine]
+ * @return        [0 or 1]
+ */
+static inline int8_t
+spi_slave_bit ( const VSM_SERIAL* serial )
+{
+	if ( serial->msb_first )
+		return ( serial->out >> ( 7 - serial->bit_count ) ) & 1;
+	return ( serial->out >> serial->bit_count ) & 1;
+}
+
+/**
+ * [SPI slave edge]
+ *
+ * CS frames the transaction. The first byte is the command, read_flag
+ * bits ask for a read and the rest is the register address, further
+ * address bytes may follow. MISO changes on the edge opposite to sampling.
+ *
+ * With CPHA 0 the first bit of a byte goes out before the master has
+ * clocked anything of it, so the register is only peeked there. The read
+ * hook and the pointer advance wait for the first sampling edge, a byte
+ * the master never clocks has no side effects.
+ *
+ * @param serial [slave engine]
+ * @param pin    [SCK or CS]
+ * @param atime  [edge time]
+ */
+static void
+spi_slave_edge ( VSM_SERIAL* serial, VSM_PIN* pin, ABSTIME atime )
+{
+	VSM_PIN* cs = serial->lines[SPI_CS];
+	const bool cpol = ( serial->mode >> 1 ) & 1;
+	const bool cpha = serial->mode & 1;
+
+	if ( pin == cs )
+	{
+		if ( is_pin_negedge ( pin->pin ) )
+		{
+			serial->state = SLAVE_ADDRESS;
+			serial->slave_read = false;
+			serial->bit_count = 0;
+			serial->shift = 0;
+			serial->out = 0;
+			serial->prefetched = false;
+			/* With CPHA 0 the first bit has to be out before the first clock */
+			if ( !cpha )
+				slave_line ( serial, SPI_MISO, 0, atime );
+		}
+		else if ( is_pin_posedge ( pin->pin ) )
+		{
+			serial->state = SLAVE_IDLE;
+			serial->prefetched = false;
+			slave_line ( serial, SPI_MISO, -1, atime );
+		}
+		return;
+	}
+	if ( SLAVE_IDLE == serial->state )
+		return;
+
+	const bool leading = cpol ? is_pin_negedge ( pin->pin ) : is_pin_posedge ( pin->pin );
+	if ( leading == cpha )
+	{
+		/* Shifting edge, a new byte starts once the previous one was sampled */
+		if ( 0 == serial->bit_count )
+		{
+			serial->out = 0;
+			if ( SLAVE_READ == serial->state && cpha )
+			{
+				serial->out = slave_load ( serial );
+			}
+			else if ( SLAVE_READ == serial->state )
+			{
+				serial->out = serial->regs.value[serial->regs.pointer];
+				serial->prefetched = true;
+			}
+		}
+		slave_line ( serial, SPI_MISO, spi_slave_bit ( serial ), atime );
+		return;
+	}
+
+	/* The master is clocking a peeked byte, it is read for real now */
+	if ( serial->prefetched )
+	{
+		serial->prefetched = false;
+		serial->out = slave_load ( serial );
+	}
+	VSM_PIN* mosi = serial->lines[SPI_MOSI];
+	uint32_t bit = mosi && is_pin_high ( mosi->pin );
+	if ( serial->msb_first )
+		serial->shift = ( serial->shift << 1 ) | bit;
+	else
+		serial->shift |= bit << serial->bit_count;
+	if ( 8 != ++serial->bit_count )
+		return;
+	uint8_t byte = serial->shift;
+	serial->bit_count = 0;
+	serial->shift = 0;
+	switch ( serial->state )
+	{
+		case SLAVE_ADDRESS:
+			serial->slave_read = byte & serial->read_flag;
+			serial->pointer_bytes = 0;
+			slave_pointer ( serial, byte & ~serial->read_flag );
+			if ( serial->pointer_bytes < serial->regs.addr_bytes )
+				serial->state = SLAVE_POINTER;
+			else
+				serial->state = serial->slave_read ? SLAVE_READ : SLAVE_WRITE;
+			break;
+		case SLAVE_POINTER:
+			if ( slave_pointer ( serial, byte ) )
+				serial->state = serial->slave_read ? SLAVE_READ : SLAVE_WRITE;
+			break;
+		case SLAVE_WRITE:
+			slave_store ( serial, byte );
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * [Edge of a pin a decoder listens to, called from vsm_pin_handler]
+ * @param serial [decoder]
+ * @param pin    [pin that moved]
+ * @param atime  [edge time]
+ */
+void
+serial_edge ( VSM_SERIAL* serial, VSM_PIN* pin, ABSTIME atime )
+{
+	switch ( serial->kind )
+	{
+		case SERIAL_UART_RX:
+			uart_rx_edge ( serial, pin, atime );
+			break;
+		case SERIAL_SPI_RX:
+			spi_rx_edge ( serial, pin );
+			break;
+		case SERIAL_I2C_RX:
+			i2c_rx_edge ( serial, pin );
+			break;
+		case SERIAL_I2C_SLAVE:
+			i2c_slave_edge ( serial, pin, atime );
+			break;
+		case SERIAL_SPI_SLAVE:
+			spi_slave_edge ( serial, pin, atime );
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * [Host callback scheduled by an engine]
+ * @param serial [engine]
+ * @param atime  [event time]
+ */
+void
+serial_callback ( VSM_SERIAL* serial, ABSTIME atime )
+{
+	if ( SERIAL_UART_RX == serial->kind )
+		uart_rx_finish ( serial );
+	else if ( SERIAL_I2C_SLAVE == serial->kind )
+		slave_line ( serial, I2C_SCL, -1, atime );
+	else
+		serial_run ( serial, atime );
+}
+
+/**
+ * [Feed a decoder with the edges of its clock, frame and data-in pins]
+ * @param  serial [decoder with its lines set]
+ * @return        [false if one of the pins already feeds another decoder]
+ */
+bool
+serial_listen ( VSM_SERIAL* serial )
+{
+	VSM_PIN* pins[2] = {NULL, NULL};
+	switch ( serial->kind )
+	{
+		case SERIAL_UART_RX:
+			pins[0] = serial->lines[UART_RX];
+			break;
+		case SERIAL_SPI_RX:
+			pins[0] = serial->lines[SPI_SCK];
+			pins[1] = serial->lines[SPI_CS];
+			break;
+		case SERIAL_I2C_RX:
+		case SERIAL_I2C_SLAVE:
+			pins[0] = serial->lines[I2C_SCL];
+			pins[1] = serial->lines[I2C_SDA];
+			break;
+		case SERIAL_SPI_SLAVE:
+			pins[0] = serial->lines[SPI_SCK];
+			pins[1] = serial->lines[SPI_CS];
+			break;
+		default:
+			return false;
+	}
+	for ( int32_t i=0; i < 2; i++ )
+		if ( pins[i] && pins[i]->listener && serial != pins[i]->listener )
+			return false;
+	for ( int32_t i=0; i < 2; i++ )
+	{
+		if ( NULL == pins[i] )
+			continue;
+		pins[i]->listener = serial;
+		watch_pin ( serial->model, pins[i] );
+	}
+	return true;
+}
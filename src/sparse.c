@@ -0,0 +1,405 @@
+/**
+ *
+ * @file   sparse.c
+ * @Author Lavrentiy Ivanov (ookami@mail.ru)
+ * @date   17.10.2026
+ * @brief  Sparse, lazily allocated memories.
+ *
+ * Memory is split into pages that are only allocated when a byte in them
+ * is written something other than the fill value. Reads of a missing page
+ * see one shared page of fill bytes, filling whole pages with the fill
+ * value gives them back. A 512 MB part touched in a few places costs the
+ * page table and those few pages.
+ *
+ * This file is part of OpenVSM.
+ * OpenVSM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * OpenVSM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with OpenVSM.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <vsm_api.h>
+
+/**
+ * [Check a byte range]
+ * @param  sp   [memory]
+ * @param  addr [first byte]
+ * @param  len  [bytes]
+ * @return      [true if the range is inside the memory]
+ */
+static inline bool
+sparse_range ( const VSM_SPARSE* sp, uint64_t addr, uint64_t len )
+{
+	return addr <= sp->size && len <= sp->size - addr;
+}
+
+/**
+ * [Page holding a byte for reading]
+ * @param  sp   [memory]
+ * @param  addr [byte address]
+ * @return      [page, the shared fill page if missing]
+ */
+static inline const uint8_t*
+sparse_page_read ( const VSM_SPARSE* sp, uint64_t addr )
+{
+	const uint8_t* page = sp->pages[addr >> SPARSE_PAGE_BITS];
+	return page ? page : sp->zero;
+}
+
+/**
+ * [Page holding a byte for writing, allocated on first use]
+ * @param  sp   [memory]
+ * @param  addr [byte address]
+ * @return      [page or NULL if out of memory]
+ */
+static uint8_t*
+sparse_page_write ( VSM_SPARSE* sp, uint64_t addr )
+{
+	uint8_t** slot = &sp->pages[addr >> SPARSE_PAGE_BITS];
+	if ( NULL == *slot )
+	{
+		*slot = malloc ( SPARSE_PAGE );
+		if ( NULL == *slot )
+			return NULL;
+		memcpy ( *slot, sp->zero, SPARSE_PAGE );
+		sp->resident++;
+	}
+	return *slot;
+}
+
+/**
+ * [Bytes from addr to the end of its page, at most len]
+ * @param  addr [byte address]
+ * @param  len  [bytes wanted]
+ * @return      [chunk size]
+ */
+static inline size_t
+sparse_chunk ( uint64_t addr, uint64_t len )
+{
+	uint64_t left = SPARSE_PAGE - ( addr & ( SPARSE_PAGE - 1 ) );
+	return len < left ? len : left;
+}
+
+/**
+ * [Refresh the popup window over a changed range]
+ * @param sp   [memory]
+ * @param addr [first changed byte]
+ * @param len  [changed bytes]
+ */
+static void
+sparse_view_update ( VSM_SPARSE* sp, uint64_t addr, uint64_t len )
+{
+	if ( NULL == sp->view || addr >= sp->view_base + sp->view_size || addr + len <= sp->view_base )
+		return;
+	uint64_t start = addr > sp->view_base ? addr : sp->view_base;
+	uint64_t end = addr + len < sp->view_base + sp->view_size ? addr + len : sp->view_base + sp->view_size;
+	sparse_read ( sp, start, sp->view + ( start - sp->view_base ), end - start );
+}
+
+/**
+ * [Create a memory and register it with the model]
+ * @param  model [model context]
+ * @param  size  [bytes]
+ * @param  fill  [value every byte starts from]
+ * @return       [memory or NULL if out of memory]
+ */
+VSM_SPARSE*
+sparse_new ( VSM_MODEL* model, uint64_t size, uint8_t fill )
+{
+	uint64_t page_count = ( size + SPARSE_PAGE - 1 ) >> SPARSE_PAGE_BITS;
+	if ( page_count > SIZE_MAX / sizeof ( uint8_t* ) )
+		return NULL;
+	VSM_SPARSE** sparses = realloc ( model->sparses, ( model->sparse_count + 1 ) * sizeof *sparses );
+	if ( NULL == sparses )
+		return NULL;
+	model->sparses = sparses;
+
+	VSM_SPARSE* sp = calloc ( 1, sizeof *sp );
+	if ( NULL == sp )
+		return NULL;
+	sp->page_count = page_count;
+	sp->pages = calloc ( page_count ? page_count : 1, sizeof *sp->pages );
+	sp->zero = malloc ( SPARSE_PAGE );
+	if ( NULL == sp->pages || NULL == sp->zero )
+	{
+		sparse_free ( sp );
+		return NULL;
+	}
+	memset ( sp->zero, fill, SPARSE_PAGE );
+	sp->model = model;
+	sp->size = size;
+	sp->fill = fill;
+	sp->lua_ref = LUA_NOREF;
+	model->sparses[model->sparse_count++] = sp;
+	return sp;
+}
+
+/**
+ * [Release a memory, only done when the model goes away]
+ * @param sp [memory]
+ */
+void
+sparse_free ( VSM_SPARSE* sp )
+{
+	if ( sp->pages )
+		for ( size_t i=0; i < sp->page_count; i++ )
+			free ( sp->pages[i] );
+	free ( sp->pages );
+	free ( sp->zero );
+	free ( sp->view );
+	free ( sp );
+}
+
+/**
+ * [Copy bytes out]
+ * @param  sp   [memory]
+ * @param  addr [first byte]
+ * @param  dst  [destination]
+ * @param  len  [bytes]
+ * @return      [false if the range is outside the memory]
+ */
+bool
+sparse_read ( VSM_SPARSE* sp, uint64_t addr, void* dst, size_t len )
+{
+	if ( !sparse_range ( sp, addr, len ) )
+		return false;
+	uint8_t* out = dst;
+	while ( len )
+	{
+		size_t chunk = sparse_chunk ( addr, len );
+		memcpy ( out, sparse_page_read ( sp, addr ) + ( addr & ( SPARSE_PAGE - 1 ) ), chunk );
+		out += chunk;
+		addr += chunk;
+		len -= chunk;
+	}
+	return true;
+}
+
+/**
+ * [Copy bytes in, runs of the fill value allocate no page]
+ * @param  sp   [memory]
+ * @param  addr [first byte]
+ * @param  src  [source]
+ * @param  len  [bytes]
+ * @return      [false if the range is outside the memory or out of memory]
+ */
+bool
+sparse_write ( VSM_SPARSE* sp, uint64_t addr, const void* src, size_t len )
+{
+	if ( !sparse_range ( sp, addr, len ) )
+		return false;
+	const uint8_t* in = src;
+	uint64_t start = addr;
+	size_t total = len;
+	bool ok = true;
+	while ( len )
+	{
+		size_t chunk = sparse_chunk ( addr, len );
+		/* Fill bytes landing on a missing page change nothing */
+		if ( sp->pages[addr >> SPARSE_PAGE_BITS] || 0 != memcmp ( in, sp->zero, chunk ) )
+		{
+			uint8_t* page = sparse_page_write ( sp, addr );
+			if ( NULL == page )
+			{
+				ok = false;
+				break;
+			}
+			memcpy ( page + ( addr & ( SPARSE_PAGE - 1 ) ), in, chunk );
+		}
+		in += chunk;
+		addr += chunk;
+		len -= chunk;
+	}
+	sparse_view_update ( sp, start, total );
+	return ok;
+}
+
+/**
+ * [Set a range to one value, whole pages of the fill value are given back]
+ * @param  sp    [memory]
+ * @param  addr  [first byte]
+ * @param  value [byte]
+ * @param  len   [bytes]
+ * @return       [false if the range is outside the memory or out of memory]
+ */
+bool
+sparse_fill ( VSM_SPARSE* sp, uint64_t addr, uint8_t value, uint64_t len )
+{
+	if ( !sparse_range ( sp, addr, len ) )
+		return false;
+	uint64_t start = addr;
+	uint64_t total = len;
+	bool ok = true;
+	while ( len )
+	{
+		size_t chunk = sparse_chunk ( addr, len );
+		uint8_t** slot = &sp->pages[addr >> SPARSE_PAGE_BITS];
+		if ( value == sp->fill && SPARSE_PAGE == chunk )
+		{
+			if ( *slot )
+			{
+				free ( *slot );
+				*slot = NULL;
+				sp->resident--;
+			}
+		}
+		else if ( value != sp->fill || *slot )
+		{
+			uint8_t* page = sparse_page_write ( sp, addr );
+			if ( NULL == page )
+			{
+				ok = false;
+				break;
+			}
+			memset ( page + ( addr & ( SPARSE_PAGE - 1 ) ), value, chunk );
+		}
+		addr += chunk;
+		len -= chunk;
+	}
+	sparse_view_update ( sp, start, total );
+	return ok;
+}
+
+/**
+ * [Copy a range between memories or inside one, overlapping ranges included]
+ *
+ * Missing source pages are copied as fills, so copying untouched memory
+ * allocates nothing.
+ *
+ * @param  dst      [destination memory]
+ * @param  dst_addr [first destination byte]
+ * @param  src      [source memory, may be dst]
+ * @param  src_addr [first source byte]
+ * @param  len      [bytes]
+ * @return          [false if a range is outside its memory or out of memory]
+ */
+bool
+sparse_copy ( VSM_SPARSE* dst, uint64_t dst_addr, VSM_SPARSE* src, uint64_t src_addr, uint64_t len )
+{
+	if ( !sparse_range ( dst, dst_addr, len ) || !sparse_range ( src, src_addr, len ) )
+		return false;
+	/* Copy back to front when the destination overlaps the source tail */
+	bool backward = dst == src && dst_addr > src_addr && dst_addr < src_addr + len;
+	uint64_t done = 0;
+	while ( done < len )
+	{
+		uint64_t left = len - done;
+		uint64_t s, d;
+		size_t chunk;
+		if ( backward )
+		{
+			/* Chunk ending at the current tail, cut at page starts */
+			s = src_addr + left;
+			d = dst_addr + left;
+			uint64_t s_room = ( ( s - 1 ) & ( SPARSE_PAGE - 1 ) ) + 1;
+			uint64_t d_room = ( ( d - 1 ) & ( SPARSE_PAGE - 1 ) ) + 1;
+			chunk = left < s_room ? left : s_room;
+			chunk = chunk < d_room ? chunk : d_room;
+			s -= chunk;
+			d -= chunk;
+		}
+		else
+		{
+			s = src_addr + done;
+			d = dst_addr + done;
+			chunk = sparse_chunk ( s, left );
+			chunk = sparse_chunk ( d, chunk );
+		}
+		const uint8_t* from = src->pages[s >> SPARSE_PAGE_BITS];
+		if ( NULL == from )
+		{
+			if ( !sparse_fill ( dst, d, src->fill, chunk ) )
+				return false;
+		}
+		else
+		{
+			uint8_t* to = sparse_page_write ( dst, d );
+			if ( NULL == to )
+				return false;
+			memmove ( to + ( d & ( SPARSE_PAGE - 1 ) ), from + ( s & ( SPARSE_PAGE - 1 ) ), chunk );
+		}
+		done += chunk;
+	}
+	sparse_view_update ( dst, dst_addr, len );
+	return true;
+}
+
+/**
+ * [Read a little endian word, bytes outside the memory read as fill]
+ * @param  sp    [memory]
+ * @param  addr  [first byte]
+ * @param  width [bytes, 1 to 8]
+ * @return       [word]
+ */
+uint64_t
+sparse_peek ( VSM_SPARSE* sp, uint64_t addr, uint8_t width )
+{
+	uint64_t value = 0;
+	for ( int32_t i=width - 1; i >= 0; i-- )
+	{
+		uint64_t a = addr + i;
+		uint8_t byte = a < sp->size ? sparse_page_read ( sp, a )[a & ( SPARSE_PAGE - 1 )] : sp->fill;
+		value = ( value << 8 ) | byte;
+	}
+	return value;
+}
+
+/**
+ * [Write a little endian word, bytes outside the memory are dropped]
+ * @param sp    [memory]
+ * @param addr  [first byte]
+ * @param value [word]
+ * @param width [bytes, 1 to 8]
+ */
+void
+sparse_poke ( VSM_SPARSE* sp, uint64_t addr, uint64_t value, uint8_t width )
+{
+	uint8_t bytes[8];
+	for ( int32_t i=0; i < width; i++, value >>= 8 )
+		bytes[i] = value;
+	if ( addr >= sp->size )
+		return;
+	sparse_write ( sp, addr, bytes, width < sp->size - addr ? width : sp->size - addr );
+}
+
+/**
+ * [Show a window of the memory in a memory popup]
+ *
+ * The popup gets a copy of the window that every later write, fill or
+ * copy through this file keeps up to date. A memory feeds one popup, a
+ * further call for the same popup moves the window.
+ *
+ * @param  sp     [memory]
+ * @param  popup  [memory popup]
+ * @param  base   [first byte shown]
+ * @param  size   [bytes shown]
+ * @return        [false if the window is outside the memory, the memory
+ *                 already feeds another popup or out of memory]
+ */
+bool
+sparse_show ( VSM_SPARSE* sp, IMEMORYPOPUP* popup, uint64_t base, size_t size )
+{
+	if ( !sparse_range ( sp, base, size ) || ( sp->popup && sp->popup != popup ) )
+		return false;
+	uint8_t* view = malloc ( size ? size : 1 );
+	if ( NULL == view )
+		return false;
+	sparse_read ( sp, base, view, size );
+	/* The popup lets go of the old window before it is freed */
+	set_memory_popup ( popup, base, view, size );
+	free ( sp->view );
+	sp->view = view;
+	sp->view_base = base;
+	sp->view_size = size;
+	sp->popup = popup;
+	return true;
+}
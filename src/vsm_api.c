@@ -24,10 +24,6 @@
 #include "vsm_api.h"
 #include <python.h>
 
-lua_State* luactx = NULL;
-/**\bug {Maximum number of pins is hardcoded}*/
-VSM_PIN device_pins[32];
-
 IDSIMMODEL_vtable VSM_DEVICE_vtable =
 {
 	.isdigital      = vsm_isdigital,
@@ -39,11 +35,6 @@ IDSIMMODEL_vtable VSM_DEVICE_vtable =
 	.callback       = vsm_callback,
 };
 
-IDSIMMODEL VSM_DEVICE =
-{
-	.vtable = &VSM_DEVICE_vtable,
-};
-
 ICPU_vtable ICPU_DEVICE_vtable =
 {
 	.vdmhlr = icpu_vdmhlr,
@@ -52,43 +43,6 @@ ICPU_vtable ICPU_DEVICE_vtable =
 	.getvardata = icpu_getvardata,
 };
 
-ICPU ICPU_DEVICE =
-{
-	.vtable = &ICPU_DEVICE_vtable,
-};
-
-typedef struct lua_global_func
-{
-	char* func_name;
-	bool* exist;
-} lua_global_func;
-
-bool global_device_init = false;
-bool global_device_simulate = false;
-bool global_timer_callback = false;
-bool global_on_stop = false;
-bool global_on_suspend = false;
-
-static lua_global_func lua_global_func_list[] =
-{
-	{.func_name="device_init", .exist=&global_device_init},
-	{.func_name="device_simulate", .exist=&global_device_simulate},
-	{.func_name="timer_callback", .exist=&global_timer_callback},
-	{.func_name="on_stop", .exist=&global_on_stop},
-	{.func_name="on_suspend", .exist=&global_on_suspend},
-	{.func_name=0},
-};
-
-static void check_global_functions ( void )
-{
-	for ( int i=0; lua_global_func_list[i].func_name; i++ )
-	{
-		lua_getglobal ( luactx,lua_global_func_list[i].func_name );
-		if ( lua_isfunction ( luactx,lua_gettop ( luactx ) ) )
-			*lua_global_func_list[i].exist = true;
-	}
-}
-
 IDSIMMODEL* __cdecl
 createdsimmodel ( char* device, ILICENCESERVER* ils )
 {
@@ -97,21 +51,65 @@ createdsimmodel ( char* device, ILICENCESERVER* ils )
 	{
 		return NULL;
 	}
+	/* Every placement of the part gets its own context */
+	VSM_MODEL* model = calloc ( 1, sizeof *model );
+	if ( NULL == model )
+	{
+		return NULL;
+	}
+	model->dsim_model.vtable = &VSM_DEVICE_vtable;
+	model->cpu.vtable = &ICPU_DEVICE_vtable;
+	for ( int32_t i=0; i < HOOK_MAX; i++ )
+		model->lua_hooks[i] = LUA_NOREF;
+	model->next_event_id = FIRST_DYNAMIC_EVENT;
 	/* Init Lua */
-	luactx = luaL_newstate();
+	model->luactx = luaL_newstate();
 	/* Open libraries */
-	luaL_openlibs ( luactx );
-	register_functions ( luactx );
+	luaL_openlibs ( model->luactx );
+	register_functions ( model );
 
-	return &VSM_DEVICE;
+	return &model->dsim_model;
 }
 
 void __cdecl
-deletedsimmodel ( IDSIMMODEL* model )
+deletedsimmodel ( IDSIMMODEL* dsim_model )
 {
-	( void ) model;
+	VSM_MODEL* model = VSM_MODEL_OF ( dsim_model );
 	/* Close Lua */
-	lua_close ( luactx );
+	lua_release_hooks ( model );
+	lua_close ( model->luactx );
+	lua_cache_release ( model->chunk );
+	for ( int32_t i=1; i <= model->pin_count; i++ )
+		free ( model->pins[i].name );
+	free ( model->pins );
+	free ( model->edge_pins );
+	free ( model->sensitivity.pins );
+	free ( model->clocks );
+	free ( model->timers );
+	free ( model->timer_due );
+	free ( model->event_handlers );
+	for ( int32_t i=0; i < model->serial_count; i++ )
+		serial_free ( model->serials[i] );
+	free ( model->serials );
+	for ( int32_t i=0; i < model->bus_master_count; i++ )
+		bus_master_free ( model->bus_masters[i] );
+	free ( model->bus_masters );
+	for ( int32_t i=0; i < model->sequencer_count; i++ )
+		sequencer_free ( model->sequencers[i] );
+	free ( model->sequencers );
+	for ( int32_t i=0; i < model->memmap_count; i++ )
+		memmap_free ( model->memmaps[i] );
+	free ( model->memmaps );
+	for ( int32_t i=0; i < model->memchip_count; i++ )
+		memchip_free ( model->memchips[i] );
+	free ( model->memchips );
+	for ( int32_t i=0; i < model->sparse_count; i++ )
+		sparse_free ( model->sparses[i] );
+	free ( model->sparses );
+	for ( int32_t i=0; i < model->nvmem_count; i++ )
+		nvmem_free ( model->nvmems[i] );
+	free ( model->nvmems );
+	free ( model );
 }
 
 int32_t __attribute__ ( ( fastcall ) )
@@ -123,115 +121,396 @@ vsm_isdigital ( IDSIMMODEL* this, uint32_t edx, char* pinname )
 	return 1;
 }
 
+/**
+ * [Number of pins declared by the device_pins entry on top of the stack]
+ * @param  L [Lua state]
+ * @return   [1 for a pin, the port width for a port, 0 for a port wider
+ *            than MAXGROUPBITS or with no pins]
+ */
+static int32_t
+entry_width ( lua_State* L )
+{
+	lua_Integer width = 1;
+	if ( LUA_TNIL == lua_getfield ( L, -1, PORT_NAME ) )
+	{
+		lua_pop ( L, 1 );
+		return width;
+	}
+	lua_pop ( L, 1 );
+	if ( LUA_TTABLE == lua_getfield ( L, -1, PORT_PINS ) )
+	{
+		lua_len ( L, -1 );
+		width = lua_tointeger ( L, -1 );
+		lua_pop ( L, 1 );
+	}
+	else
+	{
+		lua_getfield ( L, -2, PORT_FROM );
+		lua_getfield ( L, -3, PORT_TO );
+		lua_Integer from = lua_tointeger ( L, -2 );
+		lua_Integer to = lua_tointeger ( L, -1 );
+		width = ( to < from ? from - to : to - from ) + 1;
+		/* Differences wrapping past the integer range are as bad as wide */
+		if ( width <= 0 )
+			width = MAXGROUPBITS + 1;
+		lua_pop ( L, 2 );
+	}
+	lua_pop ( L, 1 );
+	return width < 1 || width > MAXGROUPBITS ? 0 : ( int32_t ) width;
+}
+
+/**
+ * [Take the next free entry of the model pin table]
+ * @param  model    [model context]
+ * @param  pin_name [pin name in the graphical model]
+ * @return          [pin with no timing set]
+ */
+static VSM_PIN*
+setup_pin ( VSM_MODEL* model, const char* pin_name )
+{
+	VSM_PIN* pin = &model->pins[++model->pin_count];
+	pin->name = strdup ( pin_name ? pin_name : "" );
+	pin->pin = get_pin ( model, pin->name );
+	pin->model = model;
+	for ( int32_t i=0; i < EDGE_MAX; i++ )
+		pin->edge_handlers[i] = LUA_NOREF;
+	pin->edge_time = -1;
+	return pin;
+}
+
+/**
+ * [Build a port from the device_pins entry on top of the stack]
+ *
+ * {port="ADDR", stem="A", from=0, to=14} or {port="DATA", pins={"D0", ...}}
+ * declares a pin group published as the global ADDR, bit 0 being the first
+ * pin listed (from). Member pins get the entry timing and no globals.
+ *
+ * @param model [model context]
+ */
+static void
+setup_port ( VSM_MODEL* model )
+{
+	lua_State* L = model->luactx;
+	int32_t width = entry_width ( L );
+	lua_getfield ( L, -1, PORT_NAME );
+	const char* port_name = lua_tostring ( L, -1 );
+	/* Checked before any pin is taken, vsm_setup counted none for it */
+	if ( NULL == port_name || 0 == width )
+	{
+		out_error ( model, "Port %s must be 1 to %d pins wide", port_name ? port_name : "?", MAXGROUPBITS );
+		lua_pop ( L, 1 );
+		return;
+	}
+	lua_getfield ( L, -2, PIN_ON_TIME );
+	ABSTIME on_time = lua_tonumber ( L, -1 );
+	lua_getfield ( L, -3, PIN_OFF_TIME );
+	ABSTIME off_time = lua_tonumber ( L, -1 );
+	lua_pop ( L, 2 );
+
+	VSM_PIN* first = &model->pins[model->pin_count + 1];
+	if ( LUA_TTABLE == lua_getfield ( L, -2, PORT_PINS ) )
+	{
+		for ( int32_t i=1; i <= width; i++ )
+		{
+			lua_rawgeti ( L, -1, i );
+			VSM_PIN* pin = setup_pin ( model, lua_tostring ( L, -1 ) );
+			pin->on_time = on_time;
+			pin->off_time = off_time;
+			lua_pop ( L, 1 );
+		}
+	}
+	else
+	{
+		lua_getfield ( L, -3, PORT_STEM );
+		const char* stem = lua_tostring ( L, -1 );
+		lua_getfield ( L, -4, PORT_FROM );
+		int32_t from = lua_tointeger ( L, -1 );
+		lua_getfield ( L, -5, PORT_TO );
+		int32_t step = lua_tointeger ( L, -1 ) < from ? -1 : 1;
+		lua_pop ( L, 2 );
+		for ( int32_t i=0; i < width; i++ )
+		{
+			char pin_name[MAX_PATH] = {0};
+			snprintf ( pin_name, sizeof pin_name, "%s%d", stem ? stem : "", from + i * step );
+			VSM_PIN* pin = setup_pin ( model, pin_name );
+			pin->on_time = on_time;
+			pin->off_time = off_time;
+		}
+		/* stem */
+		lua_pop ( L, 1 );
+	}
+	/* pins list */
+	lua_pop ( L, 1 );
+
+	for ( int32_t i=0; i < width; i++ )
+		lua_bind_pin ( model, &first[i], false );
+	VSM_PIN_GROUP* group = lua_new_pin_group ( L, model, width );
+	for ( int32_t i=0; i < width; i++ )
+		group->pins[i] = &first[i];
+	promote_pin_group ( group );
+	lua_setglobal ( L, port_name );
+	/* port name */
+	lua_pop ( L, 1 );
+}
+
+/**
+ * [Append a pin to one list of the sensitivity filter unless it is there]
+ * @param  model [model context]
+ * @param  first [index of the list in the pins array]
+ * @param  count [pins already in the list]
+ * @param  pin   [pin to append]
+ * @return       [new count]
+ */
+static int32_t
+sensitivity_push ( VSM_MODEL* model, int32_t first, int32_t count, VSM_PIN* pin )
+{
+	VSM_SENSITIVITY* sens = &model->sensitivity;
+	for ( int32_t i=first; i < first + count; i++ )
+		if ( pin == sens->pins[i] )
+			return count;
+	if ( first + count == sens->size )
+	{
+		int32_t size = sens->size ? 2 * sens->size : 8;
+		VSM_PIN** pins = realloc ( sens->pins, size * sizeof *pins );
+		if ( NULL == pins )
+		{
+			out_error ( model, "%s: not enough memory", SENSITIVITY_NAME );
+			return count;
+		}
+		sens->pins = pins;
+		sens->size = size;
+	}
+	sens->pins[first + count] = pin;
+	return count + 1;
+}
+
+/**
+ * [Append the pins named by the value on top of the stack]
+ *
+ * A value is a pin or port name, a pin object or a pin group object.
+ *
+ * @param  model [model context]
+ * @param  first [index of the list in the pins array]
+ * @param  count [pins already in the list]
+ * @return       [new count, unchanged if nothing matched]
+ */
+static int32_t
+sensitivity_add ( VSM_MODEL* model, int32_t first, int32_t count )
+{
+	lua_State* L = model->luactx;
+
+	if ( LUA_TSTRING == lua_type ( L, -1 ) )
+	{
+		const char* name = lua_tostring ( L, -1 );
+		for ( int32_t i=1; i <= model->pin_count; i++ )
+			if ( 0 == strcmp ( model->pins[i].name, name ) )
+				return sensitivity_push ( model, first, count, &model->pins[i] );
+		/* Ports are only reachable through their global */
+		lua_getglobal ( L, name );
+		VSM_PIN_GROUP* group = luaL_testudata ( L, -1, PIN_GROUP_META );
+		for ( uint32_t i=0; group && i < group->width; i++ )
+			count = sensitivity_push ( model, first, count, group->pins[i] );
+		if ( NULL == group )
+			out_warning ( model, "%s: no pin or port named %s", SENSITIVITY_NAME, name );
+		lua_pop ( L, 1 );
+		return count;
+	}
+
+	VSM_PIN** pin = luaL_testudata ( L, -1, PIN_META );
+	if ( pin )
+		return sensitivity_push ( model, first, count, *pin );
+	VSM_PIN_GROUP* group = luaL_testudata ( L, -1, PIN_GROUP_META );
+	for ( uint32_t i=0; group && i < group->width; i++ )
+		count = sensitivity_push ( model, first, count, group->pins[i] );
+	return count;
+}
+
+/**
+ * [Read device_sensitivity once device_init had its chance to build it]
+ *
+ * device_sensitivity = {"CLK", "$WR$", active = {"$CE$"}, modes = DSIMBOOT}
+ * runs device_simulate only on an edge of CLK or $WR$, while $CE$ is active,
+ * or in a listed mode. Without the table every simulate call reaches Lua.
+ *
+ * @param model [model context]
+ */
+static void
+setup_sensitivity ( VSM_MODEL* model )
+{
+	lua_State* L = model->luactx;
+	VSM_SENSITIVITY* sens = &model->sensitivity;
+
+	if ( LUA_TTABLE != lua_getglobal ( L, SENSITIVITY_NAME ) )
+	{
+		lua_pop ( L, 1 );
+		return;
+	}
+	sens->enabled = true;
+
+	lua_getfield ( L, -1, SENSITIVITY_MODES );
+	sens->modes = lua_tointeger ( L, -1 );
+	lua_pop ( L, 1 );
+
+	lua_len ( L, -1 );
+	int32_t entries = lua_tointeger ( L, -1 );
+	lua_pop ( L, 1 );
+	for ( int32_t i=1; i <= entries; i++ )
+	{
+		lua_rawgeti ( L, -1, i );
+		sens->edge_count = sensitivity_add ( model, 0, sens->edge_count );
+		lua_pop ( L, 1 );
+	}
+
+	if ( LUA_TTABLE == lua_getfield ( L, -1, SENSITIVITY_ACTIVE ) )
+	{
+		lua_len ( L, -1 );
+		entries = lua_tointeger ( L, -1 );
+		lua_pop ( L, 1 );
+		for ( int32_t i=1; i <= entries; i++ )
+		{
+			lua_rawgeti ( L, -1, i );
+			sens->active_count = sensitivity_add ( model, sens->edge_count, sens->active_count );
+			lua_pop ( L, 1 );
+		}
+	}
+	/* active list and device_sensitivity */
+	lua_pop ( L, 2 );
+}
+
+/**
+ * [Check the sensitivity filter for the current simulate call]
+ * @param  model [model context]
+ * @param  mode  [simulation mode]
+ * @return       [true if device_simulate has to run]
+ */
+static bool
+is_sensitive ( VSM_MODEL* model, DSIMMODES mode )
+{
+	VSM_SENSITIVITY* sens = &model->sensitivity;
+	if ( !sens->enabled || ( mode & sens->modes ) )
+		return true;
+	for ( int32_t i=0; i < sens->edge_count; i++ )
+		if ( is_pin_edge ( sens->pins[i]->pin ) )
+			return true;
+	for ( int32_t i=sens->edge_count; i < sens->edge_count + sens->active_count; i++ )
+		if ( is_pin_active ( sens->pins[i]->pin ) )
+			return true;
+	return false;
+}
+
 void __attribute__ ( ( fastcall ) )
 vsm_setup ( IDSIMMODEL* this, uint32_t edx, IINSTANCE* instance, IDSIMCKT* dsimckt )
 {
-	( void ) this;
 	( void ) edx;
-	model_instance = instance;
-	model_dsim = dsimckt;
+	VSM_MODEL* model = VSM_MODEL_OF ( this );
+	lua_State* luactx = model->luactx;
+	model->instance = instance;
+	model->dsim = dsimckt;
 
-	char* moddll = get_string_param ( "moddll" );
+	char* moddll = get_string_param ( model, "moddll" );
 	char luascript[MAX_PATH]= {0};
 	snprintf ( luascript, sizeof luascript, "%s.lua", moddll );
-	lua_load_script ( luascript ); ///Model name
+	lua_load_script ( model, luascript ); ///Model name
 
 	free ( moddll );
 
 	lua_getglobal ( luactx, "device_pins" );
 	if ( 0 == lua_istable ( luactx, -1 ) )
 	{
-		out_error ( "No device model found, it is fatal error" );
+		lua_pop ( luactx, 1 );
+		out_error ( model, "No device model found, it is fatal error" );
 		return;
 	}
 
+	/* Ports expand to several pins, so count them all first */
 	lua_len ( luactx, -1 );
-	int32_t pin_number = lua_tointeger ( luactx, -1 );
+	int32_t entry_number = lua_tointeger ( luactx, -1 );
 	lua_pop ( luactx, 1 );
+	int32_t pin_number = 0;
+	for ( int i=1; i<=entry_number; i++ )
+	{
+		lua_rawgeti ( luactx, -1, i );
+		pin_number += entry_width ( luactx );
+		lua_pop ( luactx, 1 );
+	}
 
-	for ( int i=1; i<=pin_number; i++ )
+	model->pins = calloc ( pin_number + 1, sizeof *model->pins );
+	model->pin_count = 0;
+	model->edge_pins = calloc ( pin_number + 1, sizeof *model->edge_pins );
+	model->edge_pin_count = 0;
+	if ( NULL == model->pins || NULL == model->edge_pins )
+	{
+		free ( model->pins );
+		free ( model->edge_pins );
+		model->pins = NULL;
+		model->edge_pins = NULL;
+		lua_pop ( luactx, 1 );
+		out_error ( model, "Not enough memory for %d pins", pin_number );
+		return;
+	}
+
+	for ( int i=1; i<=entry_number; i++ )
 	{
 		lua_rawgeti ( luactx,-1, i );
+		if ( LUA_TNIL != lua_getfield ( luactx, -1, PORT_NAME ) )
+		{
+			lua_pop ( luactx, 1 );
+			setup_port ( model );
+			lua_pop ( luactx, 1 );
+			continue;
+		}
+		lua_pop ( luactx, 1 );
 		//////////////
 		//set pin //
 		//////////////
 		lua_getfield ( luactx,-1, PIN_NAME );
 		const char* pin_name = lua_tostring ( luactx,-1 );
-		device_pins[i].pin = get_pin ( ( char* ) pin_name );
+		VSM_PIN* pin = setup_pin ( model, pin_name );
 		lua_pop ( luactx, 1 );
 		//////////////////////
 		//set pin on time //
 		//////////////////////
 		lua_getfield ( luactx,-1, PIN_ON_TIME );
-		device_pins[i].on_time = lua_tonumber ( luactx,-1 );
+		pin->on_time = lua_tonumber ( luactx,-1 );
 		lua_pop ( luactx, 1 );
 		///////////////////////
 		//set pin off time //
 		///////////////////////
 		lua_getfield ( luactx,-1, PIN_OFF_TIME );
-		device_pins[i].off_time = lua_tonumber ( luactx,-1 );
+		pin->off_time = lua_tonumber ( luactx,-1 );
+		lua_pop ( luactx, 1 );
+		/* pin entry */
 		lua_pop ( luactx, 1 );
 		/////////////////////////////////////////////////////////////
-		//Set global variable that holds pin name and its number //
+		//Set global variable that holds the pin object //
 		/////////////////////////////////////////////////////////////
-		lua_pushinteger ( luactx, i );
-		lua_setglobal ( luactx, pin_name );
-		lua_pop ( luactx, 1 );
+		lua_bind_pin ( model, pin, true );
 	}
+	/* device_pins table */
+	lua_pop ( luactx, 1 );
 
-	check_global_functions();
-	if ( global_device_init )
-		lua_run_function ( "device_init" );
+	lua_resolve_hooks ( model );
+	if ( lua_push_hook ( model, HOOK_DEVICE_INIT ) )
+		lua_run_hook ( model, HOOK_DEVICE_INIT, 0 );
+	setup_sensitivity ( model );
 }
 
 void __attribute__ ( ( fastcall ) )
 vsm_runctrl (  IDSIMMODEL* this, uint32_t edx, RUNMODES mode )
 {
-	( void ) this;
 	( void ) edx;
-	( void ) mode;
-
-	switch ( mode )
-	{
-		case RM_BATCH:
+	VSM_MODEL* model = VSM_MODEL_OF ( this );
 
-			break;
-		case RM_START:
-
-			break;
-		case RM_STOP:
-			if ( global_on_stop )
-				lua_run_function ( "on_stop" );
-			break;
-		case RM_SUSPEND:
-			if ( global_on_suspend )
-				lua_run_function ( "on_suspend" );
-			break;
-		case RM_ANIMATE:
-			break;
-		case RM_STEPTIME:
-
-			break;
-		case RM_STEPOVER:
-
-			break;
-		case RM_STEPINTO:
-
-			break;
-		case RM_STEPOUT:
-
-			break;
-		case RM_STEPTO:
-
-			break;
-		case RM_META:
-
-			break;
-		case RM_DUMP:
+	if ( mode < RM_BATCH || mode > RM_DUMP )
+		return;
 
-			break;
-	}
+	if ( lua_push_hook ( model, HOOK_RUNMODE ( mode ) ) )
+		lua_run_hook ( model, HOOK_RUNMODE ( mode ), 0 );
 
+	/* After the hook, so whatever on_stop wrote reaches the file too */
+	if ( RM_SUSPEND == mode || RM_STOP == mode )
+		for ( int32_t i=0; i < model->nvmem_count; i++ )
+			nvmem_flush ( model->nvmems[i] );
 }
 
 void __attribute__ ( ( fastcall ) )
@@ -275,13 +554,200 @@ vsm_indicate (  IDSIMMODEL* this, uint32_t edx, REALTIME atime, ACTIVEDATA* news
 void __attribute__ ( ( fastcall ) )
 vsm_simulate (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, DSIMMODES mode )
 {
-	( void ) this;
 	( void ) edx;
-	( void ) atime;
+	VSM_MODEL* model = VSM_MODEL_OF ( this );
+
+	/* Native chips follow every change, the sensitivity list only guards Lua */
+	for ( int32_t i=0; i < model->memchip_count; i++ )
+		memchip_simulate ( model->memchips[i], atime );
+	if ( !is_sensitive ( model, mode ) )
+		return;
+	if ( lua_push_hook ( model, HOOK_DEVICE_SIMULATE ) )
+		lua_run_hook ( model, HOOK_DEVICE_SIMULATE, 0 );
+}
+
+/**
+ * [Host event armed for the set_callback timers, delivers all that are due]
+ *
+ * Ids with an on_event handler go to it. The rest go to timer_callback one
+ * by one, or in a single timer_batch(time, ids) call if the script defines
+ * it and more than one is due.
+ *
+ * @param this    [model]
+ * @param edx     [unused]
+ * @param atime   [event time]
+ * @param eventid [serial of the armed host event]
+ */
+void __attribute__ ( ( fastcall ) )
+vsm_timer_callback (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, EVENTID eventid )
+{
+	( void ) edx;
+	VSM_MODEL* model = VSM_MODEL_OF ( this );
+	int32_t due = take_due_timers ( model, eventid, atime );
+	int32_t rest = 0;
+
+	/*
+	 * Handlers may cancel due events, so the handle is checked before every
+	 * call. A delivered event loses its handle, cancelling it then fails.
+	 */
+	for ( int32_t i=0; i < due; i++ )
+	{
+		VSM_TIMER timer = model->timer_due[i];
+		if ( 0 == timer.handle )
+			continue;
+		model->timer_due[i].handle = 0;
+		if ( false == lua_run_event_handler ( model, atime, timer.id ) )
+			model->timer_due[rest++] = timer;
+	}
+	model->timer_due_count = rest;
+
+	if ( rest > 1 && lua_push_hook ( model, HOOK_TIMER_BATCH ) )
+	{
+		lua_State* L = model->luactx;
+		lua_pushinteger ( L, atime );
+		lua_createtable ( L, rest, 0 );
+		for ( int32_t i=0, n=0; i < rest; i++ )
+		{
+			if ( 0 == model->timer_due[i].handle )
+				continue;
+			lua_pushinteger ( L, model->timer_due[i].id );
+			lua_rawseti ( L, -2, ++n );
+		}
+		model->timer_due_count = 0;
+		lua_run_hook ( model, HOOK_TIMER_BATCH, 2 );
+		return;
+	}
+
+	for ( int32_t i=0; i < rest; i++ )
+	{
+		if ( 0 == model->timer_due[i].handle || false == lua_push_hook ( model, HOOK_TIMER_CALLBACK ) )
+			continue;
+		model->timer_due[i].handle = 0;
+		lua_pushinteger ( model->luactx, atime );
+		lua_pushinteger ( model->luactx, model->timer_due[i].id );
+		lua_run_hook ( model, HOOK_TIMER_CALLBACK, 2 );
+	}
+	model->timer_due_count = 0;
+}
+
+/**
+ * [Next line change of a serial engine]
+ * @param this    [model]
+ * @param edx     [unused]
+ * @param atime   [event time]
+ * @param eventid [engine slot]
+ */
+void __attribute__ ( ( fastcall ) )
+vsm_serial_callback (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, EVENTID eventid )
+{
+	( void ) edx;
+	VSM_MODEL* model = VSM_MODEL_OF ( this );
+
+	if ( eventid < 0 || eventid >= model->serial_count )
+		return;
+	serial_callback ( model->serials[eventid], atime );
+}
+
+/**
+ * [Next step of a bus transactor cycle]
+ * @param this    [model]
+ * @param edx     [unused]
+ * @param atime   [event time]
+ * @param eventid [index of the transactor]
+ */
+void __attribute__ ( ( fastcall ) )
+vsm_bus_callback (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, EVENTID eventid )
+{
+	( void ) edx;
+	VSM_MODEL* model = VSM_MODEL_OF ( this );
+
+	if ( eventid < 0 || eventid >= model->bus_master_count )
+		return;
+	bus_master_callback ( model->bus_masters[eventid], atime );
+}
+
+/**
+ * [Next step of a pin sequencer]
+ * @param this    [model]
+ * @param edx     [unused]
+ * @param atime   [event time]
+ * @param eventid [index of the sequencer]
+ */
+void __attribute__ ( ( fastcall ) )
+vsm_sequencer_callback (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, EVENTID eventid )
+{
+	( void ) edx;
+	VSM_MODEL* model = VSM_MODEL_OF ( this );
+
+	if ( eventid < 0 || eventid >= model->sequencer_count )
+		return;
+	sequencer_callback ( model->sequencers[eventid], atime );
+}
+
+/**
+ * [Tick of a clock started with start_pin_clock, toggles the pin natively]
+ * @param this    [model]
+ * @param edx     [unused]
+ * @param atime   [tick time]
+ * @param eventid [number of the pin in the model pin table]
+ */
+void __attribute__ ( ( fastcall ) )
+vsm_clock_callback (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, EVENTID eventid )
+{
+	( void ) edx;
+	VSM_MODEL* model = VSM_MODEL_OF ( this );
+
+	if ( eventid < 1 || eventid > model->pin_count )
+		return;
+	VSM_PIN* pin = &model->pins[eventid];
+	for ( int32_t i=0; i < model->clock_count; i++ )
+	{
+		VSM_CLOCK* clock = &model->clocks[i];
+		if ( pin != clock->pin )
+			continue;
+		clock->level = !clock->level;
+		pin->pin->vtable->setstate2 ( pin->pin, 0, atime, pin->on_time, clock->level ? SHI : SLO );
+		return;
+	}
+}
+
+/**
+ * [Pin handler installed by on_posedge, on_negedge, on_change, the serial
+ * decoders and stalled sequencers]
+ *
+ * The host does not tell which pin moved, so only the pins that have
+ * handlers are scanned. Each edge is dispatched once even if the host
+ * calls in again for another pin changing at the same time.
+ *
+ * @param this  [model]
+ * @param edx   [unused]
+ * @param atime [event time]
+ * @param mode  [unused]
+ */
+void __attribute__ ( ( fastcall ) )
+vsm_pin_handler (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, DSIMMODES mode )
+{
+	( void ) edx;
 	( void ) mode;
+	VSM_MODEL* model = VSM_MODEL_OF ( this );
 
-	if ( global_device_simulate )
-		lua_run_function ( "device_simulate" );
+	/* Handlers may register more pins, count is re-read every pass */
+	for ( int32_t i=0; i < model->edge_pin_count; i++ )
+	{
+		VSM_PIN* pin = model->edge_pins[i];
+		if ( atime == pin->edge_time || !is_pin_edge ( pin->pin ) )
+			continue;
+		pin->edge_time = atime;
+		if ( pin->listener )
+			serial_edge ( pin->listener, pin, atime );
+		if ( pin->waiter )
+			sequencer_edge ( pin->waiter, pin, atime );
+		if ( is_pin_posedge ( pin->pin ) )
+			lua_run_pin_handler ( pin, EDGE_POS, atime );
+		else if ( is_pin_negedge ( pin->pin ) )
+			lua_run_pin_handler ( pin, EDGE_NEG, atime );
+		lua_run_pin_handler ( pin, EDGE_ANY, atime );
+	}
 }
 
 /**
@@ -296,16 +762,17 @@ vsm_simulate (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, DSIMMODES mode )
 void __attribute__ ( ( fastcall ) )
 vsm_callback (  IDSIMMODEL* this, uint32_t edx, ABSTIME atime, EVENTID eventid )
 {
-	( void ) this;
 	( void ) edx;
+	VSM_MODEL* model = VSM_MODEL_OF ( this );
 
-	if ( false == global_timer_callback )
+	if ( lua_run_event_handler ( model, atime, eventid ) )
+		return;
+	if ( false == lua_push_hook ( model, HOOK_TIMER_CALLBACK ) )
 		return;
 
-	lua_getglobal ( luactx, "timer_callback" );
-	lua_pushunsigned ( luactx, atime );
-	lua_pushunsigned ( luactx, eventid );
-	lua_pcall ( luactx, 2, 0, 0 );
+	lua_pushinteger ( model->luactx, atime );
+	lua_pushinteger ( model->luactx, eventid );
+	lua_run_hook ( model, HOOK_TIMER_CALLBACK, 2 );
 }
 
 /**
@@ -321,9 +788,11 @@ bool APIENTRY
 DllMain ( HINSTANCE hInstDLL, uint32_t fdwReason, LPVOID lpvReserved )
 {
 	( void ) hInstDLL;
-	( void ) fdwReason;
 	( void ) lpvReserved;
 
+	if ( DLL_PROCESS_DETACH == fdwReason )
+		lua_cache_flush();
+
 	return true;
 }
 